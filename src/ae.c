@@ -1,3 +1,4 @@
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -7,11 +8,15 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "ae.h"
 #include "zmalloc.h"
 #include "config.h"
 
+//// 是否使用io_uring，只在编译时启用了io_uring（USE_IOURING=yes）时有效，见aeSetUseIoUring()
+static int aeUseIoUring = 1;
+
 //// 包括本系统所支持的最佳多路复用层以下应按性能降序排列
 // linux下可以使用select和epoll
 // macos下可以使用select和kqueue
@@ -19,13 +24,17 @@
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IO_URING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
@@ -42,7 +51,13 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
 
     eventLoop->setsize = setsize;                                   // 需要监听的描述符个数
     eventLoop->lastTime = time(NULL);                               // 上一次事件循环的时间，用于检测系统时间是否变更
-    eventLoop->timeEventHead = NULL;                                // 时间事件头，因为事件时间其实是一个链表
+    eventLoop->timeEventHeap = NULL;                                // 时间事件最小堆，第一次创建时间事件时分配
+    eventLoop->timeEventNum = 0;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventDetached = NULL;
+    eventLoop->timeEventTable = NULL;                               // 按id索引时间事件的哈希表，第一次创建时间事件时分配
+    eventLoop->timeEventTableSize = 0;
+    eventLoop->timeEventTableUsed = 0;
     eventLoop->timeEventNextId = 0;                                 // 下一个时间事件的id，用于生成时间事件的唯一标识
     eventLoop->stop = 0;                                            // 停止标识，1表示停止
     eventLoop->maxfd = -1;                                          // 当前注册的最大描述符
@@ -96,7 +111,18 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 
 //// 删除事件循环
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    aeTimeEvent *te;
+    int j;
+
     aeApiFree(eventLoop);
+    for (j = 0; j < eventLoop->timeEventNum; j++)
+        zfree(eventLoop->timeEventHeap[j]);
+    while ((te = eventLoop->timeEventDetached) != NULL) {
+        eventLoop->timeEventDetached = te->next;
+        zfree(te);
+    }
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
     zfree(eventLoop);
@@ -112,8 +138,6 @@ void aeStop(aeEventLoop *eventLoop) {
 // 关于文件事件，有两个地方需要创建它
 // 1、初始化服务器的时候，需要监听新的客户连接           server.c/initServer ->  acceptTcpHandler操作函数
 // 2、在客户连接服务器之后，需要监听该客户的读写事件      etWorking.c/createClient  ->  readQueryFromClient操作函数
-// 3、aof重写时候父子进程间使用管道通信                aof.c/aofCreatePipes  -> aofChildPipeReadable操作函数
-// 4、aof                                        aof.c/aofRewriteBufferAppend -> aofChildWriteDiffData操作函数
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
         aeFileProc *proc, void *clientData)
 {
@@ -196,6 +220,123 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
 }
 
 
+//// 比较两个时间事件的执行时间，a早于b时返回非0
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    if (a->when_sec != b->when_sec) return a->when_sec < b->when_sec;
+    if (a->when_ms != b->when_ms) return a->when_ms < b->when_ms;
+    return a->id < b->id;
+}
+
+//// 将时间事件te放到堆中下标为j的位置，并记录下标
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int j, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[j] = te;
+    te->index = j;
+}
+
+//// 将下标为i的时间事件向上调整，直到父节点不晚于它
+static void aeTimeHeapUp(aeEventLoop *eventLoop, int i) {
+    aeTimeEvent *te = eventLoop->timeEventHeap[i];
+
+    while (i > 0) {
+        int parent = (i-1)/2;
+        if (!aeTimeEventBefore(te,eventLoop->timeEventHeap[parent])) break;
+        aeTimeHeapSet(eventLoop,i,eventLoop->timeEventHeap[parent]);
+        i = parent;
+    }
+    aeTimeHeapSet(eventLoop,i,te);
+}
+
+//// 将下标为i的时间事件向下调整，直到子节点都不早于它
+static void aeTimeHeapDown(aeEventLoop *eventLoop, int i) {
+    aeTimeEvent *te = eventLoop->timeEventHeap[i];
+    int num = eventLoop->timeEventNum;
+
+    while (1) {
+        int child = i*2+1;
+        if (child >= num) break;
+        if (child+1 < num &&
+            aeTimeEventBefore(eventLoop->timeEventHeap[child+1],
+                              eventLoop->timeEventHeap[child])) child++;
+        if (!aeTimeEventBefore(eventLoop->timeEventHeap[child],te)) break;
+        aeTimeHeapSet(eventLoop,i,eventLoop->timeEventHeap[child]);
+        i = child;
+    }
+    aeTimeHeapSet(eventLoop,i,te);
+}
+
+//// 将时间事件加入最小堆，堆数组不够时按两倍扩容
+static void aeTimeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventNum == eventLoop->timeEventHeapSize) {
+        int size = eventLoop->timeEventHeapSize ? eventLoop->timeEventHeapSize*2 : 16;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+                                            sizeof(aeTimeEvent*)*size);
+        eventLoop->timeEventHeapSize = size;
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventNum++,te);
+    aeTimeHeapUp(eventLoop,te->index);
+}
+
+//// 将时间事件从最小堆中移除（并不释放）
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int i = te->index;
+    aeTimeEvent *last = eventLoop->timeEventHeap[--eventLoop->timeEventNum];
+
+    te->index = -1;
+    if (last == te) return;
+    aeTimeHeapSet(eventLoop,i,last);
+    if (i > 0 && aeTimeEventBefore(last,eventLoop->timeEventHeap[(i-1)/2]))
+        aeTimeHeapUp(eventLoop,i);
+    else
+        aeTimeHeapDown(eventLoop,i);
+}
+
+//// 将时间事件加入按id索引的哈希表，事件数达到桶数时按两倍扩容
+// id是递增分配的，直接用低位作为桶的下标
+static void aeTimeTableAdd(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    unsigned long long mask;
+
+    if (eventLoop->timeEventTableUsed == eventLoop->timeEventTableSize) {
+        int size = eventLoop->timeEventTableSize ? eventLoop->timeEventTableSize*2 : 16;
+        aeTimeEvent **table = zcalloc(sizeof(aeTimeEvent*)*size);
+        int j;
+
+        mask = size-1;
+        for (j = 0; j < eventLoop->timeEventTableSize; j++) {
+            aeTimeEvent *e = eventLoop->timeEventTable[j], *next;
+
+            while (e) {
+                next = e->hnext;
+                e->hnext = table[e->id & mask];
+                table[e->id & mask] = e;
+                e = next;
+            }
+        }
+        zfree(eventLoop->timeEventTable);
+        eventLoop->timeEventTable = table;
+        eventLoop->timeEventTableSize = size;
+    }
+    mask = eventLoop->timeEventTableSize-1;
+    te->hnext = eventLoop->timeEventTable[te->id & mask];
+    eventLoop->timeEventTable[te->id & mask] = te;
+    eventLoop->timeEventTableUsed++;
+}
+
+//// 在哈希表中查找id对应的时间事件，返回指向它的指针的地址（便于摘除），不存在时返回NULL
+static aeTimeEvent **aeTimeTableFind(aeEventLoop *eventLoop, long long id) {
+    aeTimeEvent **p;
+
+    if (eventLoop->timeEventTableSize == 0 || id < 0) return NULL;
+    p = &eventLoop->timeEventTable[id & (eventLoop->timeEventTableSize-1)];
+    while (*p && (*p)->id != id) p = &(*p)->hnext;
+    return *p ? p : NULL;
+}
+
+//// 将aeTimeTableFind()找到的时间事件从哈希表中摘除（并不释放）
+static void aeTimeTableUnlink(aeEventLoop *eventLoop, aeTimeEvent **p) {
+    *p = (*p)->hnext;
+    eventLoop->timeEventTableUsed--;
+}
+
 //// 创建时间事件     server.c/initServer  ->  serverCron操作函数
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
@@ -215,116 +356,103 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;                            // 设置时间事件对应的处理函数
     te->finalizerProc = finalizerProc;              // 时间事件的最后一次处理程序，若已设置，则删除该事件的时候会调用
     te->clientData = clientData;                    // 数据
+    te->next = NULL;
 
-    // 头插法维护时间事件单链表
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    // 加入最小堆，O(log(N))，并加入按id索引的哈希表
+    aeTimeHeapInsert(eventLoop,te);
+    aeTimeTableAdd(eventLoop,te);
     return id;
 }
 
 
 //// 根据创建时间事件时返回的唯一id，删除时间事件
 // 该方法在redis中没有使用
+// 通过哈希表O(1)找到之后从哈希表中摘除，并将id设置为-1，
+// 还在最小堆中的事件O(log(N))摘下放入timeEventDetached链表，
+// 下一次processTimeEvents的时候才真正释放（并调用finalizerProc）
+// 已经在timeEventDetached链表中的到期事件，以及正在执行处理函数（删除自己）的事件只需设置id，
+// 由processTimeEvents释放
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;     // 取出时间事件单链表的头部地址
-
-    // 循环遍历链表
-    while(te) {
-        if (te->id == id) {                         // 根据事件事件分配的唯一id
-            te->id = AE_DELETED_EVENT_ID;           // 找到之后将id设置为-1，但是并没有从单链表中真正删除
-            return AE_OK;
-        }
-        te = te->next;
+    aeTimeEvent **p = aeTimeTableFind(eventLoop,id), *te;
+
+    if (p == NULL) return AE_ERR; /* NO event with the specified ID found */
+    te = *p;
+    aeTimeTableUnlink(eventLoop,p);
+    if (te->index != -1) {
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = eventLoop->timeEventDetached;
+        eventLoop->timeEventDetached = te;
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    te->id = AE_DELETED_EVENT_ID;
+    return AE_OK;
 }
 
 
-//// 获取最近的时间事件
+//// 获取最近的时间事件，即最小堆的堆顶，O(1)
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;                     // 取出时间事件单链表的头部地址
-    aeTimeEvent *nearest = NULL;                                    // 存放最近的时间事件
-
-    // 循环遍历时间事件链表，找出最近要执行的事件
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec && te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timeEventNum ? eventLoop->timeEventHeap[0] : NULL;
 }
 
 
 //// 处理时间事件
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te, *prev;
-    long long maxId;
+    int processed = 0, j;
+    aeTimeEvent *te, **tail;
+    long now_sec, now_ms;
     time_t now = time(NULL);                // 获取当前时间
 
 
-    if (now < eventLoop->lastTime) {        // 事件循环处理的最后时间与当前时间比较
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+    // 系统时间被调回，让所有时间事件尽快执行，并重建最小堆
+    if (now < eventLoop->lastTime) {
+        for (j = 0; j < eventLoop->timeEventNum; j++)
+            eventLoop->timeEventHeap[j]->when_sec = 0;
+        for (j = eventLoop->timeEventNum/2-1; j >= 0; j--)
+            aeTimeHeapDown(eventLoop,j);
     }
     eventLoop->lastTime = now;              // 更新循环处理的最后时间为当前时间
 
-    prev = NULL;
-    te = eventLoop->timeEventHead;          // 取出时间事件头指针
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
-
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {// 时间事件已经被删除，删除时间时间节点
-            aeTimeEvent *next = te->next;
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            te = next;
-            continue;
-        }
-
+    // 先把所有到期的时间事件按执行时间顺序从堆中摘下，追加到timeEventDetached链表的尾部，
+    // 这样处理函数中新建或重新调度（比如返回0）的时间事件只会在下一次循环中执行
+    tail = &eventLoop->timeEventDetached;
+    while (*tail) tail = &(*tail)->next;
+    aeGetTime(&now_sec, &now_ms);
+    while (eventLoop->timeEventNum) {
+        te = eventLoop->timeEventHeap[0];
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+        aeTimeHeapRemove(eventLoop,te);
+        te->next = NULL;
+        *tail = te;
+        tail = &te->next;
+    }
 
-        // 跳过无效事件
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
+    while ((te = eventLoop->timeEventDetached) != NULL) {
+        int retval;
 
-        // 如果当前时间等于或等于事件的执行时间，那么说明事件已到达，执行这个事件
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
+        eventLoop->timeEventDetached = te->next;
 
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);   //// 处理时间事件
+        // 已删除的事件直接释放
+        if (te->id != AE_DELETED_EVENT_ID) {
+            retval = te->timeProc(eventLoop, te->id, te->clientData);   //// 处理时间事件
             processed++;
 
-            //// 记录是否有需要循环执行这个事件时间
-            if (retval != AE_NOMORE) {
-                // 是的， retval 毫秒之后继续执行这个时间事件
+            //// 记录是否有需要循环执行这个事件时间（处理函数中也可能删除了自己）
+            if (retval != AE_NOMORE && te->id != AE_DELETED_EVENT_ID) {
+                // 是的， retval 毫秒之后继续执行这个时间事件，重新放回堆中
                 aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                // 不，将这个事件删除
-                te->id = AE_DELETED_EVENT_ID;
+                aeTimeHeapInsert(eventLoop,te);
+                continue;
             }
         }
-        prev = te;
-        te = te->next;
+
+        // 不，将这个事件删除（未通过aeDeleteTimeEvent删除的还在哈希表中）
+        if (te->id != AE_DELETED_EVENT_ID)
+            aeTimeTableUnlink(eventLoop,aeTimeTableFind(eventLoop,te->id));
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
     }
     return processed;
 }
@@ -460,6 +588,50 @@ char *aeGetApiName(void) {
     return aeApiName();
 }
 
+//// 启用/禁用io_uring，需要在创建事件循环之前调用。禁用时（或内核不支持时）使用epoll
+void aeSetUseIoUring(int enabled) {
+    aeUseIoUring = enabled;
+}
+
+//// 事件循环能否用一次系统调用完成多个读写请求（即使用io_uring时）
+int aeCanBatchIORequests(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+#ifdef HAVE_IO_URING
+    return aeUseIoUring;
+#else
+    return 0;
+#endif
+}
+
+/* Perform the socket reads and writes in 'reqs' without blocking, storing
+ * the result of every request in its 'res' field. When the event loop uses
+ * io_uring all the requests are submitted at once, otherwise they are
+ * performed one after the other. */
+void aeProcessIORequests(aeEventLoop *eventLoop, aeIORequest *reqs, int numreqs) {
+    int j;
+
+#ifdef HAVE_IO_URING
+    if (aeUseIoUring) {
+        aeUringProcessIORequests(eventLoop,reqs,numreqs);
+        return;
+    }
+#endif
+    AE_NOTUSED(eventLoop);
+    for (j = 0; j < numreqs; j++) {
+        struct msghdr msg;
+        ssize_t res;
+
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov = reqs[j].iov;
+        msg.msg_iovlen = reqs[j].iovcnt;
+        if (reqs[j].write)
+            res = sendmsg(reqs[j].fd,&msg,reqs[j].flags|MSG_DONTWAIT);
+        else
+            res = recvmsg(reqs[j].fd,&msg,reqs[j].flags|MSG_DONTWAIT);
+        reqs[j].res = (res == -1) ? -errno : res;
+    }
+}
+
 //// 设置beforesleep
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
@@ -469,3 +641,119 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+/* Test main */
+#ifdef REDIS_TEST
+#include <assert.h>
+
+static int aeTestOrder[3], aeTestFired, aeTestFinalized;
+
+static int aeTestRecordProc(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    aeTestOrder[aeTestFired++] = (int)(long)clientData;
+    return AE_NOMORE;
+}
+
+static int aeTestCountProc(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    (*(long*)clientData)++;
+    return 0; /* Fire again at the next iteration. */
+}
+
+static int aeTestDeleteSelfProc(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(clientData);
+    aeTestFired++;
+    assert(aeDeleteTimeEvent(eventLoop,id) == AE_OK);
+    return 10; /* Ignored, since the event was deleted. */
+}
+
+static void aeTestFinalizerProc(struct aeEventLoop *eventLoop, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(clientData);
+    aeTestFinalized++;
+}
+
+static long long aeTestUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+int aeTest(int argc, char *argv[]) {
+    aeEventLoop *el;
+    long long id, ids[1000], start, elapsed;
+    long count;
+    int j, k, timers[] = {0, 1000, 10000, 100000};
+
+    AE_NOTUSED(argc);
+    AE_NOTUSED(argv);
+
+    printf("Time events fire in order: ");
+    el = aeCreateEventLoop(64);
+    aeCreateTimeEvent(el,30,aeTestRecordProc,(void*)3L,NULL);
+    aeCreateTimeEvent(el,10,aeTestRecordProc,(void*)1L,NULL);
+    aeCreateTimeEvent(el,20,aeTestRecordProc,(void*)2L,NULL);
+    while (aeTestFired < 3) aeProcessEvents(el,AE_TIME_EVENTS);
+    assert(aeTestOrder[0] == 1 && aeTestOrder[1] == 2 && aeTestOrder[2] == 3);
+    assert(el->timeEventNum == 0 && el->timeEventDetached == NULL);
+    printf("OK\n");
+
+    printf("Deleted time events are finalized and never fire: ");
+    id = aeCreateTimeEvent(el,0,aeTestRecordProc,(void*)4L,aeTestFinalizerProc);
+    aeCreateTimeEvent(el,3600*1000,aeTestRecordProc,(void*)5L,NULL);
+    assert(aeDeleteTimeEvent(el,id) == AE_OK);
+    assert(aeDeleteTimeEvent(el,id) == AE_ERR);
+    assert(aeTestFinalized == 0);
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    assert(aeTestFinalized == 1 && aeTestFired == 3 && el->timeEventNum == 1);
+    printf("OK\n");
+
+    printf("Time events can delete themselves from their callback: ");
+    aeCreateTimeEvent(el,0,aeTestDeleteSelfProc,NULL,aeTestFinalizerProc);
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    assert(aeTestFired == 4 && aeTestFinalized == 2);
+    assert(el->timeEventNum == 1 && el->timeEventDetached == NULL);
+    printf("OK\n");
+    aeDeleteEventLoop(el);
+
+    printf("Time events are deleted among many timers: ");
+    el = aeCreateEventLoop(64);
+    for (k = 0; k < 1000; k++)
+        ids[k] = aeCreateTimeEvent(el,3600*1000-k,aeTestRecordProc,NULL,
+                                   aeTestFinalizerProc);
+    for (k = 0; k < 1000; k += 2) assert(aeDeleteTimeEvent(el,ids[k]) == AE_OK);
+    for (k = 0; k < 1000; k += 2) assert(aeDeleteTimeEvent(el,ids[k]) == AE_ERR);
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    assert(aeTestFinalized == 502 && el->timeEventNum == 500);
+    assert(el->timeEventTableUsed == 500);
+    for (k = 1; k < el->timeEventNum; k++)
+        assert(!aeTimeEventBefore(el->timeEventHeap[k],
+                                  el->timeEventHeap[(k-1)/2]));
+    for (k = 1; k < 1000; k += 2) assert(aeDeleteTimeEvent(el,ids[k]) == AE_OK);
+    assert(el->timeEventNum == 0 && el->timeEventTableUsed == 0);
+    printf("OK\n");
+    aeDeleteEventLoop(el);
+
+    /* Benchmark the per-iteration cost of the time events processing with
+     * an increasing number of idle timers and one timer firing at every
+     * iteration of the event loop. */
+    for (j = 0; j < (int)(sizeof(timers)/sizeof(timers[0])); j++) {
+        el = aeCreateEventLoop(64);
+        for (k = 0; k < timers[j]; k++)
+            aeCreateTimeEvent(el,3600*1000+k,aeTestRecordProc,NULL,NULL);
+        count = 0;
+        aeCreateTimeEvent(el,0,aeTestCountProc,&count,NULL);
+        start = aeTestUstime();
+        for (k = 0; k < 100000; k++) aeProcessEvents(el,AE_TIME_EVENTS);
+        elapsed = aeTestUstime()-start;
+        assert(count > 0);
+        printf("%d timers: %.3f usec per event loop iteration\n",
+            timers[j], (double)elapsed/k);
+        aeDeleteEventLoop(el);
+    }
+    return 0;
+}
+#endif
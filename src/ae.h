@@ -2,6 +2,8 @@
 #define __AE_H__
 
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -39,7 +41,7 @@ typedef struct aeFileEvent {
 } aeFileEvent;
 
 
-//// 时间事件结构体（单链表）
+//// 时间事件结构体（最小堆）
 typedef struct aeTimeEvent {
     long long id;               // 时间事件标识符，用于唯一标记该时间事件
     long when_sec;              // 时间事件触发时间 秒
@@ -47,7 +49,9 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;       // 该事件对应的处理函数
     aeEventFinalizerProc *finalizerProc;// 时间事件的最后一次处理程序，若已设置，则删除该事件的时候会调用
     void *clientData;           // 数据
-    struct aeTimeEvent *next;   // 下一个时间事件，这里可以看出时间事件使用单链表维护的
+    int index;                  // 在最小堆数组中的下标，不在堆中时为-1
+    struct aeTimeEvent *next;   // 从堆中摘下的时间事件（待执行或待删除）使用单链表维护
+    struct aeTimeEvent *hnext;  // 按id索引的哈希表中同一个桶里的下一个时间事件
 } aeTimeEvent;
 
 
@@ -58,6 +62,17 @@ typedef struct aeFiredEvent {
 } aeFiredEvent;
 
 
+/* A socket read or write performed by aeProcessIORequests(). */
+typedef struct aeIORequest {
+    int fd;
+    int write;                  /* Send 'iov' instead of receiving into it. */
+    struct iovec *iov;
+    int iovcnt;
+    int flags;                  /* sendmsg()/recvmsg() flags. */
+    ssize_t res;                /* Bytes transferred, or -errno. */
+} aeIORequest;
+
+
 //// 事件循环结构体
 // 每次调用I/O复用程序之后，会返回已经准备好的文件事件描述符，这时候就会以该结构体的形式存放下来
 // Redis在事件循环的时候，会对这些已准备好待处理的事件一一进行处理，也就是上面说的待处理事件池
@@ -69,7 +84,13 @@ typedef struct aeEventLoop {
     time_t lastTime;            // 上一次事件循环的时间，用于检测系统时间是否变更
     aeFileEvent *events;        // 注册要使用的文件事件，数组
     aeFiredEvent *fired;        // 已准备好，待处理的文件事件，数组
-    aeTimeEvent *timeEventHead; // 时间事件头，因为事件时间其实是一个链表
+    aeTimeEvent **timeEventHeap;// 时间事件最小堆，按执行时间排序，堆顶即最近的时间事件
+    int timeEventNum;           // 堆中时间事件的个数
+    int timeEventHeapSize;      // 堆数组的容量
+    aeTimeEvent *timeEventDetached; // 从堆中摘下的时间事件：正在处理的到期事件，以及等待调用finalizerProc的已删除事件
+    aeTimeEvent **timeEventTable;   // 按id索引未删除的时间事件的哈希表，删除时间事件时O(1)查找
+    int timeEventTableSize;     // 哈希表的桶数，为2的幂
+    int timeEventTableUsed;     // 哈希表中时间事件的个数
     int stop;                   // 停止标识，1表示停止
     void *apidata;              // 用于处理底层特定的API数据，对于epoll来说，其包括epoll_fd和epoll_event
     aeBeforeSleepProc *beforesleep;// 没有待处理事件时调用
@@ -92,9 +113,16 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
+void aeSetUseIoUring(int enabled);
+int aeCanBatchIORequests(aeEventLoop *eventLoop);
+void aeProcessIORequests(aeEventLoop *eventLoop, aeIORequest *reqs, int numreqs);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
+#ifdef REDIS_TEST
+int aeTest(int argc, char *argv[]);
+#endif
+
 #endif
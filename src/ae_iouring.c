@@ -0,0 +1,482 @@
+/* Linux io_uring based ae.c module
+ *
+ * Readiness is polled with one-shot IORING_OP_POLL_ADD requests. Changes to
+ * the registered events are not applied with a system call each, like
+ * epoll_ctl() does: the fds are just flagged, and all the needed poll
+ * requests (including re-arming the ones that fired) are submitted in a
+ * batch by the same io_uring_enter() call that waits for new events, so a
+ * loop iteration costs a single system call.
+ *
+ * The same ring performs the socket reads and writes networking.c batches
+ * with aeProcessIORequests(): all the requests of a loop iteration are
+ * submitted by a single system call, instead of a read() or write() for
+ * every client.
+ *
+ * The kernel must support IORING_FEAT_EXT_ARG (Linux 5.11): otherwise, or
+ * when io_uring was disabled with aeSetUseIoUring(), the epoll module is
+ * used instead. */
+
+#include <linux/io_uring.h>
+#include <linux/swab.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+
+/* The epoll module is included with its symbols renamed, to use it as
+ * fallback. */
+#define aeApiState aeEpollApiState
+#define aeApiCreate aeEpollApiCreate
+#define aeApiResize aeEpollApiResize
+#define aeApiFree aeEpollApiFree
+#define aeApiAddEvent aeEpollApiAddEvent
+#define aeApiDelEvent aeEpollApiDelEvent
+#define aeApiPoll aeEpollApiPoll
+#define aeApiName aeEpollApiName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#define AE_URING_SQ_ENTRIES 4096
+/* user_data of the requests whose completion is ignored (POLL_REMOVE). */
+#define AE_URING_IGNORE UINT64_MAX
+/* The user_data of the read and write requests is their index in the batch
+ * with this bit set, that poll requests never have, see aeUringUserData(). */
+#define AE_URING_IO_REQUEST (1ULL<<63)
+
+/* Number of event loops using io_uring: once one exists we can no longer
+ * fall back to epoll, since the backend is selected process wide. */
+static int aeUringLoops = 0;
+
+typedef struct aeApiState {
+    int ringfd;                     // io_uring fd
+    void *ring;                     // SQ and CQ rings (IORING_FEAT_SINGLE_MMAP)
+    size_t ringsize;
+    struct io_uring_sqe *sqes;
+    size_t sqessize;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;         // SQEs filled by us, published on submit
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Per fd state. */
+    int *armed;                     // Mask of the poll request in flight
+    uint32_t *seq;                  // Generation of the poll request
+    char *changed;                  // Is the fd in the 'changes' array?
+    int *changes;                   // fds whose poll request must be updated
+    int numchanges;
+    /* Batched reads and writes. */
+    struct msghdr *msgs;            // Headers of the requests in flight
+    int msgs_size;
+    struct io_uring_cqe *stash;     // Poll completions reaped meanwhile
+    int numstash, stash_size;
+} aeApiState;
+
+/* The user_data of poll requests is the fd plus a generation number that
+ * is incremented every time the request is removed, so that completions of
+ * cancelled requests can be recognized and ignored, even if the fd was
+ * closed and reused in the meantime. Only 31 bits of the generation are
+ * used, the top bit marks the read and write requests. */
+static uint64_t aeUringUserData(aeApiState *state, int fd) {
+    return ((uint64_t)(state->seq[fd] & 0x7fffffff) << 32) | (uint32_t)fd;
+}
+
+static int aeUringEnter(aeApiState *state, unsigned to_submit,
+                        unsigned min_complete, unsigned flags,
+                        struct io_uring_getevents_arg *arg)
+{
+    return syscall(__NR_io_uring_enter,state->ringfd,to_submit,min_complete,
+                   flags,arg,arg ? sizeof(*arg) : 0);
+}
+
+/* Publish the SQEs filled so far and return how many the kernel did not
+ * consume yet. */
+static unsigned aeUringPublish(aeApiState *state) {
+    __atomic_store_n(state->sq_tail,state->sq_local_tail,__ATOMIC_RELEASE);
+    return state->sq_local_tail -
+           __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+}
+
+/* Return a zeroed SQE, submitting the queued ones if the ring is full.
+ * NULL is returned if no SQE is available. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (state->sq_local_tail - head == state->sq_entries) {
+        aeUringEnter(state,aeUringPublish(state),0,0,NULL);
+        head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+        if (state->sq_local_tail - head == state->sq_entries) return NULL;
+    }
+    idx = state->sq_local_tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    state->sq_local_tail++;
+    return sqe;
+}
+
+//// 初始化io_uring，内核不支持时返回-1
+static int aeUringCreate(aeEventLoop *eventLoop) {
+    struct io_uring_params p;
+    aeApiState *state;
+    char *ring;
+    size_t sqsize, cqsize;
+
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = eventLoop->setsize*2;
+    int ringfd = syscall(__NR_io_uring_setup,AE_URING_SQ_ENTRIES,&p);
+    if (ringfd == -1) return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(ringfd);
+        return -1;
+    }
+
+    sqsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    cqsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    state = zcalloc(sizeof(*state));
+    state->ringfd = ringfd;
+    state->ringsize = sqsize > cqsize ? sqsize : cqsize;
+    state->ring = mmap(NULL,state->ringsize,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQ_RING);
+    state->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqessize,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQES);
+    if (state->ring == MAP_FAILED || state->sqes == MAP_FAILED) {
+        if (state->ring != MAP_FAILED) munmap(state->ring,state->ringsize);
+        if (state->sqes != MAP_FAILED) munmap(state->sqes,state->sqessize);
+        close(ringfd);
+        zfree(state);
+        return -1;
+    }
+
+    ring = state->ring;
+    state->sq_head = (unsigned*)(ring+p.sq_off.head);
+    state->sq_tail = (unsigned*)(ring+p.sq_off.tail);
+    state->sq_mask = (unsigned*)(ring+p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)(ring+p.sq_off.array);
+    state->sq_entries = p.sq_entries;
+    state->sq_local_tail = *state->sq_tail;
+    state->cq_head = (unsigned*)(ring+p.cq_off.head);
+    state->cq_tail = (unsigned*)(ring+p.cq_off.tail);
+    state->cq_mask = (unsigned*)(ring+p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)(ring+p.cq_off.cqes);
+
+    state->armed = zcalloc(sizeof(int)*eventLoop->setsize);
+    state->seq = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->changed = zcalloc(eventLoop->setsize);
+    state->changes = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->numchanges = 0;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+//// 初始化I/O多路复用库所需的参数，不能使用io_uring时使用epoll
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    if (aeUseIoUring) {
+        if (aeUringCreate(eventLoop) == 0) {
+            aeUringLoops++;
+            return 0;
+        }
+        if (aeUringLoops) return -1;
+    }
+    aeUseIoUring = 0;
+    return aeEpollApiCreate(eventLoop);
+}
+
+static void aeUringQueueChanges(aeEventLoop *eventLoop);
+
+//// 扩容/缩容
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    if (!aeUseIoUring) return aeEpollApiResize(eventLoop,setsize);
+
+    /* Submit the pending changes first, since fds that will no longer fit
+     * may still have poll requests to remove. */
+    aeUringQueueChanges(eventLoop);
+    aeUringEnter(state,aeUringPublish(state),0,0,NULL);
+    for (j = 0; j < state->numchanges; j++) {
+        if (state->changes[j] >= setsize)
+            state->changes[j--] = state->changes[--state->numchanges];
+    }
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->seq = zrealloc(state->seq,sizeof(uint32_t)*setsize);
+    state->changed = zrealloc(state->changed,setsize);
+    state->changes = zrealloc(state->changes,sizeof(int)*setsize);
+    for (j = eventLoop->setsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->seq[j] = 0;
+        state->changed[j] = 0;
+    }
+    return 0;
+}
+
+//// 清空
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (!aeUseIoUring) {
+        aeEpollApiFree(eventLoop);
+        return;
+    }
+    munmap(state->sqes,state->sqessize);
+    munmap(state->ring,state->ringsize);
+    close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->seq);
+    zfree(state->changed);
+    zfree(state->changes);
+    zfree(state->msgs);
+    zfree(state->stash);
+    zfree(state);
+    aeUringLoops--;
+}
+
+//// 标记fd的poll请求需要更新，在下一次aeApiPoll中批量提交
+static void aeUringMarkChanged(aeApiState *state, int fd) {
+    if (state->changed[fd]) return;
+    state->changed[fd] = 1;
+    state->changes[state->numchanges++] = fd;
+}
+
+//// 添加需要监听的事件
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    if (!aeUseIoUring) return aeEpollApiAddEvent(eventLoop,fd,mask);
+    aeUringMarkChanged(eventLoop->apidata,fd);
+    return 0;
+}
+
+//// 删除不需要监听的事件
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_sqe *sqe;
+
+    if (!aeUseIoUring) {
+        aeEpollApiDelEvent(eventLoop,fd,delmask);
+        return;
+    }
+
+    /* A poll request in flight holds a reference to the file: when no
+     * event is left the request is removed right away, since the fd is
+     * likely going to be closed, and we don't want the socket to stay
+     * open until the next aeApiPoll() call (or after exit). */
+    if ((eventLoop->events[fd].mask & ~delmask) == AE_NONE &&
+        state->armed[fd] != AE_NONE &&
+        (sqe = aeUringGetSqe(state)) != NULL)
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = aeUringUserData(state,fd);
+        sqe->user_data = AE_URING_IGNORE;
+        state->seq[fd]++;
+        state->armed[fd] = AE_NONE;
+        aeUringEnter(state,aeUringPublish(state),0,0,NULL);
+        return;
+    }
+    aeUringMarkChanged(state,fd);
+}
+
+/* Queue the SQEs needed to make the poll request in flight for every changed
+ * fd match the events registered in the event loop. fds we could not get
+ * SQEs for stay in the 'changes' array for the next call. */
+static void aeUringQueueChanges(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_sqe *sqe;
+    int j, kept = 0;
+
+    for (j = 0; j < state->numchanges; j++) {
+        int fd = state->changes[j];
+        int mask = eventLoop->events[fd].mask;
+
+        if (mask == state->armed[fd]) {
+            state->changed[fd] = 0;
+            continue;
+        }
+        if (state->armed[fd] != AE_NONE) {
+            if ((sqe = aeUringGetSqe(state)) == NULL) break;
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = aeUringUserData(state,fd);
+            sqe->user_data = AE_URING_IGNORE;
+            state->seq[fd]++;
+            state->armed[fd] = AE_NONE;
+        }
+        if (mask != AE_NONE) {
+            if ((sqe = aeUringGetSqe(state)) == NULL) break;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+            if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+            sqe->poll32_events = __swahw32(sqe->poll32_events);
+#endif
+            sqe->user_data = aeUringUserData(state,fd);
+            state->armed[fd] = mask;
+        }
+        state->changed[fd] = 0;
+    }
+    for (; j < state->numchanges; j++)
+        state->changes[kept++] = state->changes[j];
+    state->numchanges = kept;
+}
+
+/* Store in eventLoop->fired[numevents] the event reported by the poll
+ * completion 'cqe'. Returns 1 if an event was stored, 0 if the completion
+ * is about a request that is no longer relevant. */
+static int aeUringFireEvent(aeEventLoop *eventLoop, struct io_uring_cqe *cqe,
+                            int numevents)
+{
+    aeApiState *state = eventLoop->apidata;
+    uint64_t ud = cqe->user_data;
+    int fd = (int)(uint32_t)ud, mask = 0;
+
+    if (ud == AE_URING_IGNORE || fd >= eventLoop->setsize ||
+        state->armed[fd] == AE_NONE || ud != aeUringUserData(state,fd))
+        return 0;
+
+    /* Poll requests are one-shot: re-arm it at the next call. */
+    state->armed[fd] = AE_NONE;
+    aeUringMarkChanged(state,fd);
+    if (cqe->res < 0) {
+        mask = eventLoop->events[fd].mask;
+    } else {
+        if (cqe->res & POLLIN) mask |= AE_READABLE;
+        if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+        if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+        if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+    }
+
+    // 添加到事件循环准备好的文件事件中
+    eventLoop->fired[numevents].fd = fd;
+    eventLoop->fired[numevents].mask = mask;
+    return 1;
+}
+
+//// 提交批量的poll请求，并取出已准备好的文件描述符
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, min_complete = 1;
+    int j, numevents = 0;
+
+    if (!aeUseIoUring) return aeEpollApiPoll(eventLoop,tvp);
+
+    aeUringQueueChanges(eventLoop);
+    /* Don't wait if there are stashed events to return. */
+    if (state->numstash) min_complete = 0;
+    memset(&arg,0,sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) min_complete = 0;
+    }
+    /* Errors (including -ETIME on timeout) are not relevant: we just
+     * collect whatever completion is available. */
+    aeUringEnter(state,aeUringPublish(state),min_complete,
+                 IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,&arg);
+
+    /* The poll completions reaped by aeUringProcessIORequests() first. */
+    for (j = 0; j < state->numstash && numevents < eventLoop->setsize; j++)
+        numevents += aeUringFireEvent(eventLoop,&state->stash[j],numevents);
+    state->numstash -= j;
+    memmove(state->stash,state->stash+j,
+            sizeof(struct io_uring_cqe)*state->numstash);
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        numevents += aeUringFireEvent(eventLoop,
+                                      &state->cqes[head & *state->cq_mask],
+                                      numevents);
+        head++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+
+    // 返回已经准备好的事件个数
+    return numevents;
+}
+
+
+//// 返回当前使用的库的名字
+static char *aeApiName(void) {
+    return aeUseIoUring ? "io_uring" : aeEpollApiName();
+}
+
+/* Submit the reads and writes in 'reqs' with IORING_OP_RECVMSG and
+ * IORING_OP_SENDMSG, and wait for all of them to complete. MSG_DONTWAIT is
+ * used, so a socket that is not ready completes with -EAGAIN at once, like
+ * a non blocking read() or write() would do. The poll completions found in
+ * the completion queue while waiting are stashed for the next aeApiPoll(). */
+static void aeUringProcessIORequests(aeEventLoop *eventLoop, aeIORequest *reqs,
+                                     int numreqs)
+{
+    aeApiState *state = eventLoop->apidata;
+    int j, queued = 0, completed = 0;
+
+    if (numreqs > state->msgs_size) {
+        state->msgs = zrealloc(state->msgs,sizeof(struct msghdr)*numreqs);
+        state->msgs_size = numreqs;
+    }
+    while (completed < numreqs) {
+        unsigned head, tail;
+
+        /* Queue as many requests as the submission queue can take. */
+        while (queued < numreqs) {
+            struct io_uring_sqe *sqe = aeUringGetSqe(state);
+            struct msghdr *msg = &state->msgs[queued];
+
+            if (sqe == NULL) break;
+            memset(msg,0,sizeof(*msg));
+            msg->msg_iov = reqs[queued].iov;
+            msg->msg_iovlen = reqs[queued].iovcnt;
+            sqe->opcode = reqs[queued].write ? IORING_OP_SENDMSG :
+                                               IORING_OP_RECVMSG;
+            sqe->fd = reqs[queued].fd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = reqs[queued].flags|MSG_DONTWAIT;
+            sqe->user_data = AE_URING_IO_REQUEST|queued;
+            queued++;
+        }
+        aeUringEnter(state,aeUringPublish(state),1,IORING_ENTER_GETEVENTS,
+                     NULL);
+
+        head = *state->cq_head;
+        tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+
+            head++;
+            if (cqe->user_data == AE_URING_IGNORE) continue;
+            if (cqe->user_data & AE_URING_IO_REQUEST) {
+                j = (int)(cqe->user_data & ~AE_URING_IO_REQUEST);
+                reqs[j].res = cqe->res;
+                completed++;
+                continue;
+            }
+            if (state->numstash == state->stash_size) {
+                state->stash_size = state->stash_size ?
+                                    state->stash_size*2 : 64;
+                state->stash = zrealloc(state->stash,
+                    sizeof(struct io_uring_cqe)*state->stash_size);
+            }
+            state->stash[state->numstash++] = *cqe;
+        }
+        __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    }
+}
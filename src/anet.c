@@ -158,6 +158,33 @@ int anetDisableTcpNoDelay(char *err, int fd)
     return anetSetTcpNoDelay(err, fd, 0);
 }
 
+/* Set TCP_CORK (Linux only): while set, partial segments are held by the
+ * kernel, clearing it sends what is pending right away. On other systems
+ * this is a no-op returning ANET_OK. */
+static int anetSetTcpCork(char *err, int fd, int val)
+{
+#ifdef TCP_CORK
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val)) == -1)
+    {
+        anetSetError(err, "setsockopt TCP_CORK: %s", strerror(errno));
+        return ANET_ERR;
+    }
+#else
+    ((void) err); ((void) fd); ((void) val);
+#endif
+    return ANET_OK;
+}
+
+int anetEnableTcpCork(char *err, int fd)
+{
+    return anetSetTcpCork(err, fd, 1);
+}
+
+int anetDisableTcpCork(char *err, int fd)
+{
+    return anetSetTcpCork(err, fd, 0);
+}
+
 
 int anetSetSendBuffer(char *err, int fd, int buffsize)
 {
@@ -193,6 +220,20 @@ int anetSendTimeout(char *err, int fd, long long ms) {
     return ANET_OK;
 }
 
+/* Set the socket receive timeout (SO_RCVTIMEO socket option) to the specified
+ * number of milliseconds, or disable it if the 'ms' argument is zero. */
+int anetRecvTimeout(char *err, int fd, long long ms) {
+    struct timeval tv;
+
+    tv.tv_sec = ms/1000;
+    tv.tv_usec = (ms%1000)*1000;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+        anetSetError(err, "setsockopt SO_RCVTIMEO: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
 /* anetGenericResolve() is called by anetResolve() and anetResolveIP() to
  * do the actual work. It resolves the hostname "host" and set the string
  * representation of the IP address into the buffer pointed by "ipbuf".
@@ -246,6 +287,23 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Allow multiple sockets to bind the same address and port: the kernel
+ * spreads the incoming connections among them. */
+static int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    (void)fd;
+    anetSetError(err, "SO_REUSEPORT is not supported");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
@@ -462,7 +520,7 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int reuseport)
 {
     int s = -1, rv;
     char _port[6];  /* strlen("65535") */
@@ -484,6 +542,7 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if (reuseport && anetSetReusePort(err,s) == ANET_ERR) goto error;
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) goto error;
         goto end;
     }
@@ -502,12 +561,24 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, 0);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, 0);
+}
+
+/* Like anetTcpServer() and anetTcp6Server(), but the socket is created with
+ * SO_REUSEPORT, so that more sockets can listen to the same address. */
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, 1);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, 1);
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
@@ -528,10 +599,18 @@ int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
     return s;
 }
 
-static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
+static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len, int nonblock) {
     int fd;
     while(1) {
+#ifdef __linux__
+        fd = accept4(s,sa,len,nonblock ? SOCK_NONBLOCK : 0);
+#else
         fd = accept(s,sa,len);
+        if (fd != -1 && nonblock && anetNonBlock(err,fd) == ANET_ERR) {
+            close(fd);
+            return ANET_ERR;
+        }
+#endif
         if (fd == -1) {
             if (errno == EINTR)
                 continue;
@@ -545,11 +624,11 @@ static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *l
     return fd;
 }
 
-int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
+static int anetGenericTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port, int nonblock) {
     int fd;
     struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
-    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen)) == -1)
+    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen,nonblock)) == -1)
         return ANET_ERR;
 
     if (sa.ss_family == AF_INET) {
@@ -564,11 +643,21 @@ int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
     return fd;
 }
 
+int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
+    return anetGenericTcpAccept(err,s,ip,ip_len,port,0);
+}
+
+/* Like anetTcpAccept(), but the returned socket is already non blocking:
+ * on Linux this is done by accept4() itself, saving a system call. */
+int anetTcpNonBlockAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
+    return anetGenericTcpAccept(err,s,ip,ip_len,port,1);
+}
+
 int anetUnixAccept(char *err, int s) {
     int fd;
     struct sockaddr_un sa;
     socklen_t salen = sizeof(sa);
-    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen)) == -1)
+    if ((fd = anetGenericAccept(err,s,(struct sockaddr*)&sa,&salen,0)) == -1)
         return ANET_ERR;
 
     return fd;
@@ -12,146 +12,441 @@
 #include <sys/param.h>
 
 void aofUpdateCurrentSize(void);
-void aofClosePipes(void);
 
-#define AOF_RW_BUF_BLOCK_SIZE (1024*1024*10)    /* 10 MB per block */
+/* ----------------------------------------------------------------------------
+ * AOF manifest
+ *
+ * The AOF lives in server.aof_dirname and is made of a base file, that is
+ * the output of the last rewrite (RDB or AOF format), plus numbered
+ * incremental files with the commands executed after the base was taken.
+ * Every rewrite just switches the parent to a new incremental file before
+ * forking: the child snapshot and the files opened from that point on are
+ * the whole new AOF, so the parent never has to buffer or pipe the writes
+ * performed while the child is running.
+ *
+ * The manifest lists the files in load order, one per line:
+ *
+ *   file appendonly.aof.3.base.rdb seq 3 type b
+ *   file appendonly.aof.5.incr.aof seq 5 type i
+ *   file appendonly.aof.6.incr.aof seq 6 type i
+ *
+ * It is always replaced atomically, writing a temp file and renaming it.
+ * ------------------------------------------------------------------------- */
 
-typedef struct aofrwblock {
-    unsigned long used, free;
-    char buf[AOF_RW_BUF_BLOCK_SIZE];
-} aofrwblock;
+#define AOF_MANIFEST_MAX_LINE 1024
 
-//// 释放aof重写缓冲块（列表）
-void aofRewriteBufferReset(void) {
-    if (server.aof_rewrite_buf_blocks)
-        listRelease(server.aof_rewrite_buf_blocks);
+aofInfo *aofInfoCreate(sds file_name, long long file_seq, char file_type) {
+    aofInfo *ai = zmalloc(sizeof(*ai));
+    ai->file_name = file_name;
+    ai->file_seq = file_seq;
+    ai->file_type = file_type;
+    return ai;
+}
 
-    server.aof_rewrite_buf_blocks = listCreate();
-    listSetFreeMethod(server.aof_rewrite_buf_blocks,zfree);
+void aofInfoFree(aofInfo *ai) {
+    if (!ai) return;
+    sdsfree(ai->file_name);
+    zfree(ai);
 }
 
-//// 返回aof重写缓冲块（列表）的使用空间
-unsigned long aofRewriteBufferSize(void) {
-    listNode *ln;
-    listIter li;
-    unsigned long size = 0;
+aofInfo *aofInfoDup(aofInfo *orig) {
+    return aofInfoCreate(sdsdup(orig->file_name),orig->file_seq,
+                         orig->file_type);
+}
 
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        size += block->used;
+void aofListFree(void *item) {
+    aofInfoFree(item);
+}
+
+void *aofListDup(void *item) {
+    return aofInfoDup(item);
+}
+
+aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zcalloc(sizeof(*am));
+    am->incr_aof_list = listCreate();
+    listSetFreeMethod(am->incr_aof_list,aofListFree);
+    listSetDupMethod(am->incr_aof_list,aofListDup);
+    return am;
+}
+
+void aofManifestFree(aofManifest *am) {
+    aofInfoFree(am->base_aof_info);
+    listRelease(am->incr_aof_list);
+    zfree(am);
+}
+
+aofManifest *aofManifestDup(aofManifest *orig) {
+    aofManifest *am = zcalloc(sizeof(*am));
+
+    if (orig->base_aof_info)
+        am->base_aof_info = aofInfoDup(orig->base_aof_info);
+    am->incr_aof_list = listDup(orig->incr_aof_list);
+    am->curr_base_file_seq = orig->curr_base_file_seq;
+    am->curr_incr_file_seq = orig->curr_incr_file_seq;
+    return am;
+}
+
+/* Return the path of the file 'name' inside the AOF directory. */
+sds aofFilePath(const char *name) {
+    return sdscatfmt(sdsempty(),"%s/%s",server.aof_dirname,name);
+}
+
+sds getAofManifestFileName(void) {
+    return sdscatfmt(sdsempty(),"%s.manifest",server.aof_filename);
+}
+
+sds getTempAofManifestFileName(void) {
+    return sdscatfmt(sdsempty(),"temp-%s.manifest",server.aof_filename);
+}
+
+/* Incremental file receiving the writes while the first rewrite after
+ * enabling the AOF is in progress. It is not part of the manifest until
+ * the rewrite succeeds. */
+sds getTempIncrAofFileName(void) {
+    return sdscatfmt(sdsempty(),"temp-%s.incr",server.aof_filename);
+}
+
+/* Create the name of the next base file and make it the base of 'am'. The
+ * previous base, if any, is moved to 'history'. The suffix only helps who
+ * looks at the directory: the loader detects the format from the content. */
+sds getNewBaseFileName(aofManifest *am, list *history) {
+    const char *format = server.aof_use_rdb_preamble ? "rdb" : "aof";
+
+    if (am->base_aof_info) {
+        listAddNodeTail(history,am->base_aof_info);
+        am->base_aof_info = NULL;
+    }
+    am->curr_base_file_seq++;
+    sds name = sdscatfmt(sdsempty(),"%s.%I.base.%s",server.aof_filename,
+        am->curr_base_file_seq,format);
+    am->base_aof_info = aofInfoCreate(sdsdup(name),am->curr_base_file_seq,
+                                      AOF_FILE_TYPE_BASE);
+    return name;
+}
+
+/* Create the name of the next incremental file and append it to 'am'. */
+sds getNewIncrFileName(aofManifest *am) {
+    am->curr_incr_file_seq++;
+    sds name = sdscatfmt(sdsempty(),"%s.%I.incr.aof",server.aof_filename,
+        am->curr_incr_file_seq);
+    listAddNodeTail(am->incr_aof_list,aofInfoCreate(sdsdup(name),
+        am->curr_incr_file_seq,AOF_FILE_TYPE_INCR));
+    return name;
+}
+
+/* Move to 'history' the incremental files of the manifest, but the last
+ * 'keep' ones. */
+void markIncrFilesAsHistory(aofManifest *am, list *history, int keep) {
+    while (listLength(am->incr_aof_list) > (unsigned long)keep) {
+        listNode *ln = listFirst(am->incr_aof_list);
+        listAddNodeTail(history,aofInfoDup(ln->value));
+        listDelNode(am->incr_aof_list,ln);
     }
-    return size;
 }
 
+static sds catAofFileName(sds s, sds name) {
+    if (sdslen(name) == 0 || strpbrk(name," \t\r\n\"'\\"))
+        return sdscatrepr(s,name,sdslen(name));
+    return sdscatsds(s,name);
+}
+
+static sds catAofInfo(sds s, aofInfo *ai) {
+    s = sdscat(s,"file ");
+    s = catAofFileName(s,ai->file_name);
+    return sdscatprintf(s," seq %lld type %c\n",ai->file_seq,ai->file_type);
+}
 
-//// 将aof_rewrite_buf_blocks中的数据通过管道发送给aof重写的子进程
-void aofChildWriteDiffData(aeEventLoop *el, int fd, void *privdata, int mask) {
+sds getAofManifestAsString(aofManifest *am) {
+    sds s = sdsempty();
+    listIter li;
     listNode *ln;
-    aofrwblock *block;
-    ssize_t nwritten;
-    UNUSED(el);
-    UNUSED(fd);
-    UNUSED(privdata);
-    UNUSED(mask);
 
-    while(1) {
-        ln = listFirst(server.aof_rewrite_buf_blocks);
-        block = ln ? ln->value : NULL;
-
-        // 停止通信 或 block无数据
-        if (server.aof_stop_sending_diff || !block) {
-            aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,
-                              AE_WRITABLE);
-            return;
-        }
+    if (am->base_aof_info) s = catAofInfo(s,am->base_aof_info);
+    listRewind(am->incr_aof_list,&li);
+    while ((ln = listNext(&li)) != NULL) s = catAofInfo(s,ln->value);
+    return s;
+}
 
-        // block有数据
-        if (block->used > 0) {
-            // 将一个节点的数据一次性的全部发送给子进程
-            nwritten = write(server.aof_pipe_write_data_to_child,
-                             block->buf,block->used);
-            if (nwritten <= 0) return;
-            memmove(block->buf,block->buf+nwritten,block->used-nwritten);
-            block->used -= nwritten;
-            block->free += nwritten;
-        }
+int aofEnsureDir(void) {
+    if (mkdir(server.aof_dirname,0755) == -1 && errno != EEXIST) {
+        serverLog(LL_WARNING,"Can't create the AOF directory %s: %s",
+            server.aof_dirname, strerror(errno));
+        return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Write the manifest to disk atomically. Returns C_ERR if the new manifest
+ * could not be persisted, in that case the old one is left untouched. */
+int persistAofManifest(aofManifest *am) {
+    sds name = getAofManifestFileName();
+    sds tmpname = getTempAofManifestFileName();
+    sds path = aofFilePath(name);
+    sds tmppath = aofFilePath(tmpname);
+    sds content = getAofManifestAsString(am);
+    int fd, dirfd, ret = C_ERR;
+
+    fd = open(tmppath,O_WRONLY|O_TRUNC|O_CREAT,0644);
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't open the AOF manifest %s: %s",
+            tmppath, strerror(errno));
+        goto cleanup;
+    }
+    if (write(fd,content,sdslen(content)) != (ssize_t)sdslen(content) ||
+        aof_fsync(fd) == -1)
+    {
+        serverLog(LL_WARNING,"Error writing the AOF manifest %s: %s",
+            tmppath, strerror(errno));
+        close(fd);
+        unlink(tmppath);
+        goto cleanup;
+    }
+    close(fd);
+    if (rename(tmppath,path) == -1) {
+        serverLog(LL_WARNING,"Error trying to rename the AOF manifest %s "
+            "into %s: %s", tmppath, path, strerror(errno));
+        unlink(tmppath);
+        goto cleanup;
+    }
+    /* Make the rename itself durable. */
+    if ((dirfd = open(server.aof_dirname,O_RDONLY)) != -1) {
+        aof_fsync(dirfd);
+        close(dirfd);
+    }
+    ret = C_OK;
 
-        // 节点数据转移完毕之后就释放节点
-        if (block->used == 0) listDelNode(server.aof_rewrite_buf_blocks,ln);
+cleanup:
+    sdsfree(name);
+    sdsfree(tmpname);
+    sdsfree(path);
+    sdsfree(tmppath);
+    sdsfree(content);
+    return ret;
+}
+
+/* Check that 'ai' can follow the files already listed in 'am'. Returns
+ * NULL if it can, otherwise the reason why the manifest is invalid. */
+static const char *checkAofInfo(aofManifest *am, aofInfo *ai) {
+    if (!ai->file_name || !pathIsBaseName(ai->file_name))
+        return "missing or invalid file name";
+    if (ai->file_seq < 0) return "missing or invalid sequence";
+    if (ai->file_type == AOF_FILE_TYPE_BASE) {
+        if (am->base_aof_info) return "found a duplicate base file";
+        if (listLength(am->incr_aof_list))
+            return "the base file must be the first one";
+    } else if (ai->file_type == AOF_FILE_TYPE_INCR) {
+        if (ai->file_seq <= am->curr_incr_file_seq)
+            return "incremental files are not in sequence order";
+    } else {
+        return "unknown file type";
     }
+    return NULL;
 }
 
+/* Load the manifest from the AOF directory into server.aof_manifest. A
+ * missing manifest is not an error: it just means that the AOF was never
+ * written, or that it still uses the single file layout. */
+void aofLoadManifestFromDisk(void) {
+    aofManifest *am = aofManifestCreate();
+    sds name = getAofManifestFileName();
+    sds path = aofFilePath(name);
+    char buf[AOF_MANIFEST_MAX_LINE+1];
+    const char *err = NULL;
+    long long lineno = 0;
+    FILE *fp;
 
-//// 正在进行aof重写的时候，
-//// 同时写入aof_rewrite_buf_blocks这个双端列表中
-void aofRewriteBufferAppend(unsigned char *s, unsigned long len) {
-    listNode *ln = listLast(server.aof_rewrite_buf_blocks);
-    aofrwblock *block = ln ? ln->value : NULL;
+    sdsfree(name);
+    if (server.aof_manifest) aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
 
-    while(len) {
-        if (block) {
-            // 将命令拷贝到aof_rewrite_buf_blocks的最后节点上
-            unsigned long thislen = (block->free < len) ? block->free : len;
-            if (thislen) {  /* The current block is not already full. */
-                memcpy(block->buf+block->used, s, thislen);
-                block->used += thislen;
-                block->free -= thislen;
-                s += thislen;
-                len -= thislen;
-            }
+    if ((fp = fopen(path,"r")) == NULL) {
+        if (errno != ENOENT) {
+            serverLog(LL_WARNING,"Fatal error: can't open the AOF manifest "
+                "%s for reading: %s", path, strerror(errno));
+            exit(1);
         }
+        sdsfree(path);
+        return;
+    }
+
+    while (fgets(buf,sizeof(buf),fp) != NULL) {
+        aofInfo *ai;
+        sds *argv;
+        int argc, j;
 
-        // 双端链表的节点空间不够时，会剩下一部分，重新创建一个节点然后再拷贝
-        if (len) {
-            int numblocks;
-
-            block = zmalloc(sizeof(*block));
-            block->free = AOF_RW_BUF_BLOCK_SIZE;
-            block->used = 0;
-            listAddNodeTail(server.aof_rewrite_buf_blocks,block);
-
-            /* Log every time we cross more 10 or 100 blocks, respectively
-             * as a notice or warning. */
-            numblocks = listLength(server.aof_rewrite_buf_blocks);
-            if (((numblocks+1) % 10) == 0) {
-                int level = ((numblocks+1) % 100) == 0 ? LL_WARNING :
-                                                         LL_NOTICE;
-                serverLog(level,"Background AOF buffer size: %lu MB",
-                    aofRewriteBufferSize()/(1024*1024));
+        lineno++;
+        if (buf[0] == '#' || buf[0] == '\n') continue;
+        if (strchr(buf,'\n') == NULL) {
+            err = "line too long";
+            break;
+        }
+        argv = sdssplitargs(buf,&argc);
+        if (argv == NULL || argc < 6 || argc % 2) {
+            if (argv) sdsfreesplitres(argv,argc);
+            err = "wrong number of arguments";
+            break;
+        }
+        ai = aofInfoCreate(NULL,-1,0);
+        for (j = 0; j < argc; j += 2) {
+            if (!strcasecmp(argv[j],"file")) {
+                sdsfree(ai->file_name);
+                ai->file_name = sdsdup(argv[j+1]);
+            } else if (!strcasecmp(argv[j],"seq")) {
+                ai->file_seq = strtoll(argv[j+1],NULL,10);
+            } else if (!strcasecmp(argv[j],"type")) {
+                ai->file_type = argv[j+1][0];
             }
+            /* Unknown fields are skipped for forward compatibility. */
         }
-    }
+        sdsfreesplitres(argv,argc);
 
+        if ((err = checkAofInfo(am,ai)) != NULL) {
+            aofInfoFree(ai);
+            break;
+        }
+        if (ai->file_type == AOF_FILE_TYPE_BASE) {
+            am->base_aof_info = ai;
+            am->curr_base_file_seq = ai->file_seq;
+        } else {
+            listAddNodeTail(am->incr_aof_list,ai);
+            am->curr_incr_file_seq = ai->file_seq;
+        }
+    }
+    if (!err && ferror(fp)) err = strerror(errno);
+    fclose(fp);
 
-    //// 设置一个文件事件，将aof_rewrite_buf_blocks中的数据通过管道发送给aof重写的子进程
-    if (aeGetFileEvents(server.el,server.aof_pipe_write_data_to_child) == 0) {
-        aeCreateFileEvent(server.el, server.aof_pipe_write_data_to_child,
-            AE_WRITABLE, aofChildWriteDiffData, NULL);
+    if (err) {
+        serverLog(LL_WARNING,"Invalid AOF manifest %s at line %lld: %s",
+            path, lineno, err);
+        exit(1);
     }
+    sdsfree(path);
 }
 
-//// 主进程将缓冲aof_rewrite_buf_blocks（列表）中的数据写到aof重写的文件中
-ssize_t aofRewriteBufferWrite(int fd) {
-    listNode *ln;
+/* Remove the files that are no longer part of the AOF. A descriptor is
+ * kept open across the unlink(2), so that releasing the blocks of a big
+ * file happens in the close(2) performed by a background thread. */
+void aofDelHistoryFiles(list *history) {
     listIter li;
-    ssize_t count = 0;
+    listNode *ln;
 
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        ssize_t nwritten;
-
-        if (block->used) {
-            nwritten = write(fd,block->buf,block->used);
-            if (nwritten != (ssize_t)block->used) {
-                if (nwritten == 0) errno = EIO;
-                return -1;
-            }
-            count += nwritten;
+    listRewind(history,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = ln->value;
+        sds path = aofFilePath(ai->file_name);
+        int fd = open(path,O_RDONLY|O_NONBLOCK);
+
+        if (unlink(path) == -1 && errno != ENOENT) {
+            serverLog(LL_WARNING,"Can't remove the old AOF file %s: %s",
+                path, strerror(errno));
+        } else {
+            serverLog(LL_NOTICE,"Removed the old AOF file %s",path);
+        }
+        if (fd != -1)
+            bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+        sdsfree(path);
+    }
+}
+
+/* Switch server.aof_fd to a new incremental file. While the AOF waits for
+ * its first rewrite the file is a temp one, that is added to the manifest
+ * only once the rewrite succeeds. Otherwise the file is added to the
+ * manifest right away. The previous file is fsynced and closed in
+ * background. */
+int aofOpenNewIncrFile(void) {
+    aofManifest *am = NULL;
+    sds name, path;
+    int fd, oldfd;
+
+    if (aofEnsureDir() == C_ERR) return C_ERR;
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        name = getTempIncrAofFileName();
+    } else {
+        am = aofManifestDup(server.aof_manifest);
+        name = getNewIncrFileName(am);
+    }
+    path = aofFilePath(name);
+    fd = open(path,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644);
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't open the append only file %s: %s",
+            path, strerror(errno));
+        goto err;
+    }
+    if (am) {
+        if (persistAofManifest(am) == C_ERR) {
+            close(fd);
+            unlink(path);
+            goto err;
+        }
+        aofManifestFree(server.aof_manifest);
+        server.aof_manifest = am;
+    }
+
+    aofGroupCommitFlush();
+    oldfd = server.aof_fd;
+    server.aof_fd = fd;
+    server.aof_last_incr_size = 0;
+    /* Make sure the new file starts with a SELECT. */
+    server.aof_selected_db = -1;
+    if (oldfd != -1)
+        bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)oldfd,(void*)1,NULL);
+    serverLog(LL_NOTICE,"Appending to the incremental AOF file %s",name);
+    sdsfree(name);
+    sdsfree(path);
+    return C_OK;
+
+err:
+    if (am) aofManifestFree(am);
+    sdsfree(name);
+    sdsfree(path);
+    return C_ERR;
+}
+
+/* Called at startup, after the dataset was loaded, when the AOF is enabled.
+ * A single file AOF found in the working directory is moved inside the AOF
+ * directory and becomes the base of the manifest. Then the last incremental
+ * file is opened for appending, or a new one is created. */
+void aofOpenIfNeededOnServerStart(void) {
+    aofManifest *am = server.aof_manifest;
+
+    if (server.aof_state != AOF_ON) return;
+    if (aofEnsureDir() == C_ERR) exit(1);
+
+    if (am->base_aof_info == NULL && listLength(am->incr_aof_list) == 0 &&
+        access(server.aof_filename,F_OK) == 0)
+    {
+        sds path = aofFilePath(server.aof_filename);
+
+        if (rename(server.aof_filename,path) == -1) {
+            serverLog(LL_WARNING,"Can't move the append only file %s into "
+                "%s: %s", server.aof_filename, path, strerror(errno));
+            exit(1);
+        }
+        am->base_aof_info = aofInfoCreate(sdsnew(server.aof_filename),1,
+                                          AOF_FILE_TYPE_BASE);
+        am->curr_base_file_seq = 1;
+        if (persistAofManifest(am) == C_ERR) exit(1);
+        serverLog(LL_NOTICE,"Moved the append only file %s into %s, it is "
+            "now the base of the AOF manifest", server.aof_filename, path);
+        sdsfree(path);
+    }
+
+    if (listLength(am->incr_aof_list) == 0) {
+        if (aofOpenNewIncrFile() == C_ERR) exit(1);
+    } else {
+        aofInfo *ai = listNodeValue(listLast(am->incr_aof_list));
+        sds path = aofFilePath(ai->file_name);
+
+        server.aof_fd = open(path,O_WRONLY|O_APPEND|O_CREAT,0644);
+        if (server.aof_fd == -1) {
+            serverLog(LL_WARNING,"Can't open the append-only file %s: %s",
+                path, strerror(errno));
+            exit(1);
         }
+        sdsfree(path);
     }
-    return count;
+    aofUpdateCurrentSize();
 }
 
 /* ----------------------------------------------------------------------------
@@ -164,11 +459,213 @@ void aof_background_fsync(int fd) {
     bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)fd,NULL,NULL);
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF group commit
+ *
+ * With "appendfsync always" and "aof-group-commit yes" the AOF buffer is
+ * still written by flushAppendOnlyFile() before returning to the event loop,
+ * but the fsync is performed by the BIO_AOF_FSYNC thread. Every client that
+ * executes a command remembers the AOF offset reached at that point
+ * (c->aof_woff), and its replies are held until an fsync covering that offset
+ * completes: not only the acknowledged writes are on disk, but also the
+ * writes of other clients the command could observe, exactly like with the
+ * plain "always" policy. For the same reason the slaves are only sent the
+ * replication stream up to aof_fsynced_repl_offset, the replication offset
+ * matching the AOF data on disk.
+ *
+ * A single fsync is in progress at any time: the writes performed while it
+ * runs are all covered by the next one, so the number of fsyncs per second is
+ * bound by the disk latency and not by the number of writes.
+ * ------------------------------------------------------------------------- */
+
+static void aofFsyncPipeReadable(aeEventLoop *el, int fd, void *privdata,
+                                 int mask);
+
+void aofGroupCommitInit(void) {
+    server.aof_fed_offset = 0;
+    server.aof_written_offset = 0;
+    server.aof_fsynced_offset = 0;
+    server.aof_fsync_pending_offset = -1;
+    server.aof_written_repl_offset = server.master_repl_offset;
+    server.aof_fsync_pending_repl_offset = -1;
+    server.aof_fsynced_repl_offset = server.master_repl_offset;
+    server.aof_fsync_debug_delay = 0;
+    if (pipe(server.aof_fsync_pipe) == -1) {
+        serverLog(LL_WARNING,
+            "Can't create the pipe for the AOF group commit: %s",
+            strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,server.aof_fsync_pipe[0]);
+    anetNonBlock(NULL,server.aof_fsync_pipe[1]);
+    if (aeCreateFileEvent(server.el,server.aof_fsync_pipe[0],AE_READABLE,
+        aofFsyncPipeReadable,NULL) == AE_ERR)
+    {
+        serverPanic("Error registering the readable event for the AOF "
+                    "group commit.");
+    }
+}
+
+int aofGroupCommitActive(void) {
+    return server.aof_fsync == AOF_FSYNC_ALWAYS && server.aof_group_commit;
+}
+
+/* Return true if the replies of 'c' must not be sent yet since they follow
+ * a write that is not on disk. */
+int aofClientMustWaitFsync(client *c) {
+    /* The slaves are limited by aofGroupCommitReplLimit() instead. */
+    if (c->flags & CLIENT_SLAVE) return 0;
+    return aofGroupCommitActive() && c->aof_woff > server.aof_fsynced_offset;
+}
+
+/* Return the last replication offset that can be sent to the slaves, or -1
+ * if the group commit doesn't limit it. */
+long long aofGroupCommitReplLimit(void) {
+    return aofGroupCommitActive() ? server.aof_fsynced_repl_offset : -1;
+}
+
+/* Called by the bio thread once an fsync requested by the group commit
+ * completed, with the errno of the failure or zero. */
+void aofFsyncNotify(int err) {
+    if (write(server.aof_fsync_pipe[1],&err,sizeof(err)) != sizeof(err)) {
+        /* The pipe has room for many more notifications than the single
+         * fsync in progress can produce. */
+        serverLog(LL_WARNING,"Can't notify the AOF fsync completion: %s",
+            strerror(errno));
+    }
+}
+
+/* Put back in the queue of clients to write the ones whose writes are now
+ * on disk. */
+static void aofReleaseClientsWaitingFsync(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients_waiting_aof_fsync,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (aofClientMustWaitFsync(c)) continue;
+        c->flags &= ~CLIENT_PENDING_AOF_FSYNC;
+        listDelNode(server.clients_waiting_aof_fsync,ln);
+        clientInstallWriteHandler(c);
+    }
+}
+
+/* Everything up to 'offset' is on disk, and so is the replication stream
+ * up to 'repl_offset'. */
+void aofGroupCommitMarkSynced(long long offset, long long repl_offset) {
+    if (offset > server.aof_fsynced_offset) server.aof_fsynced_offset = offset;
+    if (listLength(server.clients_waiting_aof_fsync))
+        aofReleaseClientsWaitingFsync();
+    if (repl_offset > server.aof_fsynced_repl_offset) {
+        server.aof_fsynced_repl_offset = repl_offset;
+        if (listLength(server.slaves)) prepareReplicasToWrite();
+    }
+}
+
+/* Start an fsync covering what was written so far, unless there is nothing
+ * new to fsync or an fsync is already in progress: its completion will
+ * start the next one. */
+void aofGroupCommitStartFsync(void) {
+    if (server.aof_fsync_pending_offset != -1 ||
+        server.aof_fd == -1 ||
+        server.aof_written_offset <= server.aof_fsynced_offset) return;
+    server.aof_fsync_pending_offset = server.aof_written_offset;
+    server.aof_fsync_pending_repl_offset = server.aof_written_repl_offset;
+    bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,
+                           (void*)1,NULL);
+}
+
+/* Process the fsync outcomes sent by the bio thread. */
+static void aofProcessFsyncNotifications(void) {
+    int err;
+
+    while (read(server.aof_fsync_pipe[0],&err,sizeof(err)) == sizeof(err)) {
+        if (err) {
+            /* As for write errors with appendfsync always, we can't go on:
+             * the writes of the held replies may not be on disk. */
+            serverLog(LL_WARNING,"Can't persist the AOF for the group "
+                "commit: fsync: %s. Exiting...", strerror(err));
+            exit(1);
+        }
+        if (server.aof_fsync_pending_offset == -1) continue;
+        server.stat_aof_group_commits++;
+        aofGroupCommitMarkSynced(server.aof_fsync_pending_offset,
+                                 server.aof_fsync_pending_repl_offset);
+        server.aof_fsync_pending_offset = -1;
+        server.aof_fsync_pending_repl_offset = -1;
+    }
+    if (aofGroupCommitActive()) aofGroupCommitStartFsync();
+}
+
+static void aofFsyncPipeReadable(aeEventLoop *el, int fd, void *privdata,
+                                 int mask)
+{
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(privdata);
+    UNUSED(mask);
+    aofProcessFsyncNotifications();
+}
+
+/* Called in beforeSleep() before writing the replies: the clients that wrote
+ * something not yet on disk are moved from the queue of clients to write to
+ * the queue of clients waiting for the fsync. */
+void aofHoldClientsWaitingFsync(void) {
+    listIter li;
+    listNode *ln;
+
+    /* flushAppendOnlyFile() wrote everything fed so far: the replication
+     * stream produced up to now is covered by the fsync of what it wrote,
+     * or by the last one if nothing is pending. */
+    if (sdslen(server.aof_buf) == 0) {
+        server.aof_written_repl_offset = server.master_repl_offset;
+        if (server.aof_written_offset <= server.aof_fsynced_offset)
+            aofGroupCommitMarkSynced(server.aof_written_offset,
+                                     server.aof_written_repl_offset);
+    }
+    aofGroupCommitStartFsync();
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (!aofClientMustWaitFsync(c)) continue;
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+        if (!(c->flags & CLIENT_PENDING_AOF_FSYNC)) {
+            c->flags |= CLIENT_PENDING_AOF_FSYNC;
+            listAddNodeTail(server.clients_waiting_aof_fsync,c);
+        }
+    }
+}
+
+/* Make everything written so far durable and release all the held replies:
+ * called before the AOF file descriptor is closed or replaced, and when the
+ * group commit gets disabled. */
+void aofGroupCommitFlush(void) {
+    /* The fsync in progress may target the descriptor we are going to close:
+     * wait for it. */
+    while (server.aof_fsync_pending_offset != -1) {
+        aeWait(server.aof_fsync_pipe[0],AE_READABLE,1000);
+        aofProcessFsyncNotifications();
+    }
+    if (server.aof_written_offset > server.aof_fsynced_offset &&
+        server.aof_fd != -1 &&
+        listLength(server.clients_waiting_aof_fsync))
+    {
+        aof_fsync(server.aof_fd);
+    }
+    aofGroupCommitMarkSynced(server.aof_written_offset,
+                             server.aof_written_repl_offset);
+}
+
 /* Called when the user switches from "appendonly yes" to "appendonly no"
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
     serverAssert(server.aof_state != AOF_OFF);
     flushAppendOnlyFile(1);
+    aofGroupCommitFlush();
     aof_fsync(server.aof_fd);
     close(server.aof_fd);
 
@@ -184,46 +681,35 @@ void stopAppendOnly(void) {
         if (kill(server.aof_child_pid,SIGUSR1) != -1) {
             while(wait3(&statloc,0,NULL) != server.aof_child_pid);
         }
-        /* reset the buffer accumulating changes while the child saves */
-        aofRewriteBufferReset();
         aofRemoveTempFile(server.aof_child_pid);
         server.aof_child_pid = -1;
         server.aof_rewrite_time_start = -1;
-        /* close pipes used for IPC between the two processes. */
-        aofClosePipes();
+        updateDictResizePolicy();
     }
 }
 
 /* Called when the user switches from "appendonly no" to "appendonly yes"
  * at runtime using the CONFIG command. */
 int startAppendOnly(void) {
-    char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
-
-    server.aof_last_fsync = server.unixtime;
-    server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (server.aof_fd == -1) {
-        char *cwdp = getcwd(cwd,MAXPATHLEN);
-
-        serverLog(LL_WARNING,
-            "Redis needs to enable the AOF but can't open the "
-            "append only file %s (in server root dir %s): %s",
-            server.aof_filename,
-            cwdp ? cwdp : "unknown",
-            strerror(errno));
-        return C_ERR;
-    }
+    server.aof_last_fsync = server.unixtime;
+    /* The state must be set before the rewrite starts, so that the writes
+     * performed while the child runs go to the temp incremental file. */
+    server.aof_state = AOF_WAIT_REWRITE;
     if (server.rdb_child_pid != -1) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
     } else if (rewriteAppendOnlyFileBackground() == C_ERR) {
-        close(server.aof_fd);
+        server.aof_state = AOF_OFF;
+        if (server.aof_fd != -1) {
+            close(server.aof_fd);
+            server.aof_fd = -1;
+        }
         serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return C_ERR;
     }
     /* We correctly switched on AOF, now wait for the rewrite to be complete
-     * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
+     * in order to add the new files to the manifest. */
     return C_OK;
 }
 
@@ -319,7 +805,7 @@ void flushAppendOnlyFile(int force) {
             }
 
             // 尝试移除新追加的不完整内容
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            if (ftruncate(server.aof_fd, server.aof_last_incr_size) == -1) {
                 if (can_log) {
                     serverLog(LL_WARNING, "Could not remove short write "
                              "from the append-only file.  Redis may refuse "
@@ -352,6 +838,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_last_incr_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -367,6 +854,9 @@ void flushAppendOnlyFile(int force) {
 
     // 更新aof文件的当前大小
     server.aof_current_size += nwritten;
+    server.aof_last_incr_size += nwritten;
+    server.aof_written_offset = server.aof_fed_offset;
+    server.aof_written_repl_offset = server.master_repl_offset;
 
     // 当缓冲区使用量很小时，可以考虑重用缓冲区
     if ((sdslen(server.aof_buf)+sdsavail(server.aof_buf)) < 4000) {
@@ -380,16 +870,27 @@ void flushAppendOnlyFile(int force) {
      * children doing I/O in the background. */
     if (server.aof_no_fsync_on_rewrite &&
         (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
-            return;
+    {
+        /* The user accepted these writes not to be fsynced: the group
+         * commit must not hold the replies waiting for them. */
+        aofGroupCommitMarkSynced(server.aof_written_offset,
+                             server.aof_written_repl_offset);
+        return;
+    }
 
     // fsync策略
-    if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+    if (server.aof_fsync == AOF_FSYNC_ALWAYS && server.aof_group_commit) {
+        aofGroupCommitStartFsync();
+        server.aof_last_fsync = server.unixtime;
+    } else if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
         //// 每次事件循环都要将aof_buf缓冲区的所有内容都写入AOF文件，并且同步AOF文件
         latencyStartMonitor(latency);
         aof_fsync(server.aof_fd); /* Let's try to get this data on the disk */
         latencyEndMonitor(latency);
         latencyAddSampleIfNeeded("aof-fsync-always",latency);
         server.aof_last_fsync = server.unixtime;
+        aofGroupCommitMarkSynced(server.aof_written_offset,
+                             server.aof_written_repl_offset);
     } else if ((server.aof_fsync == AOF_FSYNC_EVERYSEC &&
                 server.unixtime > server.aof_last_fsync)) {
         //// 每隔1秒就要在子进程中对AOF文件进行一次同步
@@ -399,10 +900,16 @@ void flushAppendOnlyFile(int force) {
 }
 
 //// 通用格式化命令并写入到AOF缓冲区
+/* The room for the whole command is reserved in advance, so 'dst' grows at
+ * most once, and integer encoded arguments are not decoded into objects. */
 sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
-    char buf[32];
+    char buf[32], num[LONG_STR_SIZE];
+    size_t room = 1+LONG_STR_SIZE+2;
     int len, j;
-    robj *o;
+
+    for (j = 0; j < argc; j++)
+        room += 1+LONG_STR_SIZE+2+stringObjectLen(argv[j])+2;
+    dst = sdsMakeRoomFor(dst,room);
 
     // 初始化命令参数个数
     buf[0] = '*';
@@ -413,15 +920,24 @@ sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
 
     // 遍历每一个参数，并追加到aof缓冲区中
     for (j = 0; j < argc; j++) {
-        o = getDecodedObject(argv[j]);
+        robj *o = argv[j];
+        char *ptr;
+        size_t plen;
+
+        if (sdsEncodedObject(o)) {
+            ptr = o->ptr;
+            plen = sdslen(o->ptr);
+        } else {
+            ptr = num;
+            plen = ll2string(num,sizeof(num),(long)o->ptr);
+        }
         buf[0] = '$';
-        len = 1+ll2string(buf+1,sizeof(buf)-1,sdslen(o->ptr));
+        len = 1+ll2string(buf+1,sizeof(buf)-1,plen);
         buf[len++] = '\r';
         buf[len++] = '\n';
         dst = sdscatlen(dst,buf,len);
-        dst = sdscatlen(dst,o->ptr,sdslen(o->ptr));
+        dst = sdscatlen(dst,ptr,plen);
         dst = sdscatlen(dst,"\r\n",2);
-        decrRefCount(o);
     }
     return dst;
 }
@@ -465,7 +981,16 @@ sds catAppendOnlyExpireAtCommand(sds buf, struct redisCommand *cmd, robj *key, r
 
 //// 追加命令到aof_buf缓冲区
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
-    sds buf = sdsempty();
+    sds encoded = NULL;
+
+    feedAppendOnlyFileEncoded(cmd,dictid,argv,argc,&encoded);
+}
+
+/* Like feedAppendOnlyFile(), but commands written as they are take their
+ * RESP encoding from getPropagatedCommandEncoding(), so that it is shared
+ * with the replication stream via '*encoded'. */
+void feedAppendOnlyFileEncoded(struct redisCommand *cmd, int dictid, robj **argv, int argc, sds *encoded) {
+    sds buf = sdsempty(), cmdbuf = NULL;
     robj *tmpargv[3];
 
     // 如果操作的数据库dictid与上一条被执行的命令的数据库server.aof_selected_db不一致，那么补充追加一条SELECT命令记录
@@ -513,18 +1038,24 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
                                                pxarg);
     } else {
         // 这个函数用于将一条Redis命令按照一定格式写入一个sds缓冲区内
-        buf = catAppendOnlyGenericCommand(buf,argc,argv);
+        cmdbuf = getPropagatedCommandEncoding(encoded,argc,argv);
     }
 
     //// 将格式化的命令字符串追加到AOF缓冲区中，
     // AOF缓冲区中的数据会在重新进入时间循环前写入到磁盘中，
     // 相应的客户端也会受到关于此次操作的回复
-    if (server.aof_state == AOF_ON)
+    /* While the first rewrite after enabling the AOF is running, the
+     * commands go to the temp incremental file opened before the fork. */
+    if (server.aof_state == AOF_ON ||
+        (server.aof_state == AOF_WAIT_REWRITE && server.aof_child_pid != -1))
+    {
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
-
-    //// 如果正在执行后台重写aof文件，还要将命令加入server.aof_rewrite_buf_blocks中
-    if (server.aof_child_pid != -1)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
+        server.aof_fed_offset += sdslen(buf);
+        if (cmdbuf) {
+            server.aof_buf = sdscatlen(server.aof_buf,cmdbuf,sdslen(cmdbuf));
+            server.aof_fed_offset += sdslen(cmdbuf);
+        }
+    }
 
     sdsfree(buf);
 }
@@ -542,9 +1073,13 @@ struct client *createFakeClient(void) {
     c->fd = -1;
     c->name = NULL;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
+    c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->multibulklen = 0;
+    c->bulklen = -1;
     c->bufpos = 0;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
@@ -556,7 +1091,7 @@ struct client *createFakeClient(void) {
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientMultiState(c);
     return c;
@@ -578,18 +1113,27 @@ void freeFakeClient(struct client *c) {
     zfree(c);
 }
 
+/* Size of the blocks of the AOF file appended to the query buffer of the
+ * fake client while loading. */
+#define AOF_LOAD_BLOCK_SIZE (1024*1024)
+
 //// 当数据存储在AOF文件中后，服务器在下一次重启需要载入数据，AOF数据载入比较有意思，其会开一个伪Redis客户端
 //// 然后模仿客户端对服务器执行命令的过程，将AOF中存储的命令一一执行，执行完毕后服务器数据库中的数据就和上次一样了。
-int loadAppendOnlyFile(char *filename) {
+//// 'last_file'表示这是最后一个AOF文件，只有它允许被截断
+static int loadSingleAppendOnlyFile(char *filename, int last_file) {
     struct client *fakeClient;
     FILE *fp = fopen(filename,"r");
     struct redis_stat sb;
     int old_aof_state = server.aof_state;
     long loops = 0;
     off_t valid_up_to = 0; /* Offset of latest well-formed command loaded. */
+    off_t read_so_far = 0; /* Bytes of the file read so far. */
+    int eof = 0;
+    respIndex idx;
+    long long start = ustime();
 
     if (fp == NULL) {
-        serverLog(LL_WARNING,"Fatal error: can't open the append log file for reading: %s",strerror(errno));
+        serverLog(LL_WARNING,"Fatal error: can't open the append log file %s for reading: %s",filename,strerror(errno));
         exit(1);
     }
 
@@ -598,7 +1142,6 @@ int loadAppendOnlyFile(char *filename) {
      * a zero length file at startup, that will remain like that if no write
      * operation is received. */
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
-        server.aof_current_size = 0;
         fclose(fp);
         return C_ERR;
     }
@@ -608,7 +1151,7 @@ int loadAppendOnlyFile(char *filename) {
 
     //// 创建伪客户端
     fakeClient = createFakeClient();
-    startLoading(fp);
+    startLoadingFile(fp);
 
     /* Check if this AOF file has an RDB preamble. In that case we need to
      * load the RDB file and later continue loading the AOF tail. */
@@ -631,67 +1174,71 @@ int loadAppendOnlyFile(char *filename) {
         }
     }
 
-    /* Read the actual AOF file, in REPL format, command by command. */
+    /* Read the actual AOF file, in RESP format. The file is read in big
+     * blocks into the query buffer of the fake client, and the commands are
+     * parsed by processMultibulkBuffer() just like the commands of a client
+     * pipelining requests. */
+    read_so_far = ftello(fp);
+    if (read_so_far == -1) goto readerr;
+    respIndexReset(&idx);
     while(1) {
-        int argc, j;
-        unsigned long len;
-        robj **argv;
-        char buf[128];
-        sds argsds;
         struct redisCommand *cmd;
+        size_t qblen = sdslen(fakeClient->querybuf);
+        size_t nread;
 
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
-            loadingProgress(ftello(fp));
+            loadingProgress(read_so_far-(qblen-fakeClient->qb_pos));
             processEventsWhileBlocked();
         }
 
-        if (fgets(buf,sizeof(buf),fp) == NULL) {
-            if (feof(fp))
-                break;
-            else
-                goto readerr;
-        }
-        if (buf[0] != '*') goto fmterr;
-        if (buf[1] == '\0') goto readerr;
-        argc = atoi(buf+1);
-        if (argc < 1) goto fmterr;
-
-        argv = zmalloc(sizeof(robj*)*argc);
-        fakeClient->argc = argc;
-        fakeClient->argv = argv;
-
-        for (j = 0; j < argc; j++) {
-            if (fgets(buf,sizeof(buf),fp) == NULL) {
-                fakeClient->argc = j; /* Free up to j-1. */
+        if (fakeClient->multibulklen == 0 && fakeClient->qb_pos < qblen &&
+            fakeClient->querybuf[fakeClient->qb_pos] != '*') goto fmterr;
+        if (fakeClient->qb_pos == qblen ||
+            processMultibulkBuffer(fakeClient,&idx) != C_OK)
+        {
+            if (fakeClient->flags & CLIENT_CLOSE_AFTER_REPLY) goto fmterr;
+            qblen = sdslen(fakeClient->querybuf);
+            if (eof) {
+                if (fakeClient->qb_pos == qblen &&
+                    fakeClient->multibulklen == 0) break;
+                /* The file ends in the middle of a command. */
                 freeFakeClientArgv(fakeClient);
+                fakeClient->argv = NULL;
+                fakeClient->argc = 0;
                 goto readerr;
             }
-            if (buf[0] != '$') goto fmterr;
-            len = strtol(buf+1,NULL,10);
-            argsds = sdsnewlen(NULL,len);
-            if (len && fread(argsds,len,1,fp) == 0) {
-                sdsfree(argsds);
-                fakeClient->argc = j; /* Free up to j-1. */
-                freeFakeClientArgv(fakeClient);
-                goto readerr;
+
+            /* The next command is not entirely in the buffer: drop what
+             * was already parsed and append the next block of the file. */
+            if (fakeClient->qb_pos) {
+                sdsrange(fakeClient->querybuf,fakeClient->qb_pos,-1);
+                fakeClient->qb_pos = 0;
+                respIndexReset(&idx);
             }
-            argv[j] = createObject(OBJ_STRING,argsds);
-            if (fread(buf,2,1,fp) == 0) {
-                fakeClient->argc = j+1; /* Free up to j. */
-                freeFakeClientArgv(fakeClient);
-                goto readerr; /* discard CRLF */
+            fakeClient->querybuf = sdsMakeRoomFor(fakeClient->querybuf,
+                                                  AOF_LOAD_BLOCK_SIZE);
+            nread = fread(fakeClient->querybuf+sdslen(fakeClient->querybuf),
+                          1,AOF_LOAD_BLOCK_SIZE,fp);
+            if (nread < AOF_LOAD_BLOCK_SIZE) {
+                if (ferror(fp)) goto readerr;
+                eof = 1;
             }
+            sdsIncrLen(fakeClient->querybuf,nread);
+            read_so_far += nread;
+            continue;
         }
+        if (fakeClient->argc == 0) goto fmterr;
 
         /* Command lookup */
-        cmd = lookupCommand(argv[0]->ptr);
+        cmd = lookupCommand(fakeClient->argv[0]->ptr);
         if (!cmd) {
-            serverLog(LL_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
+            serverLog(LL_WARNING,"Unknown command '%s' reading the append only file", (char*)fakeClient->argv[0]->ptr);
             exit(1);
         }
 
-        /* Run the command in the context of a fake client */
+        /* Run the command in the context of a fake client. Unlike call()
+         * there is nothing to propagate and no stats to update. */
         fakeClient->cmd = cmd;
         cmd->proc(fakeClient);
 
@@ -703,8 +1250,13 @@ int loadAppendOnlyFile(char *filename) {
         /* Clean up. Command code may have changed argv/argc so we use the
          * argv/argc of the client instead of the local variables. */
         freeFakeClientArgv(fakeClient);
+        fakeClient->argv = NULL;
+        fakeClient->argc = 0;
         fakeClient->cmd = NULL;
-        if (server.aof_load_truncated) valid_up_to = ftello(fp);
+        server.aof_load_commands++;
+        if (server.aof_load_truncated)
+            valid_up_to = read_so_far-
+                (sdslen(fakeClient->querybuf)-fakeClient->qb_pos);
     }
 
     /* This point can only be reached when EOF is reached without errors.
@@ -712,12 +1264,12 @@ int loadAppendOnlyFile(char *filename) {
     if (fakeClient->flags & CLIENT_MULTI) goto uxeof;
 
 loaded_ok: /* DB loaded, cleanup and return C_OK to the caller. */
+    server.aof_load_bytes += read_so_far;
+    server.aof_load_time += ustime()-start;
     fclose(fp);
     freeFakeClient(fakeClient);
     server.aof_state = old_aof_state;
     stopLoading();
-    aofUpdateCurrentSize();
-    server.aof_rewrite_base_size = server.aof_current_size;
     return C_OK;
 
 readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
@@ -728,7 +1280,9 @@ readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
     }
 
 uxeof: /* Unexpected AOF end of file. */
-    if (server.aof_load_truncated) {
+    /* Only the file we are still appending to can have been cut in the
+     * middle of a command: a short read anywhere else is a corruption. */
+    if (server.aof_load_truncated && last_file) {
         serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file !!!");
         serverLog(LL_WARNING,"!!! Truncating the AOF at offset %llu !!!",
             (unsigned long long) valid_up_to);
@@ -762,6 +1316,76 @@ fmterr: /* Format error. */
     exit(1);
 }
 
+static off_t getAppendOnlyFileSize(sds name) {
+    struct redis_stat sb;
+    sds path = aofFilePath(name);
+    off_t size = redis_stat(path,&sb) == -1 ? 0 : sb.st_size;
+
+    sdsfree(path);
+    return size;
+}
+
+static off_t getBaseAndIncrAppendOnlyFilesSize(aofManifest *am) {
+    off_t size = 0;
+    listIter li;
+    listNode *ln;
+
+    if (am->base_aof_info) size += getAppendOnlyFileSize(am->base_aof_info->file_name);
+    listRewind(am->incr_aof_list,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = ln->value;
+        size += getAppendOnlyFileSize(ai->file_name);
+    }
+    return size;
+}
+
+/* Load the base file and then the incremental files listed in 'am'. If the
+ * manifest is empty, the single file AOF of older versions is loaded from
+ * the working directory, if any. Returns C_ERR if there was nothing to
+ * load, that is, no files or only empty files. */
+int loadAppendOnlyFiles(aofManifest *am) {
+    int loaded = 0;
+    listIter li;
+    listNode *ln;
+
+    server.aof_load_bytes = 0;
+    server.aof_load_commands = 0;
+    server.aof_load_time = 0;
+    if (am->base_aof_info == NULL && listLength(am->incr_aof_list) == 0) {
+        struct redis_stat sb;
+
+        if (redis_stat(server.aof_filename,&sb) == -1) return C_ERR;
+        if (loadSingleAppendOnlyFile(server.aof_filename,1) == C_ERR)
+            return C_ERR;
+        server.aof_current_size = server.aof_rewrite_base_size = sb.st_size;
+        return C_OK;
+    }
+
+    if (am->base_aof_info) {
+        sds path = aofFilePath(am->base_aof_info->file_name);
+        int last = listLength(am->incr_aof_list) == 0;
+
+        serverLog(LL_NOTICE,"Loading the AOF base file %s",path);
+        if (loadSingleAppendOnlyFile(path,last) == C_OK) loaded = 1;
+        sdsfree(path);
+    }
+    listRewind(am->incr_aof_list,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = ln->value;
+        sds path = aofFilePath(ai->file_name);
+
+        serverLog(LL_NOTICE,"Loading the AOF incremental file %s",path);
+        if (loadSingleAppendOnlyFile(path,ln == listLast(am->incr_aof_list))
+            == C_OK) loaded = 1;
+        sdsfree(path);
+    }
+
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = am->base_aof_info ?
+        getAppendOnlyFileSize(am->base_aof_info->file_name) : 0;
+    return loaded ? C_OK : C_ERR;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -1000,24 +1624,10 @@ int rewriteModuleObject(rio *r, robj *key, robj *o) {
     return io.error ? 0 : 1;
 }
 
-//// 从管道中读取数据存入aof_child_diff中
-ssize_t aofReadDiffFromParent(void) {
-    char buf[65536]; /* Default pipe buffer size on most Linux systems. */
-    ssize_t nread, total = 0;
-
-    while ((nread =
-            read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
-        server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
-        total += nread;
-    }
-    return total;
-}
-
 //// aof重写的真正逻辑
 int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
-    size_t processed = 0;
     long long now = mstime();
     int j;
 
@@ -1079,11 +1689,6 @@ int rewriteAppendOnlyFileRio(rio *aof) {
                 if (rioWriteBulkObject(aof,&key) == 0) goto werr;
                 if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
             }
-            /* Read some diff from the parent process from time to time. */
-            if (aof->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
-                processed = aof->processed_bytes;
-                aofReadDiffFromParent();
-            }
         }
 
         // 释放该db的字典迭代器
@@ -1103,7 +1708,6 @@ int rewriteAppendOnlyFile(char *filename) {
     rio aof;
     FILE *fp;
     char tmpfile[256];
-    char byte;
 
     // 创建临时文件
     //snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());  // filename
@@ -1114,9 +1718,6 @@ int rewriteAppendOnlyFile(char *filename) {
         return C_ERR;
     }
 
-    // 初始化差异化数据
-    server.aof_child_diff = sdsempty();
-
     // 初始化 rio 结构体
     rioInitWithFile(&aof,fp);
 
@@ -1126,6 +1727,7 @@ int rewriteAppendOnlyFile(char *filename) {
 
     if (server.aof_use_rdb_preamble) {
         int error;
+        aof.codec = server.rdb_codec;
         if (rdbSaveRio(&aof,&error,RDB_SAVE_AOF_PREAMBLE,NULL) == C_ERR) {
             errno = error;
             goto werr;
@@ -1136,57 +1738,6 @@ int rewriteAppendOnlyFile(char *filename) {
         if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
     }
 
-    // 确保数据落盘
-    if (fflush(fp) == EOF) goto werr;
-    if (fsync(fileno(fp)) == -1) goto werr;
-
-
-    //// 读取最终的差异数据，父进程与子进程通过管道通信
-    int nodata = 0;
-    mstime_t start = mstime();
-    while(mstime()-start < 1000 && nodata < 20) {
-        if (aeWait(server.aof_pipe_read_data_from_parent, AE_READABLE, 1) <= 0)
-        {
-            nodata++;
-            continue;
-        }
-        nodata = 0; /* Start counting from zero, we stop on N *contiguous*
-                       timeouts. */
-
-        //// 会循环数次尝试从redisServer.aof_pipe_read_data_from_parent对应的管道中读取父进程发送来的命令记录，
-        //// 并将这些数据存储在子进程redisServer.aof_child_diff缓存之中
-        aofReadDiffFromParent();
-    }
-
-
-    // 向管道的写入端写入一个!通知父进程停止增加数据
-    if (write(server.aof_pipe_write_ack_to_parent,"!",1) != 1) goto werr;
-    if (anetNonBlock(NULL,server.aof_pipe_read_ack_from_parent) != ANET_OK)
-        goto werr;
-
-    // 父进程从redisServer.aof_pipe_read_ack_from_child这个管道的读取端上监听的可读事件返回，
-    //// 调用对应的事件处理函数aofChildPipeReadable，这个函数会停止向redisServer.aof_pipe_write_data_to_child对应的管道之中写入数据，
-    // 同时向redisServer.aof_pipe_write_ack_to_child对应的管道之中写入一个确认数据!。
-    // 此时停止了将重写缓存写入管道的过程，但是由于子进程没有退出，如果在这一步之后执行的命令，
-    // 依然会被记录到父进程的重写缓存aof_rewrite_buf_blocks之中，但不会发送给子进程
-    if (syncRead(server.aof_pipe_read_ack_from_parent,&byte,1,5000) != 1 ||
-        byte != '!') goto werr;
-    serverLog(LL_NOTICE,"Parent agreed to stop sending diffs. Finalizing AOF...");
-
-    // 子进程在收到父进程的确认信息之后，最后再调用一次aofReadDiffFromParent，确保把管道中的数据读完
-    aofReadDiffFromParent();
-
-
-    //// 然后将记录在redisServer.aof_child_diff缓存中的数据追加到重写后的AOF文件之中。子进程在完成数据写入之后，成功结束。
-    serverLog(LL_NOTICE,
-        "Concatenating %.2f MB of AOF diff received from parent.",
-        (double) sdslen(server.aof_child_diff) / (1024*1024));
-    if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
-        goto werr;
-    //// 父进程在检测到子进程退出后，会调用backgroundRewriteDoneHandler这个函数接口，完成后续的处理步骤，
-    // 我们知道依然有一些在重写AOF文件过程中被执行的命令存储在父进程的重写缓冲区之中，那么在子进程成功退出之后，
-    //// 父进程会调用aofRewriteBufferWrite这个接口，将重写缓冲区之中的命令记录追加到新的AOF文件之中，最终完成整个重写AOF文件的过程。
-
     // 保证系统不会残留在IO输出缓冲区
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
@@ -1210,83 +1761,6 @@ werr:
     return C_ERR;
 }
 
-/* ----------------------------------------------------------------------------
- * AOF rewrite pipes for IPC
- * -------------------------------------------------------------------------- */
-
-
-//// 当子进程给父进程发送!时，将aof_stop_sending_diff设置为1，不会再向管道中写数据了
-//// 此时主进程的aof_rewrite_buf_blocks（列表）中开始积压数据
-//// 并向子进程回复！
-void aofChildPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
-    char byte;
-    UNUSED(el);
-    UNUSED(privdata);
-    UNUSED(mask);
-
-    if (read(fd,&byte,1) == 1 && byte == '!') {
-        serverLog(LL_NOTICE,"AOF rewrite child asks to stop sending diffs.");
-        server.aof_stop_sending_diff = 1;
-        if (write(server.aof_pipe_write_ack_to_child,"!",1) != 1) {
-            serverLog(LL_WARNING,"Can't send ACK to AOF child: %s",
-                strerror(errno));
-        }
-    }
-    /* Remove the handler since this can be called only one time during a
-     * rewrite. */
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-}
-
-/* Create the pipes used for parent - child process IPC during rewrite.
- * We have a data pipe used to send AOF incremental diffs to the child,
- * and two other pipes used by the children to signal it finished with
- * the rewrite so no more data should be written, and another for the
- * parent to acknowledge it understood this new condition. */
-int aofCreatePipes(void) {
-    int fds[6] = {-1, -1, -1, -1, -1, -1};
-    int j;
-
-    if (pipe(fds) == -1) goto error; /* parent -> children data. */
-    if (pipe(fds+2) == -1) goto error; /* children -> parent ack. */
-    if (pipe(fds+4) == -1) goto error; /* children -> parent ack. */
-    /* Parent -> children data is non blocking. */
-    //// 父子进程之间的数据通信设置为非阻塞
-    if (anetNonBlock(NULL,fds[0]) != ANET_OK) goto error;
-    if (anetNonBlock(NULL,fds[1]) != ANET_OK) goto error;
-
-    //// 将fds[2]和fds[3]添加到redis的文件事件中，
-    if (aeCreateFileEvent(server.el, fds[2], AE_READABLE, aofChildPipeReadable, NULL) == AE_ERR) goto error;
-
-    server.aof_pipe_write_data_to_child = fds[1];// 父写（数据）
-    server.aof_pipe_read_data_from_parent = fds[0];// 子读（数据）
-
-    server.aof_pipe_write_ack_to_parent = fds[3];// 子写（结束标识）
-    server.aof_pipe_read_ack_from_child = fds[2];// 父读（结束标识）
-
-    server.aof_pipe_write_ack_to_child = fds[5];// 父写（结束标识）
-    server.aof_pipe_read_ack_from_parent = fds[4];// 子读（结束标识）
-
-    server.aof_stop_sending_diff = 0;
-    return C_OK;
-
-error:
-    serverLog(LL_WARNING,"Error opening /setting AOF rewrite IPC pipes: %s",
-        strerror(errno));
-    for (j = 0; j < 6; j++) if(fds[j] != -1) close(fds[j]);
-    return C_ERR;
-}
-
-void aofClosePipes(void) {
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-    aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,AE_WRITABLE);
-    close(server.aof_pipe_write_data_to_child);
-    close(server.aof_pipe_read_data_from_parent);
-    close(server.aof_pipe_write_ack_to_parent);
-    close(server.aof_pipe_read_ack_from_child);
-    close(server.aof_pipe_write_ack_to_child);
-    close(server.aof_pipe_read_ack_from_parent);
-}
-
 /* ----------------------------------------------------------------------------
  * AOF background rewrite
  * ------------------------------------------------------------------------- */
@@ -1294,14 +1768,15 @@ void aofClosePipes(void) {
 /* This is how rewriting of the append only file in background works:
  *
  * 1) The user calls BGREWRITEAOF
- * 2) Redis calls this function, that forks():
+ * 2) Redis calls this function, that switches the parent to a new
+ *    incremental file and forks():
  *    2a) the child rewrite the append only file in a temp file.
- *    2b) the parent accumulates differences in server.aof_rewrite_buf.
+ *    2b) the parent keeps appending to the new incremental file.
  * 3) When the child finished '2a' exists.
- * 4) The parent will trap the exit code, if it's OK, will append the
- *    data accumulated into server.aof_rewrite_buf into the temp file, and
- *    finally will rename(2) the temp file in the actual file name.
- *    The the new file is reopened as the new append only file. Profit!
+ * 4) The parent will trap the exit code, if it's OK, will rename(2) the
+ *    temp file into the new base file, and will persist a manifest made of
+ *    the new base plus the incremental file opened in '2'. The files that
+ *    are no longer referenced are removed. Profit!
  */
 
 //// 后台执行AOF重写操作
@@ -1312,8 +1787,12 @@ int rewriteAppendOnlyFileBackground(void) {
     // aof 或 rdb 只有有一个后台子进程在执行就直接返回
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
 
-    // 初始化管道，用户父子间通信
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    /* The writes performed from now on go to a new incremental file: the
+     * snapshot taken by the child plus this file are the new AOF. */
+    if (server.aof_state != AOF_OFF) {
+        flushAppendOnlyFile(1);
+        if (aofOpenNewIncrFile() == C_ERR) return C_ERR;
+    }
     openChildInfoPipe();
     start = ustime();
 
@@ -1349,7 +1828,6 @@ int rewriteAppendOnlyFileBackground(void) {
             serverLog(LL_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
-            aofClosePipes();
             return C_ERR;
         }
         serverLog(LL_NOTICE,
@@ -1360,11 +1838,6 @@ int rewriteAppendOnlyFileBackground(void) {
         server.aof_rewrite_time_start = time(NULL);
         server.aof_child_pid = childpid;            //// aof重写的后台子进程id
         updateDictResizePolicy();
-        /* We set appendseldb to -1 in order to force the next call to the
-         * feedAppendOnlyFile() to issue a SELECT command, so the differences
-         * accumulated by the parent into server.aof_rewrite_buf will start
-         * with a SELECT statement and it will be safe to merge. */
-        server.aof_selected_db = -1;
         replicationScriptCacheFlush();
         return C_OK;
     }
@@ -1392,7 +1865,7 @@ void aofRemoveTempFile(pid_t childpid) {
 }
 
 /* Update the server.aof_current_size field explicitly using stat(2)
- * to check the size of the file. This is useful after a rewrite or after
+ * to check the size of the files. This is useful after a rewrite or after
  * a restart, normally the size is updated just adding the write length
  * to the current length, that is much faster. */
 void aofUpdateCurrentSize(void) {
@@ -1400,104 +1873,104 @@ void aofUpdateCurrentSize(void) {
     mstime_t latency;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
-        serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
-            strerror(errno));
-    } else {
-        server.aof_current_size = sb.st_size;
+    if (server.aof_fd != -1) {
+        if (redis_fstat(server.aof_fd,&sb) == -1) {
+            serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
+                strerror(errno));
+        } else {
+            server.aof_last_incr_size = sb.st_size;
+        }
     }
+    server.aof_current_size =
+        getBaseAndIncrAppendOnlyFilesSize(server.aof_manifest);
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("aof-fstat",latency);
 }
 
-//// 执行AOF后台重写的剩余工作（缓冲区内数据的重写和更名操作）
+//// 执行AOF后台重写的剩余工作（新base文件的更名和manifest的更新）
 //// 注意：该函数是由主进程执行，所以在次期间会阻塞客户端请求
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     if (!bysignal && exitcode == 0) {
-        int newfd, oldfd;
         char tmpfile[256];
         long long now = ustime();
         mstime_t latency;
+        aofManifest *am;
+        list *history;
+        sds base_name, base_path, incr_path = NULL, temp_incr_path = NULL;
 
         serverLog(LL_NOTICE,
             "Background AOF rewrite terminated with success");
 
-        /* Flush the differences accumulated by the parent to the
-         * rewritten AOF. */
-        latencyStartMonitor(latency);
+        if (aofEnsureDir() == C_ERR) goto cleanup;
 
         //// 临时文件，与aof重写最开始的那一步生成的临时文件名相同
         snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
             (int)server.aof_child_pid);
-        newfd = open(tmpfile,O_WRONLY|O_APPEND);            // 打开临时文件，获取句柄
-        if (newfd == -1) {
-            serverLog(LL_WARNING,
-                "Unable to open the temporary AOF produced by the child: %s", strerror(errno));
-            goto cleanup;
-        }
 
-        //// 将缓冲区中的数据追加到临时文件中
-        if (aofRewriteBufferWrite(newfd) == -1) {
-            serverLog(LL_WARNING,
-                "Error trying to flush the parent diff to the rewritten AOF: %s", strerror(errno));
-            close(newfd);
-            goto cleanup;
-        }
-        latencyEndMonitor(latency);
-        latencyAddSampleIfNeeded("aof-rewrite-diff-write",latency);
-
-        serverLog(LL_NOTICE,
-            "Residual parent diff successfully flushed to the rewritten AOF (%.2f MB)", (double) aofRewriteBufferSize() / (1024*1024));
-
-        if (server.aof_fd == -1) {
-            /* AOF disabled */
+        history = listCreate();
+        listSetFreeMethod(history,aofListFree);
+        am = aofManifestDup(server.aof_manifest);
+        base_name = getNewBaseFileName(am,history);
+        base_path = aofFilePath(base_name);
 
-             /* Don't care if this fails: oldfd will be -1 and we handle that.
-              * One notable case of -1 return is if the old file does
-              * not exist. */
-             oldfd = open(server.aof_filename,O_RDONLY|O_NONBLOCK);
-        } else {
-            /* AOF enabled */
-            oldfd = -1; /* We'll set this to the current AOF filedes later. */
-        }
-
-        /* Rename the temporary file. This will not unlink the target file if
-         * it exists, because we reference it with "oldfd". */
-        //// aof临时文件重新命名为aof的正式文件
+        //// aof临时文件重新命名为新的base文件
         latencyStartMonitor(latency);
-        if (rename(tmpfile,server.aof_filename) == -1) {
+        if (rename(tmpfile,base_path) == -1) {
             serverLog(LL_WARNING,
                 "Error trying to rename the temporary AOF file %s into %s: %s",
                 tmpfile,
-                server.aof_filename,
+                base_path,
                 strerror(errno));
-            close(newfd);
-            if (oldfd != -1) close(oldfd);
-            goto cleanup;
+            goto manifest_err;
         }
         latencyEndMonitor(latency);
         latencyAddSampleIfNeeded("aof-rename",latency);
 
-        if (server.aof_fd == -1) {
-            /* AOF disabled, we don't need to set the AOF file descriptor
-             * to this new file, so we can close it. */
-            close(newfd);
+        if (server.aof_state == AOF_WAIT_REWRITE) {
+            /* The writes performed during the first rewrite are in the temp
+             * incremental file: it becomes the only incremental file. */
+            sds temp_incr_name = getTempIncrAofFileName();
+            sds incr_name;
+
+            markIncrFilesAsHistory(am,history,0);
+            incr_name = getNewIncrFileName(am);
+            temp_incr_path = aofFilePath(temp_incr_name);
+            incr_path = aofFilePath(incr_name);
+            sdsfree(temp_incr_name);
+            sdsfree(incr_name);
+            if (rename(temp_incr_path,incr_path) == -1) {
+                serverLog(LL_WARNING,
+                    "Error trying to rename the temporary incremental AOF "
+                    "file %s into %s: %s", temp_incr_path, incr_path,
+                    strerror(errno));
+                unlink(base_path);
+                goto manifest_err;
+            }
         } else {
-            /* AOF enabled, replace the old fd with the new one. */
-            oldfd = server.aof_fd;
-            server.aof_fd = newfd;
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
-                aof_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
-                aof_background_fsync(newfd);
-            server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
-            aofUpdateCurrentSize();
-            server.aof_rewrite_base_size = server.aof_current_size;
+            /* If the AOF is enabled the last incremental file was opened
+             * when the child was created and follows the new base, all the
+             * others are covered by the base. */
+            markIncrFilesAsHistory(am,history,server.aof_fd != -1);
+        }
 
-            /* Clear regular AOF buffer since its contents was just written to
-             * the new AOF from the background rewrite buffer. */
-            sdsfree(server.aof_buf);
-            server.aof_buf = sdsempty();
+        if (persistAofManifest(am) == C_ERR) {
+            unlink(base_path);
+            if (incr_path) rename(incr_path,temp_incr_path);
+            goto manifest_err;
+        }
+        aofManifestFree(server.aof_manifest);
+        server.aof_manifest = am;
+        aofDelHistoryFiles(history);
+        listRelease(history);
+        sdsfree(base_name);
+        sdsfree(base_path);
+        sdsfree(incr_path);
+        sdsfree(temp_incr_path);
+
+        if (server.aof_fd != -1) {
+            aofUpdateCurrentSize();
+            server.aof_rewrite_base_size = server.aof_current_size -
+                                           server.aof_last_incr_size;
         }
 
         server.aof_lastbgrewrite_status = C_OK;
@@ -1507,11 +1980,18 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
         if (server.aof_state == AOF_WAIT_REWRITE)
             server.aof_state = AOF_ON;
 
-        /* Asynchronously close the overwritten AOF. */
-        if (oldfd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)oldfd,NULL,NULL);
-
         serverLog(LL_VERBOSE,
             "Background AOF rewrite signal handler took %lldus", ustime()-now);
+        goto cleanup;
+
+manifest_err:
+        aofManifestFree(am);
+        listRelease(history);
+        sdsfree(base_name);
+        sdsfree(base_path);
+        sdsfree(incr_path);
+        sdsfree(temp_incr_path);
+        server.aof_lastbgrewrite_status = C_ERR;
     } else if (!bysignal && exitcode != 0) {
         /* SIGUSR1 is whitelisted, so we have a way to kill a child without
          * tirggering an error conditon. */
@@ -1527,8 +2007,6 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     }
 
 cleanup:
-    aofClosePipes();
-    aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
@@ -189,9 +189,21 @@ void *bioProcessBackgroundJobs(void *arg) {
 
         /* Process the job accordingly to its type. */
         if (type == BIO_CLOSE_FILE) {
+            /* arg2 is set when the file must reach the disk before being
+             * closed, like an AOF file we stopped appending to. */
+            if (job->arg2) aof_fsync((long)job->arg1);
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
-            aof_fsync((long)job->arg1);
+            int retval;
+
+            /* Slow down the group commit: DEBUG AOF-FSYNC-DELAY. */
+            if (job->arg2 && server.aof_fsync_debug_delay)
+                usleep(server.aof_fsync_debug_delay*1000);
+            retval = aof_fsync((long)job->arg1);
+
+            /* arg2 is set by the AOF group commit, waiting for the
+             * outcome in the main thread. */
+            if (job->arg2) aofFsyncNotify(retval == -1 ? errno : 0);
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
              * arg1 -> free the object at pointer.
@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include <unistd.h>
+#include <math.h>
 
 /* Open a child-parent channel used in order to move information about the
  * RDB / AOF saving process from the child to the parent (for instance
@@ -83,3 +84,71 @@ void receiveChildInfo(void) {
         }
     }
 }
+
+/* -----------------------------------------------------------------------------
+ * Copy on write minimizing mode
+ *
+ * While a child shares the memory of the parent, every page the parent
+ * writes is copied. With fork-cow-minimize enabled the writes that are not
+ * needed for correctness are skipped while a child is active: the dict
+ * rehashing steps of lookups and updates, the decay of the LFU counters and,
+ * with fork-cow-defer-expire, the deletion of the expired keys found by read
+ * commands (they are deleted later by writes or by the active expire cycle).
+ * The LRU clock of the keys and the active defrag are already left alone
+ * while there is a child.
+ *
+ * The pages the skipped writes would have dirtied are counted with a linear
+ * counting sketch, which estimates the number of distinct pages from the
+ * fraction of bits still zero in a bitmap addressed by a hash of the page.
+ * The result is an upper bound of the saved copy on write: some of those
+ * pages may have been copied anyway by other writes.
+ * -------------------------------------------------------------------------- */
+
+#define FORK_COW_SKETCH_BITS (1<<19)
+#define FORK_COW_PAGE_SIZE 4096
+
+static uint64_t fork_cow_sketch[FORK_COW_SKETCH_BITS/64];
+
+/* Account a write skipped because of the copy on write minimizing mode. */
+void forkCowSuppressedWrite(const void *ptr) {
+    uint64_t page = (uintptr_t)ptr/FORK_COW_PAGE_SIZE;
+    uint64_t h = (page*0x9E3779B97F4A7C15ULL) >> (64-19);
+
+    fork_cow_sketch[h>>6] |= 1ULL<<(h&63);
+    server.stat_fork_cow_suppressed_writes++;
+}
+
+/* Return the estimated bytes of copy on write avoided while the current,
+ * or the last, child was active. */
+size_t forkCowSavedBytes(void) {
+    double m = FORK_COW_SKETCH_BITS, zeroes = 0;
+    unsigned long j;
+
+    if (!server.fork_cow_minimize_active)
+        return server.stat_fork_cow_saved_bytes;
+    for (j = 0; j < FORK_COW_SKETCH_BITS/64; j++)
+        zeroes += 64-__builtin_popcountll(fork_cow_sketch[j]);
+    if (zeroes == 0) zeroes = 1; /* Saturated sketch. */
+    return (size_t)(-m*log(zeroes/m))*FORK_COW_PAGE_SIZE;
+}
+
+/* Enter or leave the copy on write minimizing mode according to the
+ * configuration and to the presence of a child. Called every time a child
+ * is created or terminates, and when the configuration changes. */
+void updateForkCowMinimize(void) {
+    int active = server.fork_cow_minimize &&
+                 (server.rdb_child_pid != -1 || server.aof_child_pid != -1);
+
+    if (active == server.fork_cow_minimize_active) return;
+    if (active) {
+        memset(fork_cow_sketch,0,sizeof(fork_cow_sketch));
+        server.stat_fork_cow_suppressed_writes = 0;
+        server.stat_fork_cow_saved_bytes = 0;
+        server.fork_cow_minimize_active = 1;
+        dictDisableRehash(forkCowSuppressedWrite);
+    } else {
+        server.stat_fork_cow_saved_bytes = forkCowSavedBytes();
+        server.fork_cow_minimize_active = 0;
+        dictEnableRehash();
+    }
+}
@@ -91,6 +91,22 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum rdb_codec_enum[] = {
+    {"lzf", RDB_ENC_LZF},
+#ifdef USE_LZ4
+    {"lz4", RDB_ENC_LZ4},
+#endif
+    {"zstd", RDB_ENC_ZSTD},
+    {NULL, 0}
+};
+
+configEnum repl_diskless_load_enum[] = {
+    {"disabled", REPL_DISKLESS_LOAD_DISABLED},
+    {"on-empty-db", REPL_DISKLESS_LOAD_WHEN_DB_EMPTY},
+    {"swapdb", REPL_DISKLESS_LOAD_SWAPDB},
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -323,6 +339,11 @@ void loadServerConfigFromString(char *config) {
                 err = "Invalid maxmemory policy";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"tracking-table-max-keys") && argc == 2) {
+            server.tracking_table_max_keys = strtoll(argv[1],NULL,10);
+            if (server.tracking_table_max_keys < 0) {
+                err = "Invalid tracking-table-max-keys value"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"maxmemory-samples") && argc == 2) {
             server.maxmemory_samples = atoi(argv[1]);
             if (server.maxmemory_samples <= 0) {
@@ -366,6 +387,14 @@ void loadServerConfigFromString(char *config) {
             if ((server.repl_diskless_sync = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"repl-stream-compression") && argc==2) {
+            if ((server.repl_stream_compression = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"repl-batch-apply") && argc==2) {
+            if ((server.repl_batch_apply = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"repl-diskless-sync-delay") && argc==2) {
             server.repl_diskless_sync_delay = atoi(argv[1]);
             if (server.repl_diskless_sync_delay < 0) {
@@ -379,6 +408,13 @@ void loadServerConfigFromString(char *config) {
                 goto loaderr;
             }
             resizeReplicationBacklog(size);
+        } else if (!strcasecmp(argv[0],"repl-backlog-disk-size") && argc == 2) {
+            long long size = memtoll(argv[1],NULL);
+            if (size < 0) {
+                err = "repl-backlog-disk-size can't be negative";
+                goto loaderr;
+            }
+            resizeReplicationBacklogDisk(size);
         } else if (!strcasecmp(argv[0],"repl-backlog-ttl") && argc == 2) {
             server.repl_backlog_time_limit = atoi(argv[1]);
             if (server.repl_backlog_time_limit < 0) {
@@ -388,6 +424,13 @@ void loadServerConfigFromString(char *config) {
         } else if (!strcasecmp(argv[0],"masterauth") && argc == 2) {
             zfree(server.masterauth);
             server.masterauth = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"repl-diskless-load") && argc == 2) {
+            server.repl_diskless_load =
+                configEnumGetValue(repl_diskless_load_enum,argv[1]);
+            if (server.repl_diskless_load == INT_MIN) {
+                err = "argument must be 'disabled', 'on-empty-db' or 'swapdb'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slave-serve-stale-data") && argc == 2) {
             if ((server.repl_serve_stale_data = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -400,10 +443,49 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if ((!strcasecmp(argv[0],"rdb-compression-codec") ||
+                    !strcasecmp(argv[0],"repl-compression-codec") ||
+                    !strcasecmp(argv[0],"dump-compression-codec")) &&
+                   argc == 2)
+        {
+            int codec = configEnumGetValue(rdb_codec_enum,argv[1]);
+            if (codec == INT_MIN) {
+#ifdef USE_LZ4
+                err = "argument must be 'lzf', 'lz4' or 'zstd'";
+#else
+                err = "argument must be 'lzf' or 'zstd' (LZ4 support "
+                      "was not compiled in)";
+#endif
+                goto loaderr;
+            }
+            if (!strcasecmp(argv[0],"rdb-compression-codec"))
+                server.rdb_codec = codec;
+            else if (!strcasecmp(argv[0],"repl-compression-codec"))
+                server.repl_rdb_codec = codec;
+            else
+                server.dump_codec = codec;
+        } else if (!strcasecmp(argv[0],"rdb-zstd-level") && argc == 2) {
+            server.rdb_zstd_level = atoi(argv[1]);
+            if (server.rdb_zstd_level < 1 ||
+                server.rdb_zstd_level > RDB_CODEC_ZSTD_MAX_LEVEL)
+            {
+                err = "Invalid zstd compression level"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbchecksum") && argc == 2) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-key-index") && argc == 2) {
+            if ((server.rdb_key_index = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+            server.rdb_load_threads = atoi(argv[1]);
+            if (server.rdb_load_threads < 0 ||
+                server.rdb_load_threads > RDB_LOAD_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of RDB load threads"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -428,6 +510,32 @@ void loadServerConfigFromString(char *config) {
             if ((server.active_defrag_enabled = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+            server.io_threads_num = atoi(argv[1]);
+            if (server.io_threads_num < 1 ||
+                server.io_threads_num > IO_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of I/O threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-do-reads") && argc == 2) {
+            if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"accept-threads") && argc == 2) {
+            server.accept_threads_num = atoi(argv[1]);
+            if (server.accept_threads_num < 0 ||
+                server.accept_threads_num > ACCEPT_THREADS_MAX_NUM)
+            {
+                err = "Invalid number of accept threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-uring") && argc == 2) {
+            if ((server.io_uring = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"reply-cork") && argc == 2) {
+            if ((server.reply_cork = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"daemonize") && argc == 2) {
             if ((server.daemonize = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -450,6 +558,13 @@ void loadServerConfigFromString(char *config) {
             }
             zfree(server.aof_filename);
             server.aof_filename = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"appenddirname") && argc == 2) {
+            if (!pathIsBaseName(argv[1])) {
+                err = "appenddirname can't be a path, just a dir name";
+                goto loaderr;
+            }
+            zfree(server.aof_dirname);
+            server.aof_dirname = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"no-appendfsync-on-rewrite")
                    && argc == 2) {
             if ((server.aof_no_fsync_on_rewrite= yesnotoi(argv[1])) == -1) {
@@ -480,6 +595,10 @@ void loadServerConfigFromString(char *config) {
                  yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"aof-group-commit") && argc == 2) {
+            if ((server.aof_group_commit = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"aof-load-truncated") && argc == 2) {
             if ((server.aof_load_truncated = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -488,6 +607,14 @@ void loadServerConfigFromString(char *config) {
             if ((server.aof_use_rdb_preamble = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"fork-cow-minimize") && argc == 2) {
+            if ((server.fork_cow_minimize = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"fork-cow-defer-expire") && argc == 2) {
+            if ((server.fork_cow_defer_expire = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"requirepass") && argc == 2) {
             if (strlen(argv[1]) > CONFIG_AUTHPASS_MAX_LEN) {
                 err = "Password is longer than CONFIG_AUTHPASS_MAX_LEN";
@@ -999,14 +1126,29 @@ void configSetCommand(client *c) {
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
       "repl-diskless-sync",server.repl_diskless_sync) {
+    } config_set_bool_field(
+      "repl-stream-compression",server.repl_stream_compression) {
+    } config_set_bool_field(
+      "repl-batch-apply",server.repl_batch_apply) {
     } config_set_bool_field(
       "cluster-require-full-coverage",server.cluster_require_full_coverage) {
     } config_set_bool_field(
       "aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync) {
+    } config_set_bool_field(
+      "aof-group-commit",server.aof_group_commit) {
+        /* Release the held replies once their writes are on disk. */
+        if (!server.aof_group_commit) aofGroupCommitFlush();
     } config_set_bool_field(
       "aof-load-truncated",server.aof_load_truncated) {
     } config_set_bool_field(
       "aof-use-rdb-preamble",server.aof_use_rdb_preamble) {
+    } config_set_bool_field(
+      "rdb-key-index",server.rdb_key_index) {
+    } config_set_bool_field(
+      "fork-cow-minimize",server.fork_cow_minimize) {
+        updateForkCowMinimize();
+    } config_set_bool_field(
+      "fork-cow-defer-expire",server.fork_cow_defer_expire) {
     } config_set_bool_field(
       "slave-serve-stale-data",server.repl_serve_stale_data) {
     } config_set_bool_field(
@@ -1039,6 +1181,10 @@ void configSetCommand(client *c) {
       "slave-lazy-flush",server.repl_slave_lazy_flush) {
     } config_set_bool_field(
       "no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite) {
+    } config_set_bool_field(
+      "io-threads-do-reads",server.io_threads_do_reads) {
+    } config_set_bool_field(
+      "reply-cork",server.reply_cork) {
 
     /* Numerical fields.
      * config_set_numerical_field(name,var,min,max) */
@@ -1046,6 +1192,12 @@ void configSetCommand(client *c) {
       "tcp-keepalive",server.tcpkeepalive,0,LLONG_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",server.maxmemory_samples,1,LLONG_MAX) {
+    } config_set_numerical_field(
+      "tracking-table-max-keys",server.tracking_table_max_keys,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-load-threads",server.rdb_load_threads,0,RDB_LOAD_THREADS_MAX_NUM) {
+    } config_set_numerical_field(
+      "rdb-zstd-level",server.rdb_zstd_level,1,RDB_CODEC_ZSTD_MAX_LEVEL) {
     } config_set_numerical_field(
       "lfu-log-factor",server.lfu_log_factor,0,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1142,6 +1294,8 @@ void configSetCommand(client *c) {
         }
     } config_set_memory_field("repl-backlog-size",ll) {
         resizeReplicationBacklog(ll);
+    } config_set_memory_field("repl-backlog-disk-size",ll) {
+        resizeReplicationBacklogDisk(ll);
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
         server.aof_rewrite_min_size = ll;
 
@@ -1153,6 +1307,15 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+        if (!aofGroupCommitActive()) aofGroupCommitFlush();
+    } config_set_enum_field(
+      "rdb-compression-codec",server.rdb_codec,rdb_codec_enum) {
+    } config_set_enum_field(
+      "repl-compression-codec",server.repl_rdb_codec,rdb_codec_enum) {
+    } config_set_enum_field(
+      "dump-compression-codec",server.dump_codec,rdb_codec_enum) {
+    } config_set_enum_field(
+      "repl-diskless-load",server.repl_diskless_load,repl_diskless_load_enum) {
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1229,6 +1392,7 @@ void configGetCommand(client *c) {
     /* Numerical values */
     config_get_numerical_field("maxmemory",server.maxmemory);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
+    config_get_numerical_field("tracking-table-max-keys",server.tracking_table_max_keys);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("active-defrag-threshold-lower",server.active_defrag_threshold_lower);
     config_get_numerical_field("active-defrag-threshold-upper",server.active_defrag_threshold_upper);
@@ -1270,6 +1434,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-timeout",server.repl_timeout);
     config_get_numerical_field("repl-backlog-size",server.repl_backlog_size);
+    config_get_numerical_field("repl-backlog-disk-size",server.repl_backlog_disk_size);
     config_get_numerical_field("repl-backlog-ttl",server.repl_backlog_time_limit);
     config_get_numerical_field("maxclients",server.maxclients);
     config_get_numerical_field("watchdog-period",server.watchdog_period);
@@ -1283,6 +1448,10 @@ void configGetCommand(client *c) {
     config_get_numerical_field("cluster-slave-validity-factor",server.cluster_slave_validity_factor);
     config_get_numerical_field("repl-diskless-sync-delay",server.repl_diskless_sync_delay);
     config_get_numerical_field("tcp-keepalive",server.tcpkeepalive);
+    config_get_numerical_field("io-threads",server.io_threads_num);
+    config_get_numerical_field("accept-threads",server.accept_threads_num);
+    config_get_numerical_field("rdb-load-threads",server.rdb_load_threads);
+    config_get_numerical_field("rdb-zstd-level",server.rdb_zstd_level);
 
     /* Bool (yes/no) values */
     config_get_bool_field("cluster-require-full-coverage",
@@ -1298,6 +1467,7 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-key-index", server.rdb_key_index);
     config_get_bool_field("activerehashing", server.activerehashing);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
     config_get_bool_field("protected-mode", server.protected_mode);
@@ -1305,18 +1475,32 @@ void configGetCommand(client *c) {
             server.repl_disable_tcp_nodelay);
     config_get_bool_field("repl-diskless-sync",
             server.repl_diskless_sync);
+    config_get_bool_field("repl-stream-compression",
+            server.repl_stream_compression);
+    config_get_bool_field("repl-batch-apply",
+            server.repl_batch_apply);
     config_get_bool_field("aof-rewrite-incremental-fsync",
             server.aof_rewrite_incremental_fsync);
+    config_get_bool_field("aof-group-commit",
+            server.aof_group_commit);
     config_get_bool_field("aof-load-truncated",
             server.aof_load_truncated);
     config_get_bool_field("aof-use-rdb-preamble",
             server.aof_use_rdb_preamble);
+    config_get_bool_field("fork-cow-minimize",
+            server.fork_cow_minimize);
+    config_get_bool_field("fork-cow-defer-expire",
+            server.fork_cow_defer_expire);
     config_get_bool_field("lazyfree-lazy-eviction",
             server.lazyfree_lazy_eviction);
     config_get_bool_field("lazyfree-lazy-expire",
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
             server.lazyfree_lazy_server_del);
+    config_get_bool_field("io-threads-do-reads",
+            server.io_threads_do_reads);
+    config_get_bool_field("io-uring",server.io_uring);
+    config_get_bool_field("reply-cork",server.reply_cork);
     config_get_bool_field("slave-lazy-flush",
             server.repl_slave_lazy_flush);
 
@@ -1329,6 +1513,14 @@ void configGetCommand(client *c) {
             server.supervised_mode,supervised_mode_enum);
     config_get_enum_field("appendfsync",
             server.aof_fsync,aof_fsync_enum);
+    config_get_enum_field("rdb-compression-codec",
+            server.rdb_codec,rdb_codec_enum);
+    config_get_enum_field("repl-compression-codec",
+            server.repl_rdb_codec,rdb_codec_enum);
+    config_get_enum_field("dump-compression-codec",
+            server.dump_codec,rdb_codec_enum);
+    config_get_enum_field("repl-diskless-load",
+            server.repl_diskless_load,repl_diskless_load_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
 
@@ -1977,6 +2169,12 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
+    rewriteConfigYesNoOption(state,"rdb-key-index",server.rdb_key_index,CONFIG_DEFAULT_RDB_KEY_INDEX);
+    rewriteConfigNumericalOption(state,"rdb-load-threads",server.rdb_load_threads,CONFIG_DEFAULT_RDB_LOAD_THREADS);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",server.rdb_codec,rdb_codec_enum,CONFIG_DEFAULT_RDB_CODEC);
+    rewriteConfigEnumOption(state,"repl-compression-codec",server.repl_rdb_codec,rdb_codec_enum,CONFIG_DEFAULT_REPL_RDB_CODEC);
+    rewriteConfigEnumOption(state,"dump-compression-codec",server.dump_codec,rdb_codec_enum,CONFIG_DEFAULT_DUMP_CODEC);
+    rewriteConfigNumericalOption(state,"rdb-zstd-level",server.rdb_zstd_level,CONFIG_DEFAULT_RDB_ZSTD_LEVEL);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -1988,10 +2186,14 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"repl-ping-slave-period",server.repl_ping_slave_period,CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD);
     rewriteConfigNumericalOption(state,"repl-timeout",server.repl_timeout,CONFIG_DEFAULT_REPL_TIMEOUT);
     rewriteConfigBytesOption(state,"repl-backlog-size",server.repl_backlog_size,CONFIG_DEFAULT_REPL_BACKLOG_SIZE);
+    rewriteConfigBytesOption(state,"repl-backlog-disk-size",server.repl_backlog_disk_size,CONFIG_DEFAULT_REPL_BACKLOG_DISK_SIZE);
     rewriteConfigBytesOption(state,"repl-backlog-ttl",server.repl_backlog_time_limit,CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay,CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY);
     rewriteConfigYesNoOption(state,"repl-diskless-sync",server.repl_diskless_sync,CONFIG_DEFAULT_REPL_DISKLESS_SYNC);
     rewriteConfigNumericalOption(state,"repl-diskless-sync-delay",server.repl_diskless_sync_delay,CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY);
+    rewriteConfigEnumOption(state,"repl-diskless-load",server.repl_diskless_load,repl_diskless_load_enum,CONFIG_DEFAULT_REPL_DISKLESS_LOAD);
+    rewriteConfigYesNoOption(state,"repl-stream-compression",server.repl_stream_compression,CONFIG_DEFAULT_REPL_STREAM_COMPRESSION);
+    rewriteConfigYesNoOption(state,"repl-batch-apply",server.repl_batch_apply,CONFIG_DEFAULT_REPL_BATCH_APPLY);
     rewriteConfigNumericalOption(state,"slave-priority",server.slave_priority,CONFIG_DEFAULT_SLAVE_PRIORITY);
     rewriteConfigNumericalOption(state,"min-slaves-to-write",server.repl_min_slaves_to_write,CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE);
     rewriteConfigNumericalOption(state,"min-slaves-max-lag",server.repl_min_slaves_max_lag,CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG);
@@ -2000,6 +2202,7 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"maxmemory",server.maxmemory,CONFIG_DEFAULT_MAXMEMORY);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigNumericalOption(state,"tracking-table-max-keys",server.tracking_table_max_keys,CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-upper",server.active_defrag_threshold_upper,CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER);
     rewriteConfigBytesOption(state,"active-defrag-ignore-bytes",server.active_defrag_ignore_bytes,CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES);
@@ -2007,6 +2210,7 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"active-defrag-cycle-max",server.active_defrag_cycle_max,CONFIG_DEFAULT_DEFRAG_CYCLE_MAX);
     rewriteConfigYesNoOption(state,"appendonly",server.aof_state != AOF_OFF,0);
     rewriteConfigStringOption(state,"appendfilename",server.aof_filename,CONFIG_DEFAULT_AOF_FILENAME);
+    rewriteConfigStringOption(state,"appenddirname",server.aof_dirname,CONFIG_DEFAULT_AOF_DIRNAME);
     rewriteConfigEnumOption(state,"appendfsync",server.aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
     rewriteConfigYesNoOption(state,"no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite,CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
@@ -2036,13 +2240,21 @@ int rewriteConfig(char *path) {
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigNumericalOption(state,"hz",server.hz,CONFIG_DEFAULT_HZ);
     rewriteConfigYesNoOption(state,"aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync,CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC);
+    rewriteConfigYesNoOption(state,"aof-group-commit",server.aof_group_commit,CONFIG_DEFAULT_AOF_GROUP_COMMIT);
     rewriteConfigYesNoOption(state,"aof-load-truncated",server.aof_load_truncated,CONFIG_DEFAULT_AOF_LOAD_TRUNCATED);
     rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
+    rewriteConfigYesNoOption(state,"fork-cow-minimize",server.fork_cow_minimize,CONFIG_DEFAULT_FORK_COW_MINIMIZE);
+    rewriteConfigYesNoOption(state,"fork-cow-defer-expire",server.fork_cow_defer_expire,CONFIG_DEFAULT_FORK_COW_DEFER_EXPIRE);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-server-del",server.lazyfree_lazy_server_del,CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL);
     rewriteConfigYesNoOption(state,"slave-lazy-flush",server.repl_slave_lazy_flush,CONFIG_DEFAULT_SLAVE_LAZY_FLUSH);
+    rewriteConfigNumericalOption(state,"io-threads",server.io_threads_num,CONFIG_DEFAULT_IO_THREADS_NUM);
+    rewriteConfigYesNoOption(state,"io-threads-do-reads",server.io_threads_do_reads,CONFIG_DEFAULT_IO_THREADS_DO_READS);
+    rewriteConfigYesNoOption(state,"io-uring",server.io_uring,CONFIG_DEFAULT_IO_URING);
+    rewriteConfigYesNoOption(state,"reply-cork",server.reply_cork,CONFIG_DEFAULT_REPLY_CORK);
+    rewriteConfigNumericalOption(state,"accept-threads",server.accept_threads_num,CONFIG_DEFAULT_ACCEPT_THREADS_NUM);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
     if (server.sentinel_mode) rewriteConfigSentinelOption(state);
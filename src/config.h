@@ -76,6 +76,11 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring needs to be enabled at build time with USE_IOURING=yes. */
+#if defined(__linux__) && defined(USE_IOURING)
+#define HAVE_IO_URING 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
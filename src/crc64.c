@@ -38,6 +38,15 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "crc64.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_CRC64_PCLMUL 1
+#include <immintrin.h>
+#endif
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,7 +179,20 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+/* ----------------------------------------------------------------------------
+ * CRC64 implementations.
+ *
+ * All of them compute the same function: 'crc' is the checksum of the data
+ * processed so far (0 at the start), and the checksum updated with the 'l'
+ * bytes at 's' is returned.
+ * ------------------------------------------------------------------------- */
+
+typedef uint64_t crc64Proc(uint64_t crc, const unsigned char *s, uint64_t l);
+
+/* The original byte at a time implementation. */
+static uint64_t crc64Bytewise(uint64_t crc, const unsigned char *s,
+                              uint64_t l)
+{
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,16 +202,261 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+/* Slice by 16: crc64_slice[k][n] is the CRC of the byte 'n' followed by 'k'
+ * zero bytes, so that 16 bytes are processed with 16 independent lookups
+ * instead of a chain of 16 dependent ones. Built by crc64Init(). */
+static uint64_t crc64_slice[16][256];
+
+static void crc64SliceInit(void) {
+    int k, n;
+
+    for (n = 0; n < 256; n++) crc64_slice[0][n] = crc64_tab[n];
+    for (k = 1; k < 16; k++) {
+        for (n = 0; n < 256; n++) {
+            uint64_t c = crc64_slice[k-1][n];
+            crc64_slice[k][n] = crc64_tab[(uint8_t)c] ^ (c >> 8);
+        }
+    }
+}
+
+static uint64_t crc64Slice16(uint64_t crc, const unsigned char *s,
+                             uint64_t l)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    while (l >= 16) {
+        uint64_t a, b;
+
+        memcpy(&a,s,8);
+        memcpy(&b,s+8,8);
+        a ^= crc;
+        crc = crc64_slice[15][a & 0xff] ^
+              crc64_slice[14][(a >> 8) & 0xff] ^
+              crc64_slice[13][(a >> 16) & 0xff] ^
+              crc64_slice[12][(a >> 24) & 0xff] ^
+              crc64_slice[11][(a >> 32) & 0xff] ^
+              crc64_slice[10][(a >> 40) & 0xff] ^
+              crc64_slice[9][(a >> 48) & 0xff] ^
+              crc64_slice[8][a >> 56] ^
+              crc64_slice[7][b & 0xff] ^
+              crc64_slice[6][(b >> 8) & 0xff] ^
+              crc64_slice[5][(b >> 16) & 0xff] ^
+              crc64_slice[4][(b >> 24) & 0xff] ^
+              crc64_slice[3][(b >> 32) & 0xff] ^
+              crc64_slice[2][(b >> 40) & 0xff] ^
+              crc64_slice[1][(b >> 48) & 0xff] ^
+              crc64_slice[0][b >> 56];
+        s += 16;
+        l -= 16;
+    }
+#endif
+    return crc64Bytewise(crc,s,l);
+}
+
+#ifdef HAVE_CRC64_PCLMUL
+/* Carry-less multiplication kernel. The data is folded 64 bytes at a time
+ * into four 128 bit accumulators: with the bit reflected representation of
+ * the CRC, folding the accumulator X = H*x^64 + L over D bits is
+ *
+ *   X' = H * (x^(D+63) mod P) + L * (x^(D-1) mod P)
+ *
+ * (one bit less than D+64 and D, since the carry-less product of two
+ * reflected 64 bit values is shifted by one bit). The accumulators are
+ * then folded into one, and the remaining 16 bytes, that are equivalent to
+ * the data processed so far, are reduced with the tables together with the
+ * tail of the buffer. */
+#define CRC64_FOLD_CONSTANTS(hi,lo) _mm_set_epi64x((long long)(lo),(long long)(hi))
+
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i crc64Fold(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x,k,0x00),
+                         _mm_clmulepi64_si128(x,k,0x11));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint64_t crc64Pclmul(uint64_t crc, const unsigned char *s,
+                            uint64_t l)
+{
+    const __m128i k512 = CRC64_FOLD_CONSTANTS(0xaf86efb16d9ab4fbULL,
+                                              0xf49784a634f014e4ULL);
+    const __m128i k384 = CRC64_FOLD_CONSTANTS(0xa062b2319d66692fULL,
+                                              0x7b3211a760160db8ULL);
+    const __m128i k256 = CRC64_FOLD_CONSTANTS(0x6ba4d760ab38201eULL,
+                                              0xef3d1d18ed889ed2ULL);
+    const __m128i k128 = CRC64_FOLD_CONSTANTS(0xd9d7be7d505da32cULL,
+                                              0x381d0015c96f4444ULL);
+    __m128i x0, x1, x2, x3;
+    unsigned char rest[16];
+
+    if (l < 128) return crc64Slice16(crc,s,l);
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)s),
+                       _mm_cvtsi64_si128((long long)crc));
+    x1 = _mm_loadu_si128((const __m128i*)(s+16));
+    x2 = _mm_loadu_si128((const __m128i*)(s+32));
+    x3 = _mm_loadu_si128((const __m128i*)(s+48));
+    s += 64;
+    l -= 64;
+    while (l >= 64) {
+        x0 = _mm_xor_si128(crc64Fold(x0,k512),
+                           _mm_loadu_si128((const __m128i*)s));
+        x1 = _mm_xor_si128(crc64Fold(x1,k512),
+                           _mm_loadu_si128((const __m128i*)(s+16)));
+        x2 = _mm_xor_si128(crc64Fold(x2,k512),
+                           _mm_loadu_si128((const __m128i*)(s+32)));
+        x3 = _mm_xor_si128(crc64Fold(x3,k512),
+                           _mm_loadu_si128((const __m128i*)(s+48)));
+        s += 64;
+        l -= 64;
+    }
+    x3 = _mm_xor_si128(x3,crc64Fold(x0,k384));
+    x3 = _mm_xor_si128(x3,crc64Fold(x1,k256));
+    x3 = _mm_xor_si128(x3,crc64Fold(x2,k128));
+    while (l >= 16) {
+        x3 = _mm_xor_si128(crc64Fold(x3,k128),
+                           _mm_loadu_si128((const __m128i*)s));
+        s += 16;
+        l -= 16;
+    }
+    _mm_storeu_si128((__m128i*)rest,x3);
+    crc = crc64Slice16(0,rest,16);
+    return crc64Slice16(crc,s,l);
+}
+#endif
+
+/* The first call resolves the best implementation for this CPU, unless
+ * crc64Init() already did it. */
+static uint64_t crc64Resolve(uint64_t crc, const unsigned char *s, uint64_t l);
+static crc64Proc *crc64Impl = crc64Resolve;
+static const char *crc64ImplName = "bytewise";
+
+static void crc64Select(void) {
+    crc64SliceInit();
+#ifdef HAVE_CRC64_PCLMUL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1"))
+    {
+        crc64ImplName = "pclmul";
+        crc64Impl = crc64Pclmul;
+        return;
+    }
+#endif
+    crc64ImplName = "slice-by-16";
+    crc64Impl = crc64Slice16;
+}
+
+static uint64_t crc64Resolve(uint64_t crc, const unsigned char *s,
+                             uint64_t l)
+{
+    crc64Select();
+    return crc64Impl(crc,s,l);
+}
+
+/* Build the tables and select the implementation. Called at startup, before
+ * any thread may compute checksums. */
+void crc64Init(void) {
+    if (crc64Impl == crc64Resolve) crc64Select();
+}
+
+/* Return the name of the implementation used on this CPU. */
+const char *crc64ImplementationName(void) {
+    crc64Init();
+    return crc64ImplName;
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    return crc64Impl(crc,s,l);
+}
+
 /* Test main */
 #ifdef REDIS_TEST
 #include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
 
 #define UNUSED(x) (void)(x)
+
+static long long crc64Ustime(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Check that 'proc' returns exactly what the byte at a time implementation
+ * returns, for every length up to 'len' and every alignment. */
+static void crc64Check(crc64Proc *proc, const unsigned char *buf, size_t len) {
+    size_t off, l;
+
+    for (off = 0; off < 16; off++) {
+        for (l = 0; l+off <= len; l++) {
+            uint64_t init = (uint64_t)l * 0x9e3779b97f4a7c15ULL;
+            assert(proc(init,buf+off,l) == crc64Bytewise(init,buf+off,l));
+        }
+    }
+}
+
+/* Return the throughput of 'proc' over 'len' bytes in GB/s. */
+static volatile uint64_t crc64Sink; /* Keep the computation alive. */
+
+static double crc64Speed(crc64Proc *proc, const unsigned char *buf,
+                         size_t len)
+{
+    long long iterations = 512LL*1024*1024/len, j, start, elapsed;
+    uint64_t crc = 0;
+
+    if (proc == crc64Bytewise) iterations /= 8;
+    start = crc64Ustime();
+    for (j = 0; j < iterations; j++) crc = proc(crc,buf,len);
+    crc64Sink = crc;
+    elapsed = crc64Ustime()-start;
+    if (elapsed == 0) elapsed = 1;
+    return (double)len*iterations/elapsed/1000;
+}
+
 int crc64Test(int argc, char *argv[]) {
+    size_t sizes[] = {64, 1024, 16*1024, 1024*1024};
+    size_t len = 1024*1024, j;
+    unsigned char *buf;
+
     UNUSED(argc);
     UNUSED(argv);
+
+    crc64Init();
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+    assert(crc64(0,(unsigned char*)"123456789",9) == 0xe9c6d914c4b8d9caULL);
+
+    /* All the implementations available on this CPU must agree. */
+    buf = malloc(len);
+    for (j = 0; j < len; j++) buf[j] = (unsigned char)rand();
+    crc64Check(crc64Slice16,buf,1100);
+    assert(crc64Slice16(1,buf,len) == crc64Bytewise(1,buf,len));
+#ifdef HAVE_CRC64_PCLMUL
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc64Check(crc64Pclmul,buf,1100);
+        assert(crc64Pclmul(1,buf,len) == crc64Bytewise(1,buf,len));
+        /* Chaining calls is the same as a single call. */
+        assert(crc64Pclmul(crc64Pclmul(1,buf,1000),buf+1000,len-1000) ==
+               crc64Bytewise(1,buf,len));
+    }
+#endif
+    printf("CRC64 implementation: %s\n", crc64ImplementationName());
+
+    /* Microbenchmark: throughput of every implementation. */
+    for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+        double bytewise, slice16, pclmul = 0;
+
+        bytewise = crc64Speed(crc64Bytewise,buf,sizes[j]);
+        slice16 = crc64Speed(crc64Slice16,buf,sizes[j]);
+#ifdef HAVE_CRC64_PCLMUL
+        if (crc64Impl == crc64Pclmul)
+            pclmul = crc64Speed(crc64Pclmul,buf,sizes[j]);
+#endif
+        printf("%8zu bytes: bytewise %6.2f GB/s, slice-by-16 %6.2f GB/s, "
+               "pclmul %6.2f GB/s\n", sizes[j], bytewise, slice16, pclmul);
+    }
+    free(buf);
     return 0;
 }
 #endif
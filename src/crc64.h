@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+void crc64Init(void);
+const char *crc64ImplementationName(void);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 
 #ifdef REDIS_TEST
@@ -38,7 +38,21 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     robj *val;
 
-    if (expireIfNeeded(db,key) == 1) {                                          // 键已经过期
+    /* With fork-cow-defer-expire, read only commands executed while a child
+     * is active find expired keys missing without deleting them. Commands
+     * that can write are excluded since they are propagated verbatim and
+     * the replicas would still see the key. */
+    if (server.fork_cow_minimize_active && server.fork_cow_defer_expire &&
+        server.masterhost == NULL &&
+        server.current_client &&
+        server.current_client->cmd &&
+        server.current_client->cmd->flags & CMD_READONLY)
+    {
+        if (keyIsExpired(db,key)) {
+            forkCowSuppressedWrite(dictFind(db->dict,key->ptr));
+            return NULL;
+        }
+    } else if (expireIfNeeded(db,key) == 1) {                                          // 键已经过期
         if (server.masterhost == NULL) return NULL;                             // 主节点直接返回空
 
         //// 从节点也返回空，但是从节点expireIfNeeded没有删除过期键
@@ -198,6 +212,10 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         return -1;
     }
 
+    /* Values referenced by the output buffers of clients must not be
+     * released by the lazyfree thread, see copyClientsReplyObjects(). */
+    if (async) copyClientsReplyObjects();
+
     for (j = 0; j < server.dbnum; j++) {
         if (dbnum != -1 && dbnum != j) continue;
         removed += dictSize(server.db[j].dict);
@@ -219,6 +237,109 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
     return removed;
 }
 
+/* Return the number of keys in all the databases. */
+long long dbTotalServerKeyCount(void) {
+    long long total = 0;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) total += dictSize(server.db[j].dict);
+    return total;
+}
+
+/* Keyspace set aside by backupDb(). */
+struct dbBackup {
+    dict **dicts;               /* Main dictionary of every DB. */
+    dict **expires;             /* Expires dictionary of every DB. */
+    rax *slots_to_keys;         /* Cluster slots -> keys map, or NULL. */
+    uint64_t slots_keys_count[CLUSTER_SLOTS];
+};
+
+/* Detach the whole keyspace and replace it with empty databases. This is
+ * used by a slave loading the new dataset directly from the master socket
+ * (repl-diskless-load swapdb): if the transfer fails the old dataset is put
+ * back with restoreDbBackup(), otherwise it is released with
+ * discardDbBackup(). Clients can't access the backup meanwhile. */
+dbBackup *backupDb(void) {
+    dbBackup *backup = zmalloc(sizeof(*backup));
+    int j;
+
+    backup->dicts = zmalloc(sizeof(dict*)*server.dbnum);
+    backup->expires = zmalloc(sizeof(dict*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        backup->dicts[j] = server.db[j].dict;
+        backup->expires[j] = server.db[j].expires;
+        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+    }
+
+    backup->slots_to_keys = NULL;
+    if (server.cluster_enabled) {
+        backup->slots_to_keys = server.cluster->slots_to_keys;
+        memcpy(backup->slots_keys_count,server.cluster->slots_keys_count,
+               sizeof(backup->slots_keys_count));
+        server.cluster->slots_to_keys = raxNew();
+        memset(server.cluster->slots_keys_count,0,
+               sizeof(server.cluster->slots_keys_count));
+    }
+    return backup;
+}
+
+static void freeDbBackupContainer(dbBackup *backup) {
+    zfree(backup->dicts);
+    zfree(backup->expires);
+    zfree(backup);
+}
+
+/* Drop whatever was loaded after backupDb() and put the backup in place.
+ * 'flags' are the emptyDb() flags used to release the current data. */
+void restoreDbBackup(dbBackup *backup, int flags) {
+    int j;
+
+    emptyDb(-1,flags,NULL);
+    for (j = 0; j < server.dbnum; j++) {
+        dictRelease(server.db[j].dict);
+        dictRelease(server.db[j].expires);
+        server.db[j].dict = backup->dicts[j];
+        server.db[j].expires = backup->expires[j];
+    }
+
+    if (server.cluster_enabled) {
+        raxFree(server.cluster->slots_to_keys);
+        server.cluster->slots_to_keys = backup->slots_to_keys;
+        memcpy(server.cluster->slots_keys_count,backup->slots_keys_count,
+               sizeof(server.cluster->slots_keys_count));
+    }
+    freeDbBackupContainer(backup);
+}
+
+/* Release the keyspace saved by backupDb(). 'flags' and 'callback' have the
+ * same meaning they have for emptyDb(). */
+void discardDbBackup(dbBackup *backup, int flags, void(callback)(void*)) {
+    int j, async = (flags & EMPTYDB_ASYNC);
+
+    /* See emptyDb(). */
+    if (async) copyClientsReplyObjects();
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (async) {
+            freeDbDictsAsync(backup->dicts[j],backup->expires[j]);
+        } else {
+            dictEmpty(backup->dicts[j],callback);
+            dictEmpty(backup->expires[j],callback);
+            dictRelease(backup->dicts[j]);
+            dictRelease(backup->expires[j]);
+        }
+    }
+
+    if (backup->slots_to_keys) {
+        if (async)
+            freeSlotsToKeysAsync(backup->slots_to_keys);
+        else
+            raxFree(backup->slots_to_keys);
+    }
+    freeDbBackupContainer(backup);
+}
+
 // 选择db
 int selectDb(client *c, int id) {
     if (id < 0 || id >= server.dbnum)       // 验证id的有效性
@@ -238,10 +359,12 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    trackingInvalidateKeysOnFlush(dbid);
 }
 
 /*-----------------------------------------------------------------------------
@@ -938,6 +1061,17 @@ void propagateExpire(redisDb *db, robj *key, int lazy) {
 }
 
 //// 惰性删除策略的实现，所有读写数据库的redis命令在执行之前都会调用该函数进行检查。
+/* Return 1 if the key has an expire in the past, without deleting it. */
+int keyIsExpired(redisDb *db, robj *key) {
+    mstime_t when = getExpire(db,key);
+    mstime_t now;
+
+    if (when < 0) return 0; /* No expire for this key */
+    if (server.loading) return 0;
+    now = server.lua_caller ? server.lua_time_start : mstime();
+    return now > when;
+}
+
 int expireIfNeeded(redisDb *db, robj *key) {
     mstime_t when = getExpire(db,key);                              // 获取该键的过期时间
     mstime_t now;
@@ -956,6 +1090,7 @@ int expireIfNeeded(redisDb *db, robj *key) {
     propagateExpire(db,key,server.lazyfree_lazy_expire);            // 将删除命令传播到AOF文件和附属节点
     notifyKeyspaceEvent(NOTIFY_EXPIRED,
         "expired",key,db->id);                                // 发送键空间操作事件通知，Reactor模式
+    trackingInvalidateKey(key);
     return server.lazyfree_lazy_expire ? dbAsyncDelete(db,key) :
                                          dbSyncDelete(db,key);
 }
@@ -30,6 +30,7 @@
 #include "server.h"
 #include "sha1.h"   /* SHA1 is used for DEBUG DIGEST */
 #include "crc64.h"
+#include "cluster.h"
 
 #include <arpa/inet.h>
 #include <signal.h>
@@ -305,6 +306,8 @@ void debugCommand(client *c) {
         blen++; addReplyStatus(c,
         "loadaof  -- Flush the AOF buffers on disk and reload the AOF in memory.");
         blen++; addReplyStatus(c,
+        "loadrdb <file> [DB <id>] [SLOTS <start> <end>] -- Load only the selected keys of an RDB file, replacing existing keys. Returns the number of keys loaded.");
+        blen++; addReplyStatus(c,
         "object <key> -- Show low level info about key and associated value.");
         blen++; addReplyStatus(c,
         "sdslen <key> -- Show low level SDS string info representing key and value.");
@@ -317,6 +320,8 @@ void debugCommand(client *c) {
         blen++; addReplyStatus(c,
         "sleep <seconds> -- Stop the server for <seconds>. Decimals allowed.");
         blen++; addReplyStatus(c,
+        "aof-fsync-delay <milliseconds> -- Delay the fsyncs of the AOF group commit.");
+        blen++; addReplyStatus(c,
         "set-active-expire (0|1) -- Setting it to 0 disables expiring keys in background when they are not accessed (otherwise the Redis behavior). Setting it to 1 reenables back the default.");
         blen++; addReplyStatus(c,
         "lua-always-replicate-commands (0|1) -- Setting it to 1 makes Lua replication defaulting to replicating single commands, without the script having to enable effects replication.");
@@ -367,13 +372,55 @@ void debugCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"loadaof")) {
         if (server.aof_state == AOF_ON) flushAppendOnlyFile(1);
         emptyDb(-1,EMPTYDB_NO_FLAGS,NULL);
-        if (loadAppendOnlyFile(server.aof_filename) != C_OK) {
+        if (loadAppendOnlyFiles(server.aof_manifest) != C_OK) {
             addReply(c,shared.err);
             return;
         }
         server.dirty = 0; /* Prevent AOF / replication */
         serverLog(LL_WARNING,"Append Only File loaded by DEBUG LOADAOF");
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"loadrdb") && c->argc >= 3) {
+        rdbLoadFilter filter = {-1,-1,-1};
+        long long loaded;
+        long id, start, end;
+        int j;
+
+        for (j = 3; j < c->argc; j++) {
+            int moreargs = c->argc-j-1;
+            if (!strcasecmp(c->argv[j]->ptr,"db") && moreargs >= 1) {
+                if (getLongFromObjectOrReply(c,c->argv[j+1],&id,NULL)
+                    != C_OK) return;
+                if (id < 0 || id >= server.dbnum) {
+                    addReplyError(c,"DB index is out of range");
+                    return;
+                }
+                filter.dbid = id;
+                j++;
+            } else if (!strcasecmp(c->argv[j]->ptr,"slots") && moreargs >= 2) {
+                if (getLongFromObjectOrReply(c,c->argv[j+1],&start,NULL)
+                    != C_OK ||
+                    getLongFromObjectOrReply(c,c->argv[j+2],&end,NULL)
+                    != C_OK) return;
+                if (start < 0 || end >= CLUSTER_SLOTS || start > end) {
+                    addReplyError(c,"Invalid or out of range slots");
+                    return;
+                }
+                filter.start_slot = start;
+                filter.end_slot = end;
+                j += 2;
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+        if (rdbLoadWithFilter(c->argv[2]->ptr,&filter,&loaded) != C_OK) {
+            addReplyError(c,"Error trying to load the RDB file, check the logs");
+            return;
+        }
+        /* Like DEBUG RELOAD this only changes the local dataset. */
+        preventCommandPropagation(c);
+        serverLog(LL_WARNING,"%lld keys loaded by DEBUG LOADRDB", loaded);
+        addReplyLongLong(c,loaded);
     } else if (!strcasecmp(c->argv[1]->ptr,"object") && c->argc == 3) {
         dictEntry *de;
         robj *val;
@@ -516,6 +563,11 @@ void debugCommand(client *c) {
         tv.tv_nsec = (utime % 1000000) * 1000;
         nanosleep(&tv, NULL);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"aof-fsync-delay") &&
+               c->argc == 3)
+    {
+        server.aof_fsync_debug_delay = atoi(c->argv[2]->ptr);
+        addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"set-active-expire") &&
                c->argc == 3)
     {
@@ -591,7 +643,7 @@ void _serverAssertPrintClientInfo(const client *c) {
 
     bugReportStart();
     serverLog(LL_WARNING,"=== ASSERTION FAILED CLIENT CONTEXT ===");
-    serverLog(LL_WARNING,"client->flags = %d", c->flags);
+    serverLog(LL_WARNING,"client->flags = %llu", (unsigned long long) c->flags);
     serverLog(LL_WARNING,"client->fd = %d", c->fd);
     serverLog(LL_WARNING,"client->argc = %d", c->argc);
     for (j=0; j < c->argc; j++) {
@@ -25,6 +25,14 @@
 static int dict_can_resize = 1;
 static unsigned int dict_force_resize_ratio = 5;                // 负载因子
 
+/* The rehashing steps performed by lookups and updates can be paused as
+ * well with dictDisableRehash(), since moving the entries to the new table
+ * writes memory shared with a fork child. The steps are resumed anyway when
+ * the new table becomes too crowded. The optional callback is told about
+ * the memory each skipped step would have written. */
+static int dict_can_rehash = 1;
+static void (*dict_rehash_skipped)(const void *ptr) = NULL;
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
@@ -214,7 +222,25 @@ int dictRehashMilliseconds(dict *d, int ms) {
 //// 在执行查询和更新操作时，如果符合rehash条件就会触发一次rehash操作，每次执行1步
 //// 前提是当前没有正在使用的迭代器
 static void _dictRehashStep(dict *d) {
-    if (d->iterators == 0) dictRehash(d,1);
+    if (d->iterators != 0) return;
+    if (!dict_can_rehash &&
+        d->ht[1].used < d->ht[1].size*dict_force_resize_ratio)
+    {
+        if (dict_rehash_skipped) {
+            /* Had the steps been performed the index would have moved on:
+             * walk the buckets after it with a global count of the skipped
+             * steps, which is exact when a single dict is rehashing. */
+            static unsigned long skipped_steps = 0;
+            dictEntry **bucket = d->ht[0].table+
+                ((d->rehashidx+skipped_steps++) & d->ht[0].sizemask);
+            dictEntry *de;
+
+            dict_rehash_skipped(bucket);
+            for (de = *bucket; de; de = de->next) dict_rehash_skipped(de);
+        }
+        return;
+    }
+    dictRehash(d,1);
 }
 
 //// 添加键值对
@@ -820,6 +846,18 @@ void dictDisableResize(void) {
     dict_can_resize = 0;
 }
 
+void dictEnableRehash(void) {
+    dict_can_rehash = 1;
+    dict_rehash_skipped = NULL;
+}
+
+/* Pause the rehashing steps, calling 'skipped', if not NULL, with the
+ * addresses of the bucket and the entries each skipped step would move. */
+void dictDisableRehash(void (*skipped)(const void *ptr)) {
+    dict_can_rehash = 0;
+    dict_rehash_skipped = skipped;
+}
+
 //// 根据key计算hash值
 unsigned int dictGetHash(dict *d, const void *key) {
     return dictHashKey(d, key);
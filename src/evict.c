@@ -341,7 +341,12 @@ unsigned long LFUDecrAndReturn(robj *o) {
         } else {
             counter--;
         }
-        o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+        /* Storing the decayed counter is not needed for correctness: it
+         * is computed again at the next access. */
+        if (server.fork_cow_minimize_active)
+            forkCowSuppressedWrite(o);
+        else
+            o->lru = (LFUGetTimeInMinutes()<<8) | counter;
     }
     return counter;
 }
@@ -356,20 +361,16 @@ unsigned long LFUDecrAndReturn(robj *o) {
  * returns the sum of AOF and slaves buffer. */
 size_t freeMemoryGetNotCountedMemory(void) {
     size_t overhead = 0;
-    int slaves = listLength(server.slaves);
-
-    if (slaves) {
-        listIter li;
-        listNode *ln;
 
-        listRewind(server.slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = listNodeValue(ln);
-            overhead += getClientOutputBufferMemoryUsage(slave);
-        }
+    /* The slaves share the replication buffer with the backlog, so only the
+     * part exceeding the backlog size is retained because of them. */
+    if (listLength(server.slaves) &&
+        server.repl_buffer_mem > (size_t)server.repl_backlog_size)
+    {
+        overhead += server.repl_buffer_mem - server.repl_backlog_size;
     }
     if (server.aof_state != AOF_OFF) {
-        overhead += sdslen(server.aof_buf)+aofRewriteBufferSize();
+        overhead += sdslen(server.aof_buf);
     }
     return overhead;
 }
@@ -517,6 +518,7 @@ int freeMemoryIfNeeded(void) {
             server.stat_evictedkeys++;
             notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
                 keyobj, db->id);
+            trackingInvalidateKey(keyobj);
             decrRefCount(keyobj);
             keys_freed++;
 
@@ -71,8 +71,14 @@ void emptyDbAsync(redisDb *db) {
     dict *oldht1 = db->dict, *oldht2 = db->expires;
     db->dict = dictCreate(&dbDictType,NULL);
     db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    freeDbDictsAsync(oldht1,oldht2);
+}
+
+/* Release the main dictionary and the expires dictionary of a database,
+ * already detached from the keyspace, in the lazyfree thread. */
+void freeDbDictsAsync(dict *ht1, dict *ht2) {
+    atomicIncr(lazyfree_objects,dictSize(ht1));
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,ht1,ht2);
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -83,8 +89,13 @@ void slotToKeyFlushAsync(void) {
     server.cluster->slots_to_keys = raxNew();
     memset(server.cluster->slots_keys_count,0,
            sizeof(server.cluster->slots_keys_count));
-    atomicIncr(lazyfree_objects,old->numele);
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
+    freeSlotsToKeysAsync(old);
+}
+
+/* Release a detached slots-keys map in the lazyfree thread. */
+void freeSlotsToKeysAsync(rax *rt) {
+    atomicIncr(lazyfree_objects,rt->numele);
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,rt);
 }
 
 /* Release objects from the lazyfree thread. It's just decrRefCount()
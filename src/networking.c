@@ -30,10 +30,37 @@
 #include "server.h"
 #include "atomicvar.h"
 #include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <math.h>
 #include <ctype.h>
 
-static void setProtocolError(const char *errstr, client *c, int pos);
+static void setProtocolError(const char *errstr, client *c);
+int postponeClientRead(client *c);
+static void freeClientFromIOContext(client *c);
+
+/* Operation the I/O threads are currently performing, see the threaded I/O
+ * implementation at the end of this file. When not IO_THREADS_OP_IDLE we are
+ * in the middle of a fan-out phase: the main thread and the I/O threads are
+ * all touching client buffers, so nothing shared must be modified. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* Set while processEventsWhileBlocked() runs: in that context reads must be
+ * served synchronously since nobody will call beforeSleep(). */
+static int ProcessingEventsWhileBlocked = 0;
+
+/* Flags of the writes done while more replies are expected for the same
+ * client, see reply-cork. Holding partial segments is Linux specific. */
+#if defined(MSG_MORE) && defined(TCP_CORK)
+#define HAVE_REPLY_CORK 1
+#define REPLY_CORK_FLAGS MSG_MORE
+#else
+#define REPLY_CORK_FLAGS 0
+#endif
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -54,13 +81,120 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
+/* Capacity of the pooled reply blocks: the whole allocation, header
+ * included, is PROTO_REPLY_CHUNK_BYTES, that is an allocator size class. */
+#define REPLY_BLOCK_SIZE (PROTO_REPLY_CHUNK_BYTES-sizeof(clientReplyBlock))
+
+/* Free reply blocks, linked by their 'next' field. The pool is only used by
+ * the main thread (or by threads holding the modules GIL): blocks written
+ * by I/O threads are given back by releaseClientSentReplyBlocks(), and the
+ * blocks needed by I/O threads (protocol errors while parsing) are taken
+ * from the allocator. */
+static clientReplyBlock *ReplyBlockPool = NULL;
+static unsigned long ReplyBlockPoolLen = 0;  /* Blocks in the pool. */
+static unsigned long ReplyBlockPoolIdle = 0; /* Min pool length since the
+                                                last trimReplyBlockPool(). */
+
+/* Create an empty block for the client reply list, able to hold at least
+ * 'len' bytes. Unless 'exact' is true, replies up to REPLY_BLOCK_SIZE bytes
+ * get a block from the pool, so that the following replies can be appended
+ * to it. Bigger replies, and blocks that are never extended (like the ones
+ * referencing objects), are allocated with the exact size. */
+static clientReplyBlock *createReplyBlock(size_t len, int exact) {
+    clientReplyBlock *b;
+
+    if (!exact && len <= REPLY_BLOCK_SIZE) {
+        if (ReplyBlockPool && io_threads_op == IO_THREADS_OP_IDLE) {
+            b = ReplyBlockPool;
+            ReplyBlockPool = b->next;
+            ReplyBlockPoolLen--;
+            if (ReplyBlockPoolLen < ReplyBlockPoolIdle)
+                ReplyBlockPoolIdle = ReplyBlockPoolLen;
+        } else {
+            b = zmalloc(PROTO_REPLY_CHUNK_BYTES);
+        }
+        b->size = REPLY_BLOCK_SIZE;
+    } else {
+        b = zmalloc(sizeof(*b)+len);
+        b->size = len;
+    }
+    b->used = 0;
+    b->obj = NULL;
+    b->next = NULL;
+    return b;
+}
+
+/* Release the reference to the object of the block, if any, and give the
+ * block back to the pool, or to the allocator if the pool is full or the
+ * block was allocated with a different size. */
+static void freeReplyBlock(clientReplyBlock *b) {
+    if (b->obj) decrRefCount(b->obj);
+    if (b->size == REPLY_BLOCK_SIZE &&
+        ReplyBlockPoolLen < PROTO_REPLY_POOL_MAX_BLOCKS)
+    {
+        b->next = ReplyBlockPool;
+        ReplyBlockPool = b;
+        ReplyBlockPoolLen++;
+    } else {
+        zfree(b);
+    }
+}
+
+/* Called once per second by serverCron(): half of the blocks that stayed
+ * in the pool for the whole last period are returned to the allocator, so
+ * that the memory taken by a burst of output is eventually released. */
+void trimReplyBlockPool(void) {
+    unsigned long release = (ReplyBlockPoolIdle+1)/2;
+
+    while(release-- && ReplyBlockPool) {
+        clientReplyBlock *b = ReplyBlockPool;
+        ReplyBlockPool = b->next;
+        ReplyBlockPoolLen--;
+        zfree(b);
+    }
+    ReplyBlockPoolIdle = ReplyBlockPoolLen;
+}
+
+/* Return the memory used by the free blocks of the reply pool. */
+size_t replyBlockPoolMemory(void) {
+    return ReplyBlockPoolLen*PROTO_REPLY_CHUNK_BYTES;
+}
+
+/* Return the number of bytes of protocol the reply block emits. */
+static size_t replyBlockSize(clientReplyBlock *b) {
+    size_t size = b->used;
+    if (b->obj) size += sdslen(b->obj->ptr)+2;
+    return size;
+}
+
+/* Return the number of bytes the reply block accounts for in the client
+ * output buffer: the output buffers are accounted in blocks, so this is
+ * the whole capacity of the block, plus the payload of the object it
+ * references, if any. */
+static size_t replyBlockMemory(clientReplyBlock *b) {
+    size_t size = b->size;
+    if (b->obj) size += sdslen(b->obj->ptr)+2;
+    return size;
+}
+
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
-    return sdsdup(o);
+    clientReplyBlock *b = o;
+    clientReplyBlock *copy;
+
+    /* The copy has the same capacity, so that it accounts for the same
+     * amount of memory, see copyClientOutputBuffer(). */
+    copy = createReplyBlock(b->size,b->size != REPLY_BLOCK_SIZE);
+    memcpy(copy->buf,b->buf,b->used);
+    copy->used = b->used;
+    copy->obj = b->obj;
+    if (copy->obj) incrRefCount(copy->obj);
+    return copy;
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    if (o == NULL) return; /* addDeferredMultiBulkLength() placeholder. */
+    freeReplyBlock(o);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -68,17 +202,20 @@ int listMatchObjects(void *a, void *b) {
 }
 
 //// 根据客户端连接套接字fd，创建一个client结构体
-client *createClient(int fd) {
+// sockopts为0时，套接字的选项（非阻塞、TCP_NODELAY、keepalive）已经由accept线程设置好了
+static client *_createClient(int fd, int sockopts) {
     client *c = zmalloc(sizeof(client));        // 分配空间
 
     // 通过-1作为fd可以创建一个未连接的客户端。
     // 这很有用，因为所有的命令都需要在客户端上下文中执行。
     // 当命令在其他上下文中执行时(例如Lua脚本)，我们需要一个未连接的客户端
     if (fd != -1) {
-        anetNonBlock(NULL,fd);
-        anetEnableTcpNoDelay(NULL,fd);
-        if (server.tcpkeepalive)
-            anetKeepAlive(NULL,fd,server.tcpkeepalive);
+        if (sockopts) {
+            anetNonBlock(NULL,fd);
+            anetEnableTcpNoDelay(NULL,fd);
+            if (server.tcpkeepalive)
+                anetKeepAlive(NULL,fd,server.tcpkeepalive);
+        }
 
         //// 将客户端连接套接字，加入到事件循环中的 文件事件   （可读）
         if (aeCreateFileEvent(server.el,fd,AE_READABLE,
@@ -100,6 +237,7 @@ client *createClient(int fd) {
     c->name = NULL;
     c->bufpos = 0;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
@@ -121,8 +259,17 @@ client *createClient(int fd) {
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    c->repl_disk_off = -1;
+    c->repl_cctx = NULL;
+    c->repl_dctx = NULL;
+    c->repl_zbuf = NULL;
+    c->repl_zbuf_sent = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_sent_blocks = NULL;
+    c->reply_cork = 0;
     c->obuf_soft_limit_reached_time = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
@@ -133,17 +280,41 @@ client *createClient(int fd) {
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
+    c->aof_woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
     c->peerid = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
-    if (fd != -1) listAddNodeTail(server.clients,c);    //// 将新创建的客户端加到server.clients双向链表的尾部
+    c->client_tracking_redirection = 0;
+    if (fd != -1) linkClient(c);    //// 将新创建的客户端加到server.clients双向链表的尾部
     initClientMultiState(c);
     return c;
 }
 
+/* This function links the client to the global list of clients, and to
+ * the clients index used to lookup a client by ID. unlinkClient() does the
+ * opposite, among other things. */
+void linkClient(client *c) {
+    uint64_t id = htonu64(c->id);
+
+    listAddNodeTail(server.clients,c);
+    raxInsert(server.clients_index,(unsigned char*)&id,sizeof(id),c,NULL);
+}
+
+/* Return the client with the specified ID, or NULL if no such client is
+ * connected. */
+client *lookupClientByID(uint64_t id) {
+    id = htonu64(id);
+    client *c = raxFind(server.clients_index,(unsigned char*)&id,sizeof(id));
+    return (c == raxNotFound) ? NULL : c;
+}
+
+client *createClient(int fd) {
+    return _createClient(fd,1);
+}
+
 
 int prepareClientToWrite(client *c) {
 
@@ -160,9 +331,36 @@ int prepareClientToWrite(client *c) {
     //  如果客户端的socket描述符小于等于0，说明是加载AOF文件时的伪客户端，直接返回REDIS_ERR；
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
+    /* Slaves only receive the shared replication buffer: a reply added to
+     * their own output buffers would end up in the middle of the stream. */
+    if (getClientType(c) == CLIENT_TYPE_SLAVE) return C_ERR;
+
 
-    if (!clientHasPendingReplies(c) &&
-        !(c->flags & CLIENT_PENDING_WRITE) &&
+    /* Schedule the client to write the output buffers to the socket, unless
+     * it should already be setup to do so (it has already pending data).
+     *
+     * If CLIENT_PENDING_READ is set, we're in an I/O thread, or the read
+     * is postponed, and should not install a write handler. Instead, it
+     * will be done by handleClientsWithPendingReadsUsingThreads() upon
+     * return. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
+
+    return C_OK;
+}
+
+/* This function puts the client in the queue of clients that should write
+ * their output buffers to the socket. Note that it does not *yet* install
+ * the write handler, to start clients are put in a queue of clients that need
+ * to write, so we try to do that before returning in the event loop (see the
+ * handleClientsWithPendingWrites() function).
+ * If we fail and there is more data to write, compared to what the socket
+ * buffers can hold, then we'll really install the handler. */
+void clientInstallWriteHandler(client *c) {
+    /* Schedule the client to write the output buffers to the socket only
+     * if not already done and, for slaves, if the slave can actually receive
+     * writes at this stage. */
+    if (!(c->flags & CLIENT_PENDING_WRITE) &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -170,8 +368,6 @@ int prepareClientToWrite(client *c) {
         //// 加入需要回复的双端链表头部
         listAddNodeHead(server.clients_pending_write,c);
     }
-
-    return C_OK;
 }
 
 /* -----------------------------------------------------------------------------
@@ -194,85 +390,77 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     return C_OK;
 }
 
-void _addReplyObjectToList(client *c, robj *o) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+/* Append the protocol 's' to the reply list: the free space of the last
+ * block is filled first, then a new block is created for the rest. */
+static void _addReplyProtoToList(client *c, const char *s, size_t len) {
+    listNode *ln = listLast(c->reply);
+    clientReplyBlock *tail = ln ? listNodeValue(ln) : NULL;
 
-    if (listLength(c->reply) == 0) {
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        } else {
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
+    /* Append to the tail block when possible. If tail == NULL it was set
+     * via addDeferredMultiBulkLength(). Blocks referencing an object can't
+     * be extended. */
+    if (tail && !tail->obj) {
+        size_t avail = tail->size - tail->used;
+        size_t copy = avail >= len ? len : avail;
+
+        memcpy(tail->buf+tail->used,s,copy);
+        tail->used += copy;
+        s += copy;
+        len -= copy;
+    }
+    if (len) {
+        clientReplyBlock *b = createReplyBlock(len,0);
+
+        memcpy(b->buf,s,len);
+        b->used = len;
+        listAddNodeTail(c->reply,b);
+        c->reply_bytes += b->size;
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+void _addReplyObjectToList(client *c, robj *o) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    _addReplyProtoToList(c,o->ptr,sdslen(o->ptr));
+}
+
 /* This method takes responsibility over the sds. When it is no longer
- * needed it will be free'd, otherwise it ends up in a robj. */
+ * needed it will be free'd. */
 void _addReplySdsToList(client *c, sds s) {
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-        sdsfree(s);
-        return;
-    }
-
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
+    if (!(c->flags & CLIENT_CLOSE_AFTER_REPLY))
+        _addReplyProtoToList(c,s,sdslen(s));
+    sdsfree(s);
 }
 
 void _addReplyStringToList(client *c, const char *s, size_t len) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    _addReplyProtoToList(c,s,len);
+}
 
-    if (listLength(c->reply) == 0) {
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
-    } else {
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        /* Append to this object when possible. If tail == NULL it was
-         * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        } else {
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
-    }
+/* Add a bulk reply for the string object 'o' referencing the object instead
+ * of copying its payload into the output buffers: the block stores just the
+ * bulk length header, while the value is written directly from the object
+ * when the client socket is writable. Since we hold a reference, commands
+ * modifying the key in place will unshare the value, and overwriting or
+ * deleting the key will not release it before the reply is sent. */
+void _addReplyBulkRefToList(client *c, robj *o) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    char hdr[LONG_STR_SIZE+3];
+    size_t hdrlen;
+    clientReplyBlock *b;
+
+    hdr[0] = '$';
+    hdrlen = 1+ll2string(hdr+1,sizeof(hdr)-1,sdslen(o->ptr));
+    hdr[hdrlen++] = '\r';
+    hdr[hdrlen++] = '\n';
+    b = createReplyBlock(hdrlen,1);
+    memcpy(b->buf,hdr,hdrlen);
+    b->used = hdrlen;
+    b->obj = o;
+    incrRefCount(o);
+    listAddNodeTail(c->reply,b);
+    c->reply_bytes += replyBlockMemory(b);
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -403,27 +591,40 @@ void *addDeferredMultiBulkLength(client *c) {
 /* Populate the length object and try gluing it to the next chunk. */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    sds len, next;
+    clientReplyBlock *next, *b;
+    char lenstr[LONG_STR_SIZE+3];
+    size_t lenstr_len;
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
 
-    len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
-    listNodeValue(ln) = len;
-    c->reply_bytes += sdslen(len);
+    lenstr[0] = '*';
+    lenstr_len = 1+ll2string(lenstr+1,sizeof(lenstr)-1,length);
+    lenstr[lenstr_len++] = '\r';
+    lenstr[lenstr_len++] = '\n';
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
-            len = sdscatsds(len,next);
-            listDelNode(c->reply,ln->next);
-            listNodeValue(ln) = len;
-            /* No need to update c->reply_bytes: we are just moving the same
-             * amount of bytes from one node to another. */
+        /* Only glue when the next node is non-NULL (a reply block in this
+         * case) and has room for the length: it is prepended to the
+         * protocol of the block, that works for blocks referencing objects
+         * as well, since their buffer holds the bulk header. */
+        if (next != NULL && next->size - next->used >= lenstr_len) {
+            memmove(next->buf+lenstr_len,next->buf,next->used);
+            memcpy(next->buf,lenstr,lenstr_len);
+            next->used += lenstr_len;
+            listDelNode(c->reply,ln);
+            /* No need to update c->reply_bytes: the block capacity is
+             * already accounted. */
+            return;
         }
     }
+    b = createReplyBlock(lenstr_len,1);
+    memcpy(b->buf,lenstr,lenstr_len);
+    b->used = lenstr_len;
+    listNodeValue(ln) = b;
+    c->reply_bytes += b->size;
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -519,6 +720,18 @@ void addReplyBulkLen(client *c, robj *obj) {
 
 /* Add a Redis Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj) {
+    /* Big values are referenced by the output buffers instead of being
+     * copied. Fake clients (Lua, modules, AOF loading) don't write to
+     * sockets and read the reply list back as plain protocol, so they
+     * always get copies. */
+    if (c->fd != -1 && sdsEncodedObject(obj) &&
+        sdslen(obj->ptr) >= PROTO_REPLY_MIN_REF_BYTES &&
+        obj->refcount != OBJ_SHARED_REFCOUNT)
+    {
+        if (prepareClientToWrite(c) != C_OK) return;
+        _addReplyBulkRefToList(c,obj);
+        return;
+    }
     addReplyBulkLen(c,obj);
     addReply(c,obj);
     addReply(c,shared.crlf);
@@ -567,20 +780,53 @@ void copyClientOutputBuffer(client *dst, client *src) {
     dst->reply_bytes = src->reply_bytes;
 }
 
+/* Make the slave 'dst' reference the shared replication buffer from the
+ * same position of the slave 'src'. */
+void copyReplicaOutputBuffer(client *dst, client *src) {
+    releaseReplicaReplBuffer(dst);
+    if (src->ref_repl_buf_node == NULL) return;
+    dst->ref_repl_buf_node = src->ref_repl_buf_node;
+    dst->ref_block_pos = src->ref_block_pos;
+    dst->repl_disk_off = src->repl_disk_off;
+    ((replBufBlock*)listNodeValue(dst->ref_repl_buf_node))->refcount++;
+}
+
 /* Return true if the specified client has pending reply buffers to write to
  * the socket. */
 int clientHasPendingReplies(client *c) {
+    if (getClientType(c) == CLIENT_TYPE_SLAVE) {
+        listNode *ln = listLast(server.repl_buffer_blocks);
+
+        /* Slaves have pending data up to the end of the last block of the
+         * shared replication buffer, plus the compressed data not sent. */
+        if (c->repl_zbuf && c->repl_zbuf_sent < sdslen(c->repl_zbuf))
+            return 1;
+        long long limit = aofGroupCommitReplLimit();
+        replBufBlock *o;
+
+        if (c->ref_repl_buf_node == NULL) return 0;
+        if (c->repl_disk_off != -1)
+            return limit == -1 || c->repl_disk_off <= limit;
+
+        /* With the AOF group commit the data not yet on disk is not sent. */
+        o = listNodeValue(c->ref_repl_buf_node);
+        if (limit != -1 && o->repl_offset+(long long)c->ref_block_pos > limit)
+            return 0;
+        return ln != c->ref_repl_buf_node ||
+               c->ref_block_pos < ((replBufBlock*)listNodeValue(ln))->used;
+    }
     return c->bufpos || listLength(c->reply);
 }
 
 #define MAX_ACCEPTS_PER_CALL 1000       // 默认的最大连接请求个数
 
 //// 对cfd客户端连接套接字进行封装，加入文件事件循环等
-static void acceptCommonHandler(int fd, int flags, char *ip) {
+// peerid不为NULL时，连接是由accept线程接受的：套接字选项已经设置好，peerid也已经生成
+static void acceptCommonHandler(int fd, int flags, char *ip, char *peerid) {
     client *c;
 
     // 新用户连接的时候需要创建client结构体，此时就需要创建文件事件，用来监听其读写操作
-    if ((c = createClient(fd)) == NULL) {
+    if ((c = _createClient(fd,peerid == NULL)) == NULL) {
         serverLog(LL_WARNING,
             "Error registering fd event for the new client: %s (fd=%d)",
             strerror(errno),fd);
@@ -644,6 +890,7 @@ static void acceptCommonHandler(int fd, int flags, char *ip) {
 
     server.stat_numconnections++;
     c->flags |= flags;
+    if (peerid) c->peerid = sdsnew(peerid);
 }
 
 //// 监听redis服务端 tcp套接字(ipv4/ipv6) 可读时会调用该函数
@@ -670,7 +917,7 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_VERBOSE,"Accepted %s:%d", cip, cport);
 
         // 对cfd套接字进行封装，包装client结构体、加入文件事件等。。。
-        acceptCommonHandler(cfd,0,cip);
+        acceptCommonHandler(cfd,0,cip,NULL);
     }
 }
 
@@ -689,7 +936,7 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         }
         serverLog(LL_VERBOSE,"Accepted connection to %s", server.unixsocket);
-        acceptCommonHandler(cfd,CLIENT_UNIX_SOCKET,NULL);
+        acceptCommonHandler(cfd,CLIENT_UNIX_SOCKET,NULL,NULL);
     }
 }
 
@@ -728,6 +975,8 @@ void unlinkClient(client *c) {
         ln = listSearchKey(server.clients,c);
         serverAssert(ln != NULL);
         listDelNode(server.clients,ln);
+        uint64_t id = htonu64(c->id);
+        raxRemove(server.clients_index,(unsigned char*)&id,sizeof(id),NULL);
 
         /* Unregister async I/O handlers and close the socket. */
         aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
@@ -744,6 +993,30 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of clients waiting for the AOF fsync. */
+    if (c->flags & CLIENT_PENDING_AOF_FSYNC) {
+        ln = listSearchKey(server.clients_waiting_aof_fsync,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_waiting_aof_fsync,ln);
+        c->flags &= ~CLIENT_PENDING_AOF_FSYNC;
+    }
+
+    /* Remove from the list of corked clients if needed. */
+    if (c->flags & CLIENT_REPLY_CORKED) {
+        ln = listSearchKey(server.clients_corked,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_corked,ln);
+        c->flags &= ~CLIENT_REPLY_CORKED;
+    }
+
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -784,6 +1057,7 @@ void freeClient(client *c) {
     sdsfree(c->querybuf);
     sdsfree(c->pending_querybuf);
     c->querybuf = NULL;
+    freeClientReplStreamCodecs(c);
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
@@ -795,12 +1069,14 @@ void freeClient(client *c) {
 
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c,0);
+    if (c->flags & CLIENT_TRACKING) disableTracking(c);
     pubsubUnsubscribeAllPatterns(c,0);
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
 
     /* Free data structures. */
     listRelease(c->reply);
+    releaseClientSentReplyBlocks(c);
     freeClientArgv(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
@@ -819,6 +1095,7 @@ void freeClient(client *c) {
         ln = listSearchKey(l,c);
         serverAssert(ln != NULL);
         listDelNode(l,ln);
+        releaseReplicaReplBuffer(c);
         /* We need to remember the time when we started to have zero
          * attached slaves, as after some time we'll free the replication
          * backlog. */
@@ -853,9 +1130,33 @@ void freeClient(client *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
+    /* We need to handle concurrent access to the server.clients_to_close list
+     * only in the freeClientAsync() function, since it's the only function
+     * that may access the list while Redis uses I/O threads. All the other
+     * accesses are in the context of the main thread while the other threads
+     * are idle. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        /* No need to bother with locking if there is just the main thread. */
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
+}
+
+/* Free the client synchronously when called from the main thread outside of
+ * an I/O threads fan-out, otherwise schedule it for asynchronous release:
+ * freeClient() touches global state the I/O threads must never modify. */
+static void freeClientFromIOContext(client *c) {
+    if (io_threads_op == IO_THREADS_OP_IDLE)
+        freeClient(c);
+    else
+        freeClientAsync(c);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -869,16 +1170,387 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Remove the reply block at the head of the reply list, after it was
+ * completely transferred to the socket. */
+static void releaseReplyHead(client *c) {
+    listNode *ln = listFirst(c->reply);
+    clientReplyBlock *b = listNodeValue(ln);
+
+    c->reply_bytes -= replyBlockMemory(b);
+
+    /* I/O threads can't use the blocks pool, nor touch the reference count
+     * of objects that may be shared with other clients: in this case the
+     * block is released later by the main thread, see
+     * releaseClientSentReplyBlocks(). */
+    if (io_threads_op != IO_THREADS_OP_IDLE) {
+        b->next = c->reply_sent_blocks;
+        c->reply_sent_blocks = b;
+        listNodeValue(ln) = NULL;
+    }
+    listDelNode(c->reply,ln);
+    c->sentlen = 0;
+}
+
+/* Release the reply blocks that I/O threads wrote to the client socket. */
+void releaseClientSentReplyBlocks(client *c) {
+    while(c->reply_sent_blocks) {
+        clientReplyBlock *b = c->reply_sent_blocks;
+        c->reply_sent_blocks = b->next;
+        freeReplyBlock(b);
+    }
+}
+
+/* Copy into the reply blocks the payload of all the objects referenced by
+ * the output buffers of clients, dropping the references. This is called
+ * before handing the dictionaries of a database to the lazyfree thread:
+ * the thread can't decrement the reference count of the values while
+ * the main thread is releasing references to the same objects. */
+void copyClientsReplyObjects(void) {
+    listIter li, bi;
+    listNode *ln, *bn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        releaseClientSentReplyBlocks(c);
+        listRewind(c->reply,&bi);
+        while((bn = listNext(&bi))) {
+            clientReplyBlock *b = listNodeValue(bn), *copy;
+            size_t objlen;
+
+            if (b == NULL || b->obj == NULL) continue;
+            objlen = sdslen(b->obj->ptr);
+            copy = createReplyBlock(b->used+objlen+2,1);
+            memcpy(copy->buf,b->buf,b->used);
+            memcpy(copy->buf+b->used,b->obj->ptr,objlen);
+            memcpy(copy->buf+b->used+objlen,"\r\n",2);
+            copy->used = b->used+objlen+2;
+            c->reply_bytes -= replyBlockMemory(b);
+            c->reply_bytes += replyBlockMemory(copy);
+            listNodeValue(bn) = copy;
+            freeReplyBlock(b);
+        }
+    }
+}
+
+/* Fill 'iov' with the static buffer and up to 'maxiov' segments of the
+ * reply list still to send, about NET_MAX_WRITES_PER_EVENT bytes at most.
+ * Blocks referencing an object emit three segments: the bulk header, the
+ * object payload, and the final CRLF. The number of entries used is
+ * returned, and their total length is stored in '*len'. */
+static int clientGetReplyIov(client *c, struct iovec *iov, int maxiov,
+                             size_t *len)
+{
+    int iovcnt = 0, j;
+    size_t iovlen = 0, skip;
+    listIter li;
+    listNode *ln;
+
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        iovlen += iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+
+    /* When the static buffer is pending, sentlen refers to it and the
+     * first block of the list was not touched yet. */
+    skip = (c->bufpos > 0) ? 0 : c->sentlen;
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt <= maxiov-3 &&
+          iovlen < NET_MAX_WRITES_PER_EVENT)
+    {
+        clientReplyBlock *b = listNodeValue(ln);
+        char *seg[3];
+        size_t seglen[3];
+        int numseg = 1;
+
+        seg[0] = b->buf;
+        seglen[0] = b->used;
+        if (b->obj) {
+            seg[1] = b->obj->ptr;
+            seglen[1] = sdslen(b->obj->ptr);
+            seg[2] = "\r\n";
+            seglen[2] = 2;
+            numseg = 3;
+        }
+        for (j = 0; j < numseg; j++) {
+            if (skip >= seglen[j]) {
+                skip -= seglen[j];
+                continue;
+            }
+            iov[iovcnt].iov_base = seg[j]+skip;
+            iov[iovcnt].iov_len = seglen[j]-skip;
+            iovlen += iov[iovcnt].iov_len;
+            iovcnt++;
+            skip = 0;
+        }
+    }
+    *len = iovlen;
+    return iovcnt;
+}
+
+/* Update the client output state (bufpos, sentlen, the reply list and
+ * reply_bytes) after 'nwritten' bytes of what clientGetReplyIov() returned
+ * were transferred: first the static buffer, then the blocks at the head of
+ * the reply list are consumed. */
+static void clientConsumeReply(client *c, size_t nwritten) {
+    size_t remaining = nwritten;
+
+    if (c->bufpos > 0) {
+        size_t buflen = c->bufpos-c->sentlen;
+
+        if (remaining < buflen) {
+            c->sentlen += remaining;
+            return;
+        }
+        c->bufpos = 0;
+        c->sentlen = 0;
+        remaining -= buflen;
+    }
+    while(listLength(c->reply)) {
+        clientReplyBlock *b = listNodeValue(listFirst(c->reply));
+        size_t left = replyBlockSize(b)-c->sentlen;
+
+        if (remaining < left) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= left;
+        releaseReplyHead(c);
+    }
+    /* If there are no longer blocks in the list, we expect the count of
+     * reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0) serverAssert(c->reply_bytes == 0);
+}
+
+/* Gather the static buffer and up to NET_MAX_IOV segments of the reply list
+ * into a single writev() call, instead of issuing a write() for every
+ * block. The client output state is updated to reflect what was actually
+ * transferred, so partial writes are handled exactly like with the plain
+ * write() path.
+ *
+ * When 'more' is true the segments are sent by sendmsg() with MSG_MORE, so
+ * that the kernel may hold a partial segment waiting for the replies of the
+ * next iteration (see reply-cork).
+ *
+ * The return value is the one of writev(). */
+static ssize_t writevToClient(int fd, client *c, int more) {
+    struct iovec iov[NET_MAX_IOV];
+    int iovcnt;
+    size_t iovlen;
+    ssize_t nwritten;
+
+    iovcnt = clientGetReplyIov(c,iov,NET_MAX_IOV,&iovlen);
+    if (iovcnt == 0) {
+        /* Only empty blocks in the list: just release them. */
+        while(listLength(c->reply)) releaseReplyHead(c);
+        serverAssert(c->reply_bytes == 0);
+        return 0;
+    }
+
+    if (more) {
+        struct msghdr msg;
+
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        nwritten = sendmsg(fd,&msg,REPLY_CORK_FLAGS);
+    } else {
+        nwritten = writev(fd,iov,iovcnt);
+    }
+    if (nwritten > 0) clientConsumeReply(c,nwritten);
+    return nwritten;
+}
+
+/* Collect in 'iov' the data of the shared replication buffer the slave 'c'
+ * still has to send, up to NET_MAX_IOV blocks and about
+ * NET_MAX_WRITES_PER_EVENT bytes. Returns the number of entries used. */
+static int replicaGetPendingIov(client *c, struct iovec *iov) {
+    int iovcnt = 0;
+    size_t iovlen = 0, pos = c->ref_block_pos;
+    listNode *ln = c->ref_repl_buf_node;
+    long long limit = aofGroupCommitReplLimit();
+
+    while(ln && iovcnt < NET_MAX_IOV && iovlen < NET_MAX_WRITES_PER_EVENT) {
+        replBufBlock *o = listNodeValue(ln);
+        size_t len = o->used > pos ? o->used-pos : 0;
+
+        /* With the AOF group commit the data not yet on disk is not sent. */
+        if (limit != -1) {
+            long long avail = limit-(o->repl_offset+(long long)pos)+1;
+
+            if (avail <= 0) break;
+            if ((long long)len > avail) len = avail;
+        }
+        if (len) {
+            iov[iovcnt].iov_base = o->buf+pos;
+            iov[iovcnt].iov_len = len;
+            iovlen += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+        pos = 0;
+        ln = listNextNode(ln);
+    }
+    return iovcnt;
+}
+
+/* Move the reference of the slave 'c' to the shared replication buffer
+ * 'len' bytes forward. This may release blocks from the head of the
+ * replication buffer. */
+static void replicaAdvanceReplBuffer(client *c, size_t len) {
+    int moved = 0;
+
+    /* The last block is never left, since more data will be appended. */
+    while(1) {
+        replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+        listNode *next = listNextNode(c->ref_repl_buf_node);
+        size_t left = o->used-c->ref_block_pos;
+
+        if (next == NULL || len < left) {
+            c->ref_block_pos += len;
+            break;
+        }
+        len -= left;
+        o->refcount--;
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        c->ref_repl_buf_node = next;
+        c->ref_block_pos = 0;
+        moved = 1;
+    }
+    if (moved) incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Read in a static buffer the next chunk of the on disk backlog the slave
+ * 'c' has to send, that ends where the block it references in memory
+ * starts. Returns the chunk length, or -1 on read errors. */
+static ssize_t replicaReadBacklogDisk(client *c, char **chunk) {
+    static char buf[NET_MAX_WRITES_PER_EVENT];
+    replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+    long long len = o->repl_offset+c->ref_block_pos-c->repl_disk_off;
+    long long limit = aofGroupCommitReplLimit();
+
+    if (len > (long long)sizeof(buf)) len = sizeof(buf);
+    if (limit != -1 && len > limit-c->repl_disk_off+1)
+        len = limit-c->repl_disk_off+1;
+    *chunk = buf;
+    return readReplicationBacklogDisk(c->repl_disk_off,buf,len);
+}
+
+/* Move the slave 'c' 'len' bytes forward in the on disk backlog: once it
+ * reaches the data in memory it continues from there. */
+static void replicaAdvanceBacklogDisk(client *c, size_t len) {
+    replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+
+    c->repl_disk_off += len;
+    if (c->repl_disk_off == o->repl_offset+(long long)c->ref_block_pos)
+        c->repl_disk_off = -1;
+}
+
+/* Write the replication stream to a slave reading it compressed. The data
+ * of the shared replication buffer is compressed once all the compressed
+ * data was sent, so c->repl_zbuf stays small. */
+static ssize_t writeToCompressedReplica(int fd, client *c) {
+    ssize_t nwritten;
+
+    if (c->repl_zbuf && c->repl_zbuf_sent == sdslen(c->repl_zbuf)) {
+        sdsclear(c->repl_zbuf);
+        c->repl_zbuf_sent = 0;
+    }
+    if (c->repl_zbuf == NULL || sdslen(c->repl_zbuf) == 0) {
+        if (c->repl_disk_off != -1) {
+            char *chunk;
+            ssize_t len = replicaReadBacklogDisk(c,&chunk);
+
+            if (len == -1) return -1;
+            if (replicationCompressStream(c,chunk,len,1) == C_ERR) {
+                errno = EINVAL;
+                return -1;
+            }
+            replicaAdvanceBacklogDisk(c,len);
+        } else {
+            struct iovec iov[NET_MAX_IOV];
+            int iovcnt = replicaGetPendingIov(c,iov), j;
+            size_t consumed = 0;
+
+            if (iovcnt == 0) return 0;
+            for (j = 0; j < iovcnt; j++) {
+                if (replicationCompressStream(c,iov[j].iov_base,
+                        iov[j].iov_len,j == iovcnt-1) == C_ERR)
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+                consumed += iov[j].iov_len;
+            }
+            /* The data is part of the compressed stream now. */
+            replicaAdvanceReplBuffer(c,consumed);
+        }
+    }
+
+    nwritten = write(fd,c->repl_zbuf+c->repl_zbuf_sent,
+                     sdslen(c->repl_zbuf)-c->repl_zbuf_sent);
+    if (nwritten > 0) c->repl_zbuf_sent += nwritten;
+    return nwritten;
+}
+
+/* Write the shared replication buffer to the slave 'c', from the block it
+ * references, with a single writev() gathering the following blocks. The
+ * reference is moved past the blocks sent. This is only called by the main
+ * thread. The return value is the one of writev(). */
+static ssize_t writeToReplica(int fd, client *c) {
+    struct iovec iov[NET_MAX_IOV];
+    int iovcnt;
+    ssize_t nwritten;
+
+    if (c->slave_capa & SLAVE_CAPA_ZSTD) return writeToCompressedReplica(fd,c);
+    if (c->repl_disk_off != -1) {
+        char *chunk;
+        ssize_t len = replicaReadBacklogDisk(c,&chunk);
+
+        if (len == -1) return -1;
+        nwritten = write(fd,chunk,len);
+        if (nwritten > 0) replicaAdvanceBacklogDisk(c,nwritten);
+        return nwritten;
+    }
+    iovcnt = replicaGetPendingIov(c,iov);
+    if (iovcnt == 0) return 0;
+    nwritten = writev(fd,iov,iovcnt);
+    if (nwritten > 0) replicaAdvanceReplBuffer(c,nwritten);
+    return nwritten;
+}
+
+static int writeToClientDone(client *c, ssize_t nwritten, ssize_t totwritten,
+                             long long writes, int more,
+                             int handler_installed);
+
 /* Write data in output buffers to client. Return C_OK if the client
  * is still valid after the call, C_ERR if it was freed. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    sds o;
+    long long writes = 0;
+    int replica = getClientType(c) == CLIENT_TYPE_SLAVE;
+
+    /* Corking only applies to the writes issued after processing the
+     * input: the write handler sends what the socket could not take. */
+    int more = c->reply_cork && !handler_installed;
 
     while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
+        if (replica) {
+            nwritten = writeToReplica(fd,c);
+            writes++;
+            if (nwritten <= 0) break;
+            totwritten += nwritten;
+        } else if (listLength(c->reply) == 0) {
+            /* Only the static buffer is pending: a plain write() is
+             * enough. */
+            if (more)
+                nwritten = send(fd,c->buf+c->sentlen,c->bufpos-c->sentlen,
+                                REPLY_CORK_FLAGS);
+            else
+                nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
+            writes++;
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
             totwritten += nwritten;
@@ -890,29 +1562,12 @@ int writeToClient(int fd, client *c, int handler_installed) {
                 c->sentlen = 0;
             }
         } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
-
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
+            /* Flush the static buffer together with the reply list. */
+            nwritten = writevToClient(fd,c,more);
+            if (nwritten == 0 && !clientHasPendingReplies(c)) break;
+            writes++;
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
             totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objlen;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
         }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
@@ -926,14 +1581,28 @@ int writeToClient(int fd, client *c, int handler_installed) {
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    return writeToClientDone(c,nwritten,totwritten,writes,more,
+                             handler_installed);
+}
+
+/* Account the 'writes' write calls that transferred 'totwritten' bytes to
+ * the client, the last one returning 'nwritten' (with errno set if it is
+ * -1), and handle the outcome: errors, and the end of the reply. Returns
+ * C_OK if the client is still valid, C_ERR if it was freed. */
+static int writeToClientDone(client *c, ssize_t nwritten, ssize_t totwritten,
+                             long long writes, int more,
+                             int handler_installed)
+{
+    atomicIncr(server.stat_net_output_writes,writes);
+    if (more) atomicIncr(server.stat_net_output_corked_writes,writes);
+    atomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -950,7 +1619,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOContext(c);
             return C_ERR;
         }
     }
@@ -959,11 +1628,172 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
 //// 回复客户端
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = privdata;
     UNUSED(el);
     UNUSED(mask);
-    writeToClient(fd,privdata,1);
+
+    /* New replies were appended meanwhile, and they are about writes not
+     * yet on disk: stop writing until the AOF group commit releases it. */
+    if (aofClientMustWaitFsync(c)) {
+        aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+        if (!(c->flags & CLIENT_PENDING_AOF_FSYNC)) {
+            c->flags |= CLIENT_PENDING_AOF_FSYNC;
+            listAddNodeTail(server.clients_waiting_aof_fsync,c);
+        }
+        return;
+    }
+    writeToClient(fd,c,1);
+}
+
+
+/* Return true if the pending replies of 'c' should be written with
+ * MSG_MORE: reply-cork is enabled and the socket has more input ready, so
+ * the replies of the next event loop iteration can fill the same segment. */
+static int clientWantsReplyCork(client *c) {
+#ifdef HAVE_REPLY_CORK
+    int pending = 0;
+
+    if (!server.reply_cork ||
+        c->flags & (CLIENT_UNIX_SOCKET|CLIENT_SLAVE|CLIENT_MASTER|
+                    CLIENT_BLOCKED|CLIENT_CLOSE_AFTER_REPLY|
+                    CLIENT_CLOSE_ASAP)) return 0;
+    if (ioctl(c->fd,FIONREAD,&pending) == -1) return 0;
+    return pending > 0;
+#else
+    UNUSED(c);
+    return 0;
+#endif
+}
+
+/* Remember the clients written with MSG_MORE, so that uncorkClients() can
+ * check them in the next event loop iteration. */
+static void trackCorkedClient(client *c) {
+    if (c->reply_cork && !(c->flags & CLIENT_REPLY_CORKED)) {
+        c->flags |= CLIENT_REPLY_CORKED;
+        listAddNodeTail(server.clients_corked,c);
+    }
+}
+
+/* Called before writing the replies of every event loop iteration. The
+ * clients written with MSG_MORE in the previous iteration that have no new
+ * replies to write are uncorked, so that the kernel sends what it is still
+ * holding right away: the input we expected was not a full command, or the
+ * client got blocked meanwhile. Clients with new replies are handled by the
+ * write itself, that is done without MSG_MORE once the input is drained. */
+void uncorkClients(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.clients_corked,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (c->reply_cork && (c->flags & CLIENT_PENDING_WRITE)) continue;
+        if (c->reply_cork) anetDisableTcpCork(NULL,c->fd);
+        c->reply_cork = 0;
+        c->flags &= ~CLIENT_REPLY_CORKED;
+        listDelNode(server.clients_corked,ln);
+    }
 }
 
+/* Called after writing the replies of a client of clients_pending_write. */
+static void pendingWriteDone(client *c) {
+    trackCorkedClient(c);
+
+    /* If there is nothing left, do nothing. Otherwise install
+     * the write handler. */
+    if (clientHasPendingReplies(c) &&
+        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+            sendReplyToClient, c) == AE_ERR)
+    {
+        freeClientAsync(c);
+    }
+}
+
+/* Reads and writes of different clients submitted together, see
+ * handleClientsWithPendingWritesBatched() and
+ * handleClientsWithPendingReadsBatched(). Every request can use up to
+ * NET_BATCH_MAX_IOV entries of io_batch_iov. */
+typedef struct ioBatchClient {
+    client *c;
+    size_t len;             /* Bytes requested. */
+} ioBatchClient;
+
+static aeIORequest *io_batch_reqs = NULL;
+static ioBatchClient *io_batch_clients = NULL;
+static struct iovec *io_batch_iov = NULL;
+static int io_batch_size = 0;
+
+static void ioBatchReserve(int numreqs) {
+    if (numreqs <= io_batch_size) return;
+    io_batch_reqs = zrealloc(io_batch_reqs,sizeof(aeIORequest)*numreqs);
+    io_batch_clients = zrealloc(io_batch_clients,
+                                sizeof(ioBatchClient)*numreqs);
+    io_batch_iov = zrealloc(io_batch_iov,
+                            sizeof(struct iovec)*NET_BATCH_MAX_IOV*numreqs);
+    io_batch_size = numreqs;
+}
+
+/* Like handleClientsWithPendingWrites(), but the first write of every client
+ * is submitted together with the ones of the other clients, so that with
+ * io_uring the replies of the whole event loop iteration are sent by a
+ * single system call. Slaves, and the clients the socket took the whole
+ * batched write of, continue with writeToClient(). */
+static int handleClientsWithPendingWritesBatched(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_write);
+    int numreqs = 0, j;
+
+    ioBatchReserve(processed);
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        aeIORequest *req = io_batch_reqs+numreqs;
+        size_t len = 0;
+
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+        c->reply_cork = clientWantsReplyCork(c);
+
+        req->iov = io_batch_iov+numreqs*NET_BATCH_MAX_IOV;
+        req->iovcnt = 0;
+        if (getClientType(c) != CLIENT_TYPE_SLAVE)
+            req->iovcnt = clientGetReplyIov(c,req->iov,NET_BATCH_MAX_IOV,&len);
+        if (req->iovcnt == 0) {
+            /* Nothing to batch: a slave, or only empty reply blocks. */
+            if (writeToClient(c->fd,c,0) == C_OK) pendingWriteDone(c);
+            continue;
+        }
+        req->fd = c->fd;
+        req->write = 1;
+        req->flags = c->reply_cork ? REPLY_CORK_FLAGS : 0;
+        io_batch_clients[numreqs].c = c;
+        io_batch_clients[numreqs].len = len;
+        numreqs++;
+    }
+    aeProcessIORequests(server.el,io_batch_reqs,numreqs);
+
+    for (j = 0; j < numreqs; j++) {
+        client *c = io_batch_clients[j].c;
+        ssize_t nwritten = io_batch_reqs[j].res;
+
+        if (nwritten < 0) {
+            errno = -nwritten;
+            nwritten = -1;
+        } else {
+            clientConsumeReply(c,nwritten);
+        }
+        if (writeToClientDone(c,nwritten,nwritten > 0 ? nwritten : 0,1,
+                              c->reply_cork,0) == C_ERR) continue;
+        if ((size_t)nwritten == io_batch_clients[j].len &&
+            clientHasPendingReplies(c) &&
+            writeToClient(c->fd,c,0) == C_ERR) continue;
+        pendingWriteDone(c);
+    }
+    server.stat_io_batched_writes += numreqs;
+    return processed;
+}
 
 //// 将server.clients_pending_write双端链表中的client->fd，创建可写文件事件，并监控
 // 该函数在beforeSleep中会调用，而beforeSleep会在主进程每次循环的时候调用，所以该函数也是被循环执行的
@@ -972,6 +1802,10 @@ int handleClientsWithPendingWrites(void) {
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
 
+    /* With io_uring the writes of many clients take one system call. */
+    if (processed > 1 && aeCanBatchIORequests(server.el))
+        return handleClientsWithPendingWritesBatched();
+
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
@@ -979,16 +1813,9 @@ int handleClientsWithPendingWrites(void) {
         listDelNode(server.clients_pending_write,ln);
 
         /* Try to write buffers to the client socket. */
+        c->reply_cork = clientWantsReplyCork(c);
         if (writeToClient(c->fd,c,0) == C_ERR) continue;
-
-        /* If there is nothing left, do nothing. Otherwise install
-         * the write handler. */
-        if (clientHasPendingReplies(c) &&
-            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-                sendReplyToClient, c) == AE_ERR)
-        {
-            freeClientAsync(c);
-        }
+        pendingWriteDone(c);
     }
     return processed;
 }
@@ -1031,29 +1858,29 @@ int processInlineBuffer(client *c) {
     size_t querylen;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = strchr(c->querybuf+c->qb_pos,'\n');
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError("too big inline request",c,0);
+            setProtocolError("too big inline request",c);
         }
         return C_ERR;
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline && newline != c->querybuf+c->qb_pos && *(newline-1) == '\r')
         newline--;
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-(c->querybuf+c->qb_pos);
+    aux = sdsnewlen(c->querybuf+c->qb_pos,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
         addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError("unbalanced quotes in inline request",c,0);
+        setProtocolError("unbalanced quotes in inline request",c);
         return C_ERR;
     }
 
@@ -1064,7 +1891,7 @@ int processInlineBuffer(client *c) {
         c->repl_ack_time = server.unixtime;
 
     /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    c->qb_pos += querylen+2;
 
     /* Setup argv array on client structure */
     if (argc) {
@@ -1085,19 +1912,22 @@ int processInlineBuffer(client *c) {
     return C_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
+/* Helper function. Logs the protocol error and flags the client to be
+ * closed after the error reply is sent: the rest of the query buffer is
+ * never going to be parsed. */
 #define PROTO_DUMP_LEN 128
-static void setProtocolError(const char *errstr, client *c, int pos) {
-    if (server.verbosity <= LL_VERBOSE) {
+static void setProtocolError(const char *errstr, client *c) {
+    /* The fake client loading the AOF has no connection to describe: the
+     * loader reports the format error by itself. */
+    if (server.verbosity <= LL_VERBOSE && c->fd != -1) {
         sds client = catClientInfoString(sdsempty(),c);
 
         /* Sample some protocol to given an idea about what was inside. */
         char buf[256];
-        if (sdslen(c->querybuf) < PROTO_DUMP_LEN) {
-            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%s'", c->querybuf);
+        if (sdslen(c->querybuf)-c->qb_pos < PROTO_DUMP_LEN) {
+            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%s'", c->querybuf+c->qb_pos);
         } else {
-            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%.*s' (... more %zu bytes ...) '%.*s'", PROTO_DUMP_LEN/2, c->querybuf, sdslen(c->querybuf)-PROTO_DUMP_LEN, PROTO_DUMP_LEN/2, c->querybuf+sdslen(c->querybuf)-PROTO_DUMP_LEN/2);
+            snprintf(buf,sizeof(buf),"Query buffer during protocol error: '%.*s' (... more %zu bytes ...) '%.*s'", PROTO_DUMP_LEN/2, c->querybuf+c->qb_pos, sdslen(c->querybuf)-c->qb_pos-PROTO_DUMP_LEN, PROTO_DUMP_LEN/2, c->querybuf+sdslen(c->querybuf)-PROTO_DUMP_LEN/2);
         }
 
         /* Remove non printable chars. */
@@ -1113,7 +1943,6 @@ static void setProtocolError(const char *errstr, client *c, int pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
 }
 
 /* Process the query buffer for client 'c', setting up the client argument
@@ -1124,12 +1953,19 @@ static void setProtocolError(const char *errstr, client *c, int pos) {
  * case the client structure is setup to reply with the error and close
  * the connection.
  *
+ * The '\r' terminating the "*<count>" and "$<len>" headers are located
+ * using 'idx', which is shared by all the commands parsed by the same
+ * processInputBuffer() call, so that a deep pipeline is scanned a vector
+ * at a time instead of one strchr() per header.
+ *
  * This function is called if processInputBuffer() detects that the next
  * command is in RESP format, so the first byte in the command is found
  * to be '*'. Otherwise for inline commands processInlineBuffer() is called. */
-int processMultibulkBuffer(client *c) {
-    char *newline = NULL;
-    int pos = 0, ok;
+int processMultibulkBuffer(client *c, respIndex *idx) {
+    const char *newline = NULL;
+    size_t pos = c->qb_pos;
+    size_t qblen = sdslen(c->querybuf);
+    int ok;
     long long ll;
 
     if (c->multibulklen == 0) {
@@ -1137,32 +1973,32 @@ int processMultibulkBuffer(client *c) {
         serverAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = respIndexNext(idx,c->querybuf,qblen,pos);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (qblen-pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError("too big mbulk count string",c,0);
+                setProtocolError("too big mbulk count string",c);
             }
             return C_ERR;
         }
 
         /* Buffer should also contain \n */
-        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+        if (newline-(c->querybuf) > ((signed)qblen-2))
             return C_ERR;
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        serverAssertWithInfo(c,NULL,c->querybuf[pos] == '*');
+        ok = respParseLength(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError("invalid mbulk count",c,pos);
+            setProtocolError("invalid mbulk count",c);
             return C_ERR;
         }
 
         pos = (newline-c->querybuf)+2;
         if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
+            c->qb_pos = pos;
             return C_OK;
         }
 
@@ -1177,45 +2013,46 @@ int processMultibulkBuffer(client *c) {
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = respIndexNext(idx,c->querybuf,qblen,pos);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (qblen-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
-                    setProtocolError("too big bulk count string",c,0);
+                    setProtocolError("too big bulk count string",c);
                     return C_ERR;
                 }
                 break;
             }
 
             /* Buffer should also contain \n */
-            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
+            if (newline-(c->querybuf) > ((signed)qblen-2))
                 break;
 
             if (c->querybuf[pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
                     c->querybuf[pos]);
-                setProtocolError("expected $ but got something else",c,pos);
+                setProtocolError("expected $ but got something else",c);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = respParseLength(c->querybuf+pos+1,
+                                 newline-(c->querybuf+pos+1),&ll);
             if (!ok || ll < 0 || ll > 512*1024*1024) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError("invalid bulk length",c,pos);
+                setProtocolError("invalid bulk length",c);
                 return C_ERR;
             }
 
-            pos += newline-(c->querybuf+pos)+2;
+            pos = (newline-c->querybuf)+2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
-                size_t qblen;
-
                 /* If we are going to read a large object from network
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
                 sdsrange(c->querybuf,pos,-1);
+                respIndexReset(idx);
+                c->qb_pos = 0;
                 pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
@@ -1227,7 +2064,7 @@ int processMultibulkBuffer(client *c) {
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if (qblen-pos < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
@@ -1236,7 +2073,7 @@ int processMultibulkBuffer(client *c) {
              * just use the current sds string. */
             if (pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
-                (signed) sdslen(c->querybuf) == c->bulklen+2)
+                qblen == (size_t)(c->bulklen+2))
             {
                 c->argv[c->argc++] = createObject(OBJ_STRING,c->querybuf);
                 sdsIncrLen(c->querybuf,-2); /* remove CRLF */
@@ -1244,6 +2081,7 @@ int processMultibulkBuffer(client *c) {
                  * likely... */
                 c->querybuf = sdsnewlen(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);
+                qblen = 0;
                 pos = 0;
             } else {
                 c->argv[c->argc++] =
@@ -1255,8 +2093,8 @@ int processMultibulkBuffer(client *c) {
         }
     }
 
-    /* Trim to pos */
-    if (pos) sdsrange(c->querybuf,pos,-1);
+    /* Advance to pos: the buffer is trimmed once by processInputBuffer(). */
+    c->qb_pos = pos;
 
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
@@ -1267,10 +2105,38 @@ int processMultibulkBuffer(client *c) {
 
 //// 从c->querybuf中解析客户端命令，执行命令
 void processInputBuffer(client *c) {
-    server.current_client = c;
+    respIndex idx;
+    replApplyBatch batch, *applybatch = NULL;
+    long long applied_ops = 0, reploff = c->reploff;
+
+    /* The current client is only meaningful in the main thread. */
+    if (io_threads_op == IO_THREADS_OP_IDLE) server.current_client = c;
+    respIndexReset(&idx);
+
+    /* The commands of our master are applied as a batch: the memory is
+     * checked once here, see processMasterCommandFast(). If it can't be
+     * freed the commands take the usual path, that refuses the ones
+     * denied during OOM conditions. */
+    if (c->flags & CLIENT_MASTER && server.repl_batch_apply &&
+        io_threads_op == IO_THREADS_OP_IDLE &&
+        c->qb_pos < sdslen(c->querybuf))
+    {
+        batch.cmd = NULL;
+        batch.namelen = 0;
+        batch.calls = 0;
+        applybatch = &batch;
+        if (server.maxmemory && freeMemoryIfNeeded() == C_ERR)
+            applybatch = NULL;
+        /* freeMemoryIfNeeded may flush slave output buffers. This may
+         * result into a slave, that may be the active client, to be
+         * freed. */
+        if (server.current_client == NULL) return;
+    }
 
     // 按照RESP协议解析字符串
-    while(sdslen(c->querybuf)) {
+    while(c->qb_pos < sdslen(c->querybuf) ||
+          (c->flags & CLIENT_PENDING_COMMAND))
+    {
 
         // 首先，根据客户端的当前状态标志c->flags，判断是否需要继续解析处理
 
@@ -1283,10 +2149,17 @@ void processInputBuffer(client *c) {
         // 如果客户端标志c->flags包含REDIS_CLOSE_AFTER_REPLY，则直接返回。该标志表明发生了异常，服务器不再需要处理客户端请求，在回复客户端错误消息后直接关闭链接。
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
+        /* A command was already parsed by an I/O thread: execute it before
+         * looking at the rest of the query buffer. */
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+            goto execute;
+        }
+
         // 如果c->reqtype为0，说明刚要开始处理一条请求（第一次处理c->querybuf中的数据，或刚处理完一条完整的命令请求））
         if (!c->reqtype) {
             // 如果数据c->querybuf的首字节为'*'，说明该请求会跨越多行（包含多个”\r\n”）
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 // 否则说明该请求为单行请求
@@ -1298,20 +2171,36 @@ void processInputBuffer(client *c) {
         if (c->reqtype == PROTO_REQ_INLINE) {
             if (processInlineBuffer(c) != C_OK) break;
         } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
+            if (processMultibulkBuffer(c,&idx) != C_OK) break;
         } else {
             serverPanic("Unknown request type");
         }
 
+        /* If we are in the context of an I/O thread, we can't really
+         * execute the command here. All we can do is to flag the client
+         * as one that needs to process the command. */
+        if (io_threads_op != IO_THREADS_OP_IDLE) {
+            serverAssert(io_threads_op == IO_THREADS_OP_READ);
+            c->flags |= CLIENT_PENDING_COMMAND;
+            break;
+        }
+
+execute:
         // 如果这两个函数返回为REDIS_OK，则说明已经收到并解析好了一条完整的请求，命令的参数已经分解到数组c->argv中，c->argc表示参数个数
         if (c->argc == 0) {
             resetClient(c);
         } else {
             //// 执行命令
-            if (processCommand(c) == C_OK) {
+            if ((applybatch && processMasterCommandFast(c,applybatch)) ||
+                processCommand(c) == C_OK)
+            {
+                /* The commands queued in a transaction are applied, and
+                 * counted, by EXEC. */
                 if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+                    applied_ops++;
                     /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf);
+                    c->reploff = c->read_reploff - sdslen(c->querybuf) +
+                                 c->qb_pos;
                 }
 
                 /* Don't reset the client structure for clients blocked in a
@@ -1327,16 +2216,30 @@ void processInputBuffer(client *c) {
             if (server.current_client == NULL) break;
         }
     }
-    server.current_client = NULL;
+
+    /* Trim the consumed part of the query buffer once for the whole batch
+     * of commands, instead of moving the rest of a deep pipeline after
+     * every single command. Skip it if the client was freed meanwhile. */
+    if (io_threads_op != IO_THREADS_OP_IDLE || server.current_client != NULL) {
+        if (c->qb_pos) {
+            sdsrange(c->querybuf,c->qb_pos,-1);
+            c->qb_pos = 0;
+        }
+        if (applied_ops) {
+            server.stat_repl_applied_ops += applied_ops;
+            server.stat_repl_applied_bytes += c->reploff-reploff;
+            server.stat_repl_apply_batches++;
+        }
+    }
+    if (applybatch) server.stat_numcommands += batch.calls;
+    if (io_threads_op == IO_THREADS_OP_IDLE) server.current_client = NULL;
 }
 
-//// 客户端连接套接字可读时会调用
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    client *c = (client*) privdata;
-    int nread, readlen;
+/* Make room in the query buffer for the next read from the client, and
+ * return the number of bytes to read. */
+static int prepareQueryBufferForRead(client *c) {
+    int readlen;
     size_t qblen;
-    UNUSED(el);
-    UNUSED(mask);
 
     // 首先设置每次read读取的最大字节数readlen为REDIS_IOBUF_LEN(16k)
     readlen = PROTO_IOBUF_LEN;
@@ -1355,33 +2258,51 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     // 为c->querybuf扩容，使其能容纳readlen个字节
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+    return readlen;
+}
+
+/* Handle the outcome of a read of 'nread' bytes from the client, stored at
+ * the end of the query buffer, or in 'zbuf' for the masters compressing the
+ * stream (errno is set if 'nread' is -1). Returns C_OK if new data is ready
+ * to be processed, C_ERR if there is none or the client was freed. */
+static int handleQueryBufferRead(client *c, char *zbuf, int nread) {
+    size_t qblen = sdslen(c->querybuf);
 
-    // 调用read，最多读取readlen个字节。读取的内容追加到c->querybuf尾部。
-    nread = read(fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {// 说明暂无数据
-            return;
+            return C_ERR;
         } else {// 记录错误信息到日志，释放客户端结构redisClient，并关闭链接
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
+            freeClientFromIOContext(c);
+            return C_ERR;
         }
     } else if (nread == 0) {// 客户端断连
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
-    } else if (c->flags & CLIENT_MASTER) {
+        freeClientFromIOContext(c);
+        return C_ERR;
+    }
+    atomicIncr(server.stat_net_input_bytes,nread);
+
+    /* From now on 'nread' is about the uncompressed stream, that defines
+     * the replication offsets. */
+    if (c->repl_dctx) {
+        nread = replicationDecompressStream(c,zbuf,nread);
+        if (nread == -1) {
+            freeClientFromIOContext(c);
+            return C_ERR;
+        }
+    } else {
+        sdsIncrLen(c->querybuf,nread);
+    }
+    if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
          * of the master. We'll use this buffer later in order to have a
          * copy of the string applied by the last command executed. */
         c->pending_querybuf = sdscatlen(c->pending_querybuf,
                                         c->querybuf+qblen,nread);
+        c->read_reploff += nread;
     }
-
-    sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
-    if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
 
     // 限制客户端发送长度（1G）
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
@@ -1391,10 +2312,38 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
-        return;
+        freeClientFromIOContext(c);
+        return C_ERR;
     }
+    return C_OK;
+}
+
+//// 客户端连接套接字可读时会调用
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = (client*) privdata;
+    char zbuf[PROTO_IOBUF_LEN];
+    int nread, readlen;
+    size_t qblen;
+    UNUSED(el);
+    UNUSED(mask);
+
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled, or if
+     * the reads are batched. */
+    if (postponeClientRead(c)) return;
+
+    readlen = prepareQueryBufferForRead(c);
+    qblen = sdslen(c->querybuf);
 
+    // 调用read，最多读取readlen个字节。读取的内容追加到c->querybuf尾部。
+    if (c->repl_dctx) {
+        /* The master compresses the stream: the query buffer only gets
+         * the decompressed data. */
+        nread = read(fd, zbuf, readlen);
+    } else {
+        nread = read(fd, c->querybuf+qblen, readlen);
+    }
+    if (handleQueryBufferRead(c,zbuf,nread) == C_ERR) return;
 
     if (!(c->flags & CLIENT_MASTER)) {
         processInputBuffer(c);      //// 从c->querybuf中解析客户端命令到c->argv/c->argc中
@@ -1486,6 +2435,8 @@ sds catClientInfoString(sds s, client *client) {
     if (client->flags & CLIENT_CLOSE_ASAP) *p++ = 'A';
     if (client->flags & CLIENT_UNIX_SOCKET) *p++ = 'U';
     if (client->flags & CLIENT_READONLY) *p++ = 'r';
+    if (client->flags & CLIENT_TRACKING) *p++ = 't';
+    if (client->flags & CLIENT_TRACKING_BROKEN_REDIR) *p++ = 'R';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
@@ -1507,7 +2458,7 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
+        (unsigned long long) sdslen(client->querybuf)-client->qb_pos,
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
@@ -1536,7 +2487,10 @@ void clientCommand(client *c) {
     listIter li;
     client *client;
 
-    if (!strcasecmp(c->argv[1]->ptr,"list") && c->argc == 2) {
+    if (!strcasecmp(c->argv[1]->ptr,"id") && c->argc == 2) {
+        /* CLIENT ID */
+        addReplyLongLong(c,c->id);
+    } else if (!strcasecmp(c->argv[1]->ptr,"list") && c->argc == 2) {
         /* CLIENT LIST */
         sds o = getAllClientsInfoString();
         addReplyBulkCBuffer(c,o,sdslen(o));
@@ -1681,8 +2635,66 @@ void clientCommand(client *c) {
                                         != C_OK) return;
         pauseClients(duration);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"tracking") && c->argc >= 3) {
+        /* CLIENT TRACKING (on|off) [REDIRECT <id>] [NOLOOP] */
+        long long redir = 0;
+        int noloop = 0;
+
+        /* Parse the options. */
+        for (int j = 3; j < c->argc; j++) {
+            int moreargs = (c->argc-1) - j;
+
+            if (!strcasecmp(c->argv[j]->ptr,"redirect") && moreargs) {
+                j++;
+                if (getLongLongFromObjectOrReply(c,c->argv[j],&redir,NULL) !=
+                    C_OK) return;
+                /* We will require the client with the specified ID to exist
+                 * right now, even if it is possible that it gets disconnected
+                 * later. Still a valid sanity check. */
+                if (lookupClientByID(redir) == NULL) {
+                    addReplyError(c,"The client ID you want redirect to "
+                                    "does not exist");
+                    return;
+                }
+            } else if (!strcasecmp(c->argv[j]->ptr,"noloop")) {
+                noloop = 1;
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }
+
+        if (!strcasecmp(c->argv[2]->ptr,"on")) {
+            /* Invalidation messages can't be mixed with the replies of this
+             * connection: they need to be sent to another client. */
+            if (redir == 0) {
+                addReplyError(c,"CLIENT TRACKING requires the REDIRECT "
+                                "option with the ID of a client subscribed "
+                                "to __redis__:invalidate");
+                return;
+            }
+            if (redir == (long long)c->id) {
+                addReplyError(c,"A client can't redirect the invalidation "
+                                "messages to itself");
+                return;
+            }
+            enableTracking(c,redir,noloop);
+        } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+            disableTracking(c);
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"getredir") && c->argc == 2) {
+        /* CLIENT GETREDIR */
+        if (c->flags & CLIENT_TRACKING) {
+            addReplyLongLong(c,c->client_tracking_redirection);
+        } else {
+            addReplyLongLong(c,-1);
+        }
     } else {
-        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL | GETNAME | SETNAME | PAUSE | REPLY)");
+        addReplyError(c, "Syntax error, try CLIENT (ID | LIST | KILL | GETNAME | SETNAME | PAUSE | REPLY | TRACKING | GETREDIR)");
     }
 }
 
@@ -1782,18 +2794,39 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * It is "virtual" since the reply output list may contain objects that
  * are shared and are not really using additional memory.
  *
- * The function returns the total sum of the length of all the objects
- * stored in the output list, plus the memory used to allocate every
- * list node. The static reply buffer is not taken into account since it
+ * The output list is accounted in blocks: the function returns the total
+ * capacity of the reply blocks, plus the size of the objects they
+ * reference, plus the memory used to allocate every list node and block
+ * header. The static reply buffer is not taken into account since it
  * is allocated anyway.
  *
  * Note: this function is very fast so can be called as many time as
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+5;
-    /* The +5 above means we assume an sds16 hdr, may not be true
-     * but is not going to be a problem. */
+    unsigned long list_item_size = sizeof(listNode)+sizeof(clientReplyBlock);
+
+    /* Slaves use the shared replication buffer from the block they
+     * reference: all the blocks but the last one are full. */
+    if (getClientType(c) == CLIENT_TYPE_SLAVE) {
+        replBufBlock *cur, *last;
+        size_t zbuf, used;
+
+        if (c->ref_repl_buf_node == NULL) return 0;
+        zbuf = c->repl_zbuf ? sdsAllocSize(c->repl_zbuf) : 0;
+        cur = listNodeValue(c->ref_repl_buf_node);
+        last = listNodeValue(listLast(server.repl_buffer_blocks));
+        used = (last->repl_offset+last->size-cur->repl_offset) +
+               (last->id-cur->id+1)*(sizeof(listNode)+sizeof(replBufBlock));
+
+        /* A slave still reading the on disk backlog references the first
+         * block of the backlog in memory: it is only charged for what it
+         * keeps beyond the backlog size. */
+        if (c->repl_disk_off != -1)
+            used = used > (size_t)server.repl_backlog_size ?
+                   used-server.repl_backlog_size : 0;
+        return used + zbuf;
+    }
 
     return c->reply_bytes + (list_item_size*listLength(c->reply));
 }
@@ -1886,7 +2919,10 @@ int checkClientOutputBufferLimits(client *c) {
  * lower level functions pushing data inside the client output buffers. */
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    if (c->flags & CLIENT_CLOSE_ASAP) return;
+    /* Slaves have no reply blocks of their own: their output buffer is
+     * the part of the shared replication buffer they still have to send. */
+    if (c->reply_bytes == 0 && getClientType(c) != CLIENT_TYPE_SLAVE) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -1991,12 +3027,546 @@ int clientsArePaused(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        uncorkClients();
         events += handleClientsWithPendingWrites();
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ *
+ * Socket reads (plus query buffer parsing) and reply writes can be fanned
+ * out to a pool of I/O threads. The main thread collects the clients that
+ * need I/O during an event loop iteration, splits them among the threads
+ * and itself, and then waits for every thread to finish before going on:
+ * commands are still executed by the main thread only, so the dataset and
+ * all the other global state never need locking.
+ * ========================================================================== */
+
+pthread_t io_threads[IO_THREADS_MAX_NUM];
+pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+int io_threads_active;  /* Are the threads currently spinning waiting I/O? */
+
+/* This is the list of clients each thread will serve when threaded I/O is
+ * used. We spawn io_threads_num-1 threads, since one is the main thread
+ * itself. */
+list *io_threads_list[IO_THREADS_MAX_NUM];
+
+static inline unsigned long getIOPendingCount(int i) {
+    unsigned long count = 0;
+    atomicGetWithSync(io_threads_pending[i],count);
+    return count;
+}
+
+static inline void setIOPendingCount(int i, unsigned long count) {
+    atomicSetWithSync(io_threads_pending[i],count);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+
+    while(1) {
+        /* Wait for start */
+        for (int j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        serverAssert(getIOPendingCount(id) != 0);
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listIter li;
+        listNode *ln;
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) {
+            client *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                writeToClient(c->fd,c,0);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                readQueryFromClient(NULL,c->fd,c,0);
+            } else {
+                serverPanic("io_threads_op value is unknown");
+            }
+        }
+        listEmpty(io_threads_list[id]);
+        setIOPendingCount(id, 0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    if (server.io_threads_num > IO_THREADS_MAX_NUM) {
+        serverLog(LL_WARNING,"Fatal: too many I/O threads configured. "
+                             "The maximum number is %d.", IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+
+    /* Spawn and initialize the I/O threads. */
+    for (int i = 0; i < server.io_threads_num; i++) {
+        /* Things we do for all the threads including the main thread. */
+        io_threads_list[i] = listCreate();
+        if (i == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. */
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        setIOPendingCount(i, 0);
+        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+}
+
+void startThreadedIO(void) {
+    serverAssert(io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    io_threads_active = 1;
+}
+
+void stopThreadedIO(void) {
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Wait for all the I/O threads to drop their pending counters to zero. */
+static void waitForIOThreads(void) {
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+}
+
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!io_threads_active) startThreadedIO();
+
+    /* Distribute the clients across N different lists. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_write,&li);
+    int item_id = 0;
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+
+        /* Remove clients from the list of pending writes since
+         * they are going to be closed ASAP. */
+        if (c->flags & CLIENT_CLOSE_ASAP) {
+            listDelNode(server.clients_pending_write, ln);
+            continue;
+        }
+
+        /* Slaves write the shared replication buffer, that only the main
+         * thread can touch. */
+        if (getClientType(c) == CLIENT_TYPE_SLAVE) {
+            listAddNodeTail(io_threads_list[0],c);
+            continue;
+        }
+
+        c->reply_cork = clientWantsReplyCork(c);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = IO_THREADS_OP_WRITE;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        writeToClient(c->fd,c,0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    waitForIOThreads();
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        /* Release the reply blocks the threads wrote. */
+        releaseClientSentReplyBlocks(c);
+        trackCorkedClient(c);
+
+        /* Install the write handler if there are pending writes in some
+         * of the clients. */
+        if (!(c->flags & CLIENT_CLOSE_ASAP) && clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
+    }
+    listEmpty(server.clients_pending_write);
+
+    /* Update processed count on server */
+    server.stat_io_writes_processed += processed;
+
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O,
+ * or batched with the reads of the other clients (io_uring).
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. */
+int postponeClientRead(client *c) {
+    if (((io_threads_active && server.io_threads_do_reads) ||
+         aeCanBatchIORequests(server.el)) &&
+        !ProcessingEventsWhileBlocked &&
+        !server.clients_paused &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ|
+                      CLIENT_BLOCKED)) &&
+        io_threads_op == IO_THREADS_OP_IDLE)
+    {
+        /* Clients are served in the order their input became ready. */
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeTail(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When the event loop can batch the socket I/O (io_uring) and the reads are
+ * not handled by the I/O threads, the readable handler postpones the reads
+ * as well, so that the reads of all the clients that became readable in the
+ * same event loop iteration are submitted at once by this function. The
+ * clients then process their input in order, like after threaded reads. */
+static int handleClientsWithPendingReadsBatched(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_read);
+    int numreqs = 0, j;
+
+    if (processed == 0) return 0;
+    ioBatchReserve(processed);
+    listRewind(server.clients_pending_read,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        aeIORequest *req = io_batch_reqs+numreqs;
+        int readlen = prepareQueryBufferForRead(c);
+
+        req->fd = c->fd;
+        req->write = 0;
+        req->flags = 0;
+        req->iov = io_batch_iov+numreqs*NET_BATCH_MAX_IOV;
+        req->iov[0].iov_base = c->querybuf+sdslen(c->querybuf);
+        req->iov[0].iov_len = readlen;
+        req->iovcnt = 1;
+        io_batch_clients[numreqs].c = c;
+        io_batch_clients[numreqs].len = readlen;
+        numreqs++;
+    }
+    aeProcessIORequests(server.el,io_batch_reqs,numreqs);
+
+    /* Clients that fail are freed, and so removed from the list. */
+    for (j = 0; j < numreqs; j++) {
+        int nread = io_batch_reqs[j].res;
+
+        if (nread < 0) {
+            errno = -nread;
+            nread = -1;
+        }
+        handleQueryBufferRead(io_batch_clients[j].c,NULL,nread);
+    }
+
+    while(listLength(server.clients_pending_read)) {
+        ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+        processInputBuffer(c);
+
+        /* Replies added while the read was pending could not install the
+         * write handler, see prepareClientToWrite(). */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+            clientInstallWriteHandler(c);
+    }
+    server.stat_io_batched_reads += numreqs;
+    return processed;
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    if (!io_threads_active || !server.io_threads_do_reads)
+        return handleClientsWithPendingReadsBatched();
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    /* Distribute the clients across N different lists. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_read,&li);
+    int item_id = 0;
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = IO_THREADS_OP_READ;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        readQueryFromClient(NULL,c->fd,c,0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    /* Wait for all the other threads to end their work. */
+    waitForIOThreads();
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Run the list of clients again to process the new buffers. */
+    while(listLength(server.clients_pending_read)) {
+        ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* Clients that hit an error in the I/O thread are already queued
+         * for asynchronous release. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        processInputBuffer(c);
+
+        /* We may have pending replies if an I/O thread produced replies
+         * (protocol errors) and could not install a write handler. */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+            clientInstallWriteHandler(c);
+    }
+
+    /* Update processed count on server */
+    server.stat_io_reads_processed += processed;
+
+    return processed;
+}
+
+/* ==========================================================================
+ * Accept threads
+ *
+ * When accept-threads is greater than zero, every accept thread listens with
+ * its own SO_REUSEPORT sockets (one for every bound address), so the kernel
+ * spreads the incoming connections among the threads, and a reconnection
+ * storm no longer stalls the event loop in accept(2). The threads accept
+ * the connections and set up the sockets, then queue them for the main
+ * thread, that is woken up via a pipe and creates the clients of the whole
+ * batch at once.
+ * ========================================================================== */
+
+typedef struct acceptedConn {
+    int fd;
+    char ip[NET_IP_STR_LEN];
+    char peerid[NET_PEER_ID_LEN];
+} acceptedConn;
+
+static pthread_mutex_t accept_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static list *accept_queue;  /* Connections waiting for the main thread. */
+static int accept_pipe[2];  /* Used to wake up the main thread. */
+
+void *acceptThreadMain(void *myid) {
+    /* The ID is the thread number, used to select the thread listening
+     * sockets in server.ipfd, that has the same number of sockets for
+     * every thread. */
+    long id = (unsigned long)myid;
+    int numfds = server.ipfd_count/server.accept_threads_num;
+    int *fds = server.ipfd+id*numfds;
+    struct pollfd pfd[CONFIG_BINDADDR_MAX];
+    char err[ANET_ERR_LEN];
+    list *batch = listCreate();
+    int j;
+
+    for (j = 0; j < numfds; j++) {
+        pfd[j].fd = fds[j];
+        pfd[j].events = POLLIN;
+    }
+
+    while(1) {
+        if (poll(pfd,numfds,-1) == -1) continue;
+
+        for (j = 0; j < numfds; j++) {
+            int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
+            char cip[NET_IP_STR_LEN];
+
+            if (!(pfd[j].revents & POLLIN)) continue;
+            while(max--) {
+                cfd = anetTcpNonBlockAccept(err,fds[j],cip,sizeof(cip),&cport);
+                if (cfd == ANET_ERR) {
+                    if (errno != EWOULDBLOCK)
+                        serverLog(LL_WARNING,
+                            "Accepting client connection: %s", err);
+                    break;
+                }
+                anetEnableTcpNoDelay(NULL,cfd);
+                if (server.tcpkeepalive)
+                    anetKeepAlive(NULL,cfd,server.tcpkeepalive);
+
+                acceptedConn *conn = zmalloc(sizeof(*conn));
+                conn->fd = cfd;
+                memcpy(conn->ip,cip,sizeof(cip));
+                anetFormatAddr(conn->peerid,sizeof(conn->peerid),cip,cport);
+                listAddNodeTail(batch,conn);
+            }
+        }
+        if (listLength(batch) == 0) continue;
+
+        pthread_mutex_lock(&accept_queue_mutex);
+        listJoin(accept_queue,batch);
+        pthread_mutex_unlock(&accept_queue_mutex);
+        if (write(accept_pipe[1],"A",1) != 1) {
+            /* The pipe is full: the main thread will wake up anyway. */
+        }
+    }
+    return NULL;
+}
+
+/* Called by the event loop when accept threads queued new connections:
+ * the clients of the queued connections are created in a single batch. */
+void acceptThreadsPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[128];
+    list *batch;
+    listIter li;
+    listNode *ln;
+    UNUSED(el);
+    UNUSED(mask);
+    UNUSED(privdata);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    pthread_mutex_lock(&accept_queue_mutex);
+    batch = accept_queue;
+    accept_queue = listCreate();
+    pthread_mutex_unlock(&accept_queue_mutex);
+
+    listRewind(batch,&li);
+    while((ln = listNext(&li))) {
+        acceptedConn *conn = listNodeValue(ln);
+
+        serverLog(LL_VERBOSE,"Accepted %s", conn->peerid);
+        acceptCommonHandler(conn->fd,0,conn->ip,conn->peerid);
+    }
+    listSetFreeMethod(batch,zfree);
+    listRelease(batch);
+}
+
+/* Spawn the accept threads, if configured. The listening sockets were
+ * already created by initServer(). */
+void initAcceptThreads(void) {
+    long j;
+
+    if (server.accept_threads_num == 0 || server.ipfd_count == 0) return;
+
+    accept_queue = listCreate();
+    if (pipe(accept_pipe) == -1) {
+        serverLog(LL_WARNING,
+            "Can't create the pipe for accept threads: %s", strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,accept_pipe[0]);
+    anetNonBlock(NULL,accept_pipe[1]);
+    if (aeCreateFileEvent(server.el,accept_pipe[0],AE_READABLE,
+        acceptThreadsPipeReadable,NULL) == AE_ERR)
+    {
+        serverPanic("Error registering the accept threads pipe event.");
+    }
+
+    for (j = 0; j < server.accept_threads_num; j++) {
+        pthread_t tid;
+        if (pthread_create(&tid,NULL,acceptThreadMain,(void*)j) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize accept thread.");
+            exit(1);
+        }
+    }
+}
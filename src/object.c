@@ -772,13 +772,19 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         zmalloc_get_fragmentation_ratio(server.resident_set_size);
     mem_total += server.initial_memory_usage;
 
+    /* The replication buffer is shared by the backlog and the slaves: what
+     * exceeds the backlog size is only retained because of the slaves. */
     mem = 0;
-    if (server.repl_backlog)
-        mem += zmalloc_size(server.repl_backlog);
-    mh->repl_backlog = mem;
-    mem_total += mem;
+    if (listLength(server.slaves) &&
+        server.repl_buffer_mem > (size_t)server.repl_backlog_size)
+    {
+        mh->repl_backlog = server.repl_backlog_size;
+        mem = server.repl_buffer_mem - server.repl_backlog_size;
+    } else {
+        mh->repl_backlog = server.repl_buffer_mem;
+    }
+    mem_total += mh->repl_backlog;
 
-    mem = 0;
     if (listLength(server.slaves)) {
         listIter li;
         listNode *ln;
@@ -786,7 +792,6 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            mem += getClientOutputBufferMemoryUsage(c);
             mem += sdsAllocSize(c->querybuf);
             mem += sizeof(client);
         }
@@ -809,13 +814,14 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
             mem += sizeof(client);
         }
     }
+    /* The free reply blocks are kept for the output buffers of clients. */
+    mem += replyBlockPoolMemory();
     mh->clients_normal = mem;
     mem_total+=mem;
 
     mem = 0;
     if (server.aof_state != AOF_OFF) {
         mem += sdslen(server.aof_buf);
-        mem += aofRewriteBufferSize();
     }
     mh->aof_buffer = mem;
     mem_total+=mem;
@@ -29,8 +29,14 @@
 
 #include "server.h"
 #include "lzf.h"    /* LZF compression library */
+#define ZSTD_STATIC_LINKING_ONLY /* Magicless frames and custom allocator. */
+#include "zstd.h"
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
 #include "zipmap.h"
 #include "endianconv.h"
+#include "cluster.h"
 
 #include <math.h>
 #include <sys/types.h>
@@ -41,19 +47,17 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 
-#define rdbExitReportCorruptRDB(...) rdbCheckThenExit(__LINE__,__VA_ARGS__)
-
 extern int rdbCheckMode;
 void rdbCheckError(const char *fmt, ...);
 void rdbCheckSetError(const char *fmt, ...);
 
-void rdbCheckThenExit(int linenum, char *reason, ...) {
+void rdbCheckThenExit(const char *file, int linenum, char *reason, ...) {
     va_list ap;
     char msg[1024];
     int len;
 
     len = snprintf(msg,sizeof(msg),
-        "Internal error in RDB reading function at rdb.c:%d -> ", linenum);
+        "Internal error in RDB reading function at %s:%d -> ", file, linenum);
     va_start(ap,reason);
     vsnprintf(msg+len,sizeof(msg)-len,reason,ap);
     va_end(ap);
@@ -281,13 +285,116 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* ----------------------------------------------------------------------------
+ * Compressed strings. Every codec is identified by its string encoding, see
+ * the RDB_ENC_* defines in rdb.h.
+ * ------------------------------------------------------------------------- */
+
+/* Zstd contexts are expensive to create, so they are kept around. Every
+ * thread has its own: strings are loaded concurrently by the decoder
+ * threads of rdbloader.c. */
+static __thread ZSTD_CCtx *rdbZstdCCtx = NULL;
+static __thread ZSTD_DCtx *rdbZstdDCtx = NULL;
+
+static void *rdbZstdAlloc(void *opaque, size_t size) {
+    UNUSED(opaque);
+    return zmalloc(size);
+}
+
+static void rdbZstdFree(void *opaque, void *ptr) {
+    UNUSED(opaque);
+    zfree(ptr);
+}
+
+static const ZSTD_customMem rdbZstdMem = { rdbZstdAlloc, rdbZstdFree, NULL };
+
+/* Release the codec contexts of the calling thread. */
+void rdbFreeThreadCodecs(void) {
+    ZSTD_freeCCtx(rdbZstdCCtx);
+    ZSTD_freeDCtx(rdbZstdDCtx);
+    rdbZstdCCtx = NULL;
+    rdbZstdDCtx = NULL;
+}
+
+/* Compress 'len' bytes at 's' with 'codec' into the 'outlen' bytes at
+ * 'out'. Returns the compressed length, or 0 if the data doesn't fit. */
+size_t rdbCompress(int codec, unsigned char *s, size_t len,
+                   void *out, size_t outlen)
+{
+    size_t n;
+
+    switch(codec) {
+    case RDB_ENC_LZF:
+        return lzf_compress(s,len,out,outlen);
+#ifdef USE_LZ4
+    case RDB_ENC_LZ4:
+        if (len > LZ4_MAX_INPUT_SIZE) return 0;
+        return LZ4_compress_default((char*)s,out,len,outlen);
+#endif
+    case RDB_ENC_ZSTD:
+        if (rdbZstdCCtx == NULL) {
+            /* The lengths are already part of the RDB encoding, and the
+             * payloads are checksummed by RDB: only the compressed blocks
+             * are stored. */
+            rdbZstdCCtx = ZSTD_createCCtx_advanced(rdbZstdMem);
+            ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_format,
+                ZSTD_f_zstd1_magicless);
+            ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_contentSizeFlag,0);
+            ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_checksumFlag,0);
+            ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_dictIDFlag,0);
+        }
+        ZSTD_CCtx_setParameter(rdbZstdCCtx,ZSTD_c_compressionLevel,
+            server.rdb_zstd_level);
+        n = ZSTD_compress2(rdbZstdCCtx,out,outlen,s,len);
+        return ZSTD_isError(n) ? 0 : n;
+    default:
+        return 0;
+    }
+}
+
+/* Decompress the 'clen' bytes at 'c' into the 'len' bytes at 'val'.
+ * Returns 0 on success, -1 if the data is not valid. */
+static int rdbDecompress(int codec, unsigned char *c, size_t clen,
+                         char *val, size_t len)
+{
+    size_t n;
+
+    switch(codec) {
+    case RDB_ENC_LZF:
+        return lzf_decompress(c,clen,val,len) == 0 ? -1 : 0;
+    case RDB_ENC_LZ4:
+#ifdef USE_LZ4
+        if (clen > INT_MAX || len > INT_MAX) return -1;
+        return LZ4_decompress_safe((char*)c,val,clen,len) == (int)len ? 0 : -1;
+#else
+        serverLog(LL_WARNING,"LZ4 compressed string found, but this "
+                             "server was built without LZ4 support "
+                             "(see USE_LZ4 in the Makefile).");
+        return -1;
+#endif
+    case RDB_ENC_ZSTD:
+        if (rdbZstdDCtx == NULL) {
+            rdbZstdDCtx = ZSTD_createDCtx_advanced(rdbZstdMem);
+            ZSTD_DCtx_setParameter(rdbZstdDCtx,ZSTD_d_format,
+                ZSTD_f_zstd1_magicless);
+        }
+        n = ZSTD_decompressDCtx(rdbZstdDCtx,val,len,c,clen);
+        return (ZSTD_isError(n) || n != len) ? -1 : 0;
+    default:
+        return -1;
+    }
+}
+
+/* Save a compressed string as [codec][compressed len][original len][data].
+ * 'codec' is the string encoding, for instance RDB_ENC_LZF. */
+ssize_t rdbSaveCompressedBlob(rio *rdb, int codec, void *data,
+                              size_t compress_len, size_t original_len)
+{
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|codec;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -306,7 +413,11 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+/* Try to save the string compressed with the codec of the rio. Returns 0 if
+ * the string can't be compressed, so that it should be saved verbatim. */
+ssize_t rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
+    /* rdbSavedObjectLen() has no rio: report the length in the RDB file. */
+    int codec = rdb ? rdb->codec : server.rdb_codec;
     size_t comprlen, outlen;
     void *out;
 
@@ -314,20 +425,22 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = rdbCompress(codec,s,len,out,outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb,codec,out,comprlen,len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
+/* Load a string compressed with the codec 'enctype' in RDB format. The
+ * returned value changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadCompressedStringObject(rio *rdb, int enctype, int flags,
+                                    size_t *lenptr)
+{
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
@@ -348,8 +461,8 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
+    if (rdbDecompress(enctype,c,clen,val,len) == -1) {
+        if (rdbCheckMode) rdbCheckSetError("Invalid compressed string");
         goto err;
     }
     zfree(c);
@@ -383,10 +496,10 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes LZF is unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        n = rdbSaveCompressedStringObject(rdb,s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -461,7 +574,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,len,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -658,7 +773,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveCompressedBlob(rdb,RDB_ENC_LZF,data,
+                        compress_len,node->sz)) == -1) return -1;
                     nwritten += n;
                 } else {
                     if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
@@ -869,6 +985,153 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
     return 1;
 }
 
+/* Key index built by rdbSaveRio() while saving with RDB_SAVE_INDEX. */
+typedef struct rdbIndex {
+    rdbIndexEntry *entries;
+    size_t count, alloc;
+} rdbIndex;
+
+/* Open a new section of the index for 'dbid' and 'slot', starting at the
+ * current offset of 'rdb'. */
+static void rdbIndexOpenSection(rdbIndex *idx, rio *rdb, int dbid,
+                                uint32_t slot)
+{
+    rdbIndexEntry *e;
+
+    if (idx->count == idx->alloc) {
+        idx->alloc = idx->alloc ? idx->alloc*2 : 16;
+        idx->entries = zrealloc(idx->entries,sizeof(*e)*idx->alloc);
+    }
+    e = idx->entries+idx->count++;
+    e->dbid = dbid;
+    e->slot = slot;
+    e->offset = rioTell(rdb);
+    e->len = 0;
+    e->keys = 0;
+    e->crc_before = rdb->cksum;
+    e->crc_after = 0;
+}
+
+/* Close the last section of the index at the current offset of 'rdb'. */
+static void rdbIndexCloseSection(rdbIndex *idx, rio *rdb, uint64_t keys) {
+    rdbIndexEntry *e = idx->entries+idx->count-1;
+
+    e->len = rioTell(rdb)-e->offset;
+    e->keys = keys;
+    e->crc_after = rdb->cksum;
+}
+
+static void rdbIndexEncodeU64(unsigned char *p, uint64_t v) {
+    memrev64ifbe(&v);
+    memcpy(p,&v,8);
+}
+
+static uint64_t rdbIndexDecodeU64(unsigned char *p) {
+    uint64_t v;
+    memcpy(&v,p,8);
+    memrev64ifbe(&v);
+    return v;
+}
+
+static void rdbIndexEncodeEntry(unsigned char *p, rdbIndexEntry *e) {
+    uint32_t dbid = e->dbid, slot = e->slot;
+
+    memrev32ifbe(&dbid);
+    memrev32ifbe(&slot);
+    memcpy(p,&dbid,4);
+    memcpy(p+4,&slot,4);
+    rdbIndexEncodeU64(p+8,e->offset);
+    rdbIndexEncodeU64(p+16,e->len);
+    rdbIndexEncodeU64(p+24,e->keys);
+    rdbIndexEncodeU64(p+32,e->crc_before);
+    rdbIndexEncodeU64(p+40,e->crc_after);
+}
+
+static void rdbIndexDecodeEntry(unsigned char *p, rdbIndexEntry *e) {
+    memcpy(&e->dbid,p,4);
+    memcpy(&e->slot,p+4,4);
+    memrev32ifbe(&e->dbid);
+    memrev32ifbe(&e->slot);
+    e->offset = rdbIndexDecodeU64(p+8);
+    e->len = rdbIndexDecodeU64(p+16);
+    e->keys = rdbIndexDecodeU64(p+24);
+    e->crc_before = rdbIndexDecodeU64(p+32);
+    e->crc_after = rdbIndexDecodeU64(p+40);
+}
+
+/* Write the entries of the index followed by its footer. */
+static int rdbIndexWrite(rio *rdb, rdbIndex *idx) {
+    size_t len = idx->count*RDB_INDEX_ENTRY_SIZE;
+    unsigned char *buf = zmalloc(len+RDB_INDEX_FOOTER_SIZE);
+    size_t j;
+    int retval;
+
+    for (j = 0; j < idx->count; j++)
+        rdbIndexEncodeEntry(buf+j*RDB_INDEX_ENTRY_SIZE,idx->entries+j);
+    rdbIndexEncodeU64(buf+len,idx->count);
+    rdbIndexEncodeU64(buf+len+8,crc64(0,buf,len));
+    memcpy(buf+len+16,RDB_INDEX_MAGIC,8);
+    retval = rdbWriteRaw(rdb,buf,len+RDB_INDEX_FOOTER_SIZE);
+    zfree(buf);
+    return retval == -1 ? -1 : 1;
+}
+
+/* Check that 'buf' of 'len' bytes, the data following the checksum of an
+ * RDB payload, is a valid key index. */
+int rdbIndexTrailerIsValid(unsigned char *buf, size_t len) {
+    uint64_t count;
+
+    if (len < RDB_INDEX_FOOTER_SIZE) return 0;
+    if (memcmp(buf+len-8,RDB_INDEX_MAGIC,8) != 0) return 0;
+    count = rdbIndexDecodeU64(buf+len-RDB_INDEX_FOOTER_SIZE);
+    if (count != (len-RDB_INDEX_FOOTER_SIZE)/RDB_INDEX_ENTRY_SIZE ||
+        (len-RDB_INDEX_FOOTER_SIZE)%RDB_INDEX_ENTRY_SIZE) return 0;
+    return crc64(0,buf,len-RDB_INDEX_FOOTER_SIZE) ==
+           rdbIndexDecodeU64(buf+len-16);
+}
+
+/* Save the keys of 'db' in cluster mode, opening a new section of the index
+ * for every hash slot. The slots to keys map is walked so that the keys are
+ * emitted grouped by slot. */
+static int rdbSaveSlotSections(rio *rdb, redisDb *db, long long now,
+                               rdbIndex *idx)
+{
+    raxIterator ri;
+    sds keystr = sdsempty();
+    uint64_t keys = 0;
+    int slot = -1, retval = 0;
+
+    raxStart(&ri,server.cluster->slots_to_keys);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        int keyslot = (ri.key[0] << 8) | ri.key[1];
+        dictEntry *de;
+        robj key;
+        int saved;
+
+        if (keyslot != slot) {
+            if (slot != -1) rdbIndexCloseSection(idx,rdb,keys);
+            rdbIndexOpenSection(idx,rdb,db->id,keyslot);
+            slot = keyslot;
+            keys = 0;
+        }
+        keystr = sdscpylen(keystr,(char*)ri.key+2,ri.key_len-2);
+        if ((de = dictFind(db->dict,keystr)) == NULL) continue;
+        initStaticStringObject(key,dictGetKey(de));
+        saved = rdbSaveKeyValuePair(rdb,&key,dictGetVal(de),
+                                    getExpire(db,&key),now);
+        if (saved == -1) {
+            retval = -1;
+            break;
+        }
+        keys += saved;
+    }
+    if (retval != -1 && slot != -1) rdbIndexCloseSection(idx,rdb,keys);
+    raxStop(&ri);
+    sdsfree(keystr);
+    return retval;
+}
+
 //// 利用RIO进行写数据操
 int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     dictIterator *di = NULL;
@@ -877,14 +1140,16 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     int j;
     long long now = mstime();
     uint64_t cksum;
-    size_t processed = 0;
+    rdbIndex idx = {NULL,0,0};
 
     // 设置校验和
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
+    /* Sections are verified with the RDB checksum: no checksum, no index. */
+    if (!server.rdb_checksum) flags &= ~RDB_SAVE_INDEX;
 
     // 写入REDIS文件标识和版本号
-    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    snprintf(magic,sizeof(magic),"REDIS%04d",rdbVersionForCodec(rdb->codec));
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
 
     // 写入此时系统相关信息
@@ -923,27 +1188,32 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
         // 写入过期键的个数
         if (rdbSaveLen(rdb,expires_size) == -1) goto werr;
 
+        /* In cluster mode the index has a section for every hash slot. */
+        if ((flags & RDB_SAVE_INDEX) && server.cluster_enabled) {
+            if (rdbSaveSlotSections(rdb,db,now,&idx) == -1) goto werr;
+            dictReleaseIterator(di);
+            continue;
+        }
+
+        uint64_t keys = 0;
+        if (flags & RDB_SAVE_INDEX)
+            rdbIndexOpenSection(&idx,rdb,j,RDB_INDEX_ALL_SLOTS);
+
         // 迭代当前数据库中的每一个节点，并将键值对写入rdb文件
         while((de = dictNext(di)) != NULL) {
             sds keystr = dictGetKey(de);
             robj key, *o = dictGetVal(de);
             long long expire;
+            int saved;
 
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
             // 写入键值对数据
-            if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1) goto werr;
-
-            /* When this RDB is produced as part of an AOF rewrite, move
-             * accumulated diff from parent to child while rewriting in
-             * order to have a smaller final write. */
-            if (flags & RDB_SAVE_AOF_PREAMBLE &&
-                rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES)
-            {
-                processed = rdb->processed_bytes;
-                aofReadDiffFromParent();
-            }
+            if ((saved = rdbSaveKeyValuePair(rdb,&key,o,expire,now)) == -1)
+                goto werr;
+            keys += saved;
         }
+        if (flags & RDB_SAVE_INDEX) rdbIndexCloseSection(&idx,rdb,keys);
         dictReleaseIterator(di);        // 释放迭代器
     }
     di = NULL; // 不释放，留下一次迭代用
@@ -955,12 +1225,18 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     cksum = rdb->cksum;
     memrev64ifbe(&cksum);
     if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+
+    /* The key index follows the checksum, so loaders that don't know about
+     * it just stop reading before it. */
+    if ((flags & RDB_SAVE_INDEX) && rdbIndexWrite(rdb,&idx) == -1) goto werr;
+    zfree(idx.entries);
     return C_OK;
 
 werr:
     // 出错的处理代码
     if (error) *error = errno;
     if (di) dictReleaseIterator(di);
+    zfree(idx.entries);
     return C_ERR;
 }
 
@@ -980,6 +1256,10 @@ int rdbSaveRioWithEOFMark(rio *rdb, int *error, rdbSaveInfo *rsi) {
     if (rioWrite(rdb,"$EOF:",5) == 0) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     if (rioWrite(rdb,"\r\n",2) == 0) goto werr;
+    /* The preamble is never compressed: the slaves reading the payload
+     * compressed expect the stream to start after it. */
+    if (rioFlush(rdb) == 0) goto werr;
+    rdb->flags |= RIO_FLAG_COMPRESS;
     if (rdbSaveRio(rdb,error,RDB_SAVE_NONE,rsi) == C_ERR) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     return C_OK;
@@ -997,7 +1277,7 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     char cwd[MAXPATHLEN];                                       // 当前工作目录
     FILE *fp;
     rio rdb;
-    int error = 0;
+    int error = 0, flags;
 
     snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());        // 创建临时文件
     fp = fopen(tmpfile,"w");                              // 打开临时文件，获取描述符
@@ -1013,7 +1293,12 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     }
 
     rioInitWithFile(&rdb,fp);                                   // 初始化I/0，便于后续写入文件
-    if (rdbSaveRio(&rdb,&error,RDB_SAVE_NONE,rsi) == C_ERR) {   // 利用RIO来执行写入操作
+    /* Only the snapshots created to feed replicas carry the replication
+     * info, see startBgsaveForReplication(). */
+    rdb.codec = rsi ? server.repl_rdb_codec : server.rdb_codec;
+    /* Slaves have no use for the key index, don't send it. */
+    flags = (!rsi && server.rdb_key_index) ? RDB_SAVE_INDEX : RDB_SAVE_NONE;
+    if (rdbSaveRio(&rdb,&error,flags,rsi) == C_ERR) {   // 利用RIO来执行写入操作
         errno = error;
         goto werr;
     }
@@ -1460,19 +1745,22 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 }
 
 /* Mark that we are loading in the global state and setup the fields
- * needed to provide loading stats. */
-void startLoading(FILE *fp) {
-    struct stat sb;
-
+ * needed to provide loading stats. 'size' is the expected payload size, or
+ * zero when it is not known in advance. */
+void startLoading(size_t size) {
     /* Load the DB */
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
-    if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
-    } else {
-        server.loading_total_bytes = sb.st_size;
-    }
+    server.loading_total_bytes = size;
+}
+
+/* Like startLoading() but the payload is the whole file 'fp'. */
+void startLoadingFile(FILE *fp) {
+    struct stat sb;
+
+    if (fstat(fileno(fp), &sb) == -1) sb.st_size = 0;
+    startLoading(sb.st_size);
 }
 
 /* Refresh the loading progress info */
@@ -1487,13 +1775,12 @@ void stopLoading(void) {
     server.loading = 0;
 }
 
-/* Track loading progress in order to serve client's from time to time
-   and if needed calculate rdb checksum  */
-void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
-    if (server.rdb_checksum)
-        rioGenericUpdateChecksum(r, buf, len);
+/* Refresh the loading progress to 'pos' and serve clients, if loading
+ * moved past a loading_process_events_interval_bytes boundary since 'prev'.
+ * This must be called by the main thread. */
+void rdbLoadProcessEvents(size_t prev, size_t pos) {
     if (server.loading_process_events_interval_bytes &&
-        (r->processed_bytes + len)/server.loading_process_events_interval_bytes > r->processed_bytes/server.loading_process_events_interval_bytes)
+        pos/server.loading_process_events_interval_bytes > prev/server.loading_process_events_interval_bytes)
     {
         /* The DB can take some non trivial amount of time to load. Update
          * our cached time since it is used to create and update the last
@@ -1501,11 +1788,49 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
         updateCachedTime();
         if (server.masterhost && server.repl_state == REPL_STATE_TRANSFER)
             replicationSendNewlineToMaster();
-        loadingProgress(r->processed_bytes);
+        loadingProgress(pos);
         processEventsWhileBlocked();
     }
 }
 
+/* Track loading progress in order to serve client's from time to time
+   and if needed calculate rdb checksum  */
+void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
+    if (server.rdb_checksum)
+        rioGenericUpdateChecksum(r, buf, len);
+    rdbLoadProcessEvents(r->processed_bytes,r->processed_bytes+len);
+}
+
+/* Handle an AUX field loaded from the RDB. Takes ownership of 'auxkey'
+ * and 'auxval'. */
+void rdbLoadAuxField(robj *auxkey, robj *auxval, rdbSaveInfo *rsi) {
+    if (((char*)auxkey->ptr)[0] == '%') {
+        /* All the fields with a name staring with '%' are considered
+         * information fields and are logged at startup with a log
+         * level of NOTICE. */
+        serverLog(LL_NOTICE,"RDB '%s': %s",
+            (char*)auxkey->ptr,
+            (char*)auxval->ptr);
+    } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
+        if (rsi) rsi->repl_stream_db = atoi(auxval->ptr);
+    } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
+        if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
+            memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
+            rsi->repl_id_is_set = 1;
+        }
+    } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
+        if (rsi) rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
+    } else {
+        /* We ignore fields we don't understand, as by AUX field
+         * contract. */
+        serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",
+            (char*)auxkey->ptr);
+    }
+
+    decrRefCount(auxkey);
+    decrRefCount(auxval);
+}
+
 //// 加载rdb文件中的数据到内存中
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
     uint64_t dbid;
@@ -1534,6 +1859,14 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
         return C_ERR;
     }
 
+    /* With rdb-load-threads the payload is decoded by a pipeline of
+     * threads, while this thread just adds the keys to the databases.
+     * Module values can only be loaded by the main thread. */
+    if (server.rdb_load_threads && moduleCount() == 0) {
+        if (rdbLoadRioPipelined(rdb,rsi) == C_ERR) goto eoferr;
+        goto loaded;
+    }
+
     while(1) {
         robj *key, *val;
         expiretime = -1;
@@ -1594,32 +1927,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
             robj *auxkey, *auxval;
             if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
             if ((auxval = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-
-            if (((char*)auxkey->ptr)[0] == '%') {
-                /* All the fields with a name staring with '%' are considered
-                 * information fields and are logged at startup with a log
-                 * level of NOTICE. */
-                serverLog(LL_NOTICE,"RDB '%s': %s",
-                    (char*)auxkey->ptr,
-                    (char*)auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
-                if (rsi) rsi->repl_stream_db = atoi(auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
-                if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
-                    memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
-                    rsi->repl_id_is_set = 1;
-                }
-            } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
-                if (rsi) rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
-            } else {
-                /* We ignore fields we don't understand, as by AUX field
-                 * contract. */
-                serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",
-                    (char*)auxkey->ptr);
-            }
-
-            decrRefCount(auxkey);
-            decrRefCount(auxval);
+            rdbLoadAuxField(auxkey,auxval,rsi);
             continue; /* Read type again. */
         }
 
@@ -1645,6 +1953,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
 
         decrRefCount(key);
     }
+
+loaded:
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
         uint64_t cksum, expected = rdb->cksum;
@@ -1661,6 +1971,12 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (rioGetReadError(rdb)) {
+        /* The stream broke, not the payload: loading from the master
+         * socket the caller can still recover the previous state. */
+        serverLog(LL_WARNING,"Short read loading DB: the source stream failed.");
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
@@ -1673,7 +1989,7 @@ int rdbLoad(char *filename, rdbSaveInfo *rsi) {
     int retval;
 
     if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
-    startLoading(fp);
+    startLoadingFile(fp);
     rioInitWithFile(&rdb,fp);
     retval = rdbLoadRio(&rdb,rsi);
     fclose(fp);
@@ -1681,6 +1997,281 @@ int rdbLoad(char *filename, rdbSaveInfo *rsi) {
     return retval;
 }
 
+/* Return true if the key 'key' of the DB 'dbid' is selected by 'filter'. */
+static int rdbLoadFilterMatch(rdbLoadFilter *filter, int dbid, robj *key) {
+    int slot;
+
+    if (filter->dbid != -1 && filter->dbid != dbid) return 0;
+    if (filter->start_slot == -1) return 1;
+    slot = keyHashSlot(key->ptr,sdslen(key->ptr));
+    return slot >= filter->start_slot && slot <= filter->end_slot;
+}
+
+/* Load the records of 'rdb' selected by 'filter', replacing the keys that
+ * already exist. Loading stops at the EOF opcode or, if 'len' is not zero,
+ * after 'len' bytes: this is how a section of the key index is loaded, in
+ * that case the records belong to the DB 'dbid'. The number of keys added
+ * is incremented in '*loaded'.
+ *
+ * Corrupted values are fatal, so the payload must be verified against its
+ * checksum before calling this function. Returns C_ERR on short reads. */
+static int rdbLoadFilteredRio(rio *rdb, int dbid, size_t len,
+                              rdbLoadFilter *filter, long long *loaded)
+{
+    long long expiretime, now = mstime();
+    off_t start = rioTell(rdb);
+    int type;
+
+    while(len == 0 || (size_t)(rioTell(rdb)-start) < len) {
+        robj *key, *val;
+        redisDb *db;
+        expiretime = -1;
+
+        if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            if ((expiretime = rdbLoadTime(rdb)) == -1) return C_ERR;
+            if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
+            expiretime *= 1000;
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1)
+                return C_ERR;
+            if ((type = rdbLoadType(rdb)) == -1) return C_ERR;
+        } else if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            uint64_t id;
+            if ((id = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+            if (id >= (unsigned)server.dbnum) {
+                serverLog(LL_WARNING,
+                    "The RDB file uses DB %llu, only %d DBs are configured",
+                    (unsigned long long)id, server.dbnum);
+                return C_ERR;
+            }
+            dbid = id;
+            continue;
+        } else if (type == RDB_OPCODE_RESIZEDB) {
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return C_ERR;
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return C_ERR;
+            continue;
+        } else if (type == RDB_OPCODE_AUX) {
+            robj *auxkey, *auxval;
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) {
+                decrRefCount(auxkey);
+                return C_ERR;
+            }
+            decrRefCount(auxkey);
+            decrRefCount(auxval);
+            continue;
+        }
+
+        if ((key = rdbLoadStringObject(rdb)) == NULL) return C_ERR;
+        if ((val = rdbLoadObject(type,rdb)) == NULL) {
+            decrRefCount(key);
+            return C_ERR;
+        }
+        if (!rdbLoadFilterMatch(filter,dbid,key) ||
+            (server.masterhost == NULL && expiretime != -1 &&
+             expiretime < now))
+        {
+            decrRefCount(key);
+            decrRefCount(val);
+            continue;
+        }
+        db = server.db+dbid;
+        if (dictFind(db->dict,key->ptr)) dbDelete(db,key);
+        dbAdd(db,key,val);
+        if (expiretime != -1) setExpire(NULL,db,key,expiretime);
+        signalModifiedKey(db,key);
+        server.dirty++;
+        (*loaded)++;
+        decrRefCount(key);
+    }
+    return C_OK;
+}
+
+/* Compute the CRC64 of 'len' bytes of 'fp' starting at 'offset',
+ * continuing the checksum 'crc'. Returns C_ERR on read errors. */
+static int rdbChecksumFileRange(FILE *fp, off_t offset, uint64_t len,
+                                uint64_t *crc)
+{
+    unsigned char buf[PROTO_IOBUF_LEN];
+
+    if (fseeko(fp,offset,SEEK_SET) == -1) return C_ERR;
+    while(len) {
+        size_t toread = len < sizeof(buf) ? len : sizeof(buf);
+        if (fread(buf,toread,1,fp) != 1) return C_ERR;
+        *crc = crc64(*crc,buf,toread);
+        len -= toread;
+    }
+    return C_OK;
+}
+
+/* Read the key index at the end of the RDB file 'fp' of 'size' bytes.
+ * Returns the entries, setting '*count', or NULL if the file has no index.
+ * '*count' is set to -1 if an index exists but it is corrupted. */
+static rdbIndexEntry *rdbReadIndex(FILE *fp, off_t size, long long *count) {
+    unsigned char footer[RDB_INDEX_FOOTER_SIZE], *buf;
+    rdbIndexEntry *entries;
+    uint64_t n, j;
+    off_t start;
+
+    *count = 0;
+    if (size < 9+8+RDB_INDEX_FOOTER_SIZE ||
+        fseeko(fp,size-RDB_INDEX_FOOTER_SIZE,SEEK_SET) == -1 ||
+        fread(footer,sizeof(footer),1,fp) != 1 ||
+        memcmp(footer+16,RDB_INDEX_MAGIC,8) != 0) return NULL;
+
+    *count = -1;
+    n = rdbIndexDecodeU64(footer);
+    if (n > (uint64_t)(size-9-8-RDB_INDEX_FOOTER_SIZE)/RDB_INDEX_ENTRY_SIZE)
+        return NULL;
+    start = size-RDB_INDEX_FOOTER_SIZE-n*RDB_INDEX_ENTRY_SIZE;
+    buf = zmalloc(n*RDB_INDEX_ENTRY_SIZE+1);
+    if (fseeko(fp,start,SEEK_SET) == -1 ||
+        (n && fread(buf,n*RDB_INDEX_ENTRY_SIZE,1,fp) != 1) ||
+        crc64(0,buf,n*RDB_INDEX_ENTRY_SIZE) != rdbIndexDecodeU64(footer+8))
+    {
+        zfree(buf);
+        return NULL;
+    }
+    entries = zmalloc(sizeof(*entries)*(n+1));
+    for (j = 0; j < n; j++) {
+        rdbIndexDecodeEntry(buf+j*RDB_INDEX_ENTRY_SIZE,entries+j);
+        /* Sections live between the header and the RDB checksum. */
+        if (entries[j].offset < 9 ||
+            entries[j].offset+entries[j].len > (uint64_t)start-8 ||
+            entries[j].dbid >= (unsigned)server.dbnum)
+        {
+            zfree(buf);
+            zfree(entries);
+            return NULL;
+        }
+    }
+    zfree(buf);
+    *count = n;
+    return entries;
+}
+
+/* Return true if the index entry 'e' has keys selected by 'filter'. */
+static int rdbIndexEntryMatch(rdbIndexEntry *e, rdbLoadFilter *filter) {
+    if (filter->dbid != -1 && (unsigned)filter->dbid != e->dbid) return 0;
+    if (filter->start_slot == -1 || e->slot == RDB_INDEX_ALL_SLOTS) return 1;
+    return e->slot >= (unsigned)filter->start_slot &&
+           e->slot <= (unsigned)filter->end_slot;
+}
+
+/* Load in memory only the keys of the RDB file 'filename' selected by
+ * 'filter', replacing the existing keys with the same name. The number of
+ * keys loaded is stored in '*loaded'.
+ *
+ * If the file has a key index (see rdb-key-index) only the sections of the
+ * file holding the selected keys are read, otherwise the whole file is
+ * parsed. Either way the data is verified against its checksum before
+ * loading anything, so that a corrupted file is reported as an error
+ * instead of being fatal: files without checksum are refused. */
+int rdbLoadWithFilter(char *filename, rdbLoadFilter *filter,
+                      long long *loaded)
+{
+    rdbIndexEntry *entries = NULL;
+    long long count, j;
+    unsigned char header[9];
+    struct stat sb;
+    size_t bytes = 0;
+    FILE *fp;
+    rio rdb;
+    int rdbver;
+
+    *loaded = 0;
+    if ((fp = fopen(filename,"r")) == NULL) {
+        serverLog(LL_WARNING,"Can't open the RDB file %s: %s",
+            filename, strerror(errno));
+        return C_ERR;
+    }
+    if (fstat(fileno(fp),&sb) == -1 ||
+        fread(header,sizeof(header),1,fp) != 1 ||
+        memcmp(header,"REDIS",5) != 0)
+    {
+        serverLog(LL_WARNING,"The file %s is not an RDB file", filename);
+        goto err;
+    }
+    rdbver = atoi((char*)header+5);
+    if (rdbver < 5 || rdbver > RDB_VERSION) {
+        serverLog(LL_WARNING,
+            "Can't load RDB format version %d: a checksum is required",
+            rdbver);
+        goto err;
+    }
+
+    entries = rdbReadIndex(fp,sb.st_size,&count);
+    if (count == -1) {
+        serverLog(LL_WARNING,"The key index of %s is corrupted", filename);
+        goto err;
+    }
+
+    if (entries) {
+        /* Verify all the sections first, so that nothing is loaded from a
+         * corrupted file. */
+        for (j = 0; j < count; j++) {
+            rdbIndexEntry *e = entries+j;
+            uint64_t crc = e->crc_before;
+
+            if (!rdbIndexEntryMatch(e,filter)) continue;
+            if (rdbChecksumFileRange(fp,e->offset,e->len,&crc) == C_ERR ||
+                crc != e->crc_after)
+            {
+                serverLog(LL_WARNING,
+                    "Wrong checksum for the section of DB %u at offset "
+                    "%llu of %s", e->dbid,
+                    (unsigned long long)e->offset, filename);
+                goto err;
+            }
+        }
+        for (j = 0; j < count; j++) {
+            rdbIndexEntry *e = entries+j;
+
+            if (!rdbIndexEntryMatch(e,filter) || e->len == 0) continue;
+            if (fseeko(fp,e->offset,SEEK_SET) == -1) goto err;
+            rioInitWithFile(&rdb,fp);
+            if (rdbLoadFilteredRio(&rdb,e->dbid,e->len,filter,loaded)
+                == C_ERR) goto eoferr;
+            bytes += e->len;
+        }
+    } else {
+        uint64_t crc = 0, expected;
+
+        if (sb.st_size < 9+8 ||
+            rdbChecksumFileRange(fp,0,sb.st_size-8,&crc) == C_ERR ||
+            fread(&expected,8,1,fp) != 1) goto eoferr;
+        memrev64ifbe(&expected);
+        if (expected == 0 || crc != expected) {
+            serverLog(LL_WARNING, expected == 0 ?
+                "The RDB file %s was saved without checksum" :
+                "Wrong checksum for the RDB file %s", filename);
+            goto err;
+        }
+        if (fseeko(fp,9,SEEK_SET) == -1) goto err;
+        rioInitWithFile(&rdb,fp);
+        if (rdbLoadFilteredRio(&rdb,0,0,filter,loaded) == C_ERR)
+            goto eoferr;
+        bytes = sb.st_size;
+    }
+    serverLog(LL_NOTICE,
+        "Loaded %lld keys from %s reading %zu bytes of %lld (%s)",
+        *loaded, filename, bytes, (long long)sb.st_size,
+        entries ? "using the key index" : "no key index");
+    zfree(entries);
+    fclose(fp);
+    return C_OK;
+
+eoferr:
+    serverLog(LL_WARNING,"Short read loading the RDB file %s", filename);
+err:
+    zfree(entries);
+    fclose(fp);
+    return C_ERR;
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -1829,7 +2420,7 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
 /* Spawn an RDB child that writes the RDB to the sockets of the slaves
  * that are currently in SLAVE_STATE_WAIT_BGSAVE_START state. */
 int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
-    int *fds;
+    int *fds, *compressed, numcompressed = 0;
     uint64_t *clientids;
     int numfds;
     listNode *ln;
@@ -1854,6 +2445,8 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
      * be useful for the child process in order to build the report
      * (sent via unix pipe) that will be sent to the parent. */
     clientids = zmalloc(sizeof(uint64_t)*listLength(server.slaves));
+    /* And the slaves reading the payload compressed. */
+    compressed = zmalloc(sizeof(int)*listLength(server.slaves));
     numfds = 0;
 
     listRewind(server.slaves,&li);
@@ -1862,6 +2455,8 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 
         if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
             clientids[numfds] = slave->id;
+            compressed[numfds] = (slave->slave_capa & SLAVE_CAPA_ZSTD) != 0;
+            numcompressed += compressed[numfds];
             fds[numfds++] = slave->fd;
             replicationSetupSlaveForFullResync(slave,getPsyncInitialOffset());
             /* Put the socket in blocking mode to simplify RDB transfer.
@@ -1881,7 +2476,11 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         rio slave_sockets;
 
         rioInitWithFdset(&slave_sockets,fds,numfds);
+        slave_sockets.codec = server.repl_rdb_codec;
+        if (numcompressed)
+            rioFdsetSetCompression(&slave_sockets,compressed);
         zfree(fds);
+        zfree(compressed);
 
         closeListeningSockets(0);
         redisSetProcTitle("redis-rdb-to-slaves");
@@ -1982,6 +2581,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         }
         zfree(clientids);
         zfree(fds);
+        zfree(compressed);
         return (childpid == -1) ? C_ERR : C_OK;
     }
     return C_OK; /* Unreached. */
@@ -37,8 +37,13 @@
 #include "server.h"
 
 /* The current RDB version. When the format changes in a way that is no longer
- * backward compatible this number gets incremented. */
-#define RDB_VERSION 8
+ * backward compatible this number gets incremented.
+ *
+ * Version 9 only adds the LZ4 and Zstandard string encodings, so what is
+ * saved with the LZF codec is still marked as version 8 and can be loaded
+ * by older instances, see rdbVersionForCodec(). */
+#define RDB_VERSION 9
+#define RDB_VERSION_LZF 8
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -68,6 +73,18 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define RDB_ENC_ZSTD 5        /* string compressed with Zstandard */
+
+/* The compressed string encodings above (the "codecs") are all followed by
+ * the compressed length, the original length and the compressed data. The
+ * codec used to save the strings is configured separately for RDB files,
+ * for the RDB payloads sent to replicas, and for DUMP payloads. */
+#define RDB_CODEC_ZSTD_MAX_LEVEL 22
+
+/* RDB version to write for what is saved with 'codec'. */
+#define rdbVersionForCodec(codec) \
+    ((codec) == RDB_ENC_LZF ? RDB_VERSION_LZF : RDB_VERSION)
 
 /* Dup object types to RDB object types. Only reason is readability (are we
  * dealing with RDB types or with in-memory object types?). */
@@ -118,17 +135,55 @@
 
 #define RDB_SAVE_NONE 0
 #define RDB_SAVE_AOF_PREAMBLE (1<<0)
+#define RDB_SAVE_INDEX (1<<1)   /* Append the key index, see rdb-key-index. */
+
+/* Key index optionally written after the RDB checksum. It is composed of
+ * RDB_INDEX_ENTRY_SIZE bytes entries, one for every section of the file,
+ * followed by a footer: the number of entries, the CRC64 of the entries
+ * and the RDB_INDEX_MAGIC string. All the integers are little endian.
+ *
+ * A section is the byte range holding the keys of a DB or, in cluster mode,
+ * of a hash slot. Every entry stores the RDB checksum before and after its
+ * section, so that sections can be verified without reading the rest of
+ * the file. */
+#define RDB_INDEX_MAGIC "RDBINDEX"
+#define RDB_INDEX_ENTRY_SIZE 48
+#define RDB_INDEX_FOOTER_SIZE 24
+#define RDB_INDEX_ALL_SLOTS 0xffffffff
+
+typedef struct rdbIndexEntry {
+    uint32_t dbid;
+    uint32_t slot;          /* Hash slot, or RDB_INDEX_ALL_SLOTS. */
+    uint64_t offset;        /* Offset of the first record of the section. */
+    uint64_t len;           /* Length of the section in bytes. */
+    uint64_t keys;          /* Number of keys in the section. */
+    uint64_t crc_before;    /* RDB checksum at the start of the section. */
+    uint64_t crc_after;     /* RDB checksum at the end of the section. */
+} rdbIndexEntry;
+
+/* Selects the keys loaded by rdbLoadWithFilter(). */
+typedef struct rdbLoadFilter {
+    int dbid;               /* DB to load, or -1 for all the DBs. */
+    int start_slot;         /* Hash slots range to load, or -1 for */
+    int end_slot;           /* all the keys. */
+} rdbLoadFilter;
+
+#define rdbExitReportCorruptRDB(...) rdbCheckThenExit(__FILE__,__LINE__,__VA_ARGS__)
 
+void rdbCheckThenExit(const char *file, int linenum, char *reason, ...);
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
 time_t rdbLoadTime(rio *rdb);
+long long rdbLoadMillisecondTime(rio *rdb);
 int rdbSaveLen(rio *rdb, uint64_t len);
 uint64_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbLoadLenByRef(rio *rdb, int *isencoded, uint64_t *lenptr);
 int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
 int rdbLoad(char *filename, rdbSaveInfo *rsi);
+int rdbLoadWithFilter(char *filename, rdbLoadFilter *filter, long long *loaded);
+int rdbIndexTrailerIsValid(unsigned char *buf, size_t len);
 int rdbSaveBackground(char *filename, rdbSaveInfo *rsi);
 int rdbSaveToSlavesSockets(rdbSaveInfo *rsi);
 void rdbRemoveTempFile(pid_t childpid);
@@ -147,5 +202,10 @@ int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi);
+void rdbLoadProcessEvents(size_t prev, size_t pos);
+void rdbLoadAuxField(robj *auxkey, robj *auxval, rdbSaveInfo *rsi);
+int rdbLoadRioPipelined(rio *rdb, rdbSaveInfo *rsi);
+void rdbFreeThreadCodecs(void);
+size_t rdbCompress(int codec, unsigned char *s, size_t len, void *out, size_t outlen);
 
 #endif
@@ -0,0 +1,555 @@
+/* rdbloader.c - Multi threaded RDB loading pipeline.
+ *
+ * Loading an RDB with rdbLoadRio() reads the file, decompresses the LZF
+ * strings, builds the value objects and adds them to the databases all in
+ * the main thread. With rdb-load-threads set to N the work is split in a
+ * pipeline instead:
+ *
+ * 1. A reader thread reads the file. It only walks the serialization format
+ *    to find where every value ends, and copies the serialized keys and
+ *    values into batches of records, without decompressing or decoding
+ *    them. Opcodes (SELECTDB, RESIZEDB, AUX, expires) are parsed here.
+ * 2. N decoder threads take the batches, and for every record decompress
+ *    and decode the key and the value with rdbLoadObject(), reading from
+ *    an in memory rio. Values of keys already expired are not decoded.
+ * 3. The main thread applies the decoded batches in the file order: it
+ *    only adds the keys to the databases, sets the expires, and handles
+ *    the AUX fields. Between batches it refreshes the loading progress and
+ *    serves clients exactly like the serial loader.
+ *
+ * The number of batches in flight is bounded, so the memory used by the
+ * pipeline doesn't depend on the size of the file.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <pthread.h>
+
+#define RDB_LOAD_BATCH_BYTES (256*1024) /* Serialized bytes per batch. */
+#define RDB_LOAD_BATCH_RECORDS 1024     /* Max records per batch. */
+#define RDB_LOAD_BATCHES_PER_THREAD 4   /* Batches in flight per decoder. */
+
+/* Record kinds. Key-value records use the RDB object type. */
+#define RDB_LOAD_REC_RESIZEDB -1
+#define RDB_LOAD_REC_AUX -2
+
+typedef struct rdbLoadRecord {
+    int type;               /* RDB object type or RDB_LOAD_REC_* kind. */
+    int dbid;               /* Database of the key. */
+    long long expiretime;   /* Expire of the key in ms, or -1. */
+    size_t off;             /* Offset of the serialized key in 'raw'. */
+    robj *key, *val;        /* Decoded key and value, AUX key and value. */
+    uint64_t db_size, expires_size; /* RESIZEDB hints. */
+} rdbLoadRecord;
+
+#define RDB_LOAD_BATCH_READ 0       /* Waiting for a decoder. */
+#define RDB_LOAD_BATCH_DECODING 1   /* Taken by a decoder. */
+#define RDB_LOAD_BATCH_DECODED 2    /* Ready to be applied. */
+
+typedef struct rdbLoadBatch {
+    sds raw;                /* Serialized keys and values. */
+    rdbLoadRecord *rec;
+    int numrec;
+    int state;              /* RDB_LOAD_BATCH_* state. */
+    int error;              /* A value could not be decoded. */
+    size_t processed_bytes; /* Bytes of the file read up to this batch. */
+    struct rdbLoadBatch *next;
+} rdbLoadBatch;
+
+typedef struct rdbLoadPipeline {
+    rio *rdb;
+    long long now;          /* Time used to skip already expired keys. */
+    pthread_mutex_t lock;
+    pthread_cond_t space;   /* Signaled when a batch was applied. */
+    pthread_cond_t work;    /* Signaled when a batch was read. */
+    pthread_cond_t decoded; /* Signaled when a batch was decoded. */
+    rdbLoadBatch *head, *tail; /* Batches in file order. */
+    int inflight, max_inflight;
+    int eof;                /* The reader is done. */
+    int error;              /* The reader found a short read or bad data. */
+#if defined(USE_JEMALLOC)
+    unsigned arena;         /* Arena of the main thread. */
+    int arena_set;          /* Decoders should allocate from 'arena'. */
+#endif
+} rdbLoadPipeline;
+
+/* ----------------------------------------------------------------------------
+ * Reader thread: copy the serialized records into batches.
+ * ------------------------------------------------------------------------- */
+
+static rdbLoadBatch *rdbLoadCreateBatch(void) {
+    rdbLoadBatch *b = zmalloc(sizeof(*b));
+    b->raw = sdsempty();
+    b->rec = zmalloc(sizeof(rdbLoadRecord)*RDB_LOAD_BATCH_RECORDS);
+    b->numrec = 0;
+    b->state = RDB_LOAD_BATCH_READ;
+    b->error = 0;
+    b->processed_bytes = 0;
+    b->next = NULL;
+    return b;
+}
+
+static void rdbLoadFreeBatch(rdbLoadBatch *b) {
+    sdsfree(b->raw);
+    zfree(b->rec);
+    zfree(b);
+}
+
+/* Append 'len' bytes read from 'rdb' to the batch. */
+static int rdbCopyBytes(rio *rdb, rdbLoadBatch *b, size_t len) {
+    b->raw = sdsMakeRoomFor(b->raw,len);
+    if (rioRead(rdb,b->raw+sdslen(b->raw),len) == 0) return -1;
+    sdsIncrLen(b->raw,len);
+    return 0;
+}
+
+/* Like rdbLoadLenByRef(), but the length is also copied to the batch. */
+static int rdbCopyLen(rio *rdb, rdbLoadBatch *b, int *isencoded,
+                      uint64_t *lenptr)
+{
+    size_t off = sdslen(b->raw);
+    unsigned char *p;
+    int type;
+
+    if (isencoded) *isencoded = 0;
+    if (rdbCopyBytes(rdb,b,1) == -1) return -1;
+    p = (unsigned char*)b->raw+off;
+    type = (p[0]&0xC0)>>6;
+    if (type == RDB_ENCVAL) {
+        if (isencoded) *isencoded = 1;
+        *lenptr = p[0]&0x3F;
+    } else if (type == RDB_6BITLEN) {
+        *lenptr = p[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        if (rdbCopyBytes(rdb,b,1) == -1) return -1;
+        p = (unsigned char*)b->raw+off;
+        *lenptr = ((p[0]&0x3F)<<8)|p[1];
+    } else if (p[0] == RDB_32BITLEN) {
+        uint32_t len;
+        if (rdbCopyBytes(rdb,b,4) == -1) return -1;
+        memcpy(&len,b->raw+off+1,4);
+        *lenptr = ntohl(len);
+    } else if (p[0] == RDB_64BITLEN) {
+        uint64_t len;
+        if (rdbCopyBytes(rdb,b,8) == -1) return -1;
+        memcpy(&len,b->raw+off+1,8);
+        *lenptr = ntohu64(len);
+    } else {
+        rdbExitReportCorruptRDB(
+            "Unknown length encoding %d in rdbLoadLen()",type);
+        return -1; /* Never reached. */
+    }
+    return 0;
+}
+
+/* Copy a string as saved by rdbSaveRawString(), without decompressing it. */
+static int rdbCopyString(rio *rdb, rdbLoadBatch *b) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbCopyLen(rdb,b,&isencoded,&len) == -1) return -1;
+    if (!isencoded) return rdbCopyBytes(rdb,b,len);
+    switch(len) {
+    case RDB_ENC_INT8: return rdbCopyBytes(rdb,b,1);
+    case RDB_ENC_INT16: return rdbCopyBytes(rdb,b,2);
+    case RDB_ENC_INT32: return rdbCopyBytes(rdb,b,4);
+    case RDB_ENC_LZF:
+    case RDB_ENC_LZ4:
+    case RDB_ENC_ZSTD:
+        if (rdbCopyLen(rdb,b,NULL,&clen) == -1) return -1;
+        if (rdbCopyLen(rdb,b,NULL,&len) == -1) return -1;
+        return rdbCopyBytes(rdb,b,clen);
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Copy a double as saved by rdbSaveDoubleValue(). */
+static int rdbCopyDouble(rio *rdb, rdbLoadBatch *b) {
+    unsigned char len;
+
+    if (rdbCopyBytes(rdb,b,1) == -1) return -1;
+    len = b->raw[sdslen(b->raw)-1];
+    if (len >= 253) return 0; /* -inf, +inf, nan. */
+    return rdbCopyBytes(rdb,b,len);
+}
+
+/* Copy a value of the specified RDB type. This must follow the format read
+ * by rdbLoadObject(). */
+static int rdbCopyObject(int rdbtype, rio *rdb, rdbLoadBatch *b) {
+    uint64_t len;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+        return rdbCopyString(rdb,b);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if (rdbCopyLen(rdb,b,NULL,&len) == -1) return -1;
+        while(len--)
+            if (rdbCopyString(rdb,b) == -1) return -1;
+        return 0;
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_ZSET_2:
+        if (rdbCopyLen(rdb,b,NULL,&len) == -1) return -1;
+        while(len--) {
+            if (rdbCopyString(rdb,b) == -1) return -1;
+            if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbCopyBytes(rdb,b,8) == -1) return -1;
+            } else {
+                if (rdbCopyDouble(rdb,b) == -1) return -1;
+            }
+        }
+        return 0;
+    case RDB_TYPE_HASH:
+        if (rdbCopyLen(rdb,b,NULL,&len) == -1) return -1;
+        while(len--) {
+            if (rdbCopyString(rdb,b) == -1) return -1;
+            if (rdbCopyString(rdb,b) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_MODULE:
+    case RDB_TYPE_MODULE_2:
+        /* The pipeline is only used without modules loaded: this reports
+         * the missing module and exits. */
+        rdbLoadObject(rdbtype,rdb);
+        return -1;
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Queue the batch for the decoders, waiting if too many batches are in
+ * flight. */
+static void rdbLoadQueueBatch(rdbLoadPipeline *p, rdbLoadBatch *b) {
+    b->processed_bytes = p->rdb->processed_bytes;
+    pthread_mutex_lock(&p->lock);
+    while (p->inflight >= p->max_inflight)
+        pthread_cond_wait(&p->space,&p->lock);
+    if (p->tail) p->tail->next = b; else p->head = b;
+    p->tail = b;
+    p->inflight++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Read the records up to the EOF opcode. Returns -1 on short reads. */
+static int rdbLoadReadRecords(rdbLoadPipeline *p) {
+    rio *rdb = p->rdb;
+    rdbLoadBatch *b = rdbLoadCreateBatch();
+    int dbid = 0;
+
+    while(1) {
+        rdbLoadRecord *r;
+        long long expiretime = -1;
+        uint64_t len;
+        int type;
+
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+            expiretime *= 1000;
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1)
+                goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+        } else if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+            if (len >= (unsigned)server.dbnum) {
+                serverLog(LL_WARNING,
+                    "FATAL: Data file was created with a Redis "
+                    "server configured to handle more than %d "
+                    "databases. Exiting\n", server.dbnum);
+                exit(1);
+            }
+            dbid = len;
+            continue;
+        }
+
+        r = b->rec+b->numrec;
+        r->type = type;
+        r->dbid = dbid;
+        r->expiretime = expiretime;
+        r->key = r->val = NULL;
+        if (type == RDB_OPCODE_RESIZEDB) {
+            r->type = RDB_LOAD_REC_RESIZEDB;
+            if ((r->db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+                goto eoferr;
+            if ((r->expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+                goto eoferr;
+        } else if (type == RDB_OPCODE_AUX) {
+            r->type = RDB_LOAD_REC_AUX;
+            if ((r->key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            if ((r->val = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+        } else {
+            r->off = sdslen(b->raw);
+            if (rdbCopyString(rdb,b) == -1) goto eoferr;
+            if (rdbCopyObject(type,rdb,b) == -1) goto eoferr;
+        }
+        b->numrec++;
+
+        if (b->numrec == RDB_LOAD_BATCH_RECORDS ||
+            sdslen(b->raw) >= RDB_LOAD_BATCH_BYTES)
+        {
+            rdbLoadQueueBatch(p,b);
+            b = rdbLoadCreateBatch();
+        }
+    }
+    rdbLoadQueueBatch(p,b);
+    return 0;
+
+eoferr:
+    /* Queue what was read so far, so that the main thread frees it. */
+    rdbLoadQueueBatch(p,b);
+    return -1;
+}
+
+static void *rdbLoadReaderMain(void *arg) {
+    rdbLoadPipeline *p = arg;
+    int retval = rdbLoadReadRecords(p);
+
+    pthread_mutex_lock(&p->lock);
+    p->eof = 1;
+    if (retval == -1) p->error = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_cond_broadcast(&p->decoded);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------
+ * Decoder threads: build the keys and values of the batches.
+ * ------------------------------------------------------------------------- */
+
+static void rdbLoadDecodeBatch(rdbLoadPipeline *p, rdbLoadBatch *b) {
+    rio r;
+    int j;
+
+    rioInitWithBuffer(&r,b->raw);
+    for (j = 0; j < b->numrec; j++) {
+        rdbLoadRecord *rec = b->rec+j;
+
+        if (rec->type < 0) continue;
+        r.io.buffer.pos = rec->off;
+        if ((rec->key = rdbLoadStringObject(&r)) == NULL) {
+            b->error = 1;
+            return;
+        }
+        /* Don't build the value of keys the main thread would discard,
+         * see rdbLoadRio(). */
+        if (server.masterhost == NULL && rec->expiretime != -1 &&
+            rec->expiretime < p->now)
+        {
+            decrRefCount(rec->key);
+            rec->key = NULL;
+            continue;
+        }
+        if ((rec->val = rdbLoadObject(rec->type,&r)) == NULL) {
+            b->error = 1;
+            return;
+        }
+    }
+}
+
+static void *rdbLoadDecoderMain(void *arg) {
+    rdbLoadPipeline *p = arg;
+
+#if defined(USE_JEMALLOC)
+    /* The objects built here are going to be used and freed by the main
+     * thread: allocate them from its arena, so that the memory released
+     * after loading can be reused by the main thread. */
+    if (p->arena_set)
+        je_mallctl("thread.arena",NULL,NULL,&p->arena,sizeof(p->arena));
+#endif
+    pthread_mutex_lock(&p->lock);
+    while(1) {
+        rdbLoadBatch *b = p->head;
+
+        while (b && b->state != RDB_LOAD_BATCH_READ) b = b->next;
+        if (b == NULL) {
+            if (p->eof) break;
+            pthread_cond_wait(&p->work,&p->lock);
+            continue;
+        }
+        b->state = RDB_LOAD_BATCH_DECODING;
+        pthread_mutex_unlock(&p->lock);
+        rdbLoadDecodeBatch(p,b);
+        pthread_mutex_lock(&p->lock);
+        b->state = RDB_LOAD_BATCH_DECODED;
+        pthread_cond_broadcast(&p->decoded);
+    }
+    pthread_mutex_unlock(&p->lock);
+    rdbFreeThreadCodecs();
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------
+ * Main thread: apply the decoded batches in order.
+ * ------------------------------------------------------------------------- */
+
+/* Free the objects of the records that were not applied. */
+static void rdbLoadDiscardBatch(rdbLoadBatch *b, int from) {
+    int j;
+
+    for (j = from; j < b->numrec; j++) {
+        if (b->rec[j].key) decrRefCount(b->rec[j].key);
+        if (b->rec[j].val) decrRefCount(b->rec[j].val);
+    }
+    rdbLoadFreeBatch(b);
+}
+
+static void rdbLoadApplyBatch(rdbLoadBatch *b, rdbSaveInfo *rsi) {
+    int j;
+
+    for (j = 0; j < b->numrec; j++) {
+        rdbLoadRecord *r = b->rec+j;
+        redisDb *db = server.db+r->dbid;
+
+        if (r->type == RDB_LOAD_REC_RESIZEDB) {
+            dictExpand(db->dict,r->db_size);
+            dictExpand(db->expires,r->expires_size);
+        } else if (r->type == RDB_LOAD_REC_AUX) {
+            rdbLoadAuxField(r->key,r->val,rsi);
+        } else if (r->val != NULL) {
+            dbAdd(db,r->key,r->val);
+            if (r->expiretime != -1) setExpire(NULL,db,r->key,r->expiretime);
+            decrRefCount(r->key);
+        }
+        /* Else the key was already expired and was not decoded. */
+    }
+    rdbLoadFreeBatch(b);
+}
+
+/* The reader thread can't serve clients while loading: the checksum is
+ * computed by the reader, the progress is reported by the main thread. */
+static void rdbLoadChecksumCallback(rio *r, const void *buf, size_t len) {
+    if (server.rdb_checksum)
+        rioGenericUpdateChecksum(r, buf, len);
+}
+
+/* Load the records of the RDB, after the header, up to the EOF opcode,
+ * using the reader and decoder threads. Called by rdbLoadRio() when
+ * rdb-load-threads is not zero. Returns C_ERR on short reads or decoding
+ * errors. */
+int rdbLoadRioPipelined(rio *rdb, rdbSaveInfo *rsi) {
+    rdbLoadPipeline p;
+    pthread_t reader, *decoders;
+    int numdecoders = server.rdb_load_threads, j, err = 0;
+    void (*update_cksum)(struct _rio *, const void *, size_t);
+    size_t processed = rdb->processed_bytes;
+
+    p.rdb = rdb;
+    p.now = mstime();
+    pthread_mutex_init(&p.lock,NULL);
+    pthread_cond_init(&p.space,NULL);
+    pthread_cond_init(&p.work,NULL);
+    pthread_cond_init(&p.decoded,NULL);
+    p.head = p.tail = NULL;
+    p.inflight = 0;
+    p.max_inflight = numdecoders*RDB_LOAD_BATCHES_PER_THREAD;
+    p.eof = 0;
+    p.error = 0;
+#if defined(USE_JEMALLOC)
+    {
+        size_t sz = sizeof(p.arena);
+        p.arena_set = je_mallctl("thread.arena",&p.arena,&sz,NULL,0) == 0;
+    }
+#endif
+
+    update_cksum = rdb->update_cksum;
+    rdb->update_cksum = rdbLoadChecksumCallback;
+    decoders = zmalloc(sizeof(pthread_t)*numdecoders);
+    if (pthread_create(&reader,NULL,rdbLoadReaderMain,&p) != 0) {
+        serverLog(LL_WARNING,"Fatal: Can't initialize the RDB reader thread.");
+        exit(1);
+    }
+    for (j = 0; j < numdecoders; j++) {
+        if (pthread_create(decoders+j,NULL,rdbLoadDecoderMain,&p) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize RDB decoder threads.");
+            exit(1);
+        }
+    }
+
+    pthread_mutex_lock(&p.lock);
+    while(1) {
+        rdbLoadBatch *b = p.head;
+
+        if (b == NULL) {
+            if (p.eof) break;
+            pthread_cond_wait(&p.decoded,&p.lock);
+            continue;
+        }
+        if (b->state != RDB_LOAD_BATCH_DECODED) {
+            pthread_cond_wait(&p.decoded,&p.lock);
+            continue;
+        }
+        p.head = b->next;
+        if (p.head == NULL) p.tail = NULL;
+        p.inflight--;
+        pthread_cond_signal(&p.space);
+        pthread_mutex_unlock(&p.lock);
+
+        if (b->error || err) {
+            /* Keep consuming so that the threads can terminate. */
+            err = 1;
+            rdbLoadDiscardBatch(b,0);
+        } else {
+            size_t batch_processed = b->processed_bytes;
+
+            rdbLoadApplyBatch(b,rsi);
+            rdbLoadProcessEvents(processed,batch_processed);
+            processed = batch_processed;
+        }
+        pthread_mutex_lock(&p.lock);
+    }
+    if (p.error) err = 1;
+    pthread_mutex_unlock(&p.lock);
+
+    pthread_join(reader,NULL);
+    for (j = 0; j < numdecoders; j++) pthread_join(decoders[j],NULL);
+    zfree(decoders);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.space);
+    pthread_cond_destroy(&p.work);
+    pthread_cond_destroy(&p.decoded);
+    rdb->update_cksum = update_cksum;
+    return err ? C_ERR : C_OK;
+}
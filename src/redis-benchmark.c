@@ -79,6 +79,8 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    long long outbytes;     /* Reply bytes sent by the server in the test. */
+    long long outwrites;    /* write(2) calls the server used to send them. */
 } config;
 
 typedef struct _client {
@@ -440,6 +442,9 @@ static void showLatencyReport(void) {
         printf("  %d parallel clients\n", config.numclients);
         printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
+        if (config.outwrites > 0)
+            printf("  %.2f reply bytes per server write(2) call\n",
+                (double)config.outbytes/config.outwrites);
         printf("\n");
 
         qsort(config.latency,config.requests,sizeof(long long),compareLatency);
@@ -458,12 +463,57 @@ static void showLatencyReport(void) {
     }
 }
 
+/* Fetch from INFO the number of bytes the server wrote to its clients and
+ * the number of write(2) calls it used to do so. Returns 0 if the stats are
+ * not available, for instance because the server is too old to export them. */
+static int getServerOutputStats(long long *bytes, long long *writes) {
+    redisContext *ctx;
+    redisReply *reply = NULL;
+    char *p;
+    int retval = 0;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx == NULL) return 0;
+    if (ctx->err) goto cleanup;
+
+    if (config.auth) {
+        reply = redisCommand(ctx,"AUTH %s",config.auth);
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR) goto cleanup;
+        freeReplyObject(reply);
+    }
+    reply = redisCommand(ctx,"INFO stats");
+    if (reply == NULL || reply->type != REDIS_REPLY_STRING) goto cleanup;
+    if ((p = strstr(reply->str,"total_net_output_bytes:")) == NULL)
+        goto cleanup;
+    *bytes = strtoll(strchr(p,':')+1,NULL,10);
+    if ((p = strstr(reply->str,"total_net_output_writes:")) == NULL)
+        goto cleanup;
+    *writes = strtoll(strchr(p,':')+1,NULL,10);
+    retval = 1;
+
+cleanup:
+    if (reply) freeReplyObject(reply);
+    redisFree(ctx);
+    return retval;
+}
+
 static void benchmark(char *title, char *cmd, int len) {
     client c;
+    long long bytes_start, writes_start, bytes_end, writes_end;
+    int outstats;
 
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
+    config.outbytes = config.outwrites = 0;
+
+    /* Sample the server output stats around the test, so that we can
+     * report how well the server batches replies into write(2) calls. */
+    outstats = !config.quiet && !config.csv &&
+               getServerOutputStats(&bytes_start,&writes_start);
 
     c = createClient(cmd,len,NULL);
     createMissingClients(c);
@@ -472,6 +522,10 @@ static void benchmark(char *title, char *cmd, int len) {
     aeMain(config.el);
     config.totlatency = mstime()-config.start;
 
+    if (outstats && getServerOutputStats(&bytes_end,&writes_end)) {
+        config.outbytes = bytes_end-bytes_start;
+        config.outwrites = writes_end-writes_start;
+    }
     showLatencyReport();
     freeAllClients();
 }
@@ -599,6 +653,9 @@ usage:
 "   $ redis-benchmark -t set -n 1000000 -r 100000000\n\n"
 " Benchmark 127.0.0.1:6379 for a few commands producing CSV output:\n"
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
+" Compare how many reply bytes the server sends per write(2) call when\n"
+" big replies are pipelined (shown in the default, non quiet, output):\n"
+"   $ redis-benchmark -t lrange_600,mget -P 16 -d 100\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
@@ -839,6 +896,16 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
+        if (test_is_selected("mget")) {
+            const char *argv[11];
+            argv[0] = "MGET";
+            for (i = 1; i < 11; i++)
+                argv[i] = "key:__rand_int__";
+            len = redisFormatCommandArgv(&cmd,11,argv,NULL);
+            benchmark("MGET (10 keys)",cmd,len);
+            free(cmd);
+        }
+
         if (!config.csv) printf("\n");
     } while(config.loop);
 
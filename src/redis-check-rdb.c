@@ -172,12 +172,387 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
+/* -----------------------------------------------------------------------------
+ * Memory analysis
+ *
+ * With --analyze every key is loaded with rdbLoadObject() like the server
+ * would do, and the memory it would use is estimated with
+ * objectComputeSize(), the function behind MEMORY USAGE. The statistics are
+ * aggregated while the file is streamed, so only the biggest keys and a
+ * bounded number of key prefixes are retained.
+ * -------------------------------------------------------------------------- */
+
+#define ANALYZE_DEFAULT_TOP 10
+#define ANALYZE_MAX_PREFIXES 1024
+#define ANALYZE_DEFAULT_DELIMITERS ":"
+#define ANALYZE_MIN_COMPRESS_LEN 20 /* Shorter strings are never compressed. */
+
+#define ANALYZE_TTL_NONE 0
+#define ANALYZE_TTL_EXPIRED 1
+#define ANALYZE_TTL_MINUTE 2
+#define ANALYZE_TTL_HOUR 3
+#define ANALYZE_TTL_DAY 4
+#define ANALYZE_TTL_WEEK 5
+#define ANALYZE_TTL_LONGER 6
+#define ANALYZE_TTL_BUCKETS 7
+
+char *analyze_ttl_string[] = {
+    "no expire",
+    "already expired",
+    "< 1 minute",
+    "< 1 hour",
+    "< 1 day",
+    "< 1 week",
+    ">= 1 week"
+};
+
+struct {
+    char *name;
+    int codec;
+} analyze_codecs[] = {
+    {"lzf", RDB_ENC_LZF},
+#ifdef USE_LZ4
+    {"lz4", RDB_ENC_LZ4},
+#endif
+    {"zstd", RDB_ENC_ZSTD}
+};
+
+#define ANALYZE_CODECS (sizeof(analyze_codecs)/sizeof(analyze_codecs[0]))
+
+typedef struct analyzeStat {
+    unsigned long long keys;
+    unsigned long long bytes;
+} analyzeStat;
+
+typedef struct analyzeKey {
+    sds name;
+    uint64_t dbid;
+    int type;
+    size_t bytes;
+} analyzeKey;
+
+void bytesToHuman(char *s, unsigned long long n);
+void dictVanillaFree(void *privdata, void *val);
+
+/* Key prefix -> analyzeStat. */
+dictType analyzePrefixDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictVanillaFree             /* val destructor */
+};
+
+struct {
+    int enabled;
+    int top;                        /* Number of biggest keys to report. */
+    char *delimiters;               /* Characters ending a key prefix. */
+    long long samples;              /* Elements sampled for every value. */
+    analyzeStat total;
+    analyzeStat types[OBJ_MODULE+1];
+    analyzeStat encodings[OBJ_ENCODING_QUICKLIST+1];
+    analyzeStat ttl[ANALYZE_TTL_BUCKETS];
+    dict *prefixes;
+    analyzeStat no_prefix;          /* Keys without any delimiter. */
+    analyzeStat other_prefixes;     /* Keys beyond ANALYZE_MAX_PREFIXES. */
+    analyzeKey *biggest;            /* Min heap of the biggest keys. */
+    int biggest_len;
+    unsigned long long blob_bytes;  /* Bytes of the strings in the values. */
+    unsigned long long compressed_bytes[ANALYZE_CODECS];
+    unsigned char *cbuf;            /* Compression output buffer. */
+    size_t cbuf_len;
+} analyze;
+
+char *analyzeTypeName(int type) {
+    switch(type) {
+    case OBJ_STRING: return "string";
+    case OBJ_LIST: return "list";
+    case OBJ_SET: return "set";
+    case OBJ_ZSET: return "zset";
+    case OBJ_HASH: return "hash";
+    case OBJ_MODULE: return "module";
+    default: return "unknown";
+    }
+}
+
+void analyzeInit(void) {
+    analyze.prefixes = dictCreate(&analyzePrefixDictType,NULL);
+    analyze.biggest = zmalloc(sizeof(analyzeKey)*analyze.top);
+}
+
+void analyzeStatAdd(analyzeStat *stat, size_t bytes) {
+    stat->keys++;
+    stat->bytes += bytes;
+}
+
+/* Account a string of the value for the compressibility report: it is
+ * compressed with every codec, as RDB would do when saving it. */
+void analyzeBlob(unsigned char *s, size_t len) {
+    unsigned int j;
+
+    analyze.blob_bytes += len;
+    if (len > analyze.cbuf_len) {
+        analyze.cbuf = zrealloc(analyze.cbuf,len);
+        analyze.cbuf_len = len;
+    }
+    for (j = 0; j < ANALYZE_CODECS; j++) {
+        size_t clen = 0;
+
+        if (len > ANALYZE_MIN_COMPRESS_LEN)
+            clen = rdbCompress(analyze_codecs[j].codec,s,len,
+                               analyze.cbuf,len);
+        analyze.compressed_bytes[j] += clen ? clen : len;
+    }
+}
+
+/* Call analyzeBlob() for the strings of the value, that is the
+ * serialized encodings and the elements of the hash tables. */
+void analyzeValueBlobs(robj *o) {
+    dictIterator *di;
+    dictEntry *de;
+
+    if (o->type == OBJ_STRING) {
+        if (sdsEncodedObject(o)) analyzeBlob(o->ptr,sdslen(o->ptr));
+    } else if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+        quicklistNode *node = ((quicklist*)o->ptr)->head;
+
+        for (; node; node = node->next) {
+            if (node->encoding == QUICKLIST_NODE_ENCODING_RAW)
+                analyzeBlob(node->zl,node->sz);
+        }
+    } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+        analyzeBlob(o->ptr,ziplistBlobLen(o->ptr));
+    } else if (o->encoding == OBJ_ENCODING_INTSET) {
+        analyzeBlob(o->ptr,intsetBlobLen(o->ptr));
+    } else if (o->encoding == OBJ_ENCODING_HT ||
+               o->encoding == OBJ_ENCODING_SKIPLIST)
+    {
+        dict *d = (o->encoding == OBJ_ENCODING_HT) ? o->ptr :
+                                                     ((zset*)o->ptr)->dict;
+
+        di = dictGetIterator(d);
+        while((de = dictNext(di)) != NULL) {
+            sds ele = dictGetKey(de);
+
+            analyzeBlob((unsigned char*)ele,sdslen(ele));
+            if (o->type == OBJ_HASH) {
+                ele = dictGetVal(de);
+                analyzeBlob((unsigned char*)ele,sdslen(ele));
+            }
+        }
+        dictReleaseIterator(di);
+    }
+}
+
+/* Account the key to its prefix, the bytes before the first delimiter. */
+void analyzePrefix(sds key, size_t bytes) {
+    size_t len = sdslen(key), j;
+    dictEntry *de;
+    sds prefix;
+
+    for (j = 0; j < len; j++)
+        if (key[j] && strchr(analyze.delimiters,key[j])) break;
+    if (j == len) {
+        analyzeStatAdd(&analyze.no_prefix,bytes);
+        return;
+    }
+
+    prefix = sdsnewlen(key,j);
+    de = dictFind(analyze.prefixes,prefix);
+    if (de) {
+        analyzeStatAdd(dictGetVal(de),bytes);
+        sdsfree(prefix);
+    } else if (dictSize(analyze.prefixes) < ANALYZE_MAX_PREFIXES) {
+        analyzeStat *stat = zcalloc(sizeof(*stat));
+
+        analyzeStatAdd(stat,bytes);
+        dictAdd(analyze.prefixes,prefix,stat);
+    } else {
+        analyzeStatAdd(&analyze.other_prefixes,bytes);
+        sdsfree(prefix);
+    }
+}
+
+/* Swap the heap elements until 'j' is bigger than its parent. */
+void analyzeHeapUp(int j) {
+    analyzeKey *h = analyze.biggest;
+
+    while (j > 0 && h[(j-1)/2].bytes > h[j].bytes) {
+        analyzeKey tmp = h[j];
+        h[j] = h[(j-1)/2];
+        h[(j-1)/2] = tmp;
+        j = (j-1)/2;
+    }
+}
+
+/* Swap the heap elements until 'j' is smaller than its children. */
+void analyzeHeapDown(int j) {
+    analyzeKey *h = analyze.biggest;
+
+    while (1) {
+        int min = j, l = j*2+1, r = j*2+2;
+
+        if (l < analyze.biggest_len && h[l].bytes < h[min].bytes) min = l;
+        if (r < analyze.biggest_len && h[r].bytes < h[min].bytes) min = r;
+        if (min == j) break;
+        analyzeKey tmp = h[j];
+        h[j] = h[min];
+        h[min] = tmp;
+        j = min;
+    }
+}
+
+/* Keep the key if it is among the 'top' biggest seen so far. */
+void analyzeBiggest(uint64_t dbid, robj *key, int type, size_t bytes) {
+    analyzeKey *k;
+
+    if (analyze.top == 0) return;
+    if (analyze.biggest_len < analyze.top) {
+        k = analyze.biggest+analyze.biggest_len++;
+    } else if (bytes > analyze.biggest[0].bytes) {
+        k = analyze.biggest;
+        sdsfree(k->name);
+    } else {
+        return;
+    }
+    k->name = sdsdup(key->ptr);
+    k->dbid = dbid;
+    k->type = type;
+    k->bytes = bytes;
+    if (k == analyze.biggest) analyzeHeapDown(0);
+    else analyzeHeapUp(analyze.biggest_len-1);
+}
+
+/* Account a key read from the RDB file. */
+void analyzeKeyValue(uint64_t dbid, robj *key, robj *val,
+                     long long expiretime, long long now)
+{
+    size_t bytes;
+    int ttl;
+
+    /* The same estimate of MEMORY USAGE, plus the expire entry if any. */
+    bytes = objectComputeSize(val,analyze.samples);
+    bytes += sdsAllocSize(key->ptr);
+    bytes += sizeof(dictEntry);
+    if (expiretime != -1) bytes += sizeof(dictEntry);
+
+    if (expiretime == -1) {
+        ttl = ANALYZE_TTL_NONE;
+    } else if (expiretime < now) {
+        ttl = ANALYZE_TTL_EXPIRED;
+    } else {
+        long long secs = (expiretime-now)/1000;
+
+        if (secs < 60) ttl = ANALYZE_TTL_MINUTE;
+        else if (secs < 3600) ttl = ANALYZE_TTL_HOUR;
+        else if (secs < 3600*24) ttl = ANALYZE_TTL_DAY;
+        else if (secs < 3600*24*7) ttl = ANALYZE_TTL_WEEK;
+        else ttl = ANALYZE_TTL_LONGER;
+    }
+
+    analyzeStatAdd(&analyze.total,bytes);
+    if (val->type <= OBJ_MODULE) analyzeStatAdd(&analyze.types[val->type],bytes);
+    if (val->encoding <= OBJ_ENCODING_QUICKLIST)
+        analyzeStatAdd(&analyze.encodings[val->encoding],bytes);
+    analyzeStatAdd(&analyze.ttl[ttl],bytes);
+    analyzePrefix(key->ptr,bytes);
+    analyzeBiggest(dbid,key,val->type,bytes);
+    analyzeValueBlobs(val);
+}
+
+void analyzePrintStat(const char *name, analyzeStat *stat) {
+    char hmem[64];
+
+    if (stat->keys == 0) return;
+    bytesToHuman(hmem,stat->bytes);
+    printf("  %-24s keys: %-12llu memory: %-10s (%.2f%%)\n",
+        name, stat->keys, hmem,
+        analyze.total.bytes ?
+            (double)stat->bytes*100/analyze.total.bytes : 0);
+}
+
+int analyzeCompareStat(const void *a, const void *b) {
+    const analyzeStat *sa = dictGetVal(*(dictEntry**)a);
+    const analyzeStat *sb = dictGetVal(*(dictEntry**)b);
+
+    if (sa->bytes == sb->bytes) return 0;
+    return (sa->bytes < sb->bytes) ? 1 : -1;
+}
+
+int analyzeCompareKey(const void *a, const void *b) {
+    const analyzeKey *ka = a, *kb = b;
+
+    if (ka->bytes == kb->bytes) return 0;
+    return (ka->bytes < kb->bytes) ? 1 : -1;
+}
+
+void analyzeReport(void) {
+    char hmem[64];
+    dictEntry **prefixes, *de;
+    dictIterator *di;
+    unsigned long j, len = 0;
+    int i;
+
+    bytesToHuman(hmem,analyze.total.bytes);
+    printf("--- MEMORY ANALYSIS ---\n");
+    printf("Estimated memory of %llu keys: %s (%llu bytes)\n",
+        analyze.total.keys, hmem, analyze.total.bytes);
+
+    printf("By type:\n");
+    for (i = 0; i <= OBJ_MODULE; i++)
+        analyzePrintStat(analyzeTypeName(i),&analyze.types[i]);
+
+    printf("By encoding:\n");
+    for (i = 0; i <= OBJ_ENCODING_QUICKLIST; i++)
+        analyzePrintStat(strEncoding(i),&analyze.encodings[i]);
+
+    printf("By key prefix (delimiters '%s'):\n", analyze.delimiters);
+    prefixes = zmalloc(sizeof(dictEntry*)*(dictSize(analyze.prefixes)+1));
+    di = dictGetIterator(analyze.prefixes);
+    while((de = dictNext(di)) != NULL) prefixes[len++] = de;
+    dictReleaseIterator(di);
+    qsort(prefixes,len,sizeof(dictEntry*),analyzeCompareStat);
+    for (j = 0; j < len; j++)
+        analyzePrintStat(dictGetKey(prefixes[j]),dictGetVal(prefixes[j]));
+    zfree(prefixes);
+    analyzePrintStat("(no prefix)",&analyze.no_prefix);
+    analyzePrintStat("(other prefixes)",&analyze.other_prefixes);
+
+    printf("By time to live:\n");
+    for (i = 0; i < ANALYZE_TTL_BUCKETS; i++)
+        analyzePrintStat(analyze_ttl_string[i],&analyze.ttl[i]);
+
+    printf("Biggest keys:\n");
+    qsort(analyze.biggest,analyze.biggest_len,sizeof(analyzeKey),
+          analyzeCompareKey);
+    for (i = 0; i < analyze.biggest_len; i++) {
+        analyzeKey *k = analyze.biggest+i;
+
+        bytesToHuman(hmem,k->bytes);
+        printf("  db %-4llu %-8s %-10s %s\n",
+            (unsigned long long) k->dbid, analyzeTypeName(k->type),
+            hmem, k->name);
+    }
+
+    bytesToHuman(hmem,analyze.blob_bytes);
+    printf("Compressibility of %s of strings:\n", hmem);
+    for (j = 0; j < ANALYZE_CODECS; j++) {
+        bytesToHuman(hmem,analyze.compressed_bytes[j]);
+        printf("  %-24s compressed: %-10s (%.2f%%)\n",
+            analyze_codecs[j].name, hmem,
+            analyze.blob_bytes ?
+                (double)analyze.compressed_bytes[j]*100/analyze.blob_bytes :
+                100);
+    }
+}
+
 /* Check the specified RDB file. Return 0 if the RDB looks sane, otherwise
  * 1 is returned.
  * The file is specified as a filename in 'rdbfilename' if 'fp' is not NULL,
  * otherwise the already open file 'fp' is checked. */
 int redis_check_rdb(char *rdbfilename, FILE *fp) {
-    uint64_t dbid;
+    uint64_t dbid = 0;
     int type, rdbver;
     char buf[1024];
     long long expiretime, now = mstime();
@@ -201,7 +576,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
         return 1;
     }
 
-    startLoading(fp);
+    startLoadingFile(fp);
     while(1) {
         robj *key, *val;
         expiretime = -1;
@@ -291,6 +666,7 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
         if (server.masterhost == NULL && expiretime != -1 && expiretime < now)
             rdbstate.already_expired++;
         if (expiretime != -1) rdbstate.expires++;
+        if (analyze.enabled) analyzeKeyValue(dbid,key,val,expiretime,now);
         rdbstate.key = NULL;
         decrRefCount(key);
         decrRefCount(val);
@@ -337,9 +713,40 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
  * Otherwise if called with a non NULL fp, the function returns C_OK or
  * C_ERR depending on the success or failure. */
 int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
-    if (argc != 2 && fp == NULL) {
-        fprintf(stderr, "Usage: %s <rdb-file-name>\n", argv[0]);
-        exit(1);
+    char *filename = argv[1];
+
+    if (fp == NULL) {
+        int j;
+
+        analyze.top = ANALYZE_DEFAULT_TOP;
+        analyze.delimiters = ANALYZE_DEFAULT_DELIMITERS;
+        analyze.samples = 0;
+        for (j = 1; j < argc-1; j++) {
+            int moreargs = j < argc-2;
+
+            if (!strcmp(argv[j],"--analyze")) {
+                analyze.enabled = 1;
+            } else if (!strcmp(argv[j],"--top") && moreargs) {
+                analyze.top = atoi(argv[++j]);
+                if (analyze.top < 0) analyze.top = 0;
+            } else if (!strcmp(argv[j],"--prefix-delimiters") && moreargs) {
+                analyze.delimiters = argv[++j];
+            } else if (!strcmp(argv[j],"--samples") && moreargs) {
+                analyze.samples = strtoll(argv[++j],NULL,10);
+            } else {
+                break;
+            }
+        }
+        if (argc < 2 || j != argc-1) {
+            fprintf(stderr, "Usage: %s [--analyze [--top <count>] "
+                "[--prefix-delimiters <chars>] [--samples <count>]] "
+                "<rdb-file-name>\n", argv[0]);
+            exit(1);
+        }
+        filename = argv[argc-1];
+        /* Like MEMORY USAGE, zero means that all the elements are used. */
+        if (analyze.samples <= 0) analyze.samples = LLONG_MAX;
+        if (analyze.enabled) analyzeInit();
     }
     /* In order to call the loading functions we need to create the shared
      * integer objects, however since this function may be called from
@@ -348,12 +755,13 @@ int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
         createSharedObjects();
     server.loading_process_events_interval_bytes = 0;
     rdbCheckMode = 1;
-    rdbCheckInfo("Checking RDB file %s", argv[1]);
+    rdbCheckInfo("Checking RDB file %s", filename);
     rdbCheckSetupSignals();
-    int retval = redis_check_rdb(argv[1],fp);
+    int retval = redis_check_rdb(filename,fp);
     if (retval == 0) {
         rdbCheckInfo("\\o/ RDB looks OK! \\o/");
         rdbShowGenericInfo();
+        if (analyze.enabled) analyzeReport();
     }
     if (fp) return (retval == 0) ? C_OK : C_ERR;
     exit(retval);
@@ -29,7 +29,9 @@
  */
 
 
+#define ZSTD_STATIC_LINKING_ONLY /* Custom allocator. */
 #include "server.h"
+#include "zstd.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -74,83 +76,304 @@ char *replicationGetSlaveName(client *c) {
 
 /* ---------------------------------- MASTER -------------------------------- */
 
+/* Blocks of the replication buffer released at most by every call to
+ * incrementalTrimReplicationBacklog(), in order to bound the latency when
+ * the backlog is resized to a much smaller size. */
+
+/* Open the ring file of the on disk backlog tier, if enabled. The file is
+ * unlinked at once, its content is only meaningful for this process. */
+static void openReplicationBacklogDisk(replBacklog *bl) {
+    char path[64];
+    int fd;
+
+    bl->disk_fd = -1;
+    bl->disk_size = 0;
+    bl->disk_histlen = 0;
+    bl->disk_offset = bl->offset;
+    if (server.repl_backlog_disk_size == 0) return;
+
+    snprintf(path,sizeof(path),"temp-backlog-%d.ring",(int) getpid());
+    fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0600);
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't open the on disk replication backlog "
+                             "%s: %s", path, strerror(errno));
+        return;
+    }
+    unlink(path);
+    bl->disk_fd = fd;
+    bl->disk_size = server.repl_backlog_disk_size;
+}
+
+/* Drop the on disk backlog tier and its history. */
+static void closeReplicationBacklogDisk(replBacklog *bl) {
+    if (bl->disk_fd != -1) close(bl->disk_fd);
+    bl->disk_fd = -1;
+    bl->disk_histlen = 0;
+    bl->disk_offset = bl->offset;
+}
+
+/* Append the block 'o', released from the head of the backlog in memory,
+ * to the ring file: the oldest history on disk is overwritten. */
+static void appendReplicationBacklogDisk(replBacklog *bl, replBufBlock *o) {
+    char *p = o->buf;
+    long long len = o->used, off = o->repl_offset;
+
+    if (bl->disk_fd == -1) return;
+    serverAssert(off == bl->disk_offset+bl->disk_histlen);
+
+    /* Only the last disk_size bytes fit. */
+    if (len > bl->disk_size) {
+        p += len-bl->disk_size;
+        off += len-bl->disk_size;
+        len = bl->disk_size;
+    }
+    while(len) {
+        long long pos = off % bl->disk_size;
+        long long chunk = bl->disk_size-pos;
+
+        if (chunk > len) chunk = len;
+        if (pwrite(bl->disk_fd,p,chunk,pos) != chunk) {
+            serverLog(LL_WARNING,"Error writing the on disk replication "
+                "backlog, its history is dropped: %s",
+                errno ? strerror(errno) : "short write");
+            closeReplicationBacklogDisk(bl);
+            return;
+        }
+        p += chunk;
+        off += chunk;
+        len -= chunk;
+    }
+    bl->disk_histlen += o->used;
+    if (bl->disk_histlen > bl->disk_size) {
+        bl->disk_offset += bl->disk_histlen-bl->disk_size;
+        bl->disk_histlen = bl->disk_size;
+    }
+}
+
+/* Read 'len' bytes of the on disk backlog from the replication offset
+ * 'offset'. Returns the number of bytes read, or -1 if the data is not
+ * available anymore or on I/O errors. */
+ssize_t readReplicationBacklogDisk(long long offset, char *buf, size_t len) {
+    replBacklog *bl = server.repl_backlog;
+    size_t nread = 0;
+
+    if (bl == NULL || bl->disk_fd == -1 || offset < bl->disk_offset ||
+        offset+(long long)len > bl->disk_offset+bl->disk_histlen)
+    {
+        errno = ERANGE;
+        return -1;
+    }
+    while(nread < len) {
+        long long pos = offset % bl->disk_size;
+        size_t chunk = bl->disk_size-pos;
+        ssize_t retval;
+
+        if (chunk > len-nread) chunk = len-nread;
+        retval = pread(bl->disk_fd,buf+nread,chunk,pos);
+        if (retval <= 0) {
+            if (retval == 0) errno = EIO;
+            return -1;
+        }
+        nread += retval;
+        offset += retval;
+    }
+    return nread;
+}
+
+/* Return the replication offset of the first byte of history available
+ * for partial resynchronizations, on disk or in memory. */
+static long long replicationBacklogFirstOffset(void) {
+    replBacklog *bl = server.repl_backlog;
+
+    if (bl->disk_fd != -1 && bl->disk_histlen) return bl->disk_offset;
+    return bl->offset;
+}
+
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
+    server.repl_backlog->histlen = 0;
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
      * replication stream. */
-    server.repl_backlog_off = server.master_repl_offset+1;
+    server.repl_backlog->offset = server.master_repl_offset+1;
+    openReplicationBacklogDisk(server.repl_backlog);
 }
 
 /* This function is called when the user modifies the replication backlog
- * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * size at runtime. Since the backlog is just the head of the shared
+ * replication buffer, a bigger backlog simply keeps more blocks, while a
+ * smaller one releases the oldest blocks incrementally. */
 void resizeReplicationBacklog(long long newsize) {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
         newsize = CONFIG_REPL_BACKLOG_MIN_SIZE;
-    if (server.repl_backlog_size == newsize) return;
-
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset+1;
-    }
+    if (server.repl_backlog)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
 void freeReplicationBacklog(void) {
+    listNode *ln;
+
     serverAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL) return;
+    /* Without slaves the backlog was the only user of the blocks. */
+    while((ln = listFirst(server.repl_buffer_blocks)) != NULL) {
+        zfree(listNodeValue(ln));
+        listDelNode(server.repl_buffer_blocks,ln);
+    }
+    server.repl_buffer_mem = 0;
+    closeReplicationBacklogDisk(server.repl_backlog);
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
 }
 
-/* Add data to the replication backlog.
+/* This function is called when the user modifies the size of the on disk
+ * backlog at runtime. The history on disk is dropped, so the slaves still
+ * reading it are disconnected. */
+void resizeReplicationBacklogDisk(long long newsize) {
+    listIter li;
+    listNode *ln;
+
+    server.repl_backlog_disk_size = newsize;
+    if (server.repl_backlog == NULL) return;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->repl_disk_off != -1) {
+            serverLog(LL_NOTICE,"Disconnecting slave %s reading the on disk "
+                "backlog, that was resized.", replicationGetSlaveName(slave));
+            freeClientAsync(slave);
+        }
+    }
+    closeReplicationBacklogDisk(server.repl_backlog);
+    openReplicationBacklogDisk(server.repl_backlog);
+}
+
+/* Release the oldest blocks of the replication buffer, up to 'max_blocks',
+ * as long as the backlog is bigger than repl-backlog-size and the blocks
+ * are not referenced by slaves. A slave still reading the first block
+ * prevents the backlog from shrinking: this way partial resyncs are
+ * accepted for more history, at no additional memory cost. */
+void incrementalTrimReplicationBacklog(int max_blocks) {
+    replBacklog *bl = server.repl_backlog;
+    long long trimmed = 0;
+
+    while(bl->histlen-trimmed > server.repl_backlog_size && max_blocks--) {
+        listNode *first = listFirst(server.repl_buffer_blocks);
+        listNode *next = first ? listNextNode(first) : NULL;
+        replBufBlock *fo;
+
+        /* The backlog always keeps at least the last block. */
+        if (next == NULL) break;
+        serverAssert(first == bl->ref_repl_buf_node);
+        fo = listNodeValue(first);
+        if (fo->refcount != 1) break;
+        /* Don't go below the configured size releasing the block. */
+        if (bl->histlen-trimmed-(long long)fo->used < server.repl_backlog_size)
+            break;
+
+        appendReplicationBacklogDisk(bl,fo);
+        bl->ref_repl_buf_node = next;
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        trimmed += fo->used;
+        server.repl_buffer_mem -= sizeof(replBufBlock)+fo->size;
+        zfree(fo);
+        listDelNode(server.repl_buffer_blocks,first);
+    }
+    bl->histlen -= trimmed;
+    bl->offset += trimmed;
+}
+
+/* Slaves waiting for the BGSAVE to start don't accumulate the stream:
+ * the RDB they will receive includes the changes. */
+static int canFeedReplicaReplBuffer(client *slave) {
+    return slave->replstate != SLAVE_STATE_WAIT_BGSAVE_START;
+}
+
+/* Add data to the replication buffer, shared by the backlog and by the
+ * output buffers of the slaves, that start to reference it from the first
+ * data added after they can accumulate the stream. The data is copied once
+ * regardless of the number of slaves.
+ *
  * This function also increments the global replication offset stored at
  * server.master_repl_offset, because there is no case where we want to feed
  * the backlog without incrementing the offset. */
-void feedReplicationBacklog(void *ptr, size_t len) {
+void feedReplicationBuffer(void *ptr, size_t len) {
+    static long long repl_block_id = 0;
+    listNode *ln = listLast(server.repl_buffer_blocks);
+    replBufBlock *tail = ln ? listNodeValue(ln) : NULL;
+    listNode *start_node = NULL;
+    size_t start_pos = 0;
+    int new_block = 0;
     unsigned char *p = ptr;
+    listIter li;
 
+    if (server.repl_backlog == NULL || len == 0) return;
     server.master_repl_offset += len;
+    server.repl_backlog->histlen += len;
+
+    /* Fill the free space of the tail block first. */
+    if (tail && tail->size > tail->used) {
+        size_t copy = tail->size-tail->used;
+        if (copy > len) copy = len;
+
+        start_node = ln;
+        start_pos = tail->used;
+        memcpy(tail->buf+tail->used,p,copy);
+        tail->used += copy;
+        p += copy;
+        len -= copy;
+    }
+    if (len) {
+        size_t size = len < PROTO_REPLY_CHUNK_BYTES ?
+                      PROTO_REPLY_CHUNK_BYTES : len;
+
+        tail = zmalloc(sizeof(replBufBlock)+size);
+        tail->refcount = 0;
+        tail->id = repl_block_id++;
+        tail->repl_offset = server.master_repl_offset-len+1;
+        tail->size = size;
+        tail->used = len;
+        memcpy(tail->buf,p,len);
+        listAddNodeTail(server.repl_buffer_blocks,tail);
+        server.repl_buffer_mem += sizeof(replBufBlock)+size;
+        if (start_node == NULL) start_node = listLast(server.repl_buffer_blocks);
+        new_block = 1;
+    }
+
+    /* Slaves that just started to accumulate the stream reference it from
+     * this data. The output buffer only grows when a block is added. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
-    while(len) {
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
-        if (thislen > len) thislen = len;
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
-        server.repl_backlog_idx += thislen;
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
-        len -= thislen;
-        p += thislen;
-        server.repl_backlog_histlen += thislen;
-    }
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
-    server.repl_backlog_off = server.master_repl_offset -
-                              server.repl_backlog_histlen + 1;
-}
-
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+        if (!canFeedReplicaReplBuffer(slave)) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start_node;
+            slave->ref_block_pos = start_pos;
+            ((replBufBlock*)listNodeValue(start_node))->refcount++;
+        }
+        if (new_block) asyncCloseClientOnOutputBufferLimitReached(slave);
+    }
+
+    /* The backlog is created empty, so it references the first block. */
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        serverAssert(start_pos == 0);
+        server.repl_backlog->ref_repl_buf_node = start_node;
+        ((replBufBlock*)listNodeValue(start_node))->refcount++;
+    }
+    if (new_block)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Wrapper for feedReplicationBuffer() that takes Redis string objects
  * as input. */
-void feedReplicationBacklogWithObject(robj *o) {
+void feedReplicationBufferWithObject(robj *o) {
     char llstr[LONG_STR_SIZE];
     void *p;
     size_t len;
@@ -162,7 +385,142 @@ void feedReplicationBacklogWithObject(robj *o) {
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p,len);
+    feedReplicationBuffer(p,len);
+}
+
+/* Install the write handler of the slaves with data to send. */
+void prepareReplicasToWrite(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (canFeedReplicaReplBuffer(slave) && clientHasPendingReplies(slave))
+            clientInstallWriteHandler(slave);
+    }
+}
+
+/* Drop the reference of the slave 'c' to the replication buffer, when the
+ * client is released. */
+void releaseReplicaReplBuffer(client *c) {
+    if (c->ref_repl_buf_node == NULL) return;
+    ((replBufBlock*)listNodeValue(c->ref_repl_buf_node))->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    c->repl_disk_off = -1;
+    if (server.repl_backlog)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* -----------------------------------------------------------------------------
+ * Compressed replication stream.
+ *
+ * When repl-stream-compression is enabled on both sides the slave announces
+ * "capa zstd" and the master accepts it replying +OK zstd. Then what follows
+ * the +CONTINUE reply or the RDB payload is a single zstd stream, flushed at
+ * every write to the slave socket, and the disk-less RDB payload is a zstd
+ * stream as well. Replication offsets are always about the uncompressed
+ * stream, so the backlog and PSYNC work as usual.
+ * -------------------------------------------------------------------------- */
+
+static void *replZstdAlloc(void *opaque, size_t size) {
+    UNUSED(opaque);
+    return zmalloc(size);
+}
+
+static void replZstdFree(void *opaque, void *ptr) {
+    UNUSED(opaque);
+    zfree(ptr);
+}
+
+static const ZSTD_customMem replZstdMem = { replZstdAlloc, replZstdFree, NULL };
+
+/* Compress 'len' bytes of the replication stream for the slave 'c',
+ * appending the output to c->repl_zbuf. When 'flush' is true all the data
+ * compressed so far is emitted, so that the slave can process it. Returns
+ * C_ERR on compression errors. */
+int replicationCompressStream(client *c, const char *buf, size_t len,
+                              int flush)
+{
+    ZSTD_inBuffer in = { buf, len, 0 };
+    size_t ret;
+
+    if (c->repl_cctx == NULL) {
+        c->repl_cctx = ZSTD_createCCtx_advanced(replZstdMem);
+        ZSTD_CCtx_setParameter(c->repl_cctx,ZSTD_c_compressionLevel,
+            REPL_STREAM_ZSTD_LEVEL);
+        if (c->repl_zbuf == NULL) c->repl_zbuf = sdsempty();
+    }
+
+    do {
+        ZSTD_outBuffer out;
+
+        c->repl_zbuf = sdsMakeRoomFor(c->repl_zbuf,ZSTD_CStreamOutSize());
+        out.dst = c->repl_zbuf+sdslen(c->repl_zbuf);
+        out.size = sdsavail(c->repl_zbuf);
+        out.pos = 0;
+        ret = ZSTD_compressStream2(c->repl_cctx,&out,&in,
+            flush ? ZSTD_e_flush : ZSTD_e_continue);
+        if (ZSTD_isError(ret)) {
+            serverLog(LL_WARNING,"Error compressing the replication stream: %s",
+                ZSTD_getErrorName(ret));
+            return C_ERR;
+        }
+        sdsIncrLen(c->repl_zbuf,out.pos);
+        server.stat_repl_stream_compressed_bytes += out.pos;
+    } while(in.pos < in.size || (flush && ret != 0));
+    server.stat_repl_stream_bytes += len;
+    return C_OK;
+}
+
+/* Decompress the 'len' bytes at 'buf' read from the master 'c', appending
+ * the output to its query buffer. Returns the number of bytes appended, or
+ * -1 if the stream is not valid. */
+ssize_t replicationDecompressStream(client *c, const char *buf, size_t len) {
+    ZSTD_inBuffer in = { buf, len, 0 };
+    size_t qblen = sdslen(c->querybuf);
+    ZSTD_outBuffer out;
+
+    do {
+        size_t ret;
+
+        c->querybuf = sdsMakeRoomFor(c->querybuf,ZSTD_DStreamOutSize());
+        out.dst = c->querybuf+sdslen(c->querybuf);
+        out.size = sdsavail(c->querybuf);
+        out.pos = 0;
+        ret = ZSTD_decompressStream(c->repl_dctx,&out,&in);
+        if (ZSTD_isError(ret)) {
+            serverLog(LL_WARNING,"Error decompressing the replication "
+                                 "stream: %s", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        sdsIncrLen(c->querybuf,out.pos);
+        /* A full output buffer may leave data inside the decoder. */
+    } while(in.pos < in.size || out.pos == out.size);
+    return sdslen(c->querybuf)-qblen;
+}
+
+/* Start reading the stream of the master client 'c' with a new decoder if
+ * the master compresses it, since it is a new stream. */
+static void replicationSetupMasterStreamCodec(client *c) {
+    if (c->repl_dctx) {
+        ZSTD_freeDCtx(c->repl_dctx);
+        c->repl_dctx = NULL;
+    }
+    if (server.repl_master_zstd)
+        c->repl_dctx = ZSTD_createDCtx_advanced(replZstdMem);
+}
+
+void freeClientReplStreamCodecs(client *c) {
+    ZSTD_freeCCtx(c->repl_cctx);
+    ZSTD_freeDCtx(c->repl_dctx);
+    sdsfree(c->repl_zbuf);
+    c->repl_cctx = NULL;
+    c->repl_dctx = NULL;
+    c->repl_zbuf = NULL;
+    c->repl_zbuf_sent = 0;
 }
 
 /* Propagate write commands to slaves, and populate the replication backlog
@@ -171,10 +529,17 @@ void feedReplicationBacklogWithObject(robj *o) {
  * stream. Instead if the instance is a slave and has sub-slaves attached,
  * we use replicationFeedSlavesFromMaster() */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
-    int j, len;
+    sds encoded = NULL;
+
+    replicationFeedSlavesEncoded(slaves,dictid,argv,argc,&encoded);
+}
+
+/* Like replicationFeedSlaves(), but the RESP encoding of the command is taken
+ * from getPropagatedCommandEncoding(), so that it is shared with the AOF via
+ * '*encoded'. */
+void replicationFeedSlavesEncoded(list *slaves, int dictid, robj **argv, int argc, sds *encoded) {
     char llstr[LONG_STR_SIZE];
+    sds cmdbuf;
 
     /* If the instance is not a top level master, return ASAP: we'll just proxy
      * the stream of data we receive from our master instead, in order to
@@ -207,77 +572,28 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
                 dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-            addReply(slave,selectcmd);
-        }
+        /* Add the SELECT command into the replication buffer. */
+        feedReplicationBufferWithObject(selectcmd);
 
         if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE+3];
-
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
-        aux[len+1] = '\r';
-        aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
-    }
-
-    /* Write the command to every slave. */
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-
-        /* Add the multi bulk length. */
-        addReplyMultiBulkLen(slave,argc);
+    /* Write the command to the replication buffer, once for the backlog
+     * and all the slaves. */
+    cmdbuf = getPropagatedCommandEncoding(encoded,argc,argv);
+    feedReplicationBuffer(cmdbuf,sdslen(cmdbuf));
 
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
-    }
+    /* Install the write handler of the slaves. */
+    prepareReplicasToWrite();
 }
 
 /* This function is used in order to proxy what we receive from our master
  * to our sub-slaves. */
 #include <ctype.h>
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
-    listNode *ln;
-    listIter li;
+    UNUSED(slaves);
 
     /* Debugging: this is handy to see the stream sent from master
      * to slaves. Disabled with if(0). */
@@ -289,15 +605,9 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
         printf("\n");
     }
 
-    if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-        addReplyString(slave,buf,buflen);
-    }
+    if (server.repl_backlog == NULL) return;
+    feedReplicationBuffer(buf,buflen);
+    prepareReplicasToWrite();
 }
 
 
@@ -342,55 +652,62 @@ void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv,
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog. Nothing is copied: the
+ * slave just references the shared replication buffer from 'offset'. */
 long long addReplyReplicationBacklog(client *c, long long offset) {
-    long long j, skip, len;
+    replBacklog *bl = server.repl_backlog;
+    listNode *ln;
+    replBufBlock *o;
+    long long skip;
 
     serverLog(LL_DEBUG, "[PSYNC] Slave request offset: %lld", offset);
 
-    if (server.repl_backlog_histlen == 0) {
+    if (bl->histlen == 0) {
         serverLog(LL_DEBUG, "[PSYNC] Backlog history len is zero");
         return 0;
     }
 
     serverLog(LL_DEBUG, "[PSYNC] Backlog size: %lld",
              server.repl_backlog_size);
-    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld",
-             server.repl_backlog_off);
-    serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
-             server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
+    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld", bl->offset);
+    serverLog(LL_DEBUG, "[PSYNC] History len: %lld", bl->histlen);
+
+    /* The slave is behind the history in memory: it starts reading the on
+     * disk tier, then continues with the first block in memory. Referencing
+     * that block stops the trimming, so the part of the ring file still to
+     * be read is never overwritten. */
+    if (offset < bl->offset) {
+        serverLog(LL_DEBUG, "[PSYNC] Reading from disk: %lld",
+            bl->offset-offset);
+        ln = bl->ref_repl_buf_node;
+        o = listNodeValue(ln);
+        o->refcount++;
+        c->ref_repl_buf_node = ln;
+        c->ref_block_pos = 0;
+        c->repl_disk_off = offset;
+        clientInstallWriteHandler(c);
+        return server.master_repl_offset+1-offset;
+    }
 
     /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog_off;
+    skip = offset - bl->offset;
     serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
 
-    /* Point j to the oldest byte, that is actually our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-        (server.repl_backlog_size-server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
+    /* Find the block holding 'offset': when it is the next byte to be
+     * produced, the slave starts at the end of the last block. */
+    ln = bl->ref_repl_buf_node;
+    while(ln) {
+        o = listNodeValue(ln);
+        if (o->repl_offset+(long long)o->used >= offset) break;
+        ln = listNextNode(ln);
     }
-    return server.repl_backlog_histlen - skip;
+    serverAssert(ln != NULL);
+    o->refcount++;
+    c->ref_repl_buf_node = ln;
+    c->ref_block_pos = offset-o->repl_offset;
+    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", bl->histlen-skip);
+    if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    return bl->histlen - skip;
 }
 
 /* Return the offset to provide as reply to the PSYNC command received
@@ -491,8 +808,9 @@ int masterTryPartialResynchronization(client *c) {
 
     /* We still have the data our slave is asking for? */
     if (!server.repl_backlog ||
-        psync_offset < server.repl_backlog_off ||
-        psync_offset > (server.repl_backlog_off + server.repl_backlog_histlen))
+        psync_offset < replicationBacklogFirstOffset() ||
+        psync_offset > (server.repl_backlog->offset +
+                        server.repl_backlog->histlen))
     {
         serverLog(LL_NOTICE,
             "Unable to partial resync with slave %s for lack of backlog (Slave request was: %lld).", replicationGetSlaveName(c), psync_offset);
@@ -720,7 +1038,7 @@ void syncCommand(client *c) {
         if (ln && ((c->slave_capa & slave->slave_capa) == slave->slave_capa)) {
             /* Perfect, the server is already registering differences for
              * another slave. Set the right state, and copy the buffer. */
-            copyClientOutputBuffer(c,slave);
+            copyReplicaOutputBuffer(c,slave);
             replicationSetupSlaveForFullResync(c,slave->psync_initial_offset);
             serverLog(LL_NOTICE,"Waiting for end of BGSAVE for SYNC");
         } else {
@@ -775,7 +1093,7 @@ void syncCommand(client *c) {
  * the replication to initiate an incremental replication instead of a
  * full resync. */
 void replconfCommand(client *c) {
-    int j;
+    int j, zstd = 0;
 
     if ((c->argc % 2) == 0) {
         /* Number of arguments must be odd to make sure that every
@@ -808,6 +1126,12 @@ void replconfCommand(client *c) {
                 c->slave_capa |= SLAVE_CAPA_EOF;
             else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
                 c->slave_capa |= SLAVE_CAPA_PSYNC2;
+            else if (!strcasecmp(c->argv[j+1]->ptr,"zstd") &&
+                     server.repl_stream_compression)
+            {
+                c->slave_capa |= SLAVE_CAPA_ZSTD;
+                zstd = 1;
+            }
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -838,7 +1162,11 @@ void replconfCommand(client *c) {
             return;
         }
     }
-    addReply(c,shared.ok);
+    /* The slave reads the stream as it is unless "capa zstd" is accepted. */
+    if (zstd)
+        addReplyStatus(c,"OK zstd");
+    else
+        addReply(c,shared.ok);
 }
 
 /* This function puts a slave in the online state, and should be called just
@@ -1088,6 +1416,7 @@ void replicationCreateMasterClient(int fd, int dbid) {
     if (server.master->reploff == -1)
         server.master->flags |= CLIENT_PRE_PSYNC;
     if (dbid != -1) selectDb(server.master,dbid);
+    if (fd != -1) replicationSetupMasterStreamCodec(server.master);
 }
 
 void restartAOF() {
@@ -1105,6 +1434,157 @@ void restartAOF() {
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 
+/* Called once the new dataset is in memory, whatever the way it was
+ * transferred, to turn the sync connection into the master client. */
+static void replicationFinishFullSync(rdbSaveInfo *rsi, int aof_is_enabled) {
+    //// 这里设置server.master之后，所有初始化连接都完成，状态更新为server.repl_state = REPL_STATE_CONNECTED已经建立连接状态
+    replicationCreateMasterClient(server.repl_transfer_s,rsi->repl_stream_db);
+    server.repl_state = REPL_STATE_CONNECTED;
+    /* After a full resynchroniziation we use the replication ID and
+     * offset of the master. The secondary ID / offset are cleared since
+     * we are starting a new history. */
+    memcpy(server.replid,server.master->replid,sizeof(server.replid));
+    server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+    /* Let's create the replication backlog if needed. Slaves need to
+     * accumulate the backlog regardless of the fact they have sub-slaves
+     * or not, in order to behave correctly if they are promoted to
+     * masters after a failover. */
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (aof_is_enabled) restartAOF();
+}
+
+/* Return true if the next full sync should load the payload directly from
+ * the master socket instead of writing it to a temp file first. */
+static int useDisklessLoad(void) {
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) return 1;
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_WHEN_DB_EMPTY)
+        return dbTotalServerKeyCount() == 0;
+    return 0;
+}
+
+/* Load the RDB payload straight from the master socket 'fd', once the bulk
+ * header was read. 'eofmark' is the EOF mark terminating the payload, or
+ * NULL if its size is server.repl_transfer_size.
+ *
+ * The socket is read in blocking mode, with repl-timeout as read timeout.
+ * If the transfer breaks the data loaded so far is dropped: with
+ * repl-diskless-load swapdb the previous dataset is put back in place,
+ * otherwise the slave is left empty, in both cases the sync is retried. */
+static void readSyncBulkPayloadFromSocket(int fd, char *eofmark) {
+    int aof_is_enabled = server.aof_state != AOF_OFF;
+    int swapdb = server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB;
+    int flush_flags = server.repl_slave_lazy_flush ? EMPTYDB_ASYNC :
+                                                     EMPTYDB_NO_FLAGS;
+    rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+    dbBackup *backup = NULL;
+    int loaded = C_ERR;
+    rio rdb;
+
+    /* The readable handler must go, rdbLoadRio() processes events while
+     * loading. */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
+
+    /* We need to stop any AOFRW fork before flusing and parsing
+     * RDB, otherwise we'll create a copy-on-write disaster. */
+    if (aof_is_enabled) stopAppendOnly();
+    signalFlushedDb(-1);
+    if (swapdb) {
+        serverLog(LL_NOTICE,
+            "MASTER <-> SLAVE sync: Setting the old dataset aside");
+        backup = backupDb();
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        emptyDb(-1,flush_flags,replicationEmptyDbCallback);
+    }
+
+    if (anetBlock(NULL,fd) == ANET_ERR ||
+        anetRecvTimeout(NULL,fd,(long long)server.repl_timeout*1000) == ANET_ERR)
+    {
+        serverLog(LL_WARNING,
+            "Can't setup the MASTER socket for the transfer: %s",
+            strerror(errno));
+        goto done;
+    }
+
+    serverLog(LL_NOTICE,
+        "MASTER <-> SLAVE sync: Loading DB in memory from the MASTER socket");
+    rioInitWithFd(&rdb,fd,eofmark ? 0 : server.repl_transfer_size);
+    /* The streamed payload is compressed, the EOF mark included. */
+    if (eofmark && server.repl_master_zstd) rioFdSetDecompression(&rdb);
+    startLoading(eofmark ? 0 : server.repl_transfer_size);
+    loaded = rdbLoadRio(&rdb,&rsi);
+    if (loaded == C_OK) {
+        if (eofmark) {
+            char mark[CONFIG_RUN_ID_SIZE];
+
+            if (rioRead(&rdb,mark,CONFIG_RUN_ID_SIZE) == 0 ||
+                memcmp(mark,eofmark,CONFIG_RUN_ID_SIZE) != 0)
+            {
+                serverLog(LL_WARNING,
+                    "The EOF mark does not follow the RDB payload");
+                loaded = C_ERR;
+            }
+        } else if (rioTell(&rdb) != server.repl_transfer_size) {
+            /* An RDB file saved with rdb-key-index has the index after
+             * the checksum: accept it, we have no use for it. */
+            size_t left = server.repl_transfer_size-rioTell(&rdb);
+            unsigned char *trailer = NULL;
+
+            if (rioTell(&rdb) < server.repl_transfer_size)
+                trailer = zmalloc(left);
+            if (!trailer || rioRead(&rdb,trailer,left) == 0 ||
+                !rdbIndexTrailerIsValid(trailer,left))
+            {
+                serverLog(LL_WARNING,
+                    "The RDB payload does not match the announced size");
+                loaded = C_ERR;
+            }
+            zfree(trailer);
+        }
+    }
+    stopLoading();
+    server.repl_transfer_read = rdb.io.fd.read_so_far;
+    server.stat_net_input_bytes += rdb.io.fd.read_so_far;
+    /* The master sends nothing after the payload until we acknowledge it,
+     * so the read ahead buffer is expected to be empty here. */
+    if (loaded == C_OK && !rioFdAtEnd(&rdb)) {
+        serverLog(LL_WARNING,"Unexpected data after the RDB payload");
+        loaded = C_ERR;
+    }
+    rioFreeFd(&rdb);
+
+done:
+    if (loaded != C_OK) {
+        serverLog(LL_WARNING,"Failed trying to load the MASTER synchronization DB from socket");
+        cancelReplicationHandshake();
+        if (swapdb) {
+            serverLog(LL_NOTICE,
+                "MASTER <-> SLAVE sync: Restoring the previous dataset");
+            restoreDbBackup(backup,flush_flags);
+        } else {
+            emptyDb(-1,flush_flags,NULL);
+        }
+        /* Re-enable the AOF if we disabled it earlier, in order to restore
+         * the original configuration. */
+        if (aof_is_enabled) restartAOF();
+        return;
+    }
+
+    if (swapdb) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Discarding the old dataset");
+        discardDbBackup(backup,flush_flags,replicationEmptyDbCallback);
+    }
+    /* createClient() puts the socket back in non blocking mode. */
+    anetRecvTimeout(NULL,fd,0);
+    replicationFinishFullSync(&rsi,aof_is_enabled);
+}
+
 //// 主从复制可读事件回调函数
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[4096];
@@ -1172,6 +1652,15 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
                 "MASTER <-> SLAVE sync: receiving %lld bytes from master",
                 (long long) server.repl_transfer_size);
         }
+
+        /* Without a temp file (repl-diskless-load) the payload is parsed
+         * directly from the socket. */
+        if (server.repl_transfer_tmpfile == NULL) {
+            readSyncBulkPayloadFromSocket(fd,usemark ? eofmark : NULL);
+        } else if (usemark && server.repl_master_zstd) {
+            /* The streamed payload is compressed, the EOF mark included. */
+            server.repl_transfer_dctx = ZSTD_createDCtx_advanced(replZstdMem);
+        }
         return;
     }
 
@@ -1191,29 +1680,66 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
     server.stat_net_input_bytes += nread;
+    server.repl_transfer_lastio = server.unixtime;
 
     /* When a mark is used, we want to detect EOF asap in order to avoid
      * writing the EOF mark into the file... */
     int eof_reached = 0;
 
-    if (usemark) {
-        /* Update the last bytes array, and check if it matches our delimiter.*/
-        if (nread >= CONFIG_RUN_ID_SIZE) {
-            memcpy(lastbytes,buf+nread-CONFIG_RUN_ID_SIZE,CONFIG_RUN_ID_SIZE);
-        } else {
-            int rem = CONFIG_RUN_ID_SIZE-nread;
-            memmove(lastbytes,lastbytes+nread,rem);
-            memcpy(lastbytes+rem,buf,nread);
+    /* A compressed payload is decompressed into the file. The transfer
+     * ends when the decompressed data ends with the mark, and the zstd
+     * stream is complete. */
+    ZSTD_inBuffer zin = { buf, nread, 0 };
+    ZSTD_outBuffer zout = { NULL, 0, 0 };
+    char zbuf[PROTO_IOBUF_LEN];
+    size_t zret = 0;
+    char *data = buf;
+
+    do {
+        if (server.repl_transfer_dctx) {
+            zout.dst = zbuf;
+            zout.size = sizeof(zbuf);
+            zout.pos = 0;
+            zret = ZSTD_decompressStream(server.repl_transfer_dctx,&zout,&zin);
+            if (ZSTD_isError(zret)) {
+                serverLog(LL_WARNING,"Error decompressing the RDB payload "
+                                     "received from the MASTER: %s",
+                                     ZSTD_getErrorName(zret));
+                goto error;
+            }
+            data = zbuf;
+            nread = zout.pos;
         }
-        if (memcmp(lastbytes,eofmark,CONFIG_RUN_ID_SIZE) == 0) eof_reached = 1;
-    }
 
-    server.repl_transfer_lastio = server.unixtime;
-    if (write(server.repl_transfer_fd,buf,nread) != nread) {
-        serverLog(LL_WARNING,"Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
-        goto error;
+        if (usemark) {
+            /* Update the last bytes array, and check if it matches our delimiter.*/
+            if (nread >= CONFIG_RUN_ID_SIZE) {
+                memcpy(lastbytes,data+nread-CONFIG_RUN_ID_SIZE,CONFIG_RUN_ID_SIZE);
+            } else {
+                int rem = CONFIG_RUN_ID_SIZE-nread;
+                memmove(lastbytes,lastbytes+nread,rem);
+                memcpy(lastbytes+rem,data,nread);
+            }
+            if (memcmp(lastbytes,eofmark,CONFIG_RUN_ID_SIZE) == 0) eof_reached = 1;
+        }
+
+        if (write(server.repl_transfer_fd,data,nread) != nread) {
+            serverLog(LL_WARNING,"Write error or short write writing to the DB dump file needed for MASTER <-> SLAVE synchronization: %s", strerror(errno));
+            goto error;
+        }
+        server.repl_transfer_read += nread;
+    } while(server.repl_transfer_dctx &&
+            (zin.pos < zin.size || zout.pos == zout.size));
+
+    if (server.repl_transfer_dctx && eof_reached) {
+        if (zret != 0) {
+            /* The end of the frame is still to come. */
+            eof_reached = 0;
+        } else {
+            ZSTD_freeDCtx(server.repl_transfer_dctx);
+            server.repl_transfer_dctx = NULL;
+        }
     }
-    server.repl_transfer_read += nread;
 
     /* Delete the last 40 bytes from the file if we reached EOF. */
     if (usemark && eof_reached) {
@@ -1278,29 +1804,10 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
         /* Final setup of the connected slave <- master link */
         zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_tmpfile = NULL;
         close(server.repl_transfer_fd);
-
-
-        //// 这里设置server.master之后，所有初始化连接都完成，状态更新为server.repl_state = REPL_STATE_CONNECTED已经建立连接状态
-        replicationCreateMasterClient(server.repl_transfer_s,rsi.repl_stream_db);
-        server.repl_state = REPL_STATE_CONNECTED;
-        /* After a full resynchroniziation we use the replication ID and
-         * offset of the master. The secondary ID / offset are cleared since
-         * we are starting a new history. */
-        memcpy(server.replid,server.master->replid,sizeof(server.replid));
-        server.master_repl_offset = server.master->reploff;
-        clearReplicationId2();
-        /* Let's create the replication backlog if needed. Slaves need to
-         * accumulate the backlog regardless of the fact they have sub-slaves
-         * or not, in order to behave correctly if they are promoted to
-         * masters after a failover. */
-        if (server.repl_backlog == NULL) createReplicationBacklog();
-
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (aof_is_enabled) restartAOF();
+        server.repl_transfer_fd = -1;
+        replicationFinishFullSync(&rsi,aof_is_enabled);
     }
     return;
 
@@ -1577,7 +2084,7 @@ int slaveTryPartialResynchronization(int fd, int read_reply) {
 //// slave连接master之后会为文件描述符创建可读、可写的事件，此时可写事件会触发（触发即删除对可写事件的监听）
 void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     char tmpfile[256], *err = NULL;
-    int dfd = -1, maxtries = 5;
+    int dfd = -1, maxtries = 5, diskless;
     int sockerr = 0, psync_result;
     socklen_t errlen = sizeof(sockerr);
     UNUSED(el);
@@ -1721,12 +2228,17 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
      *
      * EOF: supports EOF-style RDB transfer for diskless replication.
      * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
+     * ZSTD: reads the stream compressed, if the master replies +OK zstd.
      *
      * The master will ignore capabilities it does not understand. */
     // 发送消息，更新状态 server.repl_state = REPL_STATE_RECEIVE_CAPA
     if (server.repl_state == REPL_STATE_SEND_CAPA) {
-        err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
-                "capa","eof","capa","psync2",NULL);
+        if (server.repl_stream_compression)
+            err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
+                    "capa","eof","capa","psync2","capa","zstd",NULL);
+        else
+            err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
+                    "capa","eof","capa","psync2",NULL);
         if (err) goto write_error;
         sdsfree(err);
         server.repl_state = REPL_STATE_RECEIVE_CAPA;
@@ -1742,6 +2254,8 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
             serverLog(LL_NOTICE,"(Non critical) Master does not understand "
                                   "REPLCONF capa: %s", err);
         }
+        server.repl_master_zstd = server.repl_stream_compression &&
+                                  !strcmp(err,"+OK zstd");
         sdsfree(err);
         server.repl_state = REPL_STATE_SEND_PSYNC;
     }
@@ -1804,15 +2318,17 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
-    /* Prepare a suitable temp file for bulk transfer */
-    while(maxtries--) {
+    /* Prepare a suitable temp file for bulk transfer, unless the payload
+     * is going to be loaded directly from the socket. */
+    diskless = useDisklessLoad();
+    while(!diskless && maxtries--) {
         snprintf(tmpfile,256,
             "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
         dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
         if (dfd != -1) break;
         sleep(1);
     }
-    if (dfd == -1) {
+    if (dfd == -1 && !diskless) {
         serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
         goto error;
     }
@@ -1834,7 +2350,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = (dfd != -1) ? zstrdup(tmpfile) : NULL;
     return;
 
 error:
@@ -1896,9 +2412,15 @@ void undoConnectWithMaster(void) {
 void replicationAbortSyncTransfer(void) {
     serverAssert(server.repl_state == REPL_STATE_TRANSFER);
     undoConnectWithMaster();
-    close(server.repl_transfer_fd);
-    unlink(server.repl_transfer_tmpfile);
-    zfree(server.repl_transfer_tmpfile);
+    if (server.repl_transfer_tmpfile) {
+        close(server.repl_transfer_fd);
+        unlink(server.repl_transfer_tmpfile);
+        zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_tmpfile = NULL;
+        server.repl_transfer_fd = -1;
+    }
+    ZSTD_freeDCtx(server.repl_transfer_dctx);
+    server.repl_transfer_dctx = NULL;
 }
 
 /* This function aborts a non blocking replication attempt if there is one
@@ -2132,6 +2654,7 @@ void replicationCacheMaster(client *c) {
      * offsets, including pending transactions, already populated arguments,
      * pending outputs to the master. */
     sdsclear(server.master->querybuf);
+    server.master->qb_pos = 0;
     sdsclear(server.master->pending_querybuf);
     server.master->read_reploff = server.master->reploff;
     if (c->flags & CLIENT_MULTI) discardTransaction(c);
@@ -2205,9 +2728,10 @@ void replicationResurrectCachedMaster(int newfd) {
     server.master->authenticated = 1;
     server.master->lastinteraction = server.unixtime;
     server.repl_state = REPL_STATE_CONNECTED;
+    replicationSetupMasterStreamCodec(server.master);
 
     /* Re-add to the list of clients. */
-    listAddNodeTail(server.clients,server.master);
+    linkClient(server.master);
     if (aeCreateFileEvent(server.el, newfd, AE_READABLE,
                           readQueryFromClient, server.master)) {
         serverLog(LL_WARNING,"Error resurrecting the cached master, impossible to add the readable handler: %s", strerror(errno));
@@ -0,0 +1,378 @@
+/* Vectorized helpers for the RESP request parser.
+ *
+ * processMultibulkBuffer() needs the position of the '\r' terminating every
+ * "*<count>" and "$<len>" header. Looking for them one strchr() at a time
+ * restarts the scan for every header; instead we scan a window of the query
+ * buffer a vector at a time into a bitmap of the '\r' positions, that the
+ * parser then consumes with a mask and a count-trailing-zeroes per header.
+ *
+ * The scanner implementation is selected at runtime: AVX2 or SSE4.2 when
+ * the CPU supports them, otherwise a portable scalar loop.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include "respscan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_RESPSCAN_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef void respScanProc(const char *s, size_t len, uint64_t *bits);
+
+/* ----------------------------------------------------------------------------
+ * Scanner implementations.
+ *
+ * All of them have the same contract: for every 64 bytes of 's' (at most
+ * RESP_INDEX_WINDOW bytes) store in 'bits' a word with bit N set if the
+ * byte N of the chunk is '\r'. Bits past 'len' in the last word are zero.
+ * ------------------------------------------------------------------------- */
+
+static uint64_t respScanWordScalar(const char *s, size_t len) {
+    uint64_t m = 0;
+    size_t j;
+
+    for (j = 0; j < len; j++) m |= (uint64_t)(s[j] == '\r') << j;
+    return m;
+}
+
+static void respScanCRScalar(const char *s, size_t len, uint64_t *bits) {
+    size_t i;
+
+    for (i = 0; i < len; i += 64)
+        *bits++ = respScanWordScalar(s+i,len-i < 64 ? len-i : 64);
+}
+
+#ifdef HAVE_RESPSCAN_SIMD
+__attribute__((target("sse4.2")))
+static void respScanCRSse42(const char *s, size_t len, uint64_t *bits) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i;
+
+    for (i = 0; i+64 <= len; i += 64) {
+        uint64_t m0 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(s+i)),cr));
+        uint64_t m1 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(s+i+16)),cr));
+        uint64_t m2 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(s+i+32)),cr));
+        uint64_t m3 = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(s+i+48)),cr));
+        *bits++ = m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+    }
+    /* Never read past the end of the buffer: the last partial word is
+     * computed 16 bytes at a time, then byte by byte. */
+    if (i < len) {
+        uint64_t m = 0;
+        size_t j = 0;
+
+        for (; i+j+16 <= len; j += 16)
+            m |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)(s+i+j)),cr)) << j;
+        *bits = m | (respScanWordScalar(s+i+j,len-i-j) << j);
+    }
+}
+
+__attribute__((target("avx2")))
+static void respScanCRAvx2(const char *s, size_t len, uint64_t *bits) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i;
+
+    for (i = 0; i+64 <= len; i += 64) {
+        uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i*)(s+i)),cr));
+        uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i*)(s+i+32)),cr));
+        *bits++ = (uint64_t)lo | ((uint64_t)hi << 32);
+    }
+    if (i < len) {
+        uint64_t m = 0;
+        size_t j = 0;
+
+        if (i+32 <= len) {
+            m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i*)(s+i)),cr));
+            j = 32;
+        }
+        if (i+j+16 <= len) {
+            m |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)(s+i+j)),
+                    _mm_set1_epi8('\r'))) << j;
+            j += 16;
+        }
+        *bits = m | (respScanWordScalar(s+i+j,len-i-j) << j);
+    }
+}
+#endif
+
+/* The first call resolves the best implementation for this CPU. Concurrent
+ * first calls from I/O threads all store the same pointer. */
+static void respScanCRResolve(const char *s, size_t len, uint64_t *bits);
+static respScanProc *respScanCRProc = respScanCRResolve;
+static const char *respScanCRName = "scalar";
+
+static void respScanSelect(void) {
+#ifdef HAVE_RESPSCAN_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        respScanCRName = "avx2";
+        respScanCRProc = respScanCRAvx2;
+        return;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        respScanCRName = "sse4.2";
+        respScanCRProc = respScanCRSse42;
+        return;
+    }
+#endif
+    respScanCRName = "scalar";
+    respScanCRProc = respScanCRScalar;
+}
+
+static void respScanCRResolve(const char *s, size_t len, uint64_t *bits) {
+    respScanSelect();
+    respScanCRProc(s,len,bits);
+}
+
+void respScanCR(const char *s, size_t len, uint64_t *bits) {
+    respScanCRProc(s,len,bits);
+}
+
+/* Return the name of the scanner used on this CPU. */
+const char *respScanImpl(void) {
+    if (respScanCRProc == respScanCRResolve) respScanSelect();
+    return respScanCRName;
+}
+
+/* ----------------------------------------------------------------------------
+ * Index API
+ * ------------------------------------------------------------------------- */
+
+void respIndexReset(respIndex *idx) {
+    idx->buf = NULL;
+    idx->start = 0;
+    idx->end = 0;
+}
+
+/* Slow path of respIndexNext(): look for the '\r' in the following words of
+ * the window, scanning a new window if 'pos' is outside the current one.
+ * If the buffer is not the one of the previous call, or it became shorter
+ * than the window, the index starts from scratch. Callers that modify the
+ * buffer contents in place must call respIndexReset(). */
+const char *respIndexSeek(respIndex *idx, const char *buf, size_t len,
+                          size_t pos)
+{
+    if (idx->buf != buf || len < idx->end) {
+        respIndexReset(idx);
+        idx->buf = buf;
+    }
+
+    while(1) {
+        size_t rel, w, words;
+        uint64_t m;
+
+        if (pos < idx->start || pos >= idx->end) {
+            if (pos >= len) return NULL;
+            idx->start = pos;
+            idx->end = pos + (len-pos < RESP_INDEX_WINDOW ?
+                              len-pos : RESP_INDEX_WINDOW);
+            respScanCR(buf+pos,idx->end-pos,idx->bits);
+        }
+
+        rel = pos - idx->start;
+        w = rel >> 6;
+        words = (idx->end - idx->start + 63) >> 6;
+        m = idx->bits[w] & (~0ULL << (rel&63));
+        while (m == 0 && ++w < words) m = idx->bits[w];
+        if (m) return buf+idx->start+(w<<6)+__builtin_ctzll(m);
+
+        /* No '\r' in the rest of the window: continue after it. */
+        pos = idx->end;
+    }
+}
+
+/* Test main */
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define UNUSED(x) (void)(x)
+
+static long long respscanUstime(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Build a pipeline of 'depth' SET commands like redis-benchmark -P does. */
+static char *respscanPipeline(int depth, size_t *len) {
+    size_t cap = (size_t)depth*64+1, l = 0;
+    char *buf = malloc(cap);
+    int j;
+
+    for (j = 0; j < depth; j++)
+        l += snprintf(buf+l,cap-l,
+            "*3\r\n$3\r\nSET\r\n$10\r\nkey:%06d\r\n$3\r\nxxx\r\n",j);
+    *len = l;
+    return buf;
+}
+
+/* Check that every implementation reports exactly the '\r' bytes of 's'. */
+static void respscanCheck(respScanProc *proc, const char *s, size_t len) {
+    uint64_t bits[RESP_INDEX_WORDS];
+    size_t pos, i, n;
+
+    for (pos = 0; pos < len; pos += n) {
+        n = len-pos < RESP_INDEX_WINDOW ? len-pos : RESP_INDEX_WINDOW;
+        memset(bits,0xff,sizeof(bits));
+        proc(s+pos,n,bits);
+        for (i = 0; i < ((n+63)&~(size_t)63); i++) {
+            int set = (bits[i>>6] >> (i&63)) & 1;
+            assert(set == (i < n && s[pos+i] == '\r'));
+        }
+    }
+}
+
+/* Walk all the headers of the pipeline, the way processMultibulkBuffer()
+ * does, using strchr() or the index. Returns the number of headers found. */
+static long respscanWalk(const char *buf, size_t len, int useindex) {
+    respIndex idx;
+    size_t pos = 0;
+    long headers = 0;
+
+    respIndexReset(&idx);
+    while (pos < len) {
+        const char *nl;
+        long long ll;
+
+        nl = useindex ? respIndexNext(&idx,buf,len,pos) : strchr(buf+pos,'\r');
+        if (nl == NULL) break;
+        if (buf[pos] == '*') {
+            pos = nl-buf+2;
+            headers++;
+            continue;
+        }
+        if (useindex)
+            assert(respParseLength(buf+pos+1,nl-(buf+pos+1),&ll));
+        else
+            assert(string2ll(buf+pos+1,nl-(buf+pos+1),&ll));
+        pos = nl-buf+2+ll+2;
+        headers++;
+    }
+    return headers;
+}
+
+int respscanTest(int argc, char *argv[]) {
+    int depths[] = {1, 16, 256, 4096, 65536};
+    size_t len;
+    long long ll;
+    char *buf;
+    int j;
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    /* Length parsing must accept exactly what string2ll() accepts. */
+    {
+        const char *ok[] = {"0","1","9","10","512","123456789012345678",
+            "1234567890123456789","-1",NULL};
+        /* The last one would overflow a signed accumulator. */
+        const char *ko[] = {"","01","1a","a1"," 1","1 ","+1","1\r",
+            "9\377\377\377\377\377\377\377\377\377\377\377\377\377"
+            "\377\377\377\377",NULL};
+        for (j = 0; ok[j]; j++) {
+            long long expected;
+            assert(string2ll(ok[j],strlen(ok[j]),&expected));
+            assert(respParseLength(ok[j],strlen(ok[j]),&ll) && ll == expected);
+        }
+        for (j = 0; ko[j]; j++)
+            assert(respParseLength(ko[j],strlen(ko[j]),&ll) == 0);
+    }
+
+    /* All the implementations available on this CPU must agree. */
+    buf = respscanPipeline(4096,&len);
+    buf[100] = buf[101] = buf[102] = '\r'; /* Runs of CRs. */
+    for (j = 0; j < 67; j++) respscanCheck(respScanCRScalar,buf+j,len-j);
+#ifdef HAVE_RESPSCAN_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        for (j = 0; j < 67; j++) respscanCheck(respScanCRSse42,buf+j,len-j);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        for (j = 0; j < 67; j++) respscanCheck(respScanCRAvx2,buf+j,len-j);
+    }
+#endif
+    /* The index must find the same '\r' as memchr() from any position,
+     * including windows without any '\r' at all. */
+    memset(buf+5000,'x',3*RESP_INDEX_WINDOW);
+    {
+        respIndex idx;
+        size_t pos;
+
+        respIndexReset(&idx);
+        for (pos = 0; pos < len; pos++) {
+            const char *a = respIndexNext(&idx,buf,len,pos);
+            const char *b = memchr(buf+pos,'\r',len-pos);
+            assert(a == b);
+        }
+        assert(respIndexNext(&idx,buf,len,len) == NULL);
+    }
+    free(buf);
+    printf("RESP scanner implementation: %s\n", respScanImpl());
+
+    /* Microbenchmark: locate every header of a pipeline of SET commands
+     * with strchr() + string2ll() versus the index + respParseLength(). */
+    for (j = 0; j < (int)(sizeof(depths)/sizeof(depths[0])); j++) {
+        int depth = depths[j], iter, iterations = 4000000/depth;
+        long long start, strchr_us, index_us;
+        long h1 = 0, h2 = 0;
+
+        buf = respscanPipeline(depth,&len);
+        start = respscanUstime();
+        for (iter = 0; iter < iterations; iter++) h1 += respscanWalk(buf,len,0);
+        strchr_us = respscanUstime()-start;
+        start = respscanUstime();
+        for (iter = 0; iter < iterations; iter++) h2 += respscanWalk(buf,len,1);
+        index_us = respscanUstime()-start;
+        assert(h1 == h2 && h1 == (long)depth*4*iterations);
+        printf("pipeline %5d: strchr %6.1f ns/cmd, index %6.1f ns/cmd\n",
+            depth,
+            (double)strchr_us*1000/((double)depth*iterations),
+            (double)index_us*1000/((double)depth*iterations));
+        free(buf);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,107 @@
+/* Vectorized helpers for the RESP request parser.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESPSCAN_H
+#define __RESPSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "util.h"
+
+/* Bytes of the query buffer covered by a single scan, as a bitmap with one
+ * bit per byte set where the byte is '\r'. */
+#define RESP_INDEX_WORDS 32
+#define RESP_INDEX_WINDOW (RESP_INDEX_WORDS*64)
+
+/* The '\r' bitmap of a window of a buffer. The parser asks for the next
+ * '\r' at or after a given position: inside the window this is a mask and a
+ * count-trailing-zeroes, and the buffer is scanned again (a whole vector at a
+ * time) only when the position moves past the window. */
+typedef struct respIndex {
+    const char *buf;    /* Buffer the bitmap refers to. */
+    size_t start;       /* Offset of the first byte of the window. */
+    size_t end;         /* Offset of the byte after the window. */
+    uint64_t bits[RESP_INDEX_WORDS];
+} respIndex;
+
+void respIndexReset(respIndex *idx);
+const char *respIndexSeek(respIndex *idx, const char *buf, size_t len,
+                          size_t pos);
+void respScanCR(const char *s, size_t len, uint64_t *bits);
+const char *respScanImpl(void);
+
+/* Return a pointer to the first '\r' in buf[pos..len-1], or NULL if there
+ * is none. The common case, a '\r' in the same 64 bytes word of the window,
+ * is inlined; everything else is handled by respIndexSeek(). */
+static inline const char *respIndexNext(respIndex *idx, const char *buf,
+                                        size_t len, size_t pos)
+{
+    if (idx->buf == buf && pos >= idx->start && pos < idx->end &&
+        len >= idx->end)
+    {
+        size_t rel = pos - idx->start;
+        uint64_t m = idx->bits[rel>>6] & (~0ULL << (rel&63));
+        if (m) return buf+idx->start+(rel&~(size_t)63)+__builtin_ctzll(m);
+    }
+    return respIndexSeek(idx,buf,len,pos);
+}
+
+/* Parse the decimal length of a '*' or '$' header. The common case (a
+ * positive number without sign or leading zeroes that fits in 18 digits)
+ * is handled with a single pass accumulating an error mask instead of
+ * branching on every digit. Everything else is delegated to string2ll(),
+ * so the accepted syntax is exactly the same. Returns 1 on success.
+ *
+ * The value is accumulated unsigned: with non digits in the input it is
+ * garbage, and may wrap around, before the error mask is checked. */
+static inline int respParseLength(const char *p, size_t len, long long *ll) {
+    unsigned long long v = 0;
+    unsigned int bad = 0;
+    size_t j;
+
+    if (len == 0 || len > 18 || p[0] < '1' || p[0] > '9')
+        return string2ll(p,len,ll);
+    for (j = 0; j < len; j++) {
+        unsigned int d = (unsigned char)p[j] - '0';
+        bad |= (d > 9);
+        v = v*10 + d;
+    }
+    if (bad) return 0;
+    *ll = (long long)v;
+    return 1;
+}
+
+#ifdef REDIS_TEST
+int respscanTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -54,6 +54,7 @@
 #include "crc64.h"
 #include "config.h"
 #include "server.h"
+#include "zstd.h"
 
 /* ------------------------- Buffer I/O implementation ----------------------- */
 
@@ -94,6 +95,8 @@ static const rio rioBufferIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    RDB_ENC_LZF,    /* compression codec */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -147,6 +150,8 @@ static const rio rioFileIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    RDB_ENC_LZF,    /* compression codec */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -159,44 +164,26 @@ void rioInitWithFile(rio *r, FILE *fp) {
 
 /* ------------------- File descriptors set implementation ------------------- */
 
-/* Returns 1 or 0 for success/failure.
- * The function returns success as long as we are able to correctly write
- * to at least one file descriptor.
- *
- * When buf is NULL and len is 0, the function performs a flush operation
- * if there is some pending buffer, so this function is also used in order
- * to implement rioFdsetFlush(). */
-static size_t rioFdsetWrite(rio *r, const void *buf, size_t len) {
+/* Write 'len' bytes at 'p' to the descriptors of the set. When the stream is
+ * compressed, only to the descriptors receiving the compressed data if
+ * 'compressed' is true, or to the others if it is false. */
+static void rioFdsetWriteTo(rio *r, unsigned char *p, size_t len,
+                            int compressed)
+{
+    int compressing = r->io.fdset.zstd && (r->flags & RIO_FLAG_COMPRESS);
     ssize_t retval;
     int j;
-    unsigned char *p = (unsigned char*) buf;
-    int doflush = (buf == NULL && len == 0);
-
-    /* To start we always append to our buffer. If it gets larger than
-     * a given size, we actually write to the sockets. */
-    if (len) {
-        r->io.fdset.buf = sdscatlen(r->io.fdset.buf,buf,len);
-        len = 0; /* Prevent entering the while below if we don't flush. */
-        if (sdslen(r->io.fdset.buf) > PROTO_IOBUF_LEN) doflush = 1;
-    }
-
-    if (doflush) {
-        p = (unsigned char*) r->io.fdset.buf;
-        len = sdslen(r->io.fdset.buf);
-    }
 
     /* Write in little chunchs so that when there are big writes we
      * parallelize while the kernel is sending data in background to
      * the TCP socket. */
     while(len) {
         size_t count = len < 1024 ? len : 1024;
-        int broken = 0;
         for (j = 0; j < r->io.fdset.numfds; j++) {
-            if (r->io.fdset.state[j] != 0) {
-                /* Skip FDs alraedy in error. */
-                broken++;
+            /* Skip FDs alraedy in error. */
+            if (r->io.fdset.state[j] != 0) continue;
+            if ((compressing && r->io.fdset.compressed[j]) != compressed)
                 continue;
-            }
 
             /* Make sure to write 'count' bytes to the socket regardless
              * of short writes. */
@@ -220,16 +207,73 @@ static size_t rioFdsetWrite(rio *r, const void *buf, size_t len) {
                 if (r->io.fdset.state[j] == 0) r->io.fdset.state[j] = EIO;
             }
         }
-        if (broken == r->io.fdset.numfds) return 0; /* All the FDs in error. */
         p += count;
         len -= count;
-        r->io.fdset.pos += count;
     }
+}
 
-    if (doflush) sdsclear(r->io.fdset.buf);
+/* Compress the buffered data into r->io.fdset.zbuf. When 'end' is true the
+ * zstd frame is completed. Returns 1 or 0 for success/failure. */
+static int rioFdsetCompress(rio *r, int end) {
+    ZSTD_inBuffer in = { r->io.fdset.buf, sdslen(r->io.fdset.buf), 0 };
+    size_t ret;
+
+    do {
+        ZSTD_outBuffer out;
+
+        r->io.fdset.zbuf = sdsMakeRoomFor(r->io.fdset.zbuf,
+                                          ZSTD_CStreamOutSize());
+        out.dst = r->io.fdset.zbuf+sdslen(r->io.fdset.zbuf);
+        out.size = sdsavail(r->io.fdset.zbuf);
+        out.pos = 0;
+        ret = ZSTD_compressStream2(r->io.fdset.zstd,&out,&in,
+                                   end ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(ret)) {
+            errno = EINVAL;
+            return 0;
+        }
+        sdsIncrLen(r->io.fdset.zbuf,out.pos);
+    } while(in.pos < in.size || (end && ret != 0));
     return 1;
 }
 
+/* Returns 1 or 0 for success/failure.
+ * The function returns success as long as we are able to correctly write
+ * to at least one file descriptor.
+ *
+ * When buf is NULL and len is 0, the function performs a flush operation
+ * if there is some pending buffer, so this function is also used in order
+ * to implement rioFdsetFlush(). */
+static size_t rioFdsetWrite(rio *r, const void *buf, size_t len) {
+    int doflush = (buf == NULL && len == 0);
+    int j;
+
+    /* To start we always append to our buffer. If it gets larger than
+     * a given size, we actually write to the sockets. */
+    if (len) {
+        r->io.fdset.buf = sdscatlen(r->io.fdset.buf,buf,len);
+        if (sdslen(r->io.fdset.buf) > PROTO_IOBUF_LEN) doflush = 1;
+    }
+    if (!doflush) return 1;
+
+    /* The descriptors reading the stream compressed get what the codec
+     * emits, an explicit flush completes the frame. */
+    if (r->io.fdset.zstd && (r->flags & RIO_FLAG_COMPRESS)) {
+        if (rioFdsetCompress(r,buf == NULL) == 0) return 0;
+        rioFdsetWriteTo(r,(unsigned char*)r->io.fdset.zbuf,
+                        sdslen(r->io.fdset.zbuf),1);
+        sdsclear(r->io.fdset.zbuf);
+    }
+    rioFdsetWriteTo(r,(unsigned char*)r->io.fdset.buf,
+                    sdslen(r->io.fdset.buf),0);
+    r->io.fdset.pos += sdslen(r->io.fdset.buf);
+    sdsclear(r->io.fdset.buf);
+
+    for (j = 0; j < r->io.fdset.numfds; j++)
+        if (r->io.fdset.state[j] == 0) return 1;
+    return 0; /* All the FDs in error. */
+}
+
 /* Returns 1 or 0 for success/failure. */
 static size_t rioFdsetRead(rio *r, void *buf, size_t len) {
     UNUSED(r);
@@ -260,6 +304,8 @@ static const rio rioFdsetIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    RDB_ENC_LZF,    /* compression codec */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -274,6 +320,23 @@ void rioInitWithFdset(rio *r, int *fds, int numfds) {
     r->io.fdset.numfds = numfds;
     r->io.fdset.pos = 0;
     r->io.fdset.buf = sdsempty();
+    r->io.fdset.compressed = NULL;
+    r->io.fdset.zstd = NULL;
+    r->io.fdset.zbuf = NULL;
+}
+
+/* Send the data compressed with zstd to the descriptors with a non zero
+ * entry in 'compressed', once RIO_FLAG_COMPRESS is set. The others still
+ * receive it as it is. */
+void rioFdsetSetCompression(rio *r, int *compressed) {
+    int numfds = r->io.fdset.numfds;
+
+    r->io.fdset.compressed = zmalloc(sizeof(int)*numfds);
+    memcpy(r->io.fdset.compressed,compressed,sizeof(int)*numfds);
+    r->io.fdset.zstd = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(r->io.fdset.zstd,ZSTD_c_compressionLevel,
+        REPL_STREAM_ZSTD_LEVEL);
+    r->io.fdset.zbuf = sdsempty();
 }
 
 /* release the rio stream. */
@@ -281,6 +344,220 @@ void rioFreeFdset(rio *r) {
     zfree(r->io.fdset.fds);
     zfree(r->io.fdset.state);
     sdsfree(r->io.fdset.buf);
+    zfree(r->io.fdset.compressed);
+    ZSTD_freeCCtx(r->io.fdset.zstd);
+    sdsfree(r->io.fdset.zbuf);
+}
+
+/* ------------------- File descriptor read implementation -------------------
+ * Buffered reader on top of a file descriptor, used by the slave to parse
+ * the RDB payload directly from the master socket (repl-diskless-load).
+ * The descriptor is expected to be in blocking mode: a read that fails or
+ * times out marks the stream with RIO_FLAG_READ_ERROR, so that the caller
+ * can tell a broken connection apart from a corrupted payload. */
+
+/* Read up to 'len' bytes from the descriptor. Returns the bytes read, or 0
+ * on errors. */
+static size_t rioFdReadRaw(rio *r, char *dst, size_t len) {
+    ssize_t retval = read(r->io.fd.fd,dst,len);
+
+    if (retval <= 0) {
+        /* As for the fdset target, EWOULDBLOCK only means that
+         * the SO_RCVTIMEO timeout elapsed. */
+        if (retval == -1 && errno == EWOULDBLOCK) errno = ETIMEDOUT;
+        if (retval == 0) errno = ECONNRESET;
+        r->flags |= RIO_FLAG_READ_ERROR;
+        return 0;
+    }
+    r->io.fd.read_so_far += retval;
+    return retval;
+}
+
+/* Refill the buffer with decompressed data, reading from the descriptor as
+ * needed. Returns once some data was produced, or when 'frame_end' is true
+ * and the zstd frame ended with no input left. Returns 1 or 0 for
+ * success/failure. */
+static int rioFdDecompress(rio *r, int frame_end) {
+    sdsclear(r->io.fd.buf);
+    r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,PROTO_IOBUF_LEN);
+    r->io.fd.pos = 0;
+
+    while(1) {
+        ZSTD_inBuffer in;
+        ZSTD_outBuffer out;
+        size_t ret;
+
+        if (r->io.fd.zpos == sdslen(r->io.fd.zbuf) && !r->io.fd.zmore) {
+            size_t nread;
+
+            if (frame_end && r->io.fd.zend) return 1;
+            sdsclear(r->io.fd.zbuf);
+            r->io.fd.zbuf = sdsMakeRoomFor(r->io.fd.zbuf,PROTO_IOBUF_LEN);
+            r->io.fd.zpos = 0;
+            nread = rioFdReadRaw(r,r->io.fd.zbuf,PROTO_IOBUF_LEN);
+            if (nread == 0) return 0;
+            sdsIncrLen(r->io.fd.zbuf,nread);
+        }
+
+        in.src = r->io.fd.zbuf;
+        in.size = sdslen(r->io.fd.zbuf);
+        in.pos = r->io.fd.zpos;
+        out.dst = r->io.fd.buf;
+        out.size = sdsavail(r->io.fd.buf);
+        out.pos = 0;
+        ret = ZSTD_decompressStream(r->io.fd.zstd,&out,&in);
+        if (ZSTD_isError(ret)) {
+            errno = EINVAL;
+            return 0;
+        }
+        r->io.fd.zpos = in.pos;
+        r->io.fd.zmore = out.pos == out.size;
+        r->io.fd.zend = ret == 0;
+        r->io.fd.zproduced += out.pos;
+        sdsIncrLen(r->io.fd.buf,out.pos);
+        if (out.pos) return 1;
+    }
+}
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    char *p = buf;
+
+    while(len) {
+        size_t avail = sdslen(r->io.fd.buf) - r->io.fd.pos;
+
+        if (avail == 0 && r->io.fd.zstd) {
+            if (rioFdDecompress(r,0) == 0) return 0;
+            continue;
+        } else if (avail == 0) {
+            /* Refill the buffer. Direct reads of big chunks skip it. */
+            size_t toread = len > PROTO_IOBUF_LEN ? len : PROTO_IOBUF_LEN;
+            char *dst;
+            size_t nread;
+
+            if (r->io.fd.read_limit) {
+                off_t left = r->io.fd.read_limit - r->io.fd.read_so_far;
+                if ((off_t)len > left) {
+                    /* The payload ends before what the caller asks for. */
+                    r->flags |= RIO_FLAG_READ_ERROR;
+                    errno = EOVERFLOW;
+                    return 0;
+                }
+                if ((off_t)toread > left) toread = left;
+            }
+
+            if (toread == len) {
+                dst = p;
+            } else {
+                sdsclear(r->io.fd.buf);
+                r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,toread);
+                r->io.fd.pos = 0;
+                dst = r->io.fd.buf;
+            }
+
+            nread = rioFdReadRaw(r,dst,toread);
+            if (nread == 0) return 0;
+
+            if (dst == p) {
+                p += nread;
+                len -= nread;
+            } else {
+                sdsIncrLen(r->io.fd.buf,nread);
+            }
+            continue;
+        }
+
+        if (avail > len) avail = len;
+        memcpy(p,r->io.fd.buf+r->io.fd.pos,avail);
+        r->io.fd.pos += avail;
+        p += avail;
+        len -= avail;
+    }
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns the number of bytes consumed by the caller, that is what was read
+ * from the descriptor (or decompressed) minus what is still buffered. */
+static off_t rioFdTell(rio *r) {
+    off_t produced = r->io.fd.zstd ? r->io.fd.zproduced :
+                                     r->io.fd.read_so_far;
+    return produced - (sdslen(r->io.fd.buf) - r->io.fd.pos);
+}
+
+static int rioFdFlush(rio *r) {
+    UNUSED(r);
+    return 1; /* Nothing to flush on a read only target. */
+}
+
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    RDB_ENC_LZF,    /* compression codec */
+    0,              /* flags */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Read from 'fd'. When 'read_limit' is not zero the stream never reads more
+ * than 'read_limit' bytes, so that data following the payload is left in
+ * the socket. */
+void rioInitWithFd(rio *r, int fd, off_t read_limit) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.buf = sdsempty();
+    r->io.fd.pos = 0;
+    r->io.fd.read_so_far = 0;
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.zstd = NULL;
+    r->io.fd.zbuf = NULL;
+}
+
+/* Read a zstd compressed stream from the descriptor: the caller reads the
+ * decompressed data. The stream must be terminated by the end of a frame,
+ * see rioFdAtEnd(). Not compatible with a read limit. */
+void rioFdSetDecompression(rio *r) {
+    serverAssert(r->io.fd.read_limit == 0);
+    r->io.fd.zstd = ZSTD_createDCtx();
+    r->io.fd.zbuf = sdsempty();
+    r->io.fd.zpos = 0;
+    r->io.fd.zmore = 0;
+    r->io.fd.zend = 0;
+    r->io.fd.zproduced = 0;
+}
+
+/* Return 1 if the caller consumed all the data read from the descriptor,
+ * and for compressed streams if the last zstd frame is complete, reading
+ * the rest of the frame if needed. Returns 0 if more data follows. */
+int rioFdAtEnd(rio *r) {
+    if (r->io.fd.pos != sdslen(r->io.fd.buf)) return 0;
+    if (r->io.fd.zstd == NULL) return 1;
+    while(!r->io.fd.zend || r->io.fd.zmore ||
+          r->io.fd.zpos != sdslen(r->io.fd.zbuf))
+    {
+        if (rioFdDecompress(r,1) == 0) return 0;
+        if (sdslen(r->io.fd.buf)) return 0;
+    }
+    return 1;
+}
+
+/* release the rio stream. */
+void rioFreeFd(rio *r) {
+    sdsfree(r->io.fd.buf);
+    ZSTD_freeDCtx(r->io.fd.zstd);
+    sdsfree(r->io.fd.zbuf);
 }
 
 /* ---------------------------- Generic functions ---------------------------- */
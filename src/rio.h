@@ -36,6 +36,10 @@
 #include <stdint.h>
 #include "sds.h"
 
+#define RIO_FLAG_READ_ERROR (1<<0) /* The source failed, not the data. */
+#define RIO_FLAG_COMPRESS (1<<1)   /* Compress what is written from now on,
+                                      see rioFdsetSetCompression(). */
+
 struct _rio {
     /* Backend functions.
      * Since this functions do not tolerate short writes or reads the return
@@ -60,6 +64,13 @@ struct _rio {
     /* maximum single read or write chunk size */
     size_t max_processing_chunk;
 
+    /* Codec used to compress the strings saved with rdbSaveRawString(),
+     * one of the RDB_ENC_LZF, RDB_ENC_LZ4 and RDB_ENC_ZSTD encodings. */
+    int codec;
+
+    /* RIO_FLAG_* flags. */
+    uint64_t flags;
+
     /* Backend-specific vars. */
     union {
         /* In-memory buffer target. */
@@ -80,7 +91,24 @@ struct _rio {
             int numfds;
             off_t pos;
             sds buf;
+            int *compressed;  /* Which fds read the data compressed. */
+            struct ZSTD_CCtx_s *zstd; /* Compressor, if any fd needs it. */
+            sds zbuf;         /* Compressed data to write. */
         } fdset;
+        /* Buffered file descriptor source (used to read from a socket). */
+        struct {
+            int fd;
+            sds buf;            /* Data read ahead. */
+            size_t pos;         /* Position of the next byte in 'buf'. */
+            off_t read_so_far;  /* Bytes read from the descriptor. */
+            off_t read_limit;   /* Never read past this, 0 if no limit. */
+            struct ZSTD_DCtx_s *zstd; /* Decompressor, if compressed. */
+            sds zbuf;           /* Compressed data read ahead. */
+            size_t zpos;        /* Position of the next byte in 'zbuf'. */
+            int zmore;          /* The decompressor may have more output. */
+            int zend;           /* The last call completed a frame. */
+            off_t zproduced;    /* Bytes decompressed. */
+        } fd;
     } io;
 };
 
@@ -124,11 +152,21 @@ static inline int rioFlush(rio *r) {
     return r->flush(r);
 }
 
+static inline int rioGetReadError(rio *r) {
+    return (r->flags & RIO_FLAG_READ_ERROR) != 0;
+}
+
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioInitWithFd(rio *r, int fd, off_t read_limit);
+
+void rioFdsetSetCompression(rio *r, int *compressed);
+void rioFdSetDecompression(rio *r);
+int rioFdAtEnd(rio *r);
 
 void rioFreeFdset(rio *r);
+void rioFreeFd(rio *r);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
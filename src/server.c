@@ -660,6 +660,7 @@ void updateDictResizePolicy(void) {
         dictEnableResize();
     else
         dictDisableResize();
+    updateForkCowMinimize();
 }
 
 /* ======================= Cron: called every 100 ms ======================== */
@@ -869,6 +870,8 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                 server.stat_net_input_bytes);
         trackInstantaneousMetric(STATS_METRIC_NET_OUTPUT,
                 server.stat_net_output_bytes);
+        trackInstantaneousMetric(STATS_METRIC_REPL_APPLY,
+                server.stat_repl_applied_ops);
     }
 
 
@@ -919,6 +922,13 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     //// 管理客户端资源
     clientsCron();
 
+    /* Release the reply blocks that were not needed for a while. */
+    run_with_period(1000) trimReplyBlockPool();
+
+    /* Stop tracking keys for client side caching over the configured
+     * limit, invalidating them. */
+    trackingLimitUsedSlots();
+
     //// 管理数据库资源
     // 定期删除，收缩字典等。。。
     databasesCron();
@@ -1076,6 +1086,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Handle the reads postponed by the readable handler when threaded
+     * I/O is active: the I/O threads read and parse, we execute. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1118,8 +1132,16 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     // 刷新aof 缓存（aof_buf）到文件
     flushAppendOnlyFile(0);
 
+    /* Hold the replies of the clients whose writes are not yet on disk. */
+    if (aofGroupCommitActive()) aofHoldClientsWaitingFsync();
+
     // 加入可写监控
-    handleClientsWithPendingWrites();
+    uncorkClients();
+    handleClientsWithPendingWritesUsingThreads();
+
+    /* Close clients that need to be closed asynchronous, for instance the
+     * ones an I/O thread found disconnected. */
+    freeClientsInAsyncFreeQueue();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1266,6 +1288,14 @@ void initServerConfig(void) {
     server.active_defrag_threshold_upper = CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER;
     server.active_defrag_cycle_min = CONFIG_DEFAULT_DEFRAG_CYCLE_MIN;
     server.active_defrag_cycle_max = CONFIG_DEFAULT_DEFRAG_CYCLE_MAX;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
+    server.io_uring = CONFIG_DEFAULT_IO_URING;
+    server.reply_cork = CONFIG_DEFAULT_REPLY_CORK;
+    server.tracking_clients = 0;
+    server.tracking_table_max_keys = CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS;
+    server.accept_threads_num = CONFIG_DEFAULT_ACCEPT_THREADS_NUM;
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
@@ -1292,14 +1322,23 @@ void initServerConfig(void) {
     server.aof_selected_db = -1; /* Make sure the first time will not match */
     server.aof_flush_postponed_start = 0;
     server.aof_rewrite_incremental_fsync = CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC;
+    server.aof_group_commit = CONFIG_DEFAULT_AOF_GROUP_COMMIT;
+    server.fork_cow_minimize = CONFIG_DEFAULT_FORK_COW_MINIMIZE;
+    server.fork_cow_defer_expire = CONFIG_DEFAULT_FORK_COW_DEFER_EXPIRE;
     server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;
     server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;
     server.pidfile = NULL;
     server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
+    server.aof_dirname = zstrdup(CONFIG_DEFAULT_AOF_DIRNAME);
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
+    server.rdb_codec = CONFIG_DEFAULT_RDB_CODEC;
+    server.repl_rdb_codec = CONFIG_DEFAULT_REPL_RDB_CODEC;
+    server.dump_codec = CONFIG_DEFAULT_DUMP_CODEC;
+    server.rdb_zstd_level = CONFIG_DEFAULT_RDB_ZSTD_LEVEL;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_key_index = CONFIG_DEFAULT_RDB_KEY_INDEX;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
@@ -1362,6 +1401,9 @@ void initServerConfig(void) {
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;
+    server.repl_stream_compression = CONFIG_DEFAULT_REPL_STREAM_COMPRESSION;
+    server.repl_batch_apply = CONFIG_DEFAULT_REPL_BATCH_APPLY;
     server.repl_ping_slave_period = CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD;
     server.repl_timeout = CONFIG_DEFAULT_REPL_TIMEOUT;
     server.repl_min_slaves_to_write = CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE;
@@ -1374,9 +1416,7 @@ void initServerConfig(void) {
     /* Replication partial resync backlog */
     server.repl_backlog = NULL;
     server.repl_backlog_size = CONFIG_DEFAULT_REPL_BACKLOG_SIZE;
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
-    server.repl_backlog_off = 0;
+    server.repl_backlog_disk_size = CONFIG_DEFAULT_REPL_BACKLOG_DISK_SIZE;
     server.repl_backlog_time_limit = CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT;
     server.repl_no_slaves_since = time(NULL);
 
@@ -1584,8 +1624,15 @@ void checkTcpBacklogSettings(void) {
 }
 
 /**     初始化socket监听客户端请求        */
-int listenToPort(int port, int *fds, int *count) {
-    int j;
+/* The sockets are appended to 'fds', created with SO_REUSEPORT if
+ * 'reuseport' is true: this way the function can be called multiple times
+ * to listen with more sockets to the same addresses. */
+int listenToPort(int port, int *fds, int *count, int reuseport) {
+    int j, start = *count;
+    int (*tcpserver)(char*,int,char*,int) =
+        reuseport ? anetTcpReusePortServer : anetTcpServer;
+    int (*tcp6server)(char*,int,char*,int) =
+        reuseport ? anetTcp6ReusePortServer : anetTcp6Server;
 
     /* Force binding of 0.0.0.0 if no bind address is specified, always
      * entering the loop if j == 0. */
@@ -1595,7 +1642,7 @@ int listenToPort(int port, int *fds, int *count) {
             int unsupported = 0;
 
             // 监听ipv6
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
+            fds[*count] = tcp6server(server.neterr,port,NULL,
                 server.tcp_backlog);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
@@ -1605,9 +1652,9 @@ int listenToPort(int port, int *fds, int *count) {
                 serverLog(LL_WARNING,"Not listening to IPv6: unsupproted");
             }
 
-            if (*count == 1 || unsupported) {
+            if (*count-start == 1 || unsupported) {
                 // 监听ipv4
-                fds[*count] = anetTcpServer(server.neterr,port,NULL,
+                fds[*count] = tcpserver(server.neterr,port,NULL,
                     server.tcp_backlog);
                 if (fds[*count] != ANET_ERR) {
                     anetNonBlock(NULL,fds[*count]);
@@ -1620,14 +1667,14 @@ int listenToPort(int port, int *fds, int *count) {
             /* Exit the loop if we were able to bind * on IPv4 and IPv6,
              * otherwise fds[*count] will be ANET_ERR and we'll print an
              * error and return to the caller with an error. */
-            if (*count + unsupported == 2) break;
+            if (*count-start + unsupported == 2) break;
         } else if (strchr(server.bindaddr[j],':')) {
             /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcp6server(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         } else {
             /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcpserver(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         }
         if (fds[*count] == ANET_ERR) {
@@ -1643,6 +1690,18 @@ int listenToPort(int port, int *fds, int *count) {
     return C_OK;
 }
 
+/* SO_REUSEPORT lets another process of the same user listen to the same
+ * port, and the two would silently split the connections. So before using
+ * it the port is bound without SO_REUSEPORT, that fails if anybody else is
+ * listening to it, and the sockets are closed again. */
+int checkListenPortIsFree(int port) {
+    int fds[CONFIG_BINDADDR_MAX], count = 0, j, retval;
+
+    retval = listenToPort(port,fds,&count,0);
+    for (j = 0; j < count; j++) close(fds[j]);
+    return retval;
+}
+
 /* Resets the stats that we expose via INFO or other means that we want
  * to reset via CONFIG RESETSTAT. The function is also used in order to
  * initialize these fields in initServer() at server startup. */
@@ -1665,6 +1724,10 @@ void resetServerStats(void) {
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
+    server.stat_io_batched_reads = 0;
+    server.stat_io_batched_writes = 0;
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
         server.inst_metric[j].last_sample_time = mstime();
@@ -1674,7 +1737,17 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_net_output_writes = 0;
+    server.stat_repl_stream_bytes = 0;
+    server.stat_repl_stream_compressed_bytes = 0;
+    server.stat_net_output_corked_writes = 0;
+    server.stat_propagated_cmds = 0;
+    server.stat_propagate_usec = 0;
+    server.stat_repl_applied_ops = 0;
+    server.stat_repl_applied_bytes = 0;
+    server.stat_repl_apply_batches = 0;
     server.aof_delayed_fsync = 0;
+    server.stat_aof_group_commits = 0;
 }
 
 /**         初始化server       */
@@ -1696,8 +1769,14 @@ void initServer(void) {
     server.clients = listCreate();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_buffer_blocks = listCreate();
+    server.repl_buffer_mem = 0;
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_waiting_aof_fsync = listCreate();
+    server.clients_corked = listCreate();
+    server.clients_index = raxNew();
+    server.clients_pending_read = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -1711,6 +1790,7 @@ void initServer(void) {
 
 
     //// 创建事件循环结构体
+    aeSetUseIoUring(server.io_uring);
     server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
     if (server.el == NULL) {
         serverLog(LL_WARNING,
@@ -1728,9 +1808,19 @@ void initServer(void) {
     // server.ipfd_count = 2
     // server.ipfd[0] = x1
     // server.ipfd[1] = x2
-    if (server.port != 0 &&
-        listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
-        exit(1);
+    // 使用accept线程时，每个线程使用SO_REUSEPORT监听自己的一组套接字，由内核分配新连接
+    if (server.port != 0) {
+        int listeners = server.accept_threads_num ?
+                        server.accept_threads_num : 1;
+        if (server.accept_threads_num &&
+            checkListenPortIsFree(server.port) == C_ERR)
+            exit(1);
+        for (j = 0; j < listeners; j++) {
+            if (listenToPort(server.port,server.ipfd,&server.ipfd_count,
+                             server.accept_threads_num != 0) == C_ERR)
+                exit(1);
+        }
+    }
 
 
 
@@ -1786,8 +1876,10 @@ void initServer(void) {
     server.child_info_pipe[0] = -1;
     server.child_info_pipe[1] = -1;
     server.child_info_data.magic = 0;
-    aofRewriteBufferReset();
+    server.aof_manifest = NULL;
+    server.aof_last_incr_size = 0;
     server.aof_buf = sdsempty();
+    server.propagate_buf = sdsempty();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
     server.rdb_save_time_last = -1;
@@ -1817,7 +1909,8 @@ void initServer(void) {
 
 
     //// 为上面创建的服务端套接字(ipv4,ipv6两个套接字)创建文件事件，可读事件类型
-    for (j = 0; j < server.ipfd_count; j++) {
+    // 使用accept线程时，TCP套接字由accept线程监听，见initAcceptThreads()
+    for (j = 0; j < server.ipfd_count && !server.accept_threads_num; j++) {
         if (aeCreateFileEvent(server.el, server.ipfd[j], AE_READABLE,
             acceptTcpHandler,NULL) == AE_ERR)
             {
@@ -1840,17 +1933,7 @@ void initServer(void) {
                 "Error registering the readable event for the module "
                 "blocked clients subsystem.");
     }
-
-    // Redis在启动服务器时，会根据配置，打开AOF文件，并将对应文件描述符记录在redisServer.aof_fd字段上
-    if (server.aof_state == AOF_ON) {// 0/1/2
-        server.aof_fd = open(server.aof_filename,
-                               O_WRONLY|O_APPEND|O_CREAT,0644);
-        if (server.aof_fd == -1) {
-            serverLog(LL_WARNING, "Can't open the append-only file: %s",
-                strerror(errno));
-            exit(1);
-        }
-    }
+    aofGroupCommitInit();
 
     // 32位实例的地址空间限制为4GB，所以如果在用户提供的配置中没有显式的限制，
     // 我们使用“noeviction”策略将最大内存限制为3gb。
@@ -1871,6 +1954,8 @@ void initServer(void) {
     slowlogInit();                   // 慢查询日志初始化
     latencyMonitorInit();
     bioInit();                       // 初始化异步线程
+    initThreadedIO();
+    initAcceptThreads();
 
     // 初始化所使用的内存大小
     server.initial_memory_usage = zmalloc_used_memory();
@@ -1997,10 +2082,35 @@ struct redisCommand *lookupCommandOrOriginal(sds name) {
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
                int flags)
 {
+    long long start = ustime();
+    sds encoded = NULL;
+
+    /* The command is encoded at most once, by the first of the AOF and the
+     * replication stream that needs it. */
     if (server.aof_state != AOF_OFF && flags & PROPAGATE_AOF)   // aof打开
-        feedAppendOnlyFile(cmd,dbid,argv,argc);
+        feedAppendOnlyFileEncoded(cmd,dbid,argv,argc,&encoded);
     if (flags & PROPAGATE_REPL)
-        replicationFeedSlaves(server.slaves,dbid,argv,argc);
+        replicationFeedSlavesEncoded(server.slaves,dbid,argv,argc,&encoded);
+    server.stat_propagated_cmds++;
+    server.stat_propagate_usec += ustime()-start;
+}
+
+/* Return the RESP encoding of the command 'argv' being propagated. It is
+ * produced in server.propagate_buf the first time, and '*encoded' is set to
+ * it: the following callers passing the same 'encoded' reuse it. */
+sds getPropagatedCommandEncoding(sds *encoded, int argc, robj **argv) {
+    if (*encoded) return *encoded;
+
+    /* Don't keep the room of a big command around. */
+    if (sdsalloc(server.propagate_buf) > PROTO_PROPAGATE_BUF_MAX) {
+        sdsfree(server.propagate_buf);
+        server.propagate_buf = sdsempty();
+    }
+    sdsclear(server.propagate_buf);
+    server.propagate_buf = catAppendOnlyGenericCommand(server.propagate_buf,
+                                                       argc,argv);
+    *encoded = server.propagate_buf;
+    return *encoded;
 }
 
 /* Used inside commands to schedule the propagation of additional commands
@@ -2092,10 +2202,13 @@ void preventCommandReplication(client *c) {
  * preventCommandAOF(client *c);
  * preventCommandReplication(client *c);
  *
+ * call() is callGeneric() with 'calls' set to NULL. When applying a batch of
+ * commands of our master, 'calls' is the counter of the batch, that the
+ * caller adds to stat_numcommands once for the whole batch.
  */
-void call(client *c, int flags) {
+static void callGeneric(client *c, int flags, long long *calls) {
     long long dirty, start, duration;
-    int client_old_flags = c->flags;
+    uint64_t client_old_flags = c->flags;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
      * not generated from reading an AOF. */
@@ -2153,6 +2266,16 @@ void call(client *c, int flags) {
         c->lastcmd->calls++;
     }
 
+    /* If the client has keys tracking enabled for client side caching,
+     * make sure to remember the keys it fetched via this command. For
+     * commands called by Lua the tracking client is the EVAL caller. */
+    if (c->cmd->flags & CMD_READONLY) {
+        client *caller = (c->flags & CLIENT_LUA && server.lua_caller) ?
+                            server.lua_caller : c;
+        if (caller->flags & CLIENT_TRACKING)
+            trackingRememberKeys(caller,c);
+    }
+
     // aof 和 复制相关
     if (flags & CMD_CALL_PROPAGATE &&
         (c->flags & CLIENT_PREVENT_PROP) != CLIENT_PREVENT_PROP)
@@ -2211,7 +2334,17 @@ void call(client *c, int flags) {
         redisOpArrayFree(&server.also_propagate);
     }
     server.also_propagate = prev_also_propagate;
-    server.stat_numcommands++;
+
+    /* With the group commit the replies of the command must wait for the
+     * fsync of what is in the AOF so far: what it wrote, and the writes of
+     * the other clients it may have observed. */
+    c->aof_woff = server.aof_fed_offset;
+    if (calls) (*calls)++;
+    else server.stat_numcommands++;
+}
+
+void call(client *c, int flags) {
+    callGeneric(c,flags,NULL);
 }
 
 //// 执行命令
@@ -2405,8 +2538,70 @@ int processCommand(client *c) {
     return C_OK;
 }
 
+/* Fast path of processCommand() for the commands of our master, used by
+ * processInputBuffer() to apply the replication stream in batches. The
+ * checks that never apply to the master link (authentication, cluster
+ * redirection, read only slave, min-slaves, disk errors) are skipped, the
+ * command lookup is cached in 'batch', and the memory limit is checked by
+ * the caller once per batch instead of once per command, like the update of
+ * stat_numcommands, see callGeneric().
+ *
+ * Returns 1 if the command was executed, 0 if it must go through
+ * processCommand() instead: unknown commands, wrong arity, transactions
+ * and the states that reject commands (loading, busy script, link down). */
+int processMasterCommandFast(client *c, replApplyBatch *batch) {
+    struct redisCommand *cmd;
+    sds name;
+    size_t len;
+
+    if (c->flags & (CLIENT_MULTI|CLIENT_PUBSUB) ||
+        server.loading || server.lua_timedout ||
+        server.repl_state != REPL_STATE_CONNECTED ||
+        !sdsEncodedObject(c->argv[0])) return 0;
+
+    name = c->argv[0]->ptr;
+    len = sdslen(name);
+    if (batch->cmd && len == batch->namelen &&
+        !memcmp(name,batch->name,len))
+    {
+        cmd = batch->cmd;
+    } else {
+        cmd = lookupCommand(name);
+        if (!cmd) return 0;
+        if (len < sizeof(batch->name)) {
+            memcpy(batch->name,name,len);
+            batch->namelen = len;
+            batch->cmd = cmd;
+        }
+    }
+    if ((cmd->arity > 0 && cmd->arity != c->argc) ||
+        (c->argc < -cmd->arity)) return 0;
+
+    c->cmd = c->lastcmd = cmd;
+    callGeneric(c,CMD_CALL_FULL,&batch->calls);
+    c->woff = server.master_repl_offset;
+    if (listLength(server.ready_keys))
+        handleClientsBlockedOnLists();
+    return 1;
+}
+
 /*================================== Shutdown =============================== */
 
+/* Remove the listening sockets from the event loop. This is needed before
+ * closing them in the server process, since the io_uring event loop keeps
+ * them open while they are polled. */
+static void unregisterListeningSockets(void) {
+    int j;
+
+    for (j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1)
+        aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    if (server.cluster_enabled)
+        for (j = 0; j < server.cfd_count; j++)
+            aeDeleteFileEvent(server.el,server.cfd[j],AE_READABLE);
+}
+
 /* Close listening sockets. Also unlink the unix domain socket if
  * unlink_unix_socket is non-zero. */
 void closeListeningSockets(int unlink_unix_socket) {
@@ -2488,6 +2683,7 @@ int prepareForShutdown(int flags) {
     flushSlavesOutputBuffers();
 
     /* Close the listening sockets. Apparently this allows faster restarts. */
+    unregisterListeningSockets();
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -2806,10 +3002,12 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "tracking_clients:%u\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            server.tracking_clients);
     }
 
     /* Memory */
@@ -2864,7 +3062,9 @@ sds genRedisInfoString(char *section) {
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
-            "lazyfree_pending_objects:%zu\r\n",
+            "lazyfree_pending_objects:%zu\r\n"
+            "mem_reply_block_pool:%zu\r\n"
+            "mem_replication_buffer:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -2886,7 +3086,9 @@ sds genRedisInfoString(char *section) {
             mh->fragmentation,
             ZMALLOC_LIB,
             server.active_defrag_running,
-            lazyfreeGetPendingObjectsCount()
+            lazyfreeGetPendingObjectsCount(),
+            replyBlockPoolMemory(),
+            server.repl_buffer_mem
         );
         freeMemoryOverheadData(mh);
     }
@@ -2911,7 +3113,10 @@ sds genRedisInfoString(char *section) {
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
             "aof_last_write_status:%s\r\n"
-            "aof_last_cow_size:%zu\r\n",
+            "aof_last_cow_size:%zu\r\n"
+            "fork_cow_minimize_active:%d\r\n"
+            "fork_cow_suppressed_writes:%lld\r\n"
+            "fork_cow_saved_bytes_est:%zu\r\n",
             server.loading,
             server.dirty,
             server.rdb_child_pid != -1,
@@ -2929,7 +3134,10 @@ sds genRedisInfoString(char *section) {
                 -1 : time(NULL)-server.aof_rewrite_time_start),
             (server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
             (server.aof_last_write_status == C_OK) ? "ok" : "err",
-            server.stat_aof_cow_bytes);
+            server.stat_aof_cow_bytes,
+            server.fork_cow_minimize_active,
+            server.stat_fork_cow_suppressed_writes,
+            forkCowSavedBytes());
 
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
@@ -2937,16 +3145,28 @@ sds genRedisInfoString(char *section) {
                 "aof_base_size:%lld\r\n"
                 "aof_pending_rewrite:%d\r\n"
                 "aof_buffer_length:%zu\r\n"
-                "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_group_commits:%lld\r\n"
+                "aof_clients_waiting_fsync:%lu\r\n"
+                "aof_last_load_bytes:%lld\r\n"
+                "aof_last_load_commands:%lld\r\n"
+                "aof_last_load_time_ms:%lld\r\n"
+                "aof_last_load_bytes_per_sec:%lld\r\n"
+                "aof_last_load_commands_per_sec:%lld\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
-                aofRewriteBufferSize(),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                server.stat_aof_group_commits,
+                listLength(server.clients_waiting_aof_fsync),
+                server.aof_load_bytes,
+                server.aof_load_commands,
+                server.aof_load_time/1000,
+                server.aof_load_bytes*1000000/(server.aof_load_time+1),
+                server.aof_load_commands*1000000/(server.aof_load_time+1));
         }
 
         if (server.loading) {
@@ -2991,12 +3211,20 @@ sds genRedisInfoString(char *section) {
             "instantaneous_ops_per_sec:%lld\r\n"
             "total_net_input_bytes:%lld\r\n"
             "total_net_output_bytes:%lld\r\n"
+            "total_net_output_writes:%lld\r\n"
+            "total_net_output_corked_writes:%lld\r\n"
+            "avg_net_output_write_size:%.2f\r\n"
             "instantaneous_input_kbps:%.2f\r\n"
             "instantaneous_output_kbps:%.2f\r\n"
             "rejected_connections:%lld\r\n"
             "sync_full:%lld\r\n"
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
+            "repl_stream_compression_in_bytes:%lld\r\n"
+            "repl_stream_compression_out_bytes:%lld\r\n"
+            "propagated_commands:%lld\r\n"
+            "propagate_usec:%lld\r\n"
+            "propagate_usec_per_call:%.2f\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
             "keyspace_hits:%lld\r\n"
@@ -3009,18 +3237,37 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "io_batched_reads_processed:%lld\r\n"
+            "io_batched_writes_processed:%lld\r\n"
+            "tracking_total_keys:%llu\r\n"
+            "tracking_total_items:%llu\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
             server.stat_net_input_bytes,
             server.stat_net_output_bytes,
+            server.stat_net_output_writes,
+            server.stat_net_output_corked_writes,
+            server.stat_net_output_writes ?
+                (double)server.stat_net_output_bytes/
+                server.stat_net_output_writes : 0,
             (float)getInstantaneousMetric(STATS_METRIC_NET_INPUT)/1024,
             (float)getInstantaneousMetric(STATS_METRIC_NET_OUTPUT)/1024,
             server.stat_rejected_conn,
             server.stat_sync_full,
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
+            server.stat_repl_stream_bytes,
+            server.stat_repl_stream_compressed_bytes,
+            server.stat_propagated_cmds,
+            server.stat_propagate_usec,
+            server.stat_propagated_cmds ?
+                (double)server.stat_propagate_usec/
+                server.stat_propagated_cmds : 0,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
             server.stat_keyspace_hits,
@@ -3033,7 +3280,14 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.stat_io_batched_reads,
+            server.stat_io_batched_writes,
+            (unsigned long long) trackingGetTotalKeys(),
+            (unsigned long long) trackingGetTotalItems());
     }
 
     /* Replication */
@@ -3058,6 +3312,7 @@ sds genRedisInfoString(char *section) {
                 "master_last_io_seconds_ago:%d\r\n"
                 "master_sync_in_progress:%d\r\n"
                 "slave_repl_offset:%lld\r\n"
+                "master_link_compression:%s\r\n"
                 ,server.masterhost,
                 server.masterport,
                 (server.repl_state == REPL_STATE_CONNECTED) ?
@@ -3065,7 +3320,8 @@ sds genRedisInfoString(char *section) {
                 server.master ?
                 ((int)(server.unixtime-server.master->lastinteraction)) : -1,
                 server.repl_state == REPL_STATE_TRANSFER,
-                slave_repl_offset
+                slave_repl_offset,
+                (server.master && server.master->repl_dctx) ? "zstd" : "none"
             );
 
             if (server.repl_state == REPL_STATE_TRANSFER) {
@@ -3083,6 +3339,34 @@ sds genRedisInfoString(char *section) {
                     "master_link_down_since_seconds:%jd\r\n",
                     (intmax_t)server.unixtime-server.repl_down_since);
             }
+
+            /* The lag is the part of the stream received but not applied
+             * yet, for instance while clients are paused. In commands it
+             * is estimated from the average size of the applied ones. */
+            long long lag_bytes = 0, lag_ops = 0;
+            if (server.master) {
+                lag_bytes = server.master->read_reploff-
+                            server.master->reploff;
+                if (lag_bytes && server.stat_repl_applied_bytes)
+                    lag_ops = (long long)((double)lag_bytes*
+                        server.stat_repl_applied_ops/
+                        server.stat_repl_applied_bytes+0.5);
+            }
+            info = sdscatprintf(info,
+                "slave_apply_ops:%lld\r\n"
+                "slave_apply_batches:%lld\r\n"
+                "slave_apply_avg_batch_ops:%.2f\r\n"
+                "instantaneous_slave_apply_ops_per_sec:%lld\r\n"
+                "slave_apply_lag_bytes:%lld\r\n"
+                "slave_apply_lag_ops:%lld\r\n",
+                server.stat_repl_applied_ops,
+                server.stat_repl_apply_batches,
+                server.stat_repl_apply_batches ?
+                    (double)server.stat_repl_applied_ops/
+                    server.stat_repl_apply_batches : 0,
+                getInstantaneousMetric(STATS_METRIC_REPL_APPLY),
+                lag_bytes,
+                lag_ops);
             info = sdscatprintf(info,
                 "slave_priority:%d\r\n"
                 "slave_read_only:%d\r\n",
@@ -3145,6 +3429,21 @@ sds genRedisInfoString(char *section) {
                 slaveid++;
             }
         }
+
+        /* The history on disk, if any, precedes the one in memory. */
+        long long backlog_first = 0, backlog_histlen = 0;
+        long long backlog_disk_histlen = 0;
+        if (server.repl_backlog) {
+            replBacklog *bl = server.repl_backlog;
+
+            backlog_first = bl->offset;
+            backlog_histlen = bl->histlen;
+            if (bl->disk_fd != -1 && bl->disk_histlen) {
+                backlog_disk_histlen = bl->disk_histlen;
+                backlog_first = bl->disk_offset;
+                backlog_histlen += bl->disk_histlen;
+            }
+        }
         info = sdscatprintf(info,
             "master_replid:%s\r\n"
             "master_replid2:%s\r\n"
@@ -3153,15 +3452,19 @@ sds genRedisInfoString(char *section) {
             "repl_backlog_active:%d\r\n"
             "repl_backlog_size:%lld\r\n"
             "repl_backlog_first_byte_offset:%lld\r\n"
-            "repl_backlog_histlen:%lld\r\n",
+            "repl_backlog_histlen:%lld\r\n"
+            "repl_backlog_disk_size:%lld\r\n"
+            "repl_backlog_disk_histlen:%lld\r\n",
             server.replid,
             server.replid2,
             server.master_repl_offset,
             server.second_replid_offset,
             server.repl_backlog != NULL,
             server.repl_backlog_size,
-            server.repl_backlog_off,
-            server.repl_backlog_histlen);
+            backlog_first,
+            backlog_histlen,
+            server.repl_backlog_disk_size,
+            backlog_disk_histlen);
     }
 
     /* CPU */
@@ -3438,9 +3741,14 @@ void loadDataFromDisk(void) {
     long long start = ustime();
 
     // 如果使用了aof则使用aof来恢复数据，否则使用rdb恢复
+    // The manifest is needed even with the AOF disabled, since BGREWRITEAOF
+    // produces a new base file anyway.
+    aofLoadManifestFromDisk();
     if (server.aof_state == AOF_ON) {
-        if (loadAppendOnlyFile(server.aof_filename) == C_OK)
+        if (loadAppendOnlyFiles(server.aof_manifest) == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
+        // Redis在启动服务器时，会根据配置，打开AOF文件，并将对应文件描述符记录在redisServer.aof_fd字段上
+        aofOpenIfNeededOnServerStart();
     } else {
         rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
         if (rdbLoad(server.rdb_filename,&rsi) == C_OK) {
@@ -3606,6 +3914,10 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "ae")) {
+            return aeTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "respscan")) {
+            return respscanTest(argc, argv);
         }
 
         return -1; /* test not found */
@@ -3619,6 +3931,7 @@ int main(int argc, char **argv) {
     setlocale(LC_COLLATE,"");
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
     srand(time(NULL)^getpid());
+    crc64Init();
     gettimeofday(&tv,NULL);
     char hashseed[16];
     getRandomHexChars(hashseed,sizeof(hashseed));
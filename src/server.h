@@ -43,6 +43,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "sha1.h"
 #include "endianconv.h"
 #include "crc64.h"
+#include "respscan.h"
 
 /* Error codes */
 #define C_OK                    0
@@ -59,6 +60,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define NET_MAX_IOV IOV_MAX     /* Max iovec entries per writev() call. */
+#else
+#define NET_MAX_IOV 1024
+#endif
+#define NET_BATCH_MAX_IOV 16    /* Max iovec entries per batched write. */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -66,7 +73,6 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_REWRITE_PERC  100
 #define AOF_REWRITE_MIN_SIZE (64*1024*1024)
 #define AOF_REWRITE_ITEMS_PER_CMD 64
-#define AOF_READ_DIFF_INTERVAL_BYTES (1024*10)
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000
@@ -78,6 +84,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define RDB_EOF_MARK_SIZE 40
 #define CONFIG_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
 #define CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT (60*60)  /* 1 hour */
+#define CONFIG_DEFAULT_REPL_BACKLOG_DISK_SIZE 0         /* Disabled. */
 #define CONFIG_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
 #define CONFIG_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define CONFIG_DEFAULT_PID_FILE "/var/run/redis.pid"
@@ -94,10 +101,18 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_SYSLOG_ENABLED 0
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
+#define CONFIG_DEFAULT_RDB_CODEC RDB_ENC_LZF
+#define CONFIG_DEFAULT_REPL_RDB_CODEC RDB_ENC_LZF
+#define CONFIG_DEFAULT_DUMP_CODEC RDB_ENC_LZF
+#define CONFIG_DEFAULT_RDB_ZSTD_LEVEL 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_KEY_INDEX 0
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
+#define CONFIG_DEFAULT_REPL_STREAM_COMPRESSION 0
+#define CONFIG_DEFAULT_REPL_BATCH_APPLY 1
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -108,11 +123,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
+#define CONFIG_DEFAULT_AOF_DIRNAME "appendonlydir"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
+#define CONFIG_DEFAULT_AOF_GROUP_COMMIT 0
+#define CONFIG_DEFAULT_FORK_COW_MINIMIZE 0
+#define CONFIG_DEFAULT_FORK_COW_DEFER_EXPIRE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
 #define NET_IP_STR_LEN 46 /* INET6_ADDRSTRLEN is 46, but we need to be sure */
@@ -131,6 +150,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1 /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0 /* Read + parse from threads? */
+#define CONFIG_DEFAULT_IO_URING 1 /* Use io_uring when compiled in. */
+#define CONFIG_DEFAULT_REPLY_CORK 0 /* Flush replies as soon as possible. */
+#define CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000 /* Keys remembered for
+                                                       client side caching. */
+#define IO_THREADS_MAX_NUM 128
+#define CONFIG_DEFAULT_ACCEPT_THREADS_NUM 0 /* Accept from the main thread. */
+#define ACCEPT_THREADS_MAX_NUM 16
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 0 /* Load RDB files serially. */
+#define RDB_LOAD_THREADS_MAX_NUM 64
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -143,14 +173,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define STATS_METRIC_COMMAND 0      /* Number of commands executed. */
 #define STATS_METRIC_NET_INPUT 1    /* Bytes read to network .*/
 #define STATS_METRIC_NET_OUTPUT 2   /* Bytes written to network. */
-#define STATS_METRIC_COUNT 3
+#define STATS_METRIC_REPL_APPLY 3   /* Commands applied from the master. */
+#define STATS_METRIC_COUNT 4
 
 /* Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_PROPAGATE_BUF_MAX (64*1024) /* Shrink server.propagate_buf
+                                             when it grows over this. */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REPLY_MIN_REF_BYTES (1024*16) /* Bulk values referenced, not copied. */
+#define PROTO_REPLY_POOL_MAX_BLOCKS 1024 /* Max free reply blocks kept. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -187,6 +222,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_ON 1              /* AOF is on */
 #define AOF_WAIT_REWRITE 2    /* AOF waits rewrite to start appending */
 
+/* Kind of file listed in the AOF manifest. */
+#define AOF_FILE_TYPE_BASE 'b' /* Snapshot produced by a rewrite. */
+#define AOF_FILE_TYPE_INCR 'i' /* Commands appended after the snapshot. */
+
 /* Client flags */
 #define CLIENT_SLAVE (1<<0)   /* This client is a slave server */
 #define CLIENT_MASTER (1<<1)  /* This client is a master server */
@@ -219,6 +258,24 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PENDING_READ (1<<28) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from. */
+#define CLIENT_PENDING_COMMAND (1<<29) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
+#define CLIENT_REPLY_CORKED (1<<30) /* The client is in the list of clients
+                                       whose replies may be held by the
+                                       kernel (MSG_MORE), see reply-cork. */
+#define CLIENT_TRACKING (1ULL<<31) /* Client enabled keys tracking in order
+                                      to perform client side caching. */
+#define CLIENT_TRACKING_BROKEN_REDIR (1ULL<<32) /* Target client is invalid. */
+#define CLIENT_TRACKING_NOLOOP (1ULL<<33) /* Don't send invalidation messages
+                                             about keys modified by the
+                                             client itself. */
+#define CLIENT_PENDING_AOF_FSYNC (1ULL<<34) /* Replies held until the AOF is
+                                               fsynced, see aof-group-commit. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -275,6 +332,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SLAVE_CAPA_NONE 0
 #define SLAVE_CAPA_EOF (1<<0)    /* Can parse the RDB EOF streaming format. */
 #define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
+#define SLAVE_CAPA_ZSTD (1<<2)   /* Reads the stream compressed with zstd. */
+
+/* Zstd level of the compressed replication stream: it is compressed while
+ * it is produced, so a fast level is used. */
+#define REPL_STREAM_ZSTD_LEVEL 1
 
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -300,6 +362,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SUPERVISED_SYSTEMD 2
 #define SUPERVISED_UPSTART 3
 
+/* Slave diskless load modes (repl-diskless-load) */
+#define REPL_DISKLESS_LOAD_DISABLED 0
+#define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1
+#define REPL_DISKLESS_LOAD_SWAPDB 2
+
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
@@ -689,6 +756,60 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* This structure is the value type of the client reply list. Replies are
+ * normally accumulated as protocol inside 'buf', however big string values
+ * are not copied into the output buffers: 'obj' holds a reference to the
+ * string object and the block emits 'buf' (just the bulk length header in
+ * this case), the object payload and the final CRLF. See addReplyBulk().
+ *
+ * Blocks have a fixed capacity of PROTO_REPLY_CHUNK_BYTES and are recycled
+ * through a process wide pool, so that clients receiving a lot of output
+ * don't keep allocating and freeing buffers of different sizes. Only the
+ * replies that don't fit a block, and the blocks referencing objects, are
+ * allocated with the exact size. */
+typedef struct clientReplyBlock {
+    size_t size, used;  /* Capacity of 'buf' and bytes used. */
+    robj *obj;          /* Referenced string value or NULL. */
+    struct clientReplyBlock *next; /* Next block in the pool or in
+                                      reply_sent_blocks. */
+    char buf[];         /* Protocol, or bulk header if obj != NULL. */
+} clientReplyBlock;
+
+/* The replication stream is stored once, in the list of blocks
+ * server.repl_buffer_blocks, shared by the replication backlog and by the
+ * output buffers of all the slaves. Each one references the first block it
+ * still needs, and blocks are released from the head of the list once the
+ * backlog is full and no slave references them anymore. All the blocks but
+ * the last are full. */
+typedef struct replBufBlock {
+    int refcount;           /* Backlog and slaves referencing the block. */
+    long long id;           /* Incremental number of the block. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;
+    char buf[];
+} replBufBlock;
+
+/* The replication backlog used for partial resynchronizations: the part
+ * of the shared replication buffer from its first block. With
+ * repl-backlog-disk-size the blocks released from the head are appended to
+ * a ring file on disk, holding the history that precedes the memory part. */
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* First block of the backlog, or NULL if
+                                    nothing was fed yet. */
+    long long histlen;           /* Backlog actual data length. */
+    long long offset;            /* Replication "master offset" of first
+                                    byte in the replication backlog. */
+    int disk_fd;                 /* Ring file (already unlinked), or -1. */
+    long long disk_size;         /* Size of the ring file. */
+    long long disk_histlen;      /* Bytes of history on disk. */
+    long long disk_offset;       /* Replication offset of the first byte on
+                                    disk, always disk_histlen bytes before
+                                    'offset'. */
+} replBacklog;
+
+/* Max number of blocks released by a single incremental backlog trim. */
+#define REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 64
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 //// 客户端的结构体
@@ -698,6 +819,8 @@ typedef struct client {
     redisDb *db;            //// 记录客户端当前正在使用的数据库
     robj *name;             //// 客户端的名字（默认是没有名字的）
     sds querybuf;           //// 查询缓冲区
+    size_t qb_pos;          /* The position we have read in querybuf. Always
+                               zero outside processInputBuffer(). */
     sds pending_querybuf;   /* If this is a master, this buffer represents the
                                yet not applied replication stream that we
                                are receiving from the master. */
@@ -712,10 +835,15 @@ typedef struct client {
     list *reply;            //// 可变大小缓冲区，当buf数组使用完毕或回复太大放不进去 的时候使用
     unsigned long long reply_bytes; //// 回复链表中对象的总大小
     size_t sentlen;         //// 已发送字节，处理 short write 用
+    clientReplyBlock *reply_sent_blocks; /* Reply blocks written by I/O
+                                            threads, released by the main
+                                            thread. */
+    int reply_cork;         /* Write the pending replies with MSG_MORE: more
+                               replies are expected in the next iteration. */
     time_t ctime;           //// 创建客户端的时间
     time_t lastinteraction; //// 客户端最后一次和服务器互动的时间
     time_t obuf_soft_limit_reached_time;//// 客户端的输出缓冲区超过软性限制的时间
-    int flags;              //// 客户端的标志属性，记录了客户端的角色（role），以及客户端目前所处的状态
+    uint64_t flags;         //// 客户端的标志属性，记录了客户端的角色（role），以及客户端目前所处的状态
     int authenticated;      //// 代表认证的状态，0 代表未认证， 1 代表已认证
 
     int replstate;          //// 复制状态
@@ -732,6 +860,16 @@ typedef struct client {
     long long psync_initial_offset; /* FULLRESYNC reply offset other slaves
                                        copying this slave output buffer
                                        should use. */
+    listNode *ref_repl_buf_node; /* Slaves: block of the shared replication
+                                    buffer to send from, or NULL. */
+    size_t ref_block_pos;   /* Slaves: bytes of that block already sent. */
+    long long repl_disk_off; /* Slaves: offset of the next byte to send from
+                                the on disk backlog, before the shared
+                                buffer, or -1. */
+    struct ZSTD_CCtx_s *repl_cctx; /* Slaves: compressor of the stream. */
+    struct ZSTD_DCtx_s *repl_dctx; /* Master: decompressor of the stream. */
+    sds repl_zbuf;          /* Slaves: compressed data still to send. */
+    size_t repl_zbuf_sent;  /* Slaves: bytes of repl_zbuf already sent. */
     char replid[CONFIG_RUN_ID_SIZE+1]; //// Master replication ID (if master).
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
     char slave_ip[NET_IP_STR_LEN]; /* Optionally given by REPLCONF ip-address */
@@ -740,10 +878,14 @@ typedef struct client {
     int btype;              //// 阻塞类型
     blockingState bpop;     //// 阻塞状态
     long long woff;         //// 最后被写入的全局复制偏移量
+    long long aof_woff;     /* AOF offset reached by the last write command
+                               of the client, see aof-group-commit. */
     list *watched_keys;     //// 被监视的键
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
+    uint64_t client_tracking_redirection; /* Client ID receiving the
+                                             invalidation messages. */
 
     /* Response buffer */
     //// 回复固定大小缓冲区
@@ -751,6 +893,16 @@ typedef struct client {
     char buf[PROTO_REPLY_CHUNK_BYTES];//// 回复缓冲区
 } client;
 
+/* State of a batch of commands of our master applied by processInputBuffer()
+ * through processMasterCommandFast(): the command table lookup is cached for
+ * the commands with the same name. */
+typedef struct replApplyBatch {
+    char name[32];                  /* argv[0] of the cached lookup. */
+    size_t namelen;
+    struct redisCommand *cmd;       /* Cached command, NULL if none. */
+    long long calls;                /* Commands executed, for numcommands. */
+} replApplyBatch;
+
 struct saveparam {
     time_t seconds;     // 秒数
     int changes;        // 修改数
@@ -861,6 +1013,22 @@ struct redisMemOverhead {
     } *db;
 };
 
+/* The AOF is made of an optional base file, written by the last rewrite,
+ * followed by the incremental files holding the commands executed since
+ * then. The list of files is persisted in a manifest inside aof_dirname. */
+typedef struct aofInfo {
+    sds file_name;      /* Name of the file inside the AOF directory. */
+    long long file_seq; /* Sequence number of the file. */
+    char file_type;     /* AOF_FILE_TYPE_BASE or AOF_FILE_TYPE_INCR. */
+} aofInfo;
+
+typedef struct aofManifest {
+    aofInfo *base_aof_info;         /* Base file, NULL if there is none. */
+    list *incr_aof_list;            /* Incremental files, oldest first. */
+    long long curr_base_file_seq;   /* Sequence of the last base created. */
+    long long curr_incr_file_seq;   /* Sequence of the last incr created. */
+} aofManifest;
+
 /* This structure can be optionally passed to RDB save/load functions in
  * order to implement additional functionalities, by storing and loading
  * metadata to the RDB file.
@@ -942,14 +1110,20 @@ struct redisServer {
     int bindaddr_count;                         //// Number of addresses in server.bindaddr[]
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd[CONFIG_BINDADDR_MAX];            //// TCP socket file descriptors , int ipfd[16]
+    int ipfd[CONFIG_BINDADDR_MAX*ACCEPT_THREADS_MAX_NUM]; //// TCP socket file descriptors，使用accept线程时每个线程有自己的一组
     int ipfd_count;                          //// 监听的文件描述符个数
     int sofd;                               //// Unix socket file descriptor
     int cfd[CONFIG_BINDADDR_MAX];/* Cluster bus listening socket */
     int cfd_count;              /* Used slots in cfd[] */
     list *clients;              //// 正常状态下的客户端链表
+    rax *clients_index;         /* Active clients dictionary by client ID. */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; //// 需要回复的客户端，就是需要加入可写队列的客户端
+    list *clients_waiting_aof_fsync; /* Clients whose replies wait for the
+                                        AOF group commit fsync. */
+    list *clients_corked;       /* Clients written with MSG_MORE, see
+                                   uncorkClients(). */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    //// List of slaves and MONITORs
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -994,8 +1168,21 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_net_output_writes; /* write()/writev() calls to clients. */
+    long long stat_net_output_corked_writes; /* Of which with MSG_MORE. */
+    long long stat_repl_stream_bytes; /* Replication stream compressed... */
+    long long stat_repl_stream_compressed_bytes; /* ...and its output. */
+    long long stat_propagated_cmds; /* Commands propagated to AOF/slaves. */
+    long long stat_propagate_usec;  /* Time spent propagating them. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
+    long long stat_fork_cow_suppressed_writes; /* Writes skipped while the
+                                                  last child was active. */
+    size_t stat_fork_cow_saved_bytes; /* Estimated copies they avoided. */
+    long long stat_io_reads_processed; /* Number of read events processed by IO threads */
+    long long stat_io_writes_processed; /* Number of write events processed by IO threads */
+    long long stat_io_batched_reads;    /* Reads submitted in batches (io_uring) */
+    long long stat_io_batched_writes;   /* Writes submitted in batches (io_uring) */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -1021,6 +1208,15 @@ struct redisServer {
     int supervised_mode;            /* See SUPERVISED_* */
     int daemonize;                  /* True if running as a daemon */
     clientBufferLimitsConfig client_obuf_limits[CLIENT_TYPE_OBUF_COUNT];
+    int io_threads_num;             /* Number of IO threads to use. */
+    int io_threads_do_reads;        /* Read and parse from IO threads? */
+    int io_uring;                   /* Use io_uring for the event loop? */
+    int accept_threads_num;         /* Threads accepting TCP connections. */
+    int rdb_load_threads;           /* Threads decoding RDB files on load. */
+    int reply_cork;                 /* Hold pipelined replies with MSG_MORE? */
+    /* Client side caching. */
+    unsigned int tracking_clients;  /* # of clients with tracking enabled. */
+    long long tracking_table_max_keys; /* Max number of keys in tracking table. */
 
 
     /* AOF persistence */
@@ -1028,15 +1224,34 @@ struct redisServer {
     int aof_state;                  //// AOF_(ON-0|OFF-1|WAIT_REWRITE-2)记录aof是否打开
     int aof_fsync;                  //// 标记了命令记录被同步写入磁盘AOF文件的策略(AOF_FSYNC_NO-0|AOF_FSYNC_ALWAYS-1|AOF_FSYNC_EVERYSEC-2)
     char *aof_filename;             //// AOF文件的文件名。
+    char *aof_dirname;              /* Directory holding the AOF files. */
+    aofManifest *aof_manifest;      /* Base and incremental AOF files. */
     sds aof_buf;                    //// AOF策略的内存缓冲，命令记录先被写入这个内存缓冲之中，然后再写入文件的内核缓冲区。
     int aof_fd;                     //// AOF文件对应的文件描述符
+    sds propagate_buf;              /* RESP of the command being propagated,
+                                       shared by the AOF and the slaves. */
     int aof_selected_db;            //// 上一条被记录的命令对应的数据库编号，如果新的命令对应数据库发生变化，需要补充追加一条SELECT命令的记录
 
     //// AOF内存缓存（aof_buf）是如何被写入到磁盘文件之中
     off_t aof_current_size;         //// 表示当前AOF文件的大小
+    off_t aof_last_incr_size;       /* Size of the incremental AOF being written. */
     time_t aof_last_fsync;          //// 记录了上次AOF数据写入磁盘的时间戳
     time_t aof_flush_postponed_start;//// 标记是否延时启动AOF写入，如果当前有正在后台运行的线程执行AOF磁盘写入，那么这个标记将会被设置，通过wirte系统调用写入AOF的操作将会被推迟
     int aof_last_write_status;      //// 记录了上次调用write系统调用的结果，可以为C_OK或者C_ERR，如果内核的文件缓冲区已满，那么write有可能失败
+    /* AOF group commit: the offsets count the bytes appended to aof_buf
+     * since the server started. */
+    int aof_group_commit;           /* Fsync in a thread with appendfsync always. */
+    long long aof_fed_offset;       /* Bytes appended to the AOF buffer. */
+    long long aof_written_offset;   /* Bytes written to the AOF file. */
+    long long aof_fsynced_offset;   /* Bytes known to be on disk. */
+    long long aof_fsync_pending_offset; /* Covered by the fsync in progress,
+                                           -1 if none. */
+    long long aof_written_repl_offset; /* Replication offsets matching the */
+    long long aof_fsync_pending_repl_offset; /* AOF offsets above: slaves */
+    long long aof_fsynced_repl_offset; /* are sent data up to the last one. */
+    int aof_fsync_debug_delay;      /* DEBUG AOF-FSYNC-DELAY milliseconds. */
+    int aof_fsync_pipe[2];          /* Bio thread -> main thread fsync outcome. */
+    long long stat_aof_group_commits; /* Fsyncs performed by the group commit. */
 
     //// AOF 重写相关操作
     off_t aof_rewrite_min_size;     //// 用于开启重写机制的AOF文件大小的阈值
@@ -1046,7 +1261,6 @@ struct redisServer {
 
     int aof_no_fsync_on_rewrite;    /* Don't fsync if a rewrite is in prog. */
     pid_t aof_child_pid;            //// aof重写子进程id
-    list *aof_rewrite_buf_blocks;   //// aof重写缓冲区（aof重写是命令不仅会写到aof_buf中还会写入aof_rewrite_buf_blocks中）
     time_t aof_rewrite_time_last;   //// 记录最后一次aof重写耗时
     time_t aof_rewrite_time_start;  //// 记录aof开始重写的时间（默认-1）
     int aof_lastbgrewrite_status;   /* C_OK or C_ERR */
@@ -1055,18 +1269,11 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       //// Use RDB preamble on AOF rewrites. */
+    long long aof_load_bytes;       /* Bytes read by the last AOF load. */
+    long long aof_load_commands;    /* Commands executed by the last AOF load. */
+    long long aof_load_time;        /* Duration of the last AOF load in usec. */
 
 
-    /* AOF pipes used to communicate between parent and child during rewrite. */
-    int aof_pipe_write_data_to_child;               //// aof父子间匿名管道通信
-    int aof_pipe_read_data_from_parent;            //// aof父子间匿名管道通信
-    int aof_pipe_write_ack_to_parent;              //// aof父子间匿名管道通信
-    int aof_pipe_read_ack_from_child;            //// aof父子间匿名管道通信
-    int aof_pipe_write_ack_to_child;            //// aof父子间匿名管道通信
-    int aof_pipe_read_ack_from_parent;        //// aof父子间匿名管道通信
-    int aof_stop_sending_diff;                //// 标识是否停止通信
-    sds aof_child_diff;                     //// aof重写时，从管道中读取的数据写到这里
-
 
     /* RDB persistence */
     long long dirty;                //// 记录距离上一次成功save/bgsave之后，进行了多少次修改
@@ -1076,7 +1283,12 @@ struct redisServer {
     int saveparamslen;              //// 记录了保存条件的数组大小
     char *rdb_filename;             //// rdb的文件名
     int rdb_compression;            //// rdb文件是否使用压缩
+    int rdb_codec;                  /* Codec of the RDB files (RDB_ENC_*). */
+    int repl_rdb_codec;             /* Codec of the RDB sent to replicas. */
+    int dump_codec;                 /* Codec of the DUMP payloads. */
+    int rdb_zstd_level;             /* Zstd compression level. */
     int rdb_checksum;               //// rdb文件是否使用校验和
+    int rdb_key_index;              /* Append a key index to RDB files. */
     time_t lastsave;                //// 记录上一次成功save/bgsave的时候
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1094,6 +1306,10 @@ struct redisServer {
         size_t cow_size;            /* Copy on write size. */
         unsigned long long magic;   /* Magic value to make sure data is valid. */
     } child_info_data;
+    /* Copy on write minimizing mode, see childinfo.c. */
+    int fork_cow_minimize;          /* Avoid writes while a child is active. */
+    int fork_cow_defer_expire;      /* Don't delete expired keys on reads. */
+    int fork_cow_minimize_active;   /* There is a child and the mode is on. */
     /* Propagation of commands in AOF / replication */
     redisOpArray also_propagate;    /* Additional command to propagate. */
     /* Logging */
@@ -1108,13 +1324,12 @@ struct redisServer {
     long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs */
-    long long repl_backlog_size;    /* Backlog circular buffer size */
-    long long repl_backlog_histlen; /* Backlog actual data length */
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset,
-                                       that is the next byte will'll write to.*/
-    long long repl_backlog_off;     /* Replication "master offset" of first
-                                       byte in the replication backlog buffer.*/
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
+    long long repl_backlog_size;    /* Backlog size */
+    long long repl_backlog_disk_size; /* Size of the on disk backlog tier. */
+    list *repl_buffer_blocks;       /* Shared replication buffer, see
+                                       replBufBlock. */
+    size_t repl_buffer_mem;         /* Memory used by the blocks. */
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
@@ -1124,11 +1339,18 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_stream_compression;    /* Compress the stream with zstd for the
+                                       slaves asking for it. */
     /* Replication (slave) */
     char *masterauth;               /* AUTH with this password with master */
     char *masterhost;               //// 主服务器的地址
     int masterport;                 //// 主服务器的端口
     int repl_timeout;               /* Timeout after N seconds of master idle */
+    int repl_batch_apply;           /* Apply the master stream in batches. */
+    long long stat_repl_applied_ops;   /* Commands applied from the master. */
+    long long stat_repl_applied_bytes; /* Stream bytes they took. */
+    long long stat_repl_apply_batches; /* processInputBuffer() calls that
+                                          applied them. */
     client *master;     /* Client that is master for this slave */
     client *cached_master; /* Cached master to be reused for PSYNC. */
     int repl_syncio_timeout; /* Timeout for synchronous I/O calls */
@@ -1140,6 +1362,9 @@ struct redisServer {
     int repl_transfer_fd;    /* Slave -> Master SYNC temp file descriptor */
     char *repl_transfer_tmpfile; /* Slave-> master SYNC temp file name */
     time_t repl_transfer_lastio; /* Unix time of the latest read, for timeout */
+    struct ZSTD_DCtx_s *repl_transfer_dctx; /* Decompressor of the RDB payload
+                                               when it is compressed. */
+    int repl_master_zstd;    /* The master compresses the stream for us. */
     int repl_serve_stale_data; /* Serve stale data when link is down? */
     int repl_slave_ro;          /* Slave is read only? */
     time_t repl_down_since; /* Unix time at which link with master went down */
@@ -1153,6 +1378,8 @@ struct redisServer {
     char master_replid[CONFIG_RUN_ID_SIZE+1];  /* Master PSYNC runid. */
     long long master_initial_offset;           /* Master PSYNC offset. */
     int repl_slave_lazy_flush;          /* Lazy FLUSHALL before loading DB? */
+    int repl_diskless_load;             /* Load the RDB from the socket, see
+                                           REPL_DISKLESS_LOAD_*. */
     /* Replication script cache. */
     dict *repl_scriptcache_dict;        /* SHA1 all slaves are aware of. */
     list *repl_scriptcache_fifo;        /* First in, first out LRU eviction. */
@@ -1384,12 +1611,14 @@ void redisSetProcTitle(char *title);
 client *createClient(int fd);
 void closeTimedoutClients(void);
 void freeClient(client *c);
+client *lookupClientByID(uint64_t id);
 void freeClientAsync(client *c);
 void resetClient(client *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+int processMultibulkBuffer(client *c, respIndex *idx);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1409,9 +1638,15 @@ void addReplyHumanLongDouble(client *c, long double d);
 void addReplyLongLong(client *c, long long ll);
 void addReplyMultiBulkLen(client *c, long length);
 void copyClientOutputBuffer(client *dst, client *src);
+void copyReplicaOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
+void freeClientReplyValue(void *o);
+void releaseClientSentReplyBlocks(client *c);
+void trimReplyBlockPool(void);
+size_t replyBlockPoolMemory(void);
+void copyClientsReplyObjects(void);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1428,14 +1663,24 @@ int getClientTypeByName(char *name);
 char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
-int listenToPort(int port, int *fds, int *count);
+int listenToPort(int port, int *fds, int *count, int reuseport);
+int checkListenPortIsFree(int port);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
 int clientHasPendingReplies(client *c);
+void linkClient(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
+extern int io_threads_active;
+void clientInstallWriteHandler(client *c);
+void initThreadedIO(void);
+void initAcceptThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+void uncorkClients(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int stopThreadedIOIfNeeded(void);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(client *c, const char *fmt, ...)
@@ -1516,6 +1761,7 @@ int getLongLongFromObject(robj *o, long long *target);
 int getLongDoubleFromObject(robj *o, long double *target);
 int getLongDoubleFromObjectOrReply(client *c, robj *o, long double *target, const char *msg);
 char *strEncoding(int encoding);
+size_t objectComputeSize(robj *o, size_t sample_size);
 int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
@@ -1529,6 +1775,8 @@ ssize_t syncReadLine(int fd, char *ptr, ssize_t size, long long timeout);
 
 /* Replication */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
+void prepareReplicasToWrite(void);
+void replicationFeedSlavesEncoded(list *slaves, int dictid, robj **argv, int argc, sds *encoded);
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
@@ -1536,6 +1784,8 @@ void replicationCron(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(client *c);
 void resizeReplicationBacklog(long long newsize);
+void resizeReplicationBacklogDisk(long long newsize);
+ssize_t readReplicationBacklogDisk(long long offset, char *buf, size_t len);
 void replicationSetMaster(char *ip, int port);
 void replicationUnsetMaster(void);
 void refreshGoodSlavesCount(void);
@@ -1555,10 +1805,16 @@ void changeReplicationId(void);
 void clearReplicationId2(void);
 void chopReplicationBacklog(void);
 void replicationCacheMasterUsingMyself(void);
-void feedReplicationBacklog(void *ptr, size_t len);
+void feedReplicationBuffer(void *ptr, size_t len);
+void releaseReplicaReplBuffer(client *c);
+int replicationCompressStream(client *c, const char *buf, size_t len, int flush);
+ssize_t replicationDecompressStream(client *c, const char *buf, size_t len);
+void freeClientReplStreamCodecs(client *c);
+void incrementalTrimReplicationBacklog(int max_blocks);
 
 /* Generic persistence functions */
-void startLoading(FILE *fp);
+void startLoading(size_t size);
+void startLoadingFile(FILE *fp);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
@@ -1569,21 +1825,34 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi);
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+void feedAppendOnlyFileEncoded(struct redisCommand *cmd, int dictid, robj **argv, int argc, sds *encoded);
+sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(aofManifest *am);
+void aofLoadManifestFromDisk(void);
+void aofOpenIfNeededOnServerStart(void);
 void stopAppendOnly(void);
+void aofGroupCommitInit(void);
+int aofGroupCommitActive(void);
+void aofGroupCommitFlush(void);
+void aofGroupCommitStartFsync(void);
+void aofGroupCommitMarkSynced(long long offset, long long repl_offset);
+long long aofGroupCommitReplLimit(void);
+void aofFsyncNotify(int err);
+void aofHoldClientsWaitingFsync(void);
+int aofClientMustWaitFsync(client *c);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
-void aofRewriteBufferReset(void);
-unsigned long aofRewriteBufferSize(void);
-ssize_t aofReadDiffFromParent(void);
 
 /* Child info */
 void openChildInfoPipe(void);
 void closeChildInfoPipe(void);
 void sendChildInfo(int process_type);
 void receiveChildInfo(void);
+void updateForkCowMinimize(void);
+void forkCowSuppressedWrite(const void *ptr);
+size_t forkCowSavedBytes(void);
 
 /* Sorted sets data type */
 
@@ -1651,12 +1920,14 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec);
 /* Core functions */
 int freeMemoryIfNeeded(void);
 int processCommand(client *c);
+int processMasterCommandFast(client *c, replApplyBatch *batch);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(client *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
+sds getPropagatedCommandEncoding(sds *encoded, int argc, robj **argv);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
 void forceCommandPropagation(client *c, int flags);
 void preventCommandPropagation(client *c);
@@ -1731,6 +2002,16 @@ robj *hashTypeLookupWriteOrCreate(client *c, robj *key);
 robj *hashTypeGetValueObject(robj *o, sds field);
 int hashTypeSet(robj *o, sds field, sds value, int flags);
 
+/* Client side caching (tracking mode) */
+void enableTracking(client *c, uint64_t redirect_to, int noloop);
+void disableTracking(client *c);
+void trackingRememberKeys(client *tc, client *c);
+void trackingInvalidateKey(robj *keyobj);
+void trackingInvalidateKeysOnFlush(int dbid);
+void trackingLimitUsedSlots(void);
+uint64_t trackingGetTotalItems(void);
+uint64_t trackingGetTotalKeys(void);
+
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(client *c, int notify);
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
@@ -1754,6 +2035,7 @@ int rewriteConfig(char *path);
 /* db.c -- Keyspace access API */
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key, int lazy);
+int keyIsExpired(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
@@ -1779,6 +2061,11 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
 #define EMPTYDB_NO_FLAGS 0      /* No flags. */
 #define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
 long long emptyDb(int dbnum, int flags, void(callback)(void*));
+long long dbTotalServerKeyCount(void);
+typedef struct dbBackup dbBackup;
+dbBackup *backupDb(void);
+void restoreDbBackup(dbBackup *backup, int flags);
+void discardDbBackup(dbBackup *backup, int flags, void(callback)(void*));
 
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
@@ -1794,7 +2081,9 @@ void slotToKeyDel(robj *key);
 void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
+void freeDbDictsAsync(dict *ht1, dict *ht2);
 void slotToKeyFlushAsync(void);
+void freeSlotsToKeysAsync(rax *rt);
 size_t lazyfreeGetPendingObjectsCount(void);
 
 /* API to get key arguments from commands */
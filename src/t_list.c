@@ -763,6 +763,9 @@ int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb
             return C_ERR;
         }
     }
+    /* The receiver is served outside call(): its reply depends on the
+     * writes we just propagated, see aof-group-commit. */
+    receiver->aof_woff = server.aof_fed_offset;
     return C_OK;
 }
 
@@ -0,0 +1,253 @@
+/* tracking.c - Client side caching: keys tracking and invalidation
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+/* The tracking table is a radix tree keyed by the names of the keys read
+ * by clients with tracking enabled. Every key points to another radix tree
+ * holding the IDs of the clients that may have cached it. When the key is
+ * modified, all those clients are sent an invalidation message and the key
+ * is removed from the table: a client is notified again only if it reads
+ * the key again after the invalidation.
+ *
+ * The table is not per database: a modification of a key invalidates the
+ * key with the same name in the other databases as well. This can only
+ * result in a few more invalidation messages than strictly needed.
+ *
+ * Clients speak RESP2, so an invalidation can't be interleaved with the
+ * replies of the tracking connection itself. The messages are sent instead
+ * to the client specified with CLIENT TRACKING on REDIRECT <id>, that must
+ * be subscribed to the __redis__:invalidate channel, in the form of Pub/Sub
+ * messages whose payload is an array with the invalidated key, or a null
+ * array when the whole table is invalidated by FLUSHDB / FLUSHALL. */
+rax *TrackingTable = NULL;
+uint64_t TrackingTableTotalItems = 0; /* Total number of IDs stored across
+                                         the whole tracking table. This
+                                         gives a hint about the total memory
+                                         used. */
+robj *TrackingChannelName;
+
+/* Remove the tracking state from the client 'c'. The IDs of the client
+ * are not removed from the tracking table: they are discarded lazily when
+ * the keys are invalidated. */
+void disableTracking(client *c) {
+    if (c->flags & CLIENT_TRACKING) {
+        server.tracking_clients--;
+        c->flags &= ~(CLIENT_TRACKING|CLIENT_TRACKING_BROKEN_REDIR|
+                      CLIENT_TRACKING_NOLOOP);
+        c->client_tracking_redirection = 0;
+    }
+}
+
+/* Enable tracking for the client 'c', sending the invalidation messages to
+ * the client with ID 'redirect_to'. With 'noloop' the client is not
+ * notified about keys it modified itself. */
+void enableTracking(client *c, uint64_t redirect_to, int noloop) {
+    if (!(c->flags & CLIENT_TRACKING)) server.tracking_clients++;
+    c->flags |= CLIENT_TRACKING;
+    c->flags &= ~(CLIENT_TRACKING_BROKEN_REDIR|CLIENT_TRACKING_NOLOOP);
+    if (noloop) c->flags |= CLIENT_TRACKING_NOLOOP;
+    c->client_tracking_redirection = redirect_to;
+    if (TrackingTable == NULL) {
+        TrackingTable = raxNew();
+        TrackingChannelName = createStringObject("__redis__:invalidate",20);
+    }
+}
+
+/* This function is called after the execution of a read only command by
+ * 'c', on behalf of the tracking client 'tc' (they are different when the
+ * command is executed by a Lua script): all the keys of the command are
+ * remembered as possibly cached by 'tc'. */
+void trackingRememberKeys(client *tc, client *c) {
+    int numkeys;
+    int *keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    if (keys == NULL) return;
+
+    for(int j = 0; j < numkeys; j++) {
+        int idx = keys[j];
+        sds sdskey = c->argv[idx]->ptr;
+        rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
+        if (ids == raxNotFound) {
+            ids = raxNew();
+            raxInsert(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey),
+                      ids,NULL);
+        }
+        if (raxInsert(ids,(unsigned char*)&tc->id,sizeof(tc->id),NULL,NULL))
+            TrackingTableTotalItems++;
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Send the invalidation message of 'keyname' (or of all the keys when
+ * 'keyname' is NULL) to the redirection client of 'c'. */
+static void sendTrackingMessage(client *c, char *keyname, size_t keylen) {
+    client *redir = lookupClientByID(c->client_tracking_redirection);
+
+    if (redir == NULL) {
+        /* The redirection client went away: there is nobody we can tell
+         * about it, the flag is reported in CLIENT LIST. */
+        c->flags |= CLIENT_TRACKING_BROKEN_REDIR;
+        return;
+    }
+    /* A message sent to a client that is not in Pub/Sub mode would be
+     * taken as the reply of its next command. */
+    if (!(redir->flags & CLIENT_PUBSUB)) return;
+
+    addReply(redir,shared.mbulkhdr[3]);
+    addReply(redir,shared.messagebulk);
+    addReplyBulk(redir,TrackingChannelName);
+    if (keyname == NULL) {
+        addReply(redir,shared.nullmultibulk);
+    } else {
+        addReply(redir,shared.mbulkhdr[1]);
+        addReplyBulkCBuffer(redir,keyname,keylen);
+    }
+}
+
+/* This function is called when the key 'keyobj' is modified, deleted,
+ * expired or evicted: the clients that may have it cached are notified,
+ * and the key is removed from the tracking table. */
+void trackingInvalidateKey(robj *keyobj) {
+    if (TrackingTable == NULL) return;
+    sds sdskey = keyobj->ptr;
+    rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
+    if (ids == raxNotFound) return;
+
+    raxIterator ri;
+    raxStart(&ri,ids);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t id;
+        memcpy(&id,ri.key,sizeof(id));
+        client *target = lookupClientByID(id);
+        /* The client may have disconnected, or may have disabled tracking
+         * (and enabled it again) since it read the key. */
+        if (target == NULL || !(target->flags & CLIENT_TRACKING)) continue;
+        if (target->flags & CLIENT_TRACKING_NOLOOP &&
+            target == server.current_client) continue;
+        sendTrackingMessage(target,sdskey,sdslen(sdskey));
+    }
+    raxStop(&ri);
+
+    TrackingTableTotalItems -= ids->numele;
+    raxFree(ids);
+    raxRemove(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey),NULL);
+}
+
+/* Free the tracking table and all the radix trees of client IDs it
+ * references. */
+static void freeTrackingTable(rax *table) {
+    raxIterator ri;
+    raxStart(&ri,table);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) raxFree(ri.data);
+    raxStop(&ri);
+    raxFree(table);
+}
+
+/* This function is called when one or all the databases are flushed
+ * ('dbid' is -1 in the latter case). Every client with tracking enabled is
+ * sent a null invalidation message, meaning that its whole cache must be
+ * discarded, and the tracking table is emptied. Since the table is not per
+ * database, this happens even when a single database is flushed. */
+void trackingInvalidateKeysOnFlush(int dbid) {
+    UNUSED(dbid);
+    if (server.tracking_clients) {
+        listNode *ln;
+        listIter li;
+        listRewind(server.clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            client *c = listNodeValue(ln);
+            if (c->flags & CLIENT_TRACKING) sendTrackingMessage(c,NULL,0);
+        }
+    }
+
+    if (TrackingTable && TrackingTable->numele) {
+        freeTrackingTable(TrackingTable);
+        TrackingTable = raxNew();
+        TrackingTableTotalItems = 0;
+    }
+}
+
+/* Tracking forces Redis to remember information about which client may
+ * have certain keys. In workloads where there are a lot of reads, but keys
+ * are hardly modified, the amount of information we have to remember
+ * server side could be a lot, with the additional drawback of wasting a
+ * lot of memory.
+ *
+ * This function is called from serverCron(): when the tracking table has
+ * more keys than tracking-table-max-keys, random keys are invalidated (the
+ * clients are notified as if the keys were modified) until the table is
+ * back under the limit. The effort is capped for every call and grows while
+ * the table stays over the limit. */
+void trackingLimitUsedSlots(void) {
+    static unsigned int timeout_counter = 0;
+
+    if (TrackingTable == NULL) return;
+    if (server.tracking_table_max_keys == 0) return; /* No limits set. */
+    size_t max_keys = server.tracking_table_max_keys;
+    if (TrackingTable->numele <= max_keys) {
+        timeout_counter = 0;
+        return; /* Limit already respected. */
+    }
+
+    int effort = 100 * (timeout_counter+1);
+    raxIterator ri;
+    raxStart(&ri,TrackingTable);
+    while(effort > 0) {
+        effort--;
+        raxSeek(&ri,"^",NULL,0);
+        raxRandomWalk(&ri,0);
+        robj *keyobj = createStringObject((char*)ri.key,ri.key_len);
+        trackingInvalidateKey(keyobj);
+        decrRefCount(keyobj);
+        if (TrackingTable->numele <= max_keys) {
+            timeout_counter = 0;
+            raxStop(&ri);
+            return; /* Return ASAP: we are again under the limit. */
+        }
+    }
+
+    /* If we reach this point, we were not able to go under the configured
+     * limit using the maximum effort we had for this run. */
+    raxStop(&ri);
+    timeout_counter++;
+}
+
+uint64_t trackingGetTotalItems(void) {
+    return TrackingTableTotalItems;
+}
+
+uint64_t trackingGetTotalKeys(void) {
+    if (TrackingTable == NULL) return 0;
+    return TrackingTable->numele;
+}
@@ -8,7 +8,9 @@ proc append_to_aof {str} {
 }
 
 proc create_aof {code} {
-    upvar fp fp aof_path aof_path
+    upvar fp fp aof_path aof_path server_path server_path
+    # A single file AOF is only loaded when there is no manifest yet.
+    file delete -force $server_path/appendonlydir
     set fp [open $aof_path w+]
     uplevel 1 $code
     close $fp
@@ -257,4 +259,234 @@ tags {"aof"} {
             r expire x -1
         }
     }
+
+    ## A single file AOF is moved into the AOF directory as the base file
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+        append_to_aof [formatCommand rpush list a b c]
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Single file AOF: it is moved into the AOF directory" {
+            assert_equal 0 [file exists $aof_path]
+            assert_equal 1 [file exists $server_path/appendonlydir/appendonly.aof]
+            set manifest [exec cat $server_path/appendonlydir/appendonly.aof.manifest]
+            assert_match "file appendonly.aof seq 1 type b*file appendonly.aof.1.incr.aof seq 1 type i" $manifest
+        }
+
+        test "Single file AOF: dataset is loaded and new writes are appended" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal "hello" [$client get foo]
+            assert_equal 3 [$client llen list]
+            $client set bar world
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: base and incremental files are loaded in order" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal "hello" [$client get foo]
+            assert_equal "world" [$client get bar]
+        }
+
+        test "Multi part AOF: rewrite replaces the base and the old files" {
+            $client config set aof-use-rdb-preamble yes
+            $client bgrewriteaof
+            wait_for_condition 100 100 {
+                [status $client aof_rewrite_in_progress] eq 0
+            } else {
+                fail "AOF rewrite did not complete"
+            }
+            $client set baz 1
+            set manifest [exec cat $server_path/appendonlydir/appendonly.aof.manifest]
+            assert_match "file appendonly.aof.2.base.rdb seq 2 type b*file appendonly.aof.2.incr.aof seq 2 type i" $manifest
+            assert_equal 0 [file exists $server_path/appendonlydir/appendonly.aof]
+            assert_equal 0 [file exists $server_path/appendonlydir/appendonly.aof.1.incr.aof]
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: dataset survives a restart after a rewrite" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal "hello" [$client get foo]
+            assert_equal "world" [$client get bar]
+            assert_equal 1 [$client get baz]
+        }
+    }
+
+    ## Enabling the AOF at runtime collects the writes performed during the
+    ## first rewrite into a temp file that then becomes the incremental file.
+    file delete -force $server_path/appendonlydir $aof_path
+    start_server_aof [list dir $server_path appendonly no] {
+        test "Multi part AOF: writes during the first rewrite are not lost" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            $client debug populate 100000
+            $client config set appendonly yes
+            for {set j 0} {$j < 100} {incr j} {
+                $client rpush mylist $j
+            }
+            wait_for_condition 100 100 {
+                [status $client aof_rewrite_in_progress] eq 0
+            } else {
+                fail "AOF rewrite did not complete"
+            }
+            assert_equal 100 [$client llen mylist]
+            set manifest [exec cat $server_path/appendonlydir/appendonly.aof.manifest]
+            assert_match "*base*type b*incr.aof*type i" $manifest
+            assert_equal 0 [file exists $server_path/appendonlydir/temp-appendonly.aof.incr]
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+        }
+    }
+
+    ## With the group commit the fsync runs in a background thread and the
+    ## replies wait for it: the result must be the same of appendfsync always.
+    file delete -force $server_path/appendonlydir $aof_path
+    start_server_aof [list dir $server_path appendfsync always aof-group-commit yes] {
+        test "AOF group commit: pipelined writes are acknowledged and persisted" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            set clients {}
+            for {set c 0} {$c < 5} {incr c} {
+                set rd [redis [dict get $srv host] [dict get $srv port] 1]
+                for {set j 0} {$j < 200} {incr j} {
+                    $rd incr counter
+                    $rd rpush list:$c $j
+                }
+                lappend clients $rd
+            }
+            foreach rd $clients {
+                for {set j 0} {$j < 200} {incr j} {
+                    assert {[$rd read] > 0}
+                    assert_equal [expr {$j+1}] [$rd read]
+                }
+                $rd close
+            }
+            assert_equal 1000 [$client get counter]
+            assert {[status $client aof_group_commits] > 0}
+            assert_equal 0 [status $client aof_clients_waiting_fsync]
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+        }
+
+        test "AOF group commit: clients served by blocking operations" {
+            set rd [redis [dict get $srv host] [dict get $srv port] 1]
+            $rd brpoplpush src dst 0
+            wait_for_condition 50 100 {
+                [status $client blocked_clients] eq 1
+            } else {
+                fail "The client did not block"
+            }
+            $client lpush src foo
+            assert_equal foo [$rd read]
+            $rd close
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+            assert_equal foo [$client lindex dst 0]
+        }
+
+        test "AOF group commit: replies wait for the fsync, readers too" {
+            $client debug aof-fsync-delay 1000
+            set writer [redis [dict get $srv host] [dict get $srv port] 1]
+            set reader [redis [dict get $srv host] [dict get $srv port] 1]
+            $writer set held value
+            after 100
+            set start [clock milliseconds]
+            $reader get held
+            assert_equal OK [$writer read]
+            assert_equal value [$reader read]
+            # The reader observed a write not yet on disk: its reply was
+            # held as well, until the fsync completed.
+            assert {[clock milliseconds]-$start >= 700}
+            $client debug aof-fsync-delay 0
+            $writer close
+            $reader close
+        }
+
+        test "AOF group commit: slaves only receive what is on disk" {
+            set master_host [dict get $srv host]
+            set master_port [dict get $srv port]
+            start_server {} {
+                set slave [srv 0 client]
+                $slave slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+                set writer [redis $master_host $master_port 1]
+                $writer select 9
+                $writer read
+                $client debug aof-fsync-delay 1500
+                $writer set onslave value
+                after 500
+                assert_equal {} [$slave get onslave]
+                assert_equal OK [$writer read]
+                wait_for_condition 50 100 {
+                    [$slave get onslave] eq {value}
+                } else {
+                    fail "The slave did not receive the write"
+                }
+                $client debug aof-fsync-delay 0
+                $writer close
+            }
+        }
+
+        test "AOF group commit: writes during a rewrite and after disabling it" {
+            set rd [redis [dict get $srv host] [dict get $srv port] 1]
+            $client bgrewriteaof
+            for {set j 0} {$j < 100} {incr j} {$rd incr during}
+            for {set j 0} {$j < 100} {incr j} {assert_equal [expr {$j+1}] [$rd read]}
+            wait_for_condition 100 100 {
+                [status $client aof_rewrite_in_progress] eq 0
+            } else {
+                fail "AOF rewrite did not complete"
+            }
+            $client config set aof-group-commit no
+            for {set j 0} {$j < 100} {incr j} {$rd incr after}
+            for {set j 0} {$j < 100} {incr j} {assert_equal [expr {$j+1}] [$rd read]}
+            $rd close
+            set d1 [$client debug digest]
+            $client debug loadaof
+            assert_equal $d1 [$client debug digest]
+        }
+    }
+
+    ## Commands and big arguments spanning the blocks read by the loader
+    create_aof {
+        append_to_aof [formatCommand select 9]
+        for {set j 0} {$j < 20000} {incr j} {
+            append_to_aof [formatCommand set key:$j val:$j]
+        }
+        append_to_aof [formatCommand set big [string repeat x 3000000]]
+        append_to_aof [formatCommand rpush list a b c]
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "AOF loading: commands spanning read blocks are loaded" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            wait_for_condition 100 100 {
+                [catch {$client ping} e] == 0
+            } else {
+                fail "Loading DB is taking too much time."
+            }
+            $client select 9
+            assert_equal 20002 [$client dbsize]
+            assert_equal val:0 [$client get key:0]
+            assert_equal val:19999 [$client get key:19999]
+            assert_equal 3000000 [$client strlen big]
+            assert_equal {a b c} [$client lrange list 0 -1]
+        }
+
+        test "AOF loading: throughput is reported in INFO" {
+            assert_equal 20003 [status $client aof_last_load_commands]
+            assert {[status $client aof_last_load_bytes] > 3000000}
+            assert {[status $client aof_last_load_bytes_per_sec] > 0}
+        }
+    }
 }
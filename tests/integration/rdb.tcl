@@ -96,3 +96,247 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+start_server_and_kill_it [list "dir" $server_path "rdb-load-threads" 4] {
+    test {Server should not start if RDB is corrupted (threaded loading)} {
+        wait_for_condition 50 100 {
+            [string match {*CRC error*} \
+                [exec tail -10 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if RDB was corrupted!"
+        }
+    }
+}
+
+set server_path [tmpdir "server.rdb-threaded-load-test"]
+exec cp tests/assets/encodings.rdb $server_path
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb"]] {
+    set serial [csvdump r]
+    start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+        test {RDB encoding loading test (threaded loading)} {
+            assert_equal $serial [csvdump r]
+        }
+    }
+}
+
+start_server {tags {"rdb"}} {
+    test {Threaded loading restores the same dataset} {
+        r config set rdbcompression yes
+        createComplexDataset r 10000
+        r select 10
+        r set compressible [string repeat abcd 100000]
+        for {set j 0} {$j < 500} {incr j} {
+            r rpush biglist [string repeat $j 200]
+            r set ttl:$j $j px 1000000
+        }
+        r select 9
+        set digest [r debug digest]
+        set keys [r dbsize]
+        r config set rdb-load-threads 4
+        r debug reload
+        assert_equal $keys [r dbsize]
+        assert_equal $digest [r debug digest]
+        r select 10
+        assert_equal 500 [r llen biglist]
+        assert {[r pttl ttl:499] > 0}
+        r select 9
+        lindex [r config get rdb-load-threads] 1
+    } {4}
+
+    test {Threaded loading does not load keys already expired} {
+        r flushall
+        r set volatile foo px 100
+        r set persistent bar
+        r save
+        after 200
+        r debug reload
+        list [r exists volatile] [r get persistent]
+    } {0 bar}
+
+    test {Threaded loading of the AOF RDB preamble} {
+        r flushall
+        createComplexDataset r 1000
+        set digest [r debug digest]
+        r config set aof-use-rdb-preamble yes
+        r config set appendonly yes
+        wait_for_condition 50 100 {
+            [s aof_rewrite_in_progress] == 0
+        } else {
+            fail "AOF rewrite did not terminate"
+        }
+        r set after-preamble 1
+        r debug loadaof
+        r del after-preamble
+        assert_equal $digest [r debug digest]
+        r config set appendonly no
+    }
+}
+
+start_server {tags {"rdb"}} {
+    test {RDB files saved with every compression codec are loaded back} {
+        createComplexDataset r 5000
+        r set compressible [string repeat abcdefgh 10000]
+        for {set j 0} {$j < 1000} {incr j} {
+            r rpush textlist "this is the element number $j of the list"
+        }
+        set digest [r debug digest]
+        foreach codec {lzf lz4 zstd} {
+            if {[catch {r config set rdb-compression-codec $codec}]} continue
+            r debug reload
+            assert_equal $digest [r debug digest]
+            r config set rdb-load-threads 2
+            r debug reload
+            assert_equal $digest [r debug digest]
+            r config set rdb-load-threads 0
+        }
+    }
+
+    test {Zstd compressed RDB files are smaller than LZF ones} {
+        set rdbfile [file join [lindex [r config get dir] 1] \
+                               [lindex [r config get dbfilename] 1]]
+        r config set rdb-compression-codec lzf
+        r save
+        set lzfsize [file size $rdbfile]
+        r config set rdb-compression-codec zstd
+        r config set rdb-zstd-level 9
+        r save
+        assert {[file size $rdbfile] < $lzfsize}
+        lindex [r config get rdb-compression-codec] 1
+    } {zstd}
+
+    test {RDB files are version 8 unless saved with LZ4 or Zstd} {
+        set rdbfile [file join [lindex [r config get dir] 1] \
+                               [lindex [r config get dbfilename] 1]]
+        set versions {}
+        foreach codec {lzf zstd} {
+            r config set rdb-compression-codec $codec
+            r save
+            set fp [open $rdbfile r]
+            fconfigure $fp -translation binary
+            lappend versions [read $fp 9]
+            close $fp
+        }
+        set versions
+    } {REDIS0008 REDIS0009}
+
+    test {Unknown compression codecs are rejected} {
+        catch {r config set repl-compression-codec foo} e
+        set e
+    } {ERR*}
+}
+
+start_server {tags {"rdb"}} {
+    test {Copy on write minimizing mode while a child is active} {
+        r config set fork-cow-minimize yes
+        r config set fork-cow-defer-expire yes
+        r debug set-active-expire 0
+        r debug populate 10000
+        r set foo bar px 1
+        after 10
+        r bgsave
+        set child [get_child_pid 0]
+        exec kill -STOP $child
+        assert_equal 1 [status r fork_cow_minimize_active]
+
+        # The expired key is missing for reads but is not deleted.
+        assert_equal {} [r get foo]
+        assert_equal 10001 [r dbsize]
+        assert {[status r fork_cow_suppressed_writes] > 0}
+        assert {[status r fork_cow_saved_bytes_est] > 0}
+
+        exec kill -CONT $child
+        waitForBgsave r
+        wait_for_condition 50 100 {
+            [status r fork_cow_minimize_active] eq 0
+        } else {
+            fail "The copy on write minimizing mode was not left"
+        }
+        assert {[status r fork_cow_saved_bytes_est] > 0}
+        assert_equal {} [r get foo]
+        assert_equal 10000 [r dbsize]
+        r debug set-active-expire 1
+    } {OK}
+}
+
+set server_path [tmpdir "server.rdb-analyze-test"]
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {redis-check-rdb --analyze reports the memory of the dataset} {
+        r debug populate 1000 user
+        r debug populate 100 session
+        r expire session:0 100
+        r set big [string repeat abcdefgh 10000]
+        r save
+        set out [exec src/redis-check-rdb --analyze --top 1 \
+                    [file join $server_path dump.rdb]]
+        assert_match {*RDB looks OK*} $out
+        assert_match {*Estimated memory of 1101 keys*} $out
+        assert_match {*user * keys: 1000 *} $out
+        assert_match {*session * keys: 100 *} $out
+        assert_match {*< 1 hour * keys: 1 *} $out
+        assert_match "*Biggest keys:\n  db 9 * string * big\n*" $out
+        # The repeated pattern must compress well with every codec.
+        set ratios [regexp -all -inline -line {compressed: +\S+ +\(([0-9.]+)%} $out]
+        assert {[llength $ratios] >= 4}
+        foreach {match ratio} $ratios {assert {$ratio < 50}}
+    }
+}
+
+set server_path [tmpdir "server.rdb-key-index-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-key-index" "yes"]] {
+    test {DEBUG LOADRDB loads a single DB using the key index} {
+        # FLUSHALL would overwrite the RDB file otherwise.
+        r config set save ""
+        r select 10
+        r debug populate 100 other
+        r select 9
+        r debug populate 1000
+        r set withttl foo ex 1000
+        r save
+        r flushall
+        assert_equal 1001 [r debug loadrdb dump.rdb db 9]
+        assert_equal 1001 [r dbsize]
+        assert {[r ttl withttl] > 900}
+        r select 10
+        assert_equal 0 [r dbsize]
+        r select 9
+        # About 1/16 of the keys hash to the first 1024 slots.
+        set loaded [r debug loadrdb dump.rdb db 9 slots 0 1023]
+        assert {$loaded > 20 && $loaded < 200}
+    }
+
+    test {DEBUG LOADRDB replaces the existing keys} {
+        r set key:0 changed
+        assert_equal 1101 [r debug loadrdb dump.rdb]
+        assert_equal value:0 [r get key:0]
+        r select 10
+        assert_equal 100 [r dbsize]
+        r select 9
+    } {OK}
+
+    test {DEBUG LOADRDB refuses a corrupted section} {
+        set fd [open [file join $server_path dump.rdb] r+]
+        fconfigure $fd -translation binary
+        seek $fd 200
+        set byte [read $fd 1]
+        seek $fd 200
+        puts -nonewline $fd [expr {$byte eq "x" ? "y" : "x"}]
+        close $fd
+        r flushall
+        catch {r debug loadrdb dump.rdb} e
+        assert_match {*Error trying to load*} $e
+        assert_equal 0 [r dbsize]
+    }
+
+    test {DEBUG LOADRDB works without key index} {
+        r config set rdb-key-index no
+        r debug populate 1000
+        r save
+        r flushall
+        set loaded [r debug loadrdb dump.rdb slots 0 8191]
+        assert {$loaded > 400 && $loaded < 600}
+        assert_equal $loaded [r dbsize]
+    }
+}
@@ -153,3 +153,410 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+foreach diskless {no yes} {
+    start_master_slave [list master [list repl-compression-codec zstd \
+                                          repl-diskless-sync $diskless \
+                                          repl-diskless-sync-delay 0] \
+                             connect 0] {
+        test "Full sync with zstd compressed RDB, diskless=$diskless" {
+            createComplexDataset $master 5000
+            $master set compressible [string repeat abcdefgh 10000]
+            connect_slave
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different digest"
+            }
+        }
+    }
+}
+
+foreach mdl {no yes} {
+    foreach sdl {swapdb on-empty-db} {
+        start_master_slave [list master [list repl-diskless-sync $mdl \
+                                              repl-diskless-sync-delay 0] \
+                                 slave [list repl-diskless-load $sdl] \
+                                 connect 0] {
+            set slave_log [srv 0 stdout]
+
+            test "Diskless load from the master socket, diskless=$mdl load=$sdl" {
+                createComplexDataset $master 5000
+                $master set big [string repeat x 100000]
+                # The old dataset must go away with swapdb, while
+                # on-empty-db only loads from the socket an empty slave.
+                if {$sdl eq {swapdb}} {$slave set oldkey oldvalue}
+                connect_slave
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Master and slave have different digest"
+                }
+                assert {[log_file_matches $slave_log "*Loading DB in memory from the MASTER socket*"]}
+            }
+        }
+    }
+}
+
+# Fake master accepting a single slave: it completes the handshake, announces
+# a full resync with 'payload' but closes the link halfway through it.
+proc fake_master_serve {payload chan addr port} {
+    fconfigure $chan -translation binary -buffering none -blocking 1
+    while {[gets $chan line] >= 0} {
+        switch [string tolower [lindex [split [string trim $line]] 0]] {
+            ping {puts -nonewline $chan "+PONG\r\n"}
+            replconf {puts -nonewline $chan "+OK\r\n"}
+            psync - sync {
+                puts -nonewline $chan "+FULLRESYNC [string repeat a 40] 0\r\n"
+                puts -nonewline $chan "\$[string length $payload]\r\n"
+                puts -nonewline $chan [string range $payload 0 \
+                    [expr {[string length $payload]/2}]]
+                break
+            }
+        }
+    }
+    close $chan
+    set ::fake_master_done 1
+}
+
+foreach sdl {swapdb on-empty-db} {
+    start_server {tags {"repl"}} {
+        set slave [srv 0 client]
+        set slave_log [srv 0 stdout]
+
+        test "Diskless load survives a master disconnection, load=$sdl" {
+            $slave debug populate 10000
+            $slave save
+            set fp [open [file join [lindex [$slave config get dir] 1] \
+                                    [lindex [$slave config get dbfilename] 1]] r]
+            fconfigure $fp -translation binary
+            set payload [read $fp]
+            close $fp
+            if {$sdl ne {swapdb}} {$slave flushall}
+            set digest [$slave debug digest]
+
+            set ::fake_master_done 0
+            set listener [socket -server [list fake_master_serve $payload] \
+                                 -myaddr 127.0.0.1 0]
+            set fake_port [lindex [fconfigure $listener -sockname] 2]
+            $slave config set repl-diskless-load $sdl
+            $slave slaveof 127.0.0.1 $fake_port
+            set timer [after 10000 {set ::fake_master_done timeout}]
+            vwait ::fake_master_done
+            after cancel $timer
+            close $listener
+            assert_equal 1 $::fake_master_done
+
+            wait_for_condition 50 100 {
+                [log_file_matches $slave_log "*Failed trying to load the MASTER synchronization DB from socket*"]
+            } else {
+                fail "The slave did not detect the broken transfer"
+            }
+            $slave slaveof no one
+            assert_equal $digest [$slave debug digest]
+            if {$sdl eq {swapdb}} {
+                assert_equal 10000 [$slave dbsize]
+            } else {
+                assert_equal 0 [$slave dbsize]
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set slave1 [srv -1 client]
+            set slave2 [srv 0 client]
+
+            test {Slaves share the replication buffer with the backlog} {
+                $master config set repl-backlog-size 1mb
+                connect_slave -1 -2
+                connect_slave 0 -2
+
+                set val [string repeat x 10000]
+                for {set j 0} {$j < 400} {incr j} {
+                    $master set key:$j $val
+                }
+                wait_for_condition 50 100 {
+                    [$slave1 dbsize] == 400 && [$slave2 dbsize] == 400
+                } else {
+                    fail "Slaves did not receive the stream"
+                }
+
+                # About 4MB were streamed to two slaves: the buffer is held
+                # once and is trimmed back to the backlog size.
+                set mem [s -2 mem_replication_buffer]
+                assert {$mem >= 1024*1024}
+                assert {$mem < 1024*1024+100*1024}
+                assert_equal [$master debug digest] [$slave1 debug digest]
+                assert_equal [$master debug digest] [$slave2 debug digest]
+            }
+
+            test {Partial resync is served from the shared buffer} {
+                set full [s -2 sync_full]
+                $slave2 client kill type master
+                wait_for_condition 50 100 {
+                    [string match {*slave1:*state=online*} [$master info replication]]
+                } else {
+                    fail "Slave did not reconnect"
+                }
+                $master set key:last $val
+                wait_for_condition 50 100 {
+                    [$slave2 dbsize] == 401
+                } else {
+                    fail "Slave did not receive the stream after reconnecting"
+                }
+                assert_equal $full [s -2 sync_full]
+                assert {[s -2 sync_partial_ok] >= 1}
+            }
+        }
+    }
+}
+
+foreach diskless {no yes} {
+    foreach sdl {disabled swapdb} {
+        start_master_slave [list master [list repl-stream-compression yes \
+                                              repl-diskless-sync $diskless \
+                                              repl-diskless-sync-delay 0] \
+                                 slave [list repl-stream-compression yes \
+                                             repl-diskless-load $sdl] \
+                                 connect 0] {
+            test "Compressed replication stream, diskless=$diskless load=$sdl" {
+                createComplexDataset $master 5000
+                connect_slave
+                assert_equal zstd [s 0 master_link_compression]
+
+                for {set j 0} {$j < 1000} {incr j} {
+                    $master set key:$j [string repeat abcd 100]
+                }
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Master and slave have different digest"
+                }
+                assert {[s -1 repl_stream_compression_out_bytes] <
+                        [s -1 repl_stream_compression_in_bytes]}
+            }
+
+            test "Partial resync of a compressed stream, diskless=$diskless load=$sdl" {
+                set partial [s -1 sync_partial_ok]
+                $slave client kill type master
+                $master incr counter
+                wait_for_condition 50 100 {
+                    [s -1 sync_partial_ok] == $partial+1 &&
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "The slave did not partially resync"
+                }
+                $master incr counter
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Master and slave have different digest"
+                }
+                assert_equal zstd [s 0 master_link_compression]
+                assert_equal [s -1 master_repl_offset] [s 0 slave_repl_offset]
+            }
+        }
+    }
+}
+
+start_master_slave {slave {repl-stream-compression yes}} {
+    test {Stream compression needs to be enabled in the master too} {
+        assert_equal none [s 0 master_link_compression]
+        $master set foo bar
+        wait_for_condition 50 100 {
+            [$slave get foo] eq {bar}
+        } else {
+            fail "The slave did not receive the stream"
+        }
+    }
+}
+
+foreach compression {no yes} {
+    start_master_slave [list master [list repl-backlog-size 16kb \
+                                          repl-backlog-disk-size 4mb \
+                                          repl-stream-compression $compression] \
+                             slave [list repl-stream-compression $compression]] {
+        test "Partial resync from the on disk backlog, compression=$compression" {
+            set partial [s -1 sync_partial_ok]
+            set full [s -1 sync_full]
+
+            # Point the slave to a port nobody listens to: the master is
+            # cached, and the writes go past the backlog in memory.
+            $slave slaveof $master_host 1
+            for {set j 0} {$j < 1000} {incr j} {
+                $master set key:$j [string repeat x 1000]
+            }
+            assert {[s -1 repl_backlog_disk_histlen] > 0}
+            assert {[s -1 repl_backlog_first_byte_offset] <
+                    [s -1 master_repl_offset]-1000000}
+
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s -1 sync_partial_ok] == $partial+1 &&
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "The slave did not partially resync"
+            }
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different digest"
+            }
+            assert_equal $full [s -1 sync_full]
+            assert_equal [s -1 master_repl_offset] [s 0 slave_repl_offset]
+        }
+
+        test "Resizing the on disk backlog drops its history, compression=$compression" {
+            set full [s -1 sync_full]
+            $slave slaveof $master_host 1
+            for {set j 0} {$j < 100} {incr j} {
+                $master set key:$j [string repeat y 1000]
+            }
+            $master config set repl-backlog-disk-size 8mb
+            assert_equal 0 [s -1 repl_backlog_disk_histlen]
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s -1 sync_full] == $full+1 &&
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "The slave did not fully resync"
+            }
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different digest"
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    test {Slaves reading the on disk backlog are not charged for the backlog} {
+        r config set repl-backlog-size 4mb
+        r config set repl-backlog-disk-size 64mb
+        # The backlog is created when the first slave attaches.
+        close [attach_to_replication_stream]
+        set val [string repeat x 100000]
+        for {set j 0} {$j < 300} {incr j} {
+            r set key:$j $val
+        }
+        assert {[s repl_backlog_disk_histlen] > 20000000}
+
+        # A slave that never reads resumes 16MB behind the backlog in
+        # memory: the socket buffers can't take all of it, so it stays in
+        # the disk phase.
+        r config set client-output-buffer-limit {slave 2000000 0 0}
+        set offset [expr {[s master_repl_offset]-20000000}]
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        puts -nonewline $fd "PSYNC [s master_replid] $offset\r\n"
+        flush $fd
+        assert_match {+CONTINUE*} [gets $fd]
+
+        # Its output buffer only counts what is kept beyond the backlog.
+        for {set j 0} {$j < 5} {incr j} {
+            r set key:$j $val
+        }
+        assert_equal 1 [s connected_slaves]
+        assert {[regexp {flags=S[^\n]* omem=([0-9]+)} [r client list] - omem]}
+        assert {$omem < 2000000}
+        close $fd
+    }
+}
+
+start_master_slave {master {appendonly yes}} {
+    test {The AOF and the slaves share the encoding of propagated commands} {
+        set propagated [s -1 propagated_commands]
+        $master select 9
+        $master set int 12345
+        $master incrby int 100
+        $master rpush list a 1 [string repeat x 100000] 2
+        $master set big [string repeat y 200000]
+        $master set tmp foo ex 1000
+        $master expire int 1000
+        $master multi
+        $master hset hash f 1
+        $master lpop list
+        $master exec
+        $master select 0
+        $master set db0 bar
+        assert {[s -1 propagated_commands] >= $propagated+9}
+        assert {[s -1 propagate_usec] > 0}
+
+        wait_for_condition 50 100 {
+            [$master debug digest] eq [$slave debug digest]
+        } else {
+            fail "Master and slave have different digest"
+        }
+        set digest [$master debug digest]
+        $master debug loadaof
+        assert_equal $digest [$master debug digest]
+    }
+}
+
+foreach batch {yes no} {
+    start_master_slave [list slave [list repl-batch-apply $batch]] {
+        test "Slave applies pipelined writes in batches, repl-batch-apply=$batch" {
+            set calls [s 0 total_commands_processed]
+            set rd [redis_deferring_client -1]
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd incr pipelined
+            }
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd read
+            }
+            $rd close
+            wait_for_condition 50 100 {
+                [$slave get pipelined] == 10000
+            } else {
+                fail "The slave did not apply the pipeline"
+            }
+            assert {[s 0 slave_apply_avg_batch_ops] > 1}
+            # The commands applied in batches are counted as well.
+            assert {[s 0 total_commands_processed] >= $calls+10000}
+        }
+
+        test "Slave applies the master stream, repl-batch-apply=$batch" {
+            set ops [s 0 slave_apply_ops]
+            for {set j 0} {$j < 1000} {incr j} {
+                $master incr counter
+                $master rpush list $j
+            }
+            $master multi
+            $master set a 1
+            $master lpop list
+            $master exec
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different digest"
+            }
+            assert {[s 0 slave_apply_ops] >= $ops+2000}
+            assert {[s 0 slave_apply_batches] > 0}
+            assert_equal 0 [s 0 slave_apply_lag_bytes]
+            assert_equal 0 [s 0 slave_apply_lag_ops]
+        }
+
+        test "A transaction is applied as one op, repl-batch-apply=$batch" {
+            # No PINGs of the master must be counted meanwhile.
+            $master config set repl-ping-slave-period 3600
+            set ops [s 0 slave_apply_ops]
+            $master multi
+            $master set a 2
+            $master set b 2
+            $master set c 2
+            $master exec
+            wait_for_condition 50 100 {
+                [$slave get c] eq {2}
+            } else {
+                fail "The slave did not apply the transaction"
+            }
+            assert_equal [expr {$ops+1}] [s 0 slave_apply_ops]
+            $master config set repl-ping-slave-period 10
+        }
+    }
+}
@@ -375,3 +375,61 @@ proc start_write_load {host port seconds} {
 proc stop_write_load {handle} {
     catch {exec /bin/kill -9 $handle}
 }
+
+proc log_file_matches {log pattern} {
+    set fp [open $log r]
+    set content [read $fp]
+    close $fp
+    string match $pattern $content
+}
+
+# Make the server at index 'slave' replicate the one at index 'master', and
+# wait for its link with the master to be up.
+proc connect_slave {{slave 0} {master -1}} {
+    [srv $slave client] slaveof [srv $master host] [srv $master port]
+    wait_for_condition 50 100 {
+        [s $slave master_link_status] eq {up}
+    } else {
+        fail "Replication not started."
+    }
+}
+
+# Start a master (at index -1) and a slave (at index 0), and run 'code' in
+# the caller with the variables master, master_host, master_port and slave
+# set. The options are the configuration overrides of the two servers,
+# 'master' and 'slave', and 'connect': unless it is 0 the slave is connected
+# to the master before running 'code', otherwise 'code' calls connect_slave
+# when it is ready.
+proc start_master_slave {options code} {
+    set master_overrides {}
+    set slave_overrides {}
+    set connect 1
+    foreach {option value} $options {
+        switch $option {
+            "master" { set master_overrides $value }
+            "slave" { set slave_overrides $value }
+            "connect" { set connect $value }
+            default { error "Unknown option $option" }
+        }
+    }
+
+    start_server [list tags {"repl"} overrides $master_overrides] {
+        start_server [list overrides $slave_overrides] {
+            uplevel 1 [list set master [srv -1 client]]
+            uplevel 1 [list set master_host [srv -1 host]]
+            uplevel 1 [list set master_port [srv -1 port]]
+            uplevel 1 [list set slave [srv 0 client]]
+            if {$connect} connect_slave
+            uplevel 1 $code
+        }
+    }
+}
+
+# Return the pid of the child process of the server at index 'idx', if any.
+proc get_child_pid {idx} {
+    set pid [srv $idx pid]
+    set fd [open "|ps --ppid $pid -o pid=" "r"]
+    set child_pid [string trim [lindex [split [read $fd] \n] 0]]
+    catch {close $fd}
+    return $child_pid
+}
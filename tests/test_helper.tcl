@@ -31,6 +31,7 @@ set ::all_tests {
     unit/other
     unit/multi
     unit/quit
+    unit/networking
     unit/aofrw
     integration/replication
     integration/replication-2
@@ -44,6 +45,7 @@ set ::all_tests {
     integration/psync2
     integration/psync2-reg
     unit/pubsub
+    unit/tracking
     unit/slowlog
     unit/scripting
     unit/maxmemory
@@ -53,6 +53,36 @@ start_server {tags {"dump"}} {
         r dump nonexisting_key
     } {}
 
+    test {DUMP / RESTORE with every compression codec} {
+        set value [string repeat "compressible payload " 1000]
+        r set foo $value
+        set lzf [r dump foo]
+        foreach codec {lz4 zstd} {
+            # LZ4 is only available when Redis is built with USE_LZ4=yes.
+            if {[catch {r config set dump-compression-codec $codec}]} continue
+            set encoded [r dump foo]
+            assert {$encoded ne $lzf}
+            r del foo
+            r restore foo 0 $encoded
+            assert_equal $value [r get foo]
+        }
+        r config set dump-compression-codec lzf
+        assert_equal $lzf [r dump foo]
+    }
+
+    test {DUMP payloads are version 8 unless saved with LZ4 or Zstd} {
+        r set foo [string repeat "compressible payload " 1000]
+        set versions {}
+        foreach codec {lzf zstd} {
+            r config set dump-compression-codec $codec
+            set encoded [r dump foo]
+            binary scan [string range $encoded end-9 end-8] s ver
+            lappend versions $ver
+        }
+        r config set dump-compression-codec lzf
+        set versions
+    } {8 9}
+
     test {MIGRATE is caching connections} {
         # Note, we run this as first test so that the connection cache
         # is empty.
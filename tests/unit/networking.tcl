@@ -0,0 +1,294 @@
+start_server {tags {"networking"} overrides {io-threads 4 io-threads-do-reads yes}} {
+    test {CONFIG GET io-threads reports the configured threads} {
+        lindex [r config get io-threads] 1
+    } {4}
+
+    test {CONFIG SET io-threads is not allowed at runtime} {
+        catch {r config set io-threads 2} e
+        set e
+    } {*Unsupported*}
+
+    test {Threaded I/O serves many pipelining clients correctly} {
+        set numclients 32
+        set clients {}
+        for {set j 0} {$j < $numclients} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+
+        # Send a pipeline from every client before reading any reply, so
+        # that the server sees a lot of clients with pending I/O in the same
+        # event loop iteration, which is the condition to activate threads.
+        set rounds 0
+        while {$rounds < 50} {
+            for {set j 0} {$j < $numclients} {incr j} {
+                set rd [lindex $clients $j]
+                for {set i 0} {$i < 10} {incr i} {
+                    $rd set key:$j:$i [string repeat x [expr {$i*100}]]
+                    $rd incr counter:$j
+                }
+            }
+            for {set j 0} {$j < $numclients} {incr j} {
+                set rd [lindex $clients $j]
+                for {set i 0} {$i < 10} {incr i} {
+                    assert_equal OK [$rd read]
+                    assert_equal [expr {$rounds*10+$i+1}] [$rd read]
+                }
+            }
+            incr rounds
+            if {[s io_threaded_writes_processed] > 0} break
+        }
+
+        for {set j 0} {$j < $numclients} {incr j} {
+            [lindex $clients $j] close
+        }
+
+        # Check the data written through the threaded path.
+        r select 9
+        for {set j 0} {$j < $numclients} {incr j} {
+            assert_equal [expr {$rounds*10}] [r get counter:$j]
+            assert_equal [string repeat x 900] [r get key:$j:9]
+        }
+        assert {[s io_threaded_writes_processed] > 0}
+    }
+
+    test {Threaded I/O handles protocol errors and closed clients} {
+        set rd [redis_deferring_client]
+        $rd write "*3\r\n\$3\r\nSET\r\n\$1\r\nx\r\n\$bad\r\n"
+        $rd flush
+        assert_error {*Protocol error*} {$rd read}
+        $rd close
+        r ping
+    } {PONG}
+}
+
+start_server {tags {"networking"}} {
+    test {Pipelined big replies are flushed with few writes} {
+        r del mylist
+        for {set j 0} {$j < 1000} {incr j} {
+            r rpush mylist [string repeat $j 20]
+        }
+        set expected [r lrange mylist 0 -1]
+        set rd [redis_deferring_client]
+        set writes [s total_net_output_writes]
+        for {set j 0} {$j < 20} {incr j} {
+            $rd lrange mylist 0 -1
+            $rd mget a b c d e f g h
+        }
+        $rd flush
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $expected [$rd read]
+            assert_equal {{} {} {} {} {} {} {} {}} [$rd read]
+        }
+        $rd close
+        # Every LRANGE reply spans many reply list objects: with the
+        # scatter-gather flush we expect less than a write per object.
+        assert {[s total_net_output_writes] - $writes < 50}
+    }
+
+    test {Reply blocks are recycled and released when idle} {
+        set expected [r lrange mylist 0 -1]
+        for {set j 0} {$j < 10} {incr j} {
+            assert_equal $expected [r lrange mylist 0 -1]
+        }
+        # The blocks of the last reply were given back to the pool.
+        assert {[s mem_reply_block_pool] > 0}
+        assert {[s mem_reply_block_pool] % 16384 == 0}
+        wait_for_condition 100 100 {
+            [s mem_reply_block_pool] == 0
+        } else {
+            fail "Idle reply blocks were not released"
+        }
+    }
+
+    test {Output buffers are accounted in reply blocks} {
+        set rd [redis_deferring_client]
+        $rd client setname blocks
+        $rd read
+        $rd subscribe chan
+        $rd read
+        r publish chan [string repeat x 20000]
+        r publish chan x
+        set omem 0
+        foreach c [split [r client list] "\r\n"] {
+            if {[string match "*name=blocks*" $c]} {
+                regexp {omem=([0-9]+)} $c - omem
+            }
+        }
+        $rd close
+        # Depending on how much the socket took, zero, one or two blocks
+        # are pending: the small message never takes less than a block.
+        assert {$omem == 0 || $omem >= 16384}
+    }
+}
+
+start_server {tags {"networking"}} {
+    set big [string repeat abcdefghij 400000]
+
+    # Wait for the server to process 'count' GET calls since the last
+    # CONFIG RESETSTAT.
+    proc wait_for_get_calls {count} {
+        wait_for_condition 50 100 {
+            [string match "*cmdstat_get:calls=$count,*" [r info commandstats]]
+        } else {
+            fail "GET commands were not processed"
+        }
+    }
+
+    test {Big bulk replies survive in-place modification of the value} {
+        r set bigkey $big
+        r config resetstat
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 5} {incr j} {$rd get bigkey}
+        $rd flush
+        wait_for_get_calls 5
+        # The replies can't fit in the socket buffers, so they are still
+        # referencing the value while we modify it.
+        r setrange bigkey 0 XYZ
+        r append bigkey XYZ
+        for {set j 0} {$j < 5} {incr j} {
+            assert_equal $big [$rd read]
+        }
+        $rd close
+        assert_equal XYZ [r getrange bigkey 0 2]
+    }
+
+    test {Big bulk replies survive overwrite and FLUSHALL ASYNC} {
+        r set bigkey $big
+        r config resetstat
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 5} {incr j} {$rd get bigkey}
+        $rd flush
+        wait_for_get_calls 5
+        r set bigkey foo
+        r set bigkey $big
+        $rd get bigkey
+        $rd flush
+        wait_for_get_calls 6
+        r flushall async
+        for {set j 0} {$j < 6} {incr j} {
+            assert_equal $big [$rd read]
+        }
+        $rd close
+        r dbsize
+    } {0}
+
+    test {Big bulk replies release the value reference once sent} {
+        r set bigkey $big
+        r get bigkey
+        r object refcount bigkey
+    } {1}
+}
+
+start_server {tags {"networking"}} {
+    test {Replies of many clients pipelining at once are not mixed up} {
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [redis_deferring_client]
+            for {set k 0} {$k < 50} {incr k} {
+                $rd set key:$j:$k [string repeat $j 5000]
+                $rd get key:$j:$k
+            }
+            lappend clients $rd
+        }
+        set j 0
+        foreach rd $clients {
+            for {set k 0} {$k < 50} {incr k} {
+                assert_equal OK [$rd read]
+                assert_equal [string repeat $j 5000] [$rd read]
+            }
+            $rd close
+            incr j
+        }
+        # With io_uring the reads and the writes are submitted in batches.
+        if {[s multiplexing_api] eq {io_uring}} {
+            assert {[s io_batched_reads_processed] > 0}
+            assert {[s io_batched_writes_processed] > 0}
+        }
+    }
+}
+
+start_server {tags {"networking"} overrides {io-uring no}} {
+    test {With io-uring disabled the event loop does not use io_uring} {
+        assert_equal no [lindex [r config get io-uring] 1]
+        assert {[s multiplexing_api] ne {io_uring}}
+    }
+}
+
+start_server {tags {"networking"} overrides {accept-threads 2}} {
+    test {Accept threads serve many new connections} {
+        set before [s total_connections_received]
+        set clients {}
+        for {set j 0} {$j < 50} {incr j} {
+            set rd [redis [srv 0 host] [srv 0 port]]
+            $rd set key$j $j
+            lappend clients $rd
+        }
+        for {set j 0} {$j < 50} {incr j} {
+            assert_equal $j [[lindex $clients $j] get key$j]
+            [lindex $clients $j] close
+        }
+        assert_equal 50 [expr {[s total_connections_received]-$before}]
+        lindex [r config get accept-threads] 1
+    } {2}
+
+    test {Accept threads report the client address} {
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd client setname accepted
+        set info [$rd client list]
+        $rd close
+        assert_match "*addr=127.0.0.1:*name=accepted*" $info
+    }
+
+    test {Accept threads don't share the port with another instance} {
+        set dir [tmpdir server]
+        set stdout [file join $dir stdout]
+        set pid [exec src/redis-server --port [srv 0 port] \
+                     --bind [srv 0 host] --accept-threads 2 --dir $dir \
+                     > $stdout 2>@1 &]
+        wait_for_condition 50 100 {
+            [string match {*already in use*} [exec cat $stdout]]
+        } else {
+            catch {exec kill -9 $pid}
+            fail "A second instance listens to the same port"
+        }
+        catch {exec kill -9 $pid}
+    }
+}
+
+start_server {tags {"networking"} overrides {reply-cork yes}} {
+    test {Corked replies of a deep pipeline are all delivered} {
+        r del counter
+        set cmd "*2\r\n\$4\r\nINCR\r\n\$7\r\ncounter\r\n"
+        set rd [redis_deferring_client]
+        $rd write [string repeat $cmd 20000]
+        $rd flush
+        for {set j 1} {$j <= 20000} {incr j} {
+            assert_equal $j [$rd read]
+        }
+        $rd close
+        assert {[s total_net_output_corked_writes] > 0}
+        assert {[s avg_net_output_write_size] > 0}
+        lindex [r config get reply-cork] 1
+    } {yes}
+
+    test {Corked replies are flushed when the pipeline ends with a partial command} {
+        r del counter
+        set cmd "*2\r\n\$4\r\nINCR\r\n\$7\r\ncounter\r\n"
+        set rd [redis_deferring_client]
+        $rd write [string repeat $cmd 5000]
+        $rd write "*2\r\n\$4\r\nINCR\r\n"
+        $rd flush
+        for {set j 1} {$j <= 5000} {incr j} {
+            assert_equal $j [$rd read]
+        }
+        $rd write "\$7\r\ncounter\r\n"
+        $rd flush
+        assert_equal 5001 [$rd read]
+        $rd close
+    }
+
+    test {CONFIG SET reply-cork no} {
+        r config set reply-cork no
+        r incr counter
+    } {5002}
+}
@@ -70,4 +70,19 @@ start_server {tags {"obuf-limits"}} {
         assert {$omem >= 100000 && $time_elapsed < 6}
         $rd1 close
     }
+
+    test {Slave output buffer hard limit is enforced} {
+        r config set client-output-buffer-limit {slave 1000000 0 0}
+        set repl [attach_to_replication_stream]
+        # The stream is never read: once the socket buffers are full the
+        # part of the shared replication buffer the slave has to send grows.
+        set val [string repeat x 100000]
+        for {set j 0} {$j < 500} {incr j} {
+            r set key $val
+            if {[s connected_slaves] == 0} break
+        }
+        set slaves [s connected_slaves]
+        close $repl
+        set slaves
+    } {0}
 }
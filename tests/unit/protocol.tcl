@@ -68,6 +68,35 @@ start_server {tags {"protocol"}} {
         assert_error "*unbalanced*" {r read}
     }
 
+    test "Deep pipeline mixing inline, multibulk and big arguments" {
+        reconnect
+        r del pipelined-counter pipelined-big
+        set big [string repeat x 70000]
+        set proto {}
+        for {set j 0} {$j < 2000} {incr j} {
+            if {$j % 2} {
+                append proto "INCR pipelined-counter\r\n"
+            } else {
+                append proto "*2\r\n\$4\r\nINCR\r\n\$17\r\npipelined-counter\r\n"
+            }
+            if {$j == 1000} {
+                append proto "*3\r\n\$3\r\nSET\r\n\$13\r\npipelined-big\r\n"
+                append proto "\$[string length $big]\r\n$big\r\n"
+            }
+        }
+        r write $proto
+        r flush
+        for {set j 1} {$j <= 1001} {incr j} {
+            assert_equal $j [r read]
+        }
+        assert_equal OK [r read]
+        for {set j 1002} {$j <= 2000} {incr j} {
+            assert_equal $j [r read]
+        }
+        assert_equal [string length $big] [r strlen pipelined-big]
+        assert_equal 2000 [r get pipelined-counter]
+    }
+
     set c 0
     foreach seq [list "\x00" "*\x00" "$\x00"] {
         incr c
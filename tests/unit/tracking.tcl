@@ -0,0 +1,140 @@
+start_server {tags {"tracking"}} {
+    # Create a deferring client we can use for redirection of tracking
+    # messages, and another one to modify keys from a different connection.
+    set rd_redirection [redis_deferring_client]
+    $rd_redirection client id
+    set redir [$rd_redirection read]
+    $rd_redirection subscribe __redis__:invalidate
+    $rd_redirection read ; # Consume the SUBSCRIBE reply.
+    set rd [redis_deferring_client]
+
+    test {CLIENT ID returns a different ID for every connection} {
+        set myid [r client id]
+        assert {$myid > 0 && $myid != $redir}
+    }
+
+    test {CLIENT TRACKING requires a valid redirection} {
+        assert_error "*REDIRECT*" {r client tracking on}
+        assert_error "*itself*" {r client tracking on redirect [r client id]}
+        assert_error "*does not exist*" {r client tracking on redirect 123456789}
+    }
+
+    test {Clients are able to enable tracking and redirect it} {
+        r client tracking on redirect $redir
+    } {OK}
+
+    test {CLIENT GETREDIR returns the redirection client ID} {
+        r client getredir
+    } $redir
+
+    test {The other connection is able to get invalidations} {
+        r set a 1
+        r get a
+        $rd set a 2
+        $rd read
+        set msg [$rd_redirection read]
+        assert_equal {message __redis__:invalidate a} $msg
+    }
+
+    test {A key is invalidated only once until it is read again} {
+        r set b 1
+        r get b
+        $rd set b 2
+        $rd read
+        $rd set b 3
+        $rd read
+        r get b
+        $rd set b 4
+        $rd read
+        set msg1 [$rd_redirection read]
+        set msg2 [$rd_redirection read]
+        assert_equal {message __redis__:invalidate b} $msg1
+        assert_equal {message __redis__:invalidate b} $msg2
+        $rd_redirection ping
+        assert_equal {pong {}} [$rd_redirection read]
+    }
+
+    test {Expired and deleted keys are invalidated} {
+        r set c 1 px 50
+        r get c
+        r set d 1
+        r get d
+        after 100
+        r exists c ; # Trigger the expire from another connection.
+        $rd del d
+        $rd read
+        set keys {}
+        lappend keys [lindex [$rd_redirection read] 2]
+        lappend keys [lindex [$rd_redirection read] 2]
+        lsort $keys
+    } {c d}
+
+    test {Tracking gets notification of keys modified by the client} {
+        r get e
+        r set e 1
+        lindex [$rd_redirection read] 2
+    } {e}
+
+    test {NOLOOP skips the keys modified by the client itself} {
+        r client tracking on redirect $redir noloop
+        r get f
+        r set f 1
+        r get g
+        $rd set g 1
+        $rd read
+        lindex [$rd_redirection read] 2
+    } {g}
+
+    test {FLUSHALL sends a null invalidation message} {
+        r get h
+        r flushall
+        $rd_redirection read
+    } {message __redis__:invalidate {}}
+
+    test {CLIENT LIST reports tracking and broken redirection} {
+        set rd2 [redis_deferring_client]
+        $rd2 client id
+        set id2 [$rd2 read]
+        r client tracking on redirect $id2
+        assert_match {*flags=t *} [r client list]
+        $rd2 close
+        wait_for_condition 50 100 {
+            [llength [split [string trim [r client list]] "\r\n"]] == 3
+        } else {
+            fail "Redirection client still connected"
+        }
+        r get i
+        $rd set i 1
+        $rd read
+        assert_match {*flags=tR *} [r client list]
+        r client tracking on redirect $redir
+    }
+
+    test {The tracking table is bounded by tracking-table-max-keys} {
+        r config set tracking-table-max-keys 10
+        for {set j 0} {$j < 100} {incr j} {
+            r get key:$j
+        }
+        wait_for_condition 50 100 {
+            [s tracking_total_keys] <= 10
+        } else {
+            fail "Tracking table not evicted"
+        }
+        # The evicted keys were sent as invalidation messages.
+        for {set j 0} {$j < 90} {incr j} {
+            assert_match {message __redis__:invalidate key:*} \
+                [$rd_redirection read]
+        }
+        r config set tracking-table-max-keys 1000000
+    }
+
+    test {Tracking info is reported by INFO} {
+        assert_equal 1 [s tracking_clients]
+        r client tracking off
+        assert_equal 0 [s tracking_clients]
+        r client getredir
+    } {-1}
+
+    $rd_redirection close
+    $rd close
+}